@@ -0,0 +1,253 @@
+#include "archive.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+
+#include "common.h"
+#include "trace.h"
+
+namespace Archive {
+
+namespace {
+
+constexpr size_t kTarBlockSize = 512;
+
+PACK(struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+});
+static_assert(sizeof(TarHeader) == kTarBlockSize, "");
+
+void write_octal(char* dest, size_t fieldSize, uint64_t value)
+{
+    // Zero-padded octal digits followed by a NUL
+    for (size_t i = fieldSize - 1; i-- > 0; value >>= 3)
+        dest[i] = (char)('0' + (value & 7));
+    dest[fieldSize - 1] = '\0';
+}
+
+bool fill_header(TarHeader& header, const std::string& name, uint64_t size)
+{
+    memset(&header, 0, sizeof(header));
+
+    // Long names are split into prefix + name at a directory separator
+    if (name.size() <= sizeof(header.name))
+    {
+        memcpy(header.name, name.data(), name.size());
+    }
+    else
+    {
+        size_t split = name.rfind('/', sizeof(header.prefix));
+        if (split == std::string::npos || name.size() - split - 1 > sizeof(header.name))
+            return false;
+
+        memcpy(header.prefix, name.data(), split);
+        memcpy(header.name, name.data() + split + 1, name.size() - split - 1);
+    }
+
+    write_octal(header.mode, sizeof(header.mode), 0644);
+    write_octal(header.uid, sizeof(header.uid), 0);
+    write_octal(header.gid, sizeof(header.gid), 0);
+    write_octal(header.mtime, sizeof(header.mtime), (uint64_t)std::time(nullptr));
+
+    if (size < (1ull << 33))
+    {
+        write_octal(header.size, sizeof(header.size), size);
+    }
+    else
+    {
+        // GNU base-256 extension for sizes of 8 GiB and more
+        header.size[0] = (char)0x80;
+        for (int i = 11; i > 0; i--, size >>= 8)
+            header.size[i] = (char)(size & 0xFF);
+    }
+
+    header.typeflag = '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    // Checksum of the header bytes, the checksum field counting as spaces
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    uint32_t checksum = 0;
+    const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&header);
+    for (size_t i = 0; i < sizeof(header); i++)
+        checksum += pBytes[i];
+    write_octal(header.checksum, 7, checksum);
+    return true;
+}
+
+} // namespace
+
+bool TarWriter::Slot::store(const std::string& path, std::vector<char>&& data)
+{
+    return writer.store(ticket, path, std::move(data));
+}
+
+void TarWriter::Slot::finish()
+{
+    if (bFinished)
+        return;
+    bFinished = true;
+    writer.finish(ticket);
+}
+
+TarWriter::TarWriter(const std::string& in_rootFolder, size_t in_maxPendingBytes)
+    : maxPendingBytes(in_maxPendingBytes)
+{
+    rootFolder = in_rootFolder;
+    std::replace(rootFolder.begin(), rootFolder.end(), '\\', '/');
+    while (!rootFolder.empty() && rootFolder.back() == '/')
+        rootFolder.pop_back();
+}
+
+TarWriter::~TarWriter()
+{
+    close();
+}
+
+bool TarWriter::open(const std::string& path)
+{
+    archivePath = path;
+    index.clear();
+    return file.open(path, &diskStore);
+}
+
+std::unique_ptr<TarWriter::Slot> TarWriter::create_slot()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::unique_ptr<Slot>(new Slot(*this, nextTicket++));
+}
+
+std::string TarWriter::get_entry_name(const std::string& path) const
+{
+    std::string name = path;
+    std::replace(name.begin(), name.end(), '\\', '/');
+
+    if (!rootFolder.empty() && name.compare(0, rootFolder.size(), rootFolder) == 0
+        && (name.size() == rootFolder.size() || name[rootFolder.size()] == '/'))
+    {
+        name.erase(0, rootFolder.size());
+    }
+
+    while (name.compare(0, 2, "./") == 0 || name.compare(0, 1, "/") == 0)
+        name.erase(0, name[0] == '/' ? 1 : 2);
+
+    return name;
+}
+
+bool TarWriter::write_entry(const std::string& name, const std::vector<char>& data)
+{
+    TarHeader header;
+    if (!fill_header(header, name, data.size()))
+    {
+        std::cerr << "Archive: name too long, skipping " << name << "\n";
+        return false;
+    }
+
+    file.write(&header, sizeof(header));
+    const uint64_t dataOffset = file.tell();
+    file.write(data.data(), data.size());
+
+    static const char kPadding[kTarBlockSize] = {};
+    const size_t padding = (kTarBlockSize - data.size() % kTarBlockSize) % kTarBlockSize;
+    file.write(kPadding, padding);
+
+    index += Utils::str_format("%llu\t%llu\t%s\n", (unsigned long long)dataOffset, (unsigned long long)data.size(), name.c_str());
+    return true;
+}
+
+bool TarWriter::store(uint64_t ticket, const std::string& path, std::vector<char>&& data)
+{
+    const size_t size = data.size();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Backpressure. The head slot never waits, so the slots behind it always get
+    // their turn (and an entry larger than the cap is written once at the head).
+    auto canProceed = [&]() { return ticket == headTicket || pendingBytes + size <= maxPendingBytes; };
+    if (!canProceed())
+    {
+        Trace::Span span("stall", "archive buffers full");
+        spaceAvailable.wait(lock, canProceed);
+    }
+
+    if (ticket == headTicket)
+        return write_entry(get_entry_name(path), data);
+
+    pending[ticket].entries.push_back({ get_entry_name(path), std::move(data) });
+    pendingBytes += size;
+    return true;
+}
+
+void TarWriter::finish(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (ticket != headTicket)
+    {
+        pending[ticket].bFinished = true;
+        return;
+    }
+
+    // Write what the following slots have buffered so far, up to the first unfinished one
+    headTicket++;
+    for (auto it = pending.find(headTicket); it != pending.end(); it = pending.find(headTicket))
+    {
+        for (const auto& entry : it->second.entries)
+        {
+            write_entry(entry.name, entry.data);
+            pendingBytes -= entry.data.size();
+        }
+        it->second.entries.clear();
+
+        if (!it->second.bFinished)
+            break;
+
+        pending.erase(it);
+        headTicket++;
+    }
+    spaceAvailable.notify_all();
+}
+
+bool TarWriter::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open())
+        return false;
+
+    // Slots that were never finished
+    for (const auto& slot : pending)
+    {
+        for (const auto& entry : slot.second.entries)
+            write_entry(entry.name, entry.data);
+    }
+    pending.clear();
+    pendingBytes = 0;
+
+    // End of archive: two zero blocks
+    static const char kEndBlocks[2 * kTarBlockSize] = {};
+    file.write(kEndBlocks, sizeof(kEndBlocks));
+
+    bool bSuccess = file.close();
+    bSuccess &= Utils::write_file(archivePath + ".idx", index.data(), index.size());
+    return bSuccess;
+}
+
+} // namespace Archive
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+#include "utils.h"
+
+namespace Archive {
+
+//-----------------------------------------------------------------------------
+// Streams output files into a single .tar (ustar) archive through large
+// sequential writes, and writes an index of the entries next to it
+// (<archive>.idx: one "dataOffset<TAB>size<TAB>name" line per entry), so that
+// single files can be read back without unpacking.
+// Entries are grouped in slots (e.g. one per input file), written in slot
+// creation order whatever the threads and order in which the slots are filled:
+// the slot at the head of the queue streams straight to the archive, the
+// following ones are kept in memory until their turn.
+// Buffered data is capped in bytes: storing into a slot which isn't at the head
+// blocks while the buffers are full, until the head slot moves on.
+//-----------------------------------------------------------------------------
+class TarWriter
+{
+public:
+    class Slot : public Utils::FileStore
+    {
+    public:
+        ~Slot() override { finish(); }
+
+        bool store(const std::string& path, std::vector<char>&& data) override;
+
+        // No more entries will be added to this slot
+        void finish();
+
+    private:
+        friend class TarWriter;
+        Slot(TarWriter& in_writer, uint64_t in_ticket) : writer(in_writer), ticket(in_ticket) {}
+
+        TarWriter& writer;
+        const uint64_t ticket;
+        bool bFinished = false;
+    };
+
+    static constexpr size_t kDefaultMaxPendingBytes = 256 << 20;
+
+    // Entry names are the output paths relative to rootFolder
+    explicit TarWriter(const std::string& in_rootFolder, size_t in_maxPendingBytes = kDefaultMaxPendingBytes);
+    ~TarWriter();
+
+    bool open(const std::string& path);
+    bool close();
+
+    std::unique_ptr<Slot> create_slot();
+
+private:
+    struct Entry
+    {
+        std::string name;
+        std::vector<char> data;
+    };
+
+    struct PendingSlot
+    {
+        std::vector<Entry> entries;
+        bool bFinished = false;
+    };
+
+    bool store(uint64_t ticket, const std::string& path, std::vector<char>&& data);
+    void finish(uint64_t ticket);
+
+    std::string get_entry_name(const std::string& path) const;
+    bool write_entry(const std::string& name, const std::vector<char>& data);
+
+    std::mutex mutex;
+    std::condition_variable spaceAvailable;
+    std::string rootFolder;
+    std::string archivePath;
+    Utils::DiskStore diskStore;
+    Utils::OutputFile file;
+    std::string index;
+
+    uint64_t nextTicket = 0; // next slot to create
+    uint64_t headTicket = 0; // slot currently written
+    std::map<uint64_t, PendingSlot> pending;
+    const size_t maxPendingBytes;
+    size_t pendingBytes = 0;
+};
+
+} // namespace Archive
@@ -0,0 +1,435 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "cpu_dispatch.h"
+#include "cryo_apc.h"
+#include "indywv.h"
+#include "midi.h"
+#include "pcm_convert.h"
+#include "sample_convert.h"
+#include "synth.h"
+#include "utils.h"
+#include "wave.h"
+
+#include "midifile/include/MidiFile.h"
+
+namespace Bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kSeed = 0x5EED;
+constexpr uint32_t kSampleRate = 22050;
+constexpr size_t kWvsmBlockSize = 4096;
+constexpr size_t kWaveChunkSize = 1 << 16;
+constexpr int kNotesPerMidi = 64;
+constexpr int kMidisPerSequence = 8; // GlobalMidiFile writes a sequence every 8 files
+
+// Discards the files produced by the writers, only keeping their size
+class NullStore : public Utils::FileStore
+{
+public:
+    bool store(const std::string&, std::vector<char>&& data) override
+    {
+        numBytes = data.size();
+        return true;
+    }
+
+    uint64_t numBytes = 0;
+};
+
+struct Kernel
+{
+    uint64_t numSamples = 0;            // samples (or MIDI events) produced or consumed per run
+    uint64_t numBytes = 0;              // encoded bytes read or written per run
+    std::function<void()> run;
+    std::function<uint64_t()> checksum; // of the output of the last run, computed outside the timings
+};
+
+Kernel create_adpcm_decode(size_t numSamples, unsigned int numChannels)
+{
+    struct State
+    {
+        IndyWV codec;
+        std::vector<char> input;
+        std::vector<char> output;
+    };
+    auto pState = std::make_shared<State>();
+
+    // The encoder reads each channel from the same stream, one sample apart:
+    // the stereo stream is made of 2 slightly shifted copies of the signal
+    const auto signal = Synth::generate_signal(numSamples + 1, 1, kSampleRate, kSeed);
+    IndyWV::DecompressorState encoderStates[2] = {};
+    pState->input.resize(numSamples * numChannels * 3 + 16, 0);
+    const int compressedSize = pState->codec.compressADPCM(encoderStates, pState->input.data(), (const char*)signal.data(), (int)numSamples, numChannels);
+    pState->input.resize(compressedSize); // includes the zeroed padding read ahead by the decoder
+    pState->output.resize(numSamples * numChannels * sizeof(int16_t));
+
+    Kernel kernel;
+    kernel.numSamples = numSamples * numChannels;
+    kernel.numBytes = compressedSize - 4;
+    kernel.run = [pState, numSamples, numChannels]()
+    {
+        IndyWV::DecompressorState state = {};
+        pState->codec.decompressADPCM(&state, pState->output.data(), pState->input.data(), (int)numSamples, numChannels);
+    };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size()); };
+    return kernel;
+}
+
+Kernel create_adpcm_encode(size_t numSamples)
+{
+    struct State
+    {
+        IndyWV codec;
+        std::vector<int16_t> input;
+        std::vector<char> output;
+        int compressedSize = 0;
+    };
+    auto pState = std::make_shared<State>();
+    pState->input = Synth::generate_signal(numSamples, 1, kSampleRate, kSeed);
+    pState->output.resize(numSamples * 3 + 16, 0);
+
+    Kernel kernel;
+    kernel.numSamples = numSamples;
+    kernel.run = [pState, numSamples]()
+    {
+        IndyWV::DecompressorState state = {};
+        pState->compressedSize = pState->codec.compressADPCM(&state, pState->output.data(), (const char*)pState->input.data(), (int)numSamples, 1);
+    };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->compressedSize); };
+
+    // Size of the encoded stream, for the byte rate
+    kernel.run();
+    kernel.numBytes = pState->compressedSize - 4;
+    return kernel;
+}
+
+Kernel create_wvsm_inflate(size_t numSamples)
+{
+    struct State
+    {
+        IndyWV codec;
+        std::vector<uint8_t> input;
+        std::vector<int16_t> output;
+    };
+    auto pState = std::make_shared<State>();
+
+    const auto signal = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+    pState->input = Synth::encode_wvsm(signal.data(), signal.size(), kWvsmBlockSize);
+    pState->output.resize(signal.size());
+
+    Kernel kernel;
+    kernel.numSamples = signal.size();
+    kernel.numBytes = pState->input.size();
+    kernel.run = [pState]()
+    {
+        const uint8_t* pData = pState->input.data();
+        const uint8_t* pDataEnd = pData + pState->input.size();
+        const size_t outSize = pState->output.size() * sizeof(int16_t);
+        for (size_t offset = 0; offset < outSize; offset += kWvsmBlockSize)
+        {
+            const size_t blockSize = std::min(kWvsmBlockSize, outSize - offset);
+            pState->codec.wvsmInflateBlock(pData, pDataEnd, blockSize, pState->output.data() + offset / sizeof(int16_t));
+        }
+    };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size() * sizeof(int16_t)); };
+    return kernel;
+}
+
+Kernel create_apc_decode(size_t numSamples, uint8_t numChannels)
+{
+    struct State
+    {
+        std::vector<uint8_t> input;
+        std::vector<int16_t> output;
+    };
+    auto pState = std::make_shared<State>();
+
+    // No APC encoder: IMA ADPCM nibbles of real streams are close to uniformly distributed
+    Synth::Random random(kSeed);
+    pState->input.resize(numSamples * numChannels / 2);
+    for (auto& byte : pState->input)
+        byte = (uint8_t)random.next();
+    pState->output.resize(pState->input.size() * 2);
+
+    Kernel kernel;
+    kernel.numSamples = pState->output.size();
+    kernel.numBytes = pState->input.size();
+    kernel.run = [pState, numChannels]()
+    {
+        CryoAPC::ChannelState states[2];
+        CryoAPC::decode_nibbles(pState->input.data(), pState->input.size(), pState->output.data(), numChannels, states);
+    };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size() * sizeof(int16_t)); };
+    return kernel;
+}
+
+Kernel create_midi_merge(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<std::vector<uint8_t>> midis;
+        std::vector<std::string> trackNames;
+        NullStore store;
+    };
+    auto pState = std::make_shared<State>();
+
+    // About one MIDI file per 8192 samples, by whole sequences
+    const size_t numSequences = std::max<size_t>(numSamples / (8192 * kMidisPerSequence), 1);
+    uint64_t numEvents = 0;
+    uint64_t numBytes = 0;
+    for (size_t i = 0; i < numSequences * kMidisPerSequence; i++)
+    {
+        const std::string sequenceName = Utils::str_format("seq%zu", i / kMidisPerSequence);
+        pState->trackNames.push_back(Utils::str_format("track%zu", i));
+        pState->midis.push_back(Synth::generate_midi(kNotesPerMidi, (int)(i % kMidisPerSequence), sequenceName, pState->trackNames.back(), kSeed + i));
+        numBytes += pState->midis.back().size();
+
+        std::stringstream ss;
+        ss.write((const char*)pState->midis.back().data(), pState->midis.back().size());
+        smf::MidiFile midiFile;
+        midiFile.read(ss);
+        for (int track = 0; track < midiFile.getTrackCount(); track++)
+            numEvents += midiFile[track].size();
+    }
+
+    Kernel kernel;
+    kernel.numSamples = numEvents;
+    kernel.numBytes = numBytes;
+    kernel.run = [pState]()
+    {
+        GlobalMidiFile merge("bench", std::string(), &pState->store);
+        for (size_t i = 0; i < pState->midis.size(); i++)
+        {
+            const std::string sequenceName = Utils::str_format("seq%zu", i / kMidisPerSequence);
+            merge.add_midi_to_merge(pState->midis[i].data(), (int)pState->midis[i].size(), sequenceName, pState->trackNames[i]);
+        }
+    };
+    kernel.checksum = [pState]() { return pState->store.numBytes; };
+    return kernel;
+}
+
+Kernel create_wave_write(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<int16_t> input;
+        NullStore store;
+    };
+    auto pState = std::make_shared<State>();
+    pState->input = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+
+    Kernel kernel;
+    kernel.numSamples = pState->input.size();
+    kernel.numBytes = pState->input.size() * sizeof(int16_t);
+    kernel.run = [pState]()
+    {
+        PcmFormat format;
+        format.numChannels = 2;
+        format.sampleRate = kSampleRate;
+
+        const char* pData = (const char*)pState->input.data();
+        const size_t dataSize = pState->input.size() * sizeof(int16_t);
+
+        Wave::Writer writer("bench.wav", &pState->store);
+        writer.begin(format, dataSize);
+        for (size_t offset = 0; offset < dataSize; offset += kWaveChunkSize)
+        {
+            const size_t chunkSize = std::min(kWaveChunkSize, dataSize - offset);
+            memcpy(writer.reserve(chunkSize), pData + offset, chunkSize);
+            writer.commit(chunkSize);
+        }
+        writer.end();
+    };
+    kernel.checksum = [pState]() { return pState->store.numBytes; };
+    return kernel;
+}
+
+Kernel create_s16_to_f32(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<int16_t> input;
+        std::vector<float> output;
+    };
+    auto pState = std::make_shared<State>();
+    pState->input = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+    pState->output.resize(pState->input.size());
+
+    Kernel kernel;
+    kernel.numSamples = pState->input.size();
+    kernel.numBytes = pState->input.size() * sizeof(int16_t);
+    kernel.run = [pState]() { SampleConvert::s16_to_f32(pState->input.data(), pState->output.data(), pState->input.size()); };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size() * sizeof(float)); };
+    return kernel;
+}
+
+Kernel create_f32_to_s16(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<float> input;
+        std::vector<int16_t> output;
+    };
+    auto pState = std::make_shared<State>();
+    const std::vector<int16_t> signal = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+    pState->input.resize(signal.size());
+    for (size_t i = 0; i < signal.size(); i++)
+        pState->input[i] = signal[i] * (1.1f / 32768.0f); // some clipping
+    pState->output.resize(signal.size());
+
+    Kernel kernel;
+    kernel.numSamples = pState->input.size();
+    kernel.numBytes = pState->output.size() * sizeof(int16_t);
+    kernel.run = [pState]() { SampleConvert::f32_to_s16(pState->input.data(), pState->output.data(), pState->input.size()); };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size() * sizeof(int16_t)); };
+    return kernel;
+}
+
+Kernel create_deinterleave(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<int16_t> input;
+        std::vector<int32_t> left;
+        std::vector<int32_t> right;
+    };
+    auto pState = std::make_shared<State>();
+    pState->input = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+    pState->left.resize(numSamples);
+    pState->right.resize(numSamples);
+
+    Kernel kernel;
+    kernel.numSamples = pState->input.size();
+    kernel.numBytes = pState->input.size() * sizeof(int16_t);
+    kernel.run = [pState]() { SampleConvert::deinterleave_s16_stereo(pState->input.data(), pState->left.data(), pState->right.data(), pState->left.size()); };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->left.data(), pState->left.size() * sizeof(int32_t)) ^ Utils::hash64(pState->right.data(), pState->right.size() * sizeof(int32_t)); };
+    return kernel;
+}
+
+Kernel create_resample(size_t numSamples)
+{
+    struct State
+    {
+        std::vector<int16_t> input;
+        std::vector<float> output;
+    };
+    auto pState = std::make_shared<State>();
+    pState->input = Synth::generate_signal(numSamples, 2, kSampleRate, kSeed);
+
+    Kernel kernel;
+    kernel.numSamples = pState->input.size();
+    kernel.numBytes = pState->input.size() * sizeof(int16_t);
+    kernel.run = [pState]()
+    {
+        PcmConvert::Resampler resampler;
+        resampler.init(kSampleRate, 48000, 2);
+        pState->output.resize(resampler.get_output_frames(pState->input.size() / 2) * 2);
+
+        // By chunks, as decoders produce them
+        const size_t numFrames = pState->input.size() / 2;
+        const size_t chunkFrames = kWaveChunkSize / 4;
+        float* pOut = pState->output.data();
+        for (size_t frame = 0; frame < numFrames; frame += chunkFrames)
+        {
+            resampler.push(pState->input.data() + frame * 2, std::min(chunkFrames, numFrames - frame));
+            const size_t available = resampler.get_available_frames();
+            resampler.pull(pOut, available);
+            pOut += available * 2;
+        }
+        resampler.flush();
+        resampler.pull(pOut, resampler.get_available_frames());
+    };
+    kernel.checksum = [pState]() { return Utils::hash64(pState->output.data(), pState->output.size() * sizeof(float)); };
+    return kernel;
+}
+
+struct Benchmark
+{
+    const char* name;
+    std::function<Kernel(size_t numSamples)> create;
+};
+
+const std::vector<Benchmark>& get_benchmarks()
+{
+    static const std::vector<Benchmark> benchmarks = {
+        { "adpcm_decode_mono", [](size_t n) { return create_adpcm_decode(n, 1); } },
+        { "adpcm_decode_stereo", [](size_t n) { return create_adpcm_decode(n, 2); } },
+        { "adpcm_encode_mono", create_adpcm_encode },
+        { "wvsm_inflate_stereo", create_wvsm_inflate },
+        { "apc_decode_mono", [](size_t n) { return create_apc_decode(n, 1); } },
+        { "apc_decode_stereo", [](size_t n) { return create_apc_decode(n, 2); } },
+        { "midi_merge", create_midi_merge },
+        { "wave_write_stereo", create_wave_write },
+        { "s16_to_f32", create_s16_to_f32 },
+        { "f32_to_s16", create_f32_to_s16 },
+        { "deinterleave_stereo", create_deinterleave },
+        { "resample_stereo_48k", create_resample },
+    };
+    return benchmarks;
+}
+
+double get_elapsed_seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int run(const Options& options)
+{
+    const size_t numSamples = std::max<size_t>(options.numSamples, 2);
+    const int numRepetitions = std::max(options.numRepetitions, 1);
+
+    std::vector<const Benchmark*> selected;
+    for (const auto& benchmark : get_benchmarks())
+    {
+        if (options.filter.empty() || std::string(benchmark.name).find(options.filter) != std::string::npos)
+            selected.push_back(&benchmark);
+    }
+
+    if (selected.empty())
+    {
+        std::cerr << "No benchmark matches " << options.filter << "\n";
+        return -1;
+    }
+
+    std::cout << Utils::str_format("%zu samples per channel, %d run(s) after 1 warm-up, rates of the median run, %s kernels\n", numSamples,
+        numRepetitions, CpuDispatch::get_name(CpuDispatch::get_isa()));
+    std::cout << Utils::str_format("%-22s %12s %12s %10s %10s %12s %10s %10s  %s\n",
+        "kernel", "samples", "bytes", "best_ms", "median_ms", "Msamples/s", "MB/s", "ns/sample", "checksum");
+
+    for (const Benchmark* pBenchmark : selected)
+    {
+        Kernel kernel = pBenchmark->create(numSamples);
+        kernel.run(); // warm-up: caches, page faults of the output buffers
+
+        std::vector<double> seconds;
+        for (int r = 0; r < numRepetitions; r++)
+        {
+            const auto start = Clock::now();
+            kernel.run();
+            seconds.push_back(get_elapsed_seconds(start));
+        }
+        std::sort(seconds.begin(), seconds.end());
+        const double median = std::max(seconds[seconds.size() / 2], 1e-9);
+
+        std::cout << Utils::str_format("%-22s %12llu %12llu %10.3f %10.3f %12.2f %10.2f %10.3f  %016llx\n", pBenchmark->name,
+            (unsigned long long)kernel.numSamples, (unsigned long long)kernel.numBytes, seconds.front() * 1000.0, median * 1000.0,
+            kernel.numSamples / median / 1e6, kernel.numBytes / median / 1e6, median * 1e9 / std::max<uint64_t>(kernel.numSamples, 1),
+            (unsigned long long)kernel.checksum());
+    }
+    return 0;
+}
+
+} // namespace Bench
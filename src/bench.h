@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Bench {
+
+//-----------------------------------------------------------------------------
+// Microbenchmarks of the codec kernels, run by the MiscAudioBench executable
+// on synthetic deterministic inputs: each kernel runs once to warm up, then
+// numRepetitions times. The best and median times are reported, with the
+// samples/s, MB/s and ns/sample of the median run, and a checksum of the
+// output to compare builds.
+//-----------------------------------------------------------------------------
+
+struct Options
+{
+    std::string filter;                 // only the kernels whose name contains it (all if empty)
+    size_t numSamples = 1 << 20;        // samples per channel fed to each kernel
+    int numRepetitions = 7;
+};
+
+// Returns the process exit code
+int run(const Options& options);
+
+} // namespace Bench
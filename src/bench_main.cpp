@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "bench.h"
+#include "cpu_dispatch.h"
+
+//-----------------------------------------------------------------------------
+// MiscAudioBench: microbenchmarks of the codec kernels (bench.h), built
+// against the codecs library alone.
+//-----------------------------------------------------------------------------
+
+const char* kSizeArg = "-size";
+const char* kRunsArg = "-runs";
+const char* kIsaArg = "-isa";
+
+void printUsage()
+{
+    std::cout << "Usage: MiscAudioBench [<Filter>] [-size <NumSamples>] [-runs <N>] [-isa <scalar|sse4.1|avx2|avx512>]\n"
+        << "Times the codec kernels on synthetic data, optionally only those whose name contains Filter,\n"
+        << "with NumSamples samples per channel and N timed runs, using the widest instruction set of the CPU unless -isa is given\n";
+}
+
+int main(int argc, const char* argv[])
+{
+    Bench::Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool bHasValue = (i + 1 < argc);
+        if (arg == kSizeArg && bHasValue)
+        {
+            options.numSamples = (size_t)std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == kRunsArg && bHasValue)
+        {
+            options.numRepetitions = std::atoi(argv[++i]);
+        }
+        else if (arg == kIsaArg)
+        {
+            CpuDispatch::EIsa isa;
+            if (!bHasValue || !CpuDispatch::find_isa_from_name(argv[++i], isa))
+            {
+                std::cerr << "Please input an instruction set with -isa: scalar, sse4.1, avx2 or avx512\n";
+                return -1;
+            }
+            if (!CpuDispatch::select(isa))
+                return -1;
+        }
+        else if (arg[0] != '-' && options.filter.empty())
+        {
+            options.filter = arg;
+        }
+        else
+        {
+            printUsage();
+            return -1;
+        }
+    }
+
+    return Bench::run(options);
+}
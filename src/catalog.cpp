@@ -0,0 +1,614 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "cryo_apc.h"
+#include "file_utils.h"
+#include "indywv.h"
+#include "inti_icelib.h"
+#include "labn.h"
+#include "midi.h"
+#include "utils.h"
+#include "wave.h"
+
+namespace Catalog {
+
+namespace {
+
+PACK(struct CatalogHeader
+{
+    char tag[8];
+    uint32_t version;
+    uint32_t numSources;
+    uint32_t numAssets;
+    uint32_t stringPoolSize;
+});
+
+PACK(struct SourceRecord
+{
+    uint32_t pathOffset;
+    uint64_t size;
+    int64_t mtime;
+});
+
+PACK(struct AssetRecord
+{
+    uint32_t sourceIndex;
+    uint32_t nameOffset;
+    uint32_t sequenceNameOffset;
+    uint8_t kind;
+    uint8_t codec;
+    uint16_t numChannels;
+    uint32_t sampleRate;
+    uint16_t bitSize;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t numFrames;
+});
+
+std::string get_stem(const std::string& fileName)
+{
+    auto name = fileName.substr(fileName.find_last_of("/\\") + 1);
+    return name.substr(0, name.find_last_of("."));
+}
+
+void set_format(Asset& asset, const PcmFormat& format, uint64_t numFrames)
+{
+    asset.sampleRate = format.sampleRate;
+    asset.numChannels = format.numChannels;
+    asset.bitSize = format.bitSize;
+    asset.numFrames = numFrames;
+}
+
+bool read_wv_header(const uint8_t* pData, size_t size, Asset& asset)
+{
+    if (size < sizeof(IndyWVHeader) || strncmp((const char*)pData, IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV)) != 0)
+        return false;
+
+    const auto* header = reinterpret_cast<const IndyWVHeader*>(pData);
+    const uint32_t frameSize = header->numChannels * header->sampleBitSize / 8;
+
+    asset.sampleRate = header->sampleRate;
+    asset.numChannels = (uint16_t)header->numChannels;
+    asset.bitSize = (uint16_t)header->sampleBitSize;
+    asset.numFrames = frameSize ? (uint32_t)header->decompressedSize / frameSize : 0;
+    asset.codec = IndyWV::is_wvsm(pData + sizeof(IndyWVHeader), size - sizeof(IndyWVHeader)) ? ECodec::WVSM : ECodec::ADPCM;
+    return true;
+}
+
+bool read_wav_header(const uint8_t* pData, size_t size, Asset& asset)
+{
+    Wave::Reader reader;
+    if (!reader.open(pData, size))
+        return false;
+
+    set_format(asset, reader.get_source_format(), reader.get_num_frames());
+    return true;
+}
+
+ECodec get_bigrp_codec(uint32_t codec)
+{
+    switch (static_cast<icelib::EntryCodec>(codec))
+    {
+    case icelib::EntryCodec::Range: return ECodec::BigrpRange;
+    case icelib::EntryCodec::Data: return ECodec::BigrpData;
+    case icelib::EntryCodec::Midi: return ECodec::Midi;
+    case icelib::EntryCodec::DCT: return ECodec::BigrpDCT;
+    default: return ECodec::Unknown;
+    }
+}
+
+// Lists the assets of one input file, returns false if it isn't a known format
+bool scan_file(const std::string& path, Inti::EGame game, std::vector<Asset>& outAssets)
+{
+    Utils::MappedFile file(path);
+    if (!file.is_open() || file.size() < 8)
+        return false;
+
+    const uint8_t* pData = file.data();
+    const size_t size = file.size();
+
+    Asset asset;
+    asset.name = get_stem(path);
+    asset.size = size;
+
+    if (strncmp((const char*)pData, IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV)) == 0)
+    {
+        asset.kind = EAssetKind::IndyWV;
+        if (!read_wv_header(pData, size, asset))
+            return false;
+        outAssets.push_back(asset);
+    }
+    else if (strncmp((const char*)pData, CryoAPC::kAPCTag, sizeof(CryoAPC::kAPCTag)) == 0)
+    {
+        PcmFormat format;
+        uint64_t numFrames;
+        if (!CryoAPC::read_header(pData, size, format, numFrames))
+            return false;
+
+        asset.kind = EAssetKind::CryoAPC;
+        asset.codec = ECodec::CryoADPCM;
+        set_format(asset, format, numFrames);
+        outAssets.push_back(asset);
+    }
+    else if (strncmp((const char*)pData, Wave::kRIFF, sizeof(Wave::kRIFF)) == 0)
+    {
+        asset.kind = EAssetKind::Wave;
+        asset.codec = ECodec::PCM;
+        if (!read_wav_header(pData, size, asset))
+            return false;
+        outAssets.push_back(asset);
+    }
+    else if (strncmp((const char*)pData, LABN::kLABNId, sizeof(LABN::kLABNId)) == 0)
+    {
+        std::vector<LABN::Entry> entries;
+        if (!LABN::list_entries(path, pData, size, entries))
+            return false;
+
+        for (const auto& entry : entries)
+        {
+            Asset labAsset;
+            labAsset.kind = EAssetKind::LabEntry;
+            labAsset.name = get_stem(entry.fileName);
+            labAsset.offset = entry.dataOffset;
+            labAsset.size = entry.sizeInBytes;
+            read_wv_header(pData + entry.dataOffset, entry.sizeInBytes, labAsset);
+            outAssets.push_back(labAsset);
+        }
+    }
+    else if (memcmp(pData, Inti::kBigrpTag, sizeof(Inti::kBigrpTag)) == 0)
+    {
+        std::vector<Inti::Subsong> subsongs;
+        if (!Inti::list_subsongs(path, pData, size, game, subsongs))
+            return false;
+
+        const std::string bigrpName = get_stem(path);
+        for (const auto& subsong : subsongs)
+        {
+            Asset songAsset;
+            songAsset.kind = EAssetKind::BigrpSubsong;
+            songAsset.codec = get_bigrp_codec(subsong.codec);
+            songAsset.name = Utils::str_format("%s_%03d", bigrpName.c_str(), subsong.index);
+            songAsset.sequenceName = subsong.sequenceName;
+            songAsset.offset = subsong.dataOffset;
+            songAsset.size = subsong.dataSize;
+            if (songAsset.codec == ECodec::BigrpData && subsong.dataSize > 0)
+                read_wav_header(pData + subsong.dataOffset, subsong.dataSize, songAsset);
+            outAssets.push_back(songAsset);
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Case-insensitive match with '*' (any sequence) and '?' (any character) wildcards
+bool match_pattern(const std::string& pattern, const std::string& text)
+{
+    size_t p = 0, t = 0;
+    size_t starPattern = std::string::npos, starText = 0;
+    while (t < text.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || tolower((unsigned char)pattern[p]) == tolower((unsigned char)text[t])))
+        {
+            p++;
+            t++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            starPattern = p++;
+            starText = t;
+        }
+        else if (starPattern != std::string::npos)
+        {
+            p = starPattern + 1;
+            t = ++starText;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+class StringPool
+{
+public:
+    StringPool() { pool.push_back(0); } // offset 0: empty string
+
+    uint32_t add(const std::string& str)
+    {
+        if (str.empty())
+            return 0;
+
+        auto found = offsets.find(str);
+        if (found != offsets.end())
+            return found->second;
+
+        uint32_t offset = (uint32_t)pool.size();
+        pool.insert(pool.end(), str.begin(), str.end());
+        pool.push_back(0);
+        offsets[str] = offset;
+        return offset;
+    }
+
+    const std::vector<char>& get_data() const { return pool; }
+
+private:
+    std::vector<char> pool;
+    std::map<std::string, uint32_t> offsets;
+};
+
+} // namespace
+
+bool AssetCatalog::build(const std::string& inputPath, Inti::EGame game)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> paths;
+    std::error_code error;
+    if (fs::is_directory(inputPath, error))
+    {
+        for (auto it = fs::recursive_directory_iterator(inputPath, fs::directory_options::skip_permission_denied, error);
+            !error && it != fs::recursive_directory_iterator(); it.increment(error))
+        {
+            if (it->is_regular_file(error))
+                paths.push_back(it->path().string());
+        }
+    }
+    else if (fs::is_regular_file(inputPath, error))
+    {
+        paths.push_back(inputPath);
+    }
+    else
+    {
+        std::cerr << "Can't find " << inputPath << "\n";
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    // Files are scanned in parallel, and their assets merged in path order
+    struct ScannedFile
+    {
+        Source source;
+        std::vector<Asset> assets;
+        bool bKnown = false;
+    };
+    std::vector<ScannedFile> scanned(paths.size());
+
+    std::atomic<size_t> nextFile(0);
+    auto worker = [&]()
+    {
+        for (size_t i = nextFile++; i < paths.size(); i = nextFile++)
+        {
+            ScannedFile& file = scanned[i];
+            std::error_code pathError;
+            file.source.path = fs::absolute(paths[i], pathError).lexically_normal().string();
+            file.bKnown = Utils::read_stats(paths[i], file.source.size, file.source.mtime) && scan_file(paths[i], game, file.assets);
+        }
+    };
+
+    const size_t numThreads = std::min<size_t>(paths.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < numThreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    sources.clear();
+    assets.clear();
+    for (auto& file : scanned)
+    {
+        if (!file.bKnown)
+            continue;
+
+        for (auto& asset : file.assets)
+        {
+            asset.sourceIndex = (uint32_t)sources.size();
+            assets.push_back(std::move(asset));
+        }
+        sources.push_back(std::move(file.source));
+    }
+    return true;
+}
+
+bool AssetCatalog::save(const std::string& path) const
+{
+    StringPool strings;
+
+    std::vector<SourceRecord> sourceRecords;
+    for (const auto& source : sources)
+        sourceRecords.push_back({ strings.add(source.path), source.size, source.mtime });
+
+    std::vector<AssetRecord> assetRecords;
+    for (const auto& asset : assets)
+    {
+        AssetRecord record = {};
+        record.sourceIndex = asset.sourceIndex;
+        record.nameOffset = strings.add(asset.name);
+        record.sequenceNameOffset = strings.add(asset.sequenceName);
+        record.kind = (uint8_t)asset.kind;
+        record.codec = (uint8_t)asset.codec;
+        record.numChannels = asset.numChannels;
+        record.sampleRate = asset.sampleRate;
+        record.bitSize = asset.bitSize;
+        record.offset = asset.offset;
+        record.size = asset.size;
+        record.numFrames = asset.numFrames;
+        assetRecords.push_back(record);
+    }
+
+    CatalogHeader header = {};
+    memcpy(header.tag, kCatalogTag, sizeof(kCatalogTag));
+    header.version = kCatalogVersion;
+    header.numSources = (uint32_t)sourceRecords.size();
+    header.numAssets = (uint32_t)assetRecords.size();
+    header.stringPoolSize = (uint32_t)strings.get_data().size();
+
+    std::vector<char> data;
+    auto append = [&](const void* p, size_t size) { data.insert(data.end(), (const char*)p, (const char*)p + size); };
+    append(&header, sizeof(header));
+    append(sourceRecords.data(), sourceRecords.size() * sizeof(SourceRecord));
+    append(assetRecords.data(), assetRecords.size() * sizeof(AssetRecord));
+    append(strings.get_data().data(), strings.get_data().size());
+
+    return Utils::write_file(path, data.data(), data.size());
+}
+
+bool AssetCatalog::load(const std::string& path)
+{
+    std::vector<uint8_t> data;
+    if (!Utils::read_file(path, data))
+    {
+        std::cerr << "Can't read catalog " << path << "\n";
+        return false;
+    }
+
+    CatalogHeader header;
+    if (data.size() < sizeof(header))
+    {
+        std::cerr << path << " is not a catalog file\n";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (memcmp(header.tag, kCatalogTag, sizeof(kCatalogTag)) != 0 || header.version != kCatalogVersion)
+    {
+        std::cerr << path << " is not a catalog file, or was made by another version\n";
+        return false;
+    }
+
+    const uint64_t sourcesOffset = sizeof(header);
+    const uint64_t assetsOffset = sourcesOffset + (uint64_t)header.numSources * sizeof(SourceRecord);
+    const uint64_t stringsOffset = assetsOffset + (uint64_t)header.numAssets * sizeof(AssetRecord);
+    if (stringsOffset + header.stringPoolSize != data.size() || header.stringPoolSize == 0 || data.back() != 0)
+    {
+        std::cerr << "Corrupted catalog " << path << "\n";
+        return false;
+    }
+
+    const char* pStrings = (const char*)data.data() + stringsOffset;
+    auto get_string = [&](uint32_t offset) { return std::string(offset < header.stringPoolSize ? pStrings + offset : ""); };
+
+    sources.resize(header.numSources);
+    for (uint32_t i = 0; i < header.numSources; i++)
+    {
+        SourceRecord record;
+        memcpy(&record, data.data() + sourcesOffset + i * sizeof(SourceRecord), sizeof(record));
+        sources[i].path = get_string(record.pathOffset);
+        sources[i].size = record.size;
+        sources[i].mtime = record.mtime;
+    }
+
+    assets.resize(header.numAssets);
+    for (uint32_t i = 0; i < header.numAssets; i++)
+    {
+        AssetRecord record;
+        memcpy(&record, data.data() + assetsOffset + i * sizeof(AssetRecord), sizeof(record));
+        if (record.sourceIndex >= header.numSources)
+        {
+            std::cerr << "Corrupted catalog " << path << "\n";
+            return false;
+        }
+
+        Asset& asset = assets[i];
+        asset.sourceIndex = record.sourceIndex;
+        asset.kind = (EAssetKind)record.kind;
+        asset.codec = (ECodec)record.codec;
+        asset.name = get_string(record.nameOffset);
+        asset.sequenceName = get_string(record.sequenceNameOffset);
+        asset.offset = record.offset;
+        asset.size = record.size;
+        asset.sampleRate = record.sampleRate;
+        asset.numChannels = record.numChannels;
+        asset.bitSize = record.bitSize;
+        asset.numFrames = record.numFrames;
+    }
+    return true;
+}
+
+std::vector<size_t> AssetCatalog::find(const std::string& pattern) const
+{
+    std::vector<size_t> found;
+    for (size_t i = 0; i < assets.size(); i++)
+    {
+        const Asset& asset = assets[i];
+        if (pattern.empty() || match_pattern(pattern, asset.name) || match_pattern(pattern, asset.sequenceName) ||
+            match_pattern(pattern, get_codec_name(asset.codec)))
+        {
+            found.push_back(i);
+        }
+    }
+    return found;
+}
+
+void AssetCatalog::print(const std::vector<size_t>& assetIndices) const
+{
+    struct Total
+    {
+        size_t count = 0;
+        double duration = 0.0;
+        uint64_t size = 0;
+    };
+    std::map<std::string, Total> totals;
+
+    for (size_t index : assetIndices)
+    {
+        const Asset& asset = assets[index];
+        const Source& source = sources[asset.sourceIndex];
+
+        std::string format = asset.sampleRate ? Utils::str_format("%6u Hz %u ch %2u bit %9.3f s", asset.sampleRate, asset.numChannels, asset.bitSize, asset.get_duration())
+                                              : std::string(35, ' ');
+        std::string name = asset.sequenceName.empty() ? asset.name : asset.name + " (" + asset.sequenceName + ")";
+        std::string location = (asset.kind == EAssetKind::LabEntry || asset.kind == EAssetKind::BigrpSubsong)
+            ? Utils::str_format("%s @%llu", source.path.c_str(), (unsigned long long)asset.offset)
+            : source.path;
+
+        std::cout << Utils::str_format("%-12s %-10s %s %10llu  %s  [%s]\n", get_kind_name(asset.kind), get_codec_name(asset.codec),
+            format.c_str(), (unsigned long long)asset.size, name.c_str(), location.c_str());
+
+        Total& total = totals[get_codec_name(asset.codec)];
+        total.count++;
+        total.duration += asset.get_duration();
+        total.size += asset.size;
+    }
+
+    for (const auto& total : totals)
+    {
+        std::cout << Utils::str_format("%-10s %6zu asset(s) %10.1f s %12llu bytes\n", total.first.c_str(), total.second.count,
+            total.second.duration, (unsigned long long)total.second.size);
+    }
+    std::cout << assetIndices.size() << " asset(s) listed, " << assets.size() << " in catalog\n";
+}
+
+size_t AssetCatalog::extract(const std::vector<size_t>& assetIndices, const std::string& outFolder, const Output::Options& options) const
+{
+    const std::string pcmExt = Output::get_extension(options);
+
+    // Each source is mapped once, for all of its selected assets
+    std::map<uint32_t, std::vector<size_t>> assetsPerSource;
+    for (size_t index : assetIndices)
+        assetsPerSource[assets[index].sourceIndex].push_back(index);
+
+    size_t numExtracted = 0;
+    for (const auto& group : assetsPerSource)
+    {
+        const Source& source = sources[group.first];
+
+        uint64_t size;
+        int64_t mtime;
+        if (!Utils::read_stats(source.path, size, mtime) || size != source.size || mtime != source.mtime)
+        {
+            std::cerr << source.path << " changed since the catalog was built, skipping it (run -index again)\n";
+            continue;
+        }
+
+        Utils::MappedFile file(source.path);
+        if (!file.is_open())
+            continue;
+
+        for (size_t index : group.second)
+        {
+            const Asset& asset = assets[index];
+            if (asset.offset + asset.size > file.size() || asset.size == 0)
+                continue;
+
+            const uint8_t* pData = file.data() + asset.offset;
+            const std::string outPath = outFolder + "\\" + asset.name;
+
+            bool bExtracted = true;
+            switch (asset.codec)
+            {
+            case ECodec::ADPCM:
+            case ECodec::WVSM:
+            {
+                auto sink = Output::create_pcm_sink(outPath + "." + pcmExt, options);
+                bExtracted = sink && IndyWV().decode(pData, (size_t)asset.size, *sink);
+                break;
+            }
+            case ECodec::CryoADPCM:
+            {
+                auto sink = Output::create_pcm_sink(outPath + "." + pcmExt, options);
+                bExtracted = sink && CryoAPC::decode(pData, (size_t)asset.size, *sink);
+                break;
+            }
+            case ECodec::PCM:
+            {
+                std::string wvPath = outPath + ".wv";
+                IndyWV().wav_to_wv(pData, (size_t)asset.size, wvPath, options.pStore);
+                break;
+            }
+            case ECodec::BigrpData:
+                bExtracted = Utils::store_file(outPath + ".wav", pData, (size_t)asset.size, options.pStore);
+                break;
+            case ECodec::Midi:
+            {
+                std::string midiPath = asset.sequenceName.empty() ? outPath : outPath + "_" + asset.sequenceName;
+                MidiUtils::write_raw_midi_file(midiPath + ".mid", pData, (uint32_t)asset.size, options.pStore);
+                break;
+            }
+            default:
+                bExtracted = false;
+                break;
+            }
+
+            if (bExtracted)
+                numExtracted++;
+        }
+    }
+    return numExtracted;
+}
+
+bool is_catalog_file(const std::string& path)
+{
+    char tag[sizeof(kCatalogTag)] = {};
+    std::ifstream file(path, std::ios::binary);
+    file.read(tag, sizeof(tag));
+    return file && memcmp(tag, kCatalogTag, sizeof(kCatalogTag)) == 0;
+}
+
+const char* get_codec_name(ECodec codec)
+{
+    switch (codec)
+    {
+    case ECodec::PCM: return "pcm";
+    case ECodec::ADPCM: return "adpcm";
+    case ECodec::WVSM: return "wvsm";
+    case ECodec::CryoADPCM: return "apc";
+    case ECodec::Midi: return "midi";
+    case ECodec::BigrpData: return "wav";
+    case ECodec::BigrpRange: return "range";
+    case ECodec::BigrpDCT: return "dct";
+    default: return "unknown";
+    }
+}
+
+const char* get_kind_name(EAssetKind kind)
+{
+    switch (kind)
+    {
+    case EAssetKind::IndyWV: return "wv";
+    case EAssetKind::CryoAPC: return "apc";
+    case EAssetKind::Wave: return "wav";
+    case EAssetKind::LabEntry: return "lab-entry";
+    case EAssetKind::BigrpSubsong: return "bigrp-song";
+    default: return "unknown";
+    }
+}
+
+} // namespace Catalog
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "inti_bigrp.h"
+#include "output.h"
+
+namespace Catalog {
+
+constexpr static char kCatalogTag[8] = { 'M', 'A', 'C', 'C', 'A', 'T', 'L', 'G' };
+constexpr uint32_t kCatalogVersion = 1;
+
+enum class EAssetKind : uint8_t
+{
+    IndyWV,   // standalone .wv file
+    CryoAPC,  // standalone .apc file
+    Wave,     // standalone .wav file
+    LabEntry, // entry of a .lab archive
+    BigrpSubsong,
+};
+
+enum class ECodec : uint8_t
+{
+    Unknown,
+    PCM,
+    ADPCM,     // INDYWV ADPCM
+    WVSM,      // INDYWV WVSM
+    CryoADPCM,
+    Midi,      // BIGRP embedded .mid
+    BigrpData, // BIGRP embedded .wav
+    BigrpRange,
+    BigrpDCT,
+};
+
+// Input file scanned into the catalog, with the stats it had then
+struct Source
+{
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+struct Asset
+{
+    uint32_t sourceIndex = 0;
+    EAssetKind kind = EAssetKind::IndyWV;
+    ECodec codec = ECodec::Unknown;
+    std::string name;         // file name without extension, LAB entry name or <bigrp>_<index>
+    std::string sequenceName; // BIGRP MIDI subsongs only
+
+    uint64_t offset = 0; // of the asset data in its source file
+    uint64_t size = 0;
+
+    uint32_t sampleRate = 0; // 0 if not audio data
+    uint16_t numChannels = 0;
+    uint16_t bitSize = 0;
+    uint64_t numFrames = 0;
+
+    double get_duration() const { return sampleRate ? (double)numFrames / sampleRate : 0.0; }
+};
+
+//-----------------------------------------------------------------------------
+// Binary catalog of the assets found in a set of input files: standalone
+// WV/APC/WAV files, LAB entries and BIGRP subsongs, with their format, size
+// and duration. Building it only parses headers (files are memory-mapped, so
+// the audio data itself is never read), on one thread per core; queries and
+// extractions then use the catalog instead of rescanning the inputs.
+// File layout: header, Source records, Asset records, then a pool of
+// null-terminated strings referenced by offset.
+//-----------------------------------------------------------------------------
+class AssetCatalog
+{
+public:
+    // Scans a file, or a directory tree recursively
+    bool build(const std::string& inputPath, Inti::EGame game);
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    // Indices of the assets whose name, sequence name or codec matches a
+    // case-insensitive pattern ('*' and '?' wildcards). An empty pattern matches all.
+    std::vector<size_t> find(const std::string& pattern) const;
+
+    // Prints the given assets, one per line, then totals per codec
+    void print(const std::vector<size_t>& assetIndices) const;
+
+    // Decodes the given assets to outFolder, reading only their data from the sources.
+    // Sources changed since the catalog was built are skipped.
+    size_t extract(const std::vector<size_t>& assetIndices, const std::string& outFolder, const Output::Options& options) const;
+
+    const std::vector<Source>& get_sources() const { return sources; }
+    const std::vector<Asset>& get_assets() const { return assets; }
+
+private:
+    std::vector<Source> sources;
+    std::vector<Asset> assets;
+};
+
+// Whether a file starts with the catalog tag
+bool is_catalog_file(const std::string& path);
+
+const char* get_codec_name(ECodec codec);
+const char* get_kind_name(EAssetKind kind);
+
+} // namespace Catalog
@@ -0,0 +1,321 @@
+#include "corpus.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+#include "cryo_apc.h"
+#include "file_utils.h"
+#include "indywv.h"
+#include "inti_icelib.h"
+#include "labn.h"
+#include "synth.h"
+#include "utils.h"
+#include "wave.h"
+
+namespace Corpus {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Number of files of each kind at scale 1
+constexpr int kNumMonoAdpcmFiles = 40;
+constexpr int kNumStereoAdpcmFiles = 10;
+constexpr int kNumWvsmFiles = 20;
+constexpr int kNumWavFiles = 20;
+constexpr int kNumApcFiles = 20; // of each channel count
+constexpr int kNumLabEntries = 3000;
+constexpr int kMaxEntriesPerLab = 1500;
+constexpr int kNumBigrpFiles = 4;
+
+constexpr int kSongsPerBigrp = 4;
+constexpr int kSamplesPerBigrp = 8;
+constexpr int kNotesPerTrack = 96;
+const char* kTrackNames[8] = { "lead", "bass", "pad", "arp", "strings", "brass", "perc", "fx" };
+
+constexpr uint32_t kBigrpHeadSize = 0x0c;
+constexpr uint32_t kBigrpEntrySize = 0x34;
+
+// Keeps the last file written to it in memory
+class MemoryStore : public Utils::FileStore
+{
+public:
+    bool store(const std::string&, std::vector<char>&& in_data) override
+    {
+        data = std::move(in_data);
+        return true;
+    }
+
+    std::vector<char> data;
+};
+
+struct LabHeader
+{
+    char id[4];
+    uint32_t unknown;
+    uint32_t fileCount;
+    uint32_t fileNameListLength;
+};
+
+struct LabFileEntry
+{
+    uint32_t nameOffset;
+    uint32_t dataOffset;
+    uint32_t sizeInBytes;
+    char typeId[4];
+};
+
+int get_count(int countAtScale1, double scale)
+{
+    return std::max(1, (int)std::lround(countAtScale1 * scale));
+}
+
+uint32_t get_random_length(Synth::Random& random, double minSeconds, double maxSeconds, uint32_t sampleRate)
+{
+    return (uint32_t)((minSeconds + (maxSeconds - minSeconds) * random.uniform()) * sampleRate);
+}
+
+uint32_t get_random_length(uint64_t seed, double minSeconds, double maxSeconds, uint32_t sampleRate)
+{
+    Synth::Random random(~seed);
+    return get_random_length(random, minSeconds, maxSeconds, sampleRate);
+}
+
+std::string get_path(const std::string& folder, const char* subFolder, const std::string& fileName)
+{
+    return (fs::path(folder) / subFolder / fileName).string();
+}
+
+void append(std::vector<uint8_t>& data, const void* pValue, size_t size)
+{
+    const uint8_t* pBytes = (const uint8_t*)pValue;
+    data.insert(data.end(), pBytes, pBytes + size);
+}
+
+// ADPCM INDYWV file. The encoder reads each channel from the same stream, one sample apart:
+// stereo files hold 2 slightly shifted copies of the signal.
+void write_adpcm_wv(IndyWV& codec, std::string path, uint32_t numFrames, uint16_t numChannels, uint32_t sampleRate, uint64_t seed, Utils::FileStore* pStore)
+{
+    const auto signal = Synth::generate_signal(numFrames + 1, 1, sampleRate, seed);
+
+    std::vector<char> compressed((size_t)numFrames * numChannels * 3 + 16, 0);
+    IndyWV::DecompressorState states[2] = {};
+    const int compressedSize = codec.compressADPCM(states, compressed.data(), (const char*)signal.data(), (int)numFrames, numChannels);
+
+    PcmFormat format;
+    format.numChannels = numChannels;
+    format.sampleRate = sampleRate;
+    codec.write_wv_file(path, format, numFrames * numChannels * sizeof(int16_t), compressed.data(), compressedSize, pStore);
+}
+
+void write_wvsm_wv(IndyWV& codec, std::string path, uint32_t numFrames, uint32_t sampleRate, uint64_t seed, Utils::FileStore* pStore)
+{
+    const auto signal = Synth::generate_signal(numFrames, 2, sampleRate, seed);
+    const auto stream = Synth::encode_wvsm(signal.data(), signal.size());
+
+    PcmFormat format;
+    format.numChannels = 2;
+    format.sampleRate = sampleRate;
+    codec.write_wvsm_file(path, format, (uint32_t)(signal.size() * sizeof(int16_t)), stream.data(), stream.size(), pStore);
+}
+
+bool write_wav(const std::string& path, uint32_t numFrames, uint16_t numChannels, uint32_t sampleRate, uint64_t seed, Utils::FileStore* pStore)
+{
+    const auto signal = Synth::generate_signal(numFrames, numChannels, sampleRate, seed);
+    const size_t dataSize = signal.size() * sizeof(int16_t);
+
+    PcmFormat format;
+    format.numChannels = numChannels;
+    format.sampleRate = sampleRate;
+
+    Wave::Writer writer(path, pStore);
+    if (!writer.begin(format, dataSize))
+        return false;
+    memcpy(writer.reserve(dataSize), signal.data(), dataSize);
+    writer.commit(dataSize);
+    return writer.end();
+}
+
+bool write_lab(IndyWV& codec, const std::string& path, int firstEntry, int numEntries, uint64_t seed)
+{
+    Synth::Random random(seed);
+
+    // Entry names, then the table offsets once their sizes are known
+    std::string nameList;
+    std::vector<std::vector<char>> entryData;
+    for (int e = 0; e < numEntries; e++)
+    {
+        nameList += Utils::str_format("v%05d.wv", firstEntry + e);
+        nameList += '\0';
+
+        MemoryStore store;
+        write_adpcm_wv(codec, "entry.wv", get_random_length(random, 0.1, 0.8, 22050), 1, 22050, seed + e + 1, &store);
+        entryData.push_back(std::move(store.data));
+    }
+
+    LabHeader header;
+    memcpy(header.id, LABN::kLABNId, sizeof(header.id));
+    header.unknown = 0x10000;
+    header.fileCount = (uint32_t)numEntries;
+    header.fileNameListLength = (uint32_t)nameList.size();
+
+    std::vector<uint8_t> lab;
+    append(lab, &header, sizeof(header));
+
+    uint32_t nameOffset = 0;
+    uint32_t dataOffset = (uint32_t)(sizeof(LabHeader) + numEntries * sizeof(LabFileEntry) + nameList.size());
+    for (int e = 0; e < numEntries; e++)
+    {
+        LabFileEntry entry;
+        entry.nameOffset = nameOffset;
+        entry.dataOffset = dataOffset;
+        entry.sizeInBytes = (uint32_t)entryData[e].size();
+        memcpy(entry.typeId, "WV  ", sizeof(entry.typeId));
+        append(lab, &entry, sizeof(entry));
+
+        nameOffset += (uint32_t)strlen(nameList.c_str() + nameOffset) + 1;
+        dataOffset += entry.sizeInBytes;
+    }
+    append(lab, nameList.data(), nameList.size());
+    for (const auto& data : entryData)
+        append(lab, data.data(), data.size());
+
+    return Utils::write_file(path, lab.data(), lab.size());
+}
+
+// Songs of 8 MIDI tracks named <song>_<track> (grouped into one merged MIDI file per song),
+// then embedded WAV samples (packed into a SoundFont), after a range entry
+bool write_bigrp(const std::string& path, int bigrpIndex, uint64_t seed)
+{
+    Synth::Random random(seed);
+
+    struct BigrpEntry
+    {
+        icelib::EntryCodec codec;
+        std::vector<uint8_t> data;
+    };
+    std::vector<BigrpEntry> entries;
+    entries.push_back({ icelib::EntryCodec::Range, {} });
+
+    for (int song = 0; song < kSongsPerBigrp; song++)
+    {
+        for (int track = 0; track < 8; track++)
+        {
+            const std::string sequenceName = Utils::str_format("song%02d%02d_%s", bigrpIndex, song, kTrackNames[track]);
+            entries.push_back({ icelib::EntryCodec::Midi, Synth::generate_midi(kNotesPerTrack, track, sequenceName, kTrackNames[track], random.next()) });
+        }
+    }
+
+    for (int s = 0; s < kSamplesPerBigrp; s++)
+    {
+        MemoryStore store;
+        if (!write_wav("sample.wav", get_random_length(random, 0.2, 0.6, 32000), 1, 32000, random.next(), &store))
+            return false;
+        entries.push_back({ icelib::EntryCodec::Data, std::vector<uint8_t>(store.data.begin(), store.data.end()) });
+    }
+
+    // Header, entry table, then the blobs (offsets are relative to their entry)
+    const size_t tableEnd = kBigrpHeadSize + entries.size() * kBigrpEntrySize;
+    std::vector<uint8_t> bigrp(tableEnd, 0);
+    auto put_u32 = [&](size_t offset, uint32_t value) { memcpy(bigrp.data() + offset, &value, sizeof(value)); };
+
+    put_u32(0x00, kBigrpHeadSize);
+    put_u32(0x04, kBigrpEntrySize);
+    put_u32(0x08, (uint32_t)entries.size());
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const size_t entryOffset = kBigrpHeadSize + i * kBigrpEntrySize;
+        put_u32(entryOffset + 0x08, (uint32_t)entries[i].codec);
+        if (entries[i].data.empty())
+            continue;
+
+        put_u32(entryOffset + 0x10, (uint32_t)(bigrp.size() - entryOffset));
+        put_u32(entryOffset + 0x14, (uint32_t)entries[i].data.size());
+        append(bigrp, entries[i].data.data(), entries[i].data.size());
+    }
+
+    return Utils::write_file(path, bigrp.data(), bigrp.size());
+}
+
+} // namespace
+
+bool generate(const std::string& folder, const Options& options)
+{
+    for (const char* subFolder : { kWvFolder, kWavFolder, kApcFolder, kLabFolder, kBigrpFolder })
+    {
+        std::error_code error;
+        fs::create_directories(fs::path(folder) / subFolder, error);
+        if (error)
+        {
+            std::cerr << "Could not create " << (fs::path(folder) / subFolder).string() << ": " << error.message() << "\n";
+            return false;
+        }
+    }
+
+    // Each file has its own seed, so that changing the scale doesn't change the files common to both scales
+    auto get_seed = [&](uint64_t kind, int index) { return options.seed * 1000003 + kind * 100000 + (uint64_t)index; };
+    IndyWV codec;
+    Utils::DiskStore diskStore;
+    bool bSuccess = true;
+
+    for (int i = 0; i < get_count(kNumMonoAdpcmFiles, options.scale); i++)
+        write_adpcm_wv(codec, get_path(folder, kWvFolder, Utils::str_format("mono_adpcm_%03d.wv", i)), get_random_length(get_seed(1, i), 1.0, 6.0, 22050), 1, 22050, get_seed(1, i), &diskStore);
+    for (int i = 0; i < get_count(kNumStereoAdpcmFiles, options.scale); i++)
+        write_adpcm_wv(codec, get_path(folder, kWvFolder, Utils::str_format("stereo_adpcm_%03d.wv", i)), get_random_length(get_seed(2, i), 1.0, 6.0, 22050), 2, 22050, get_seed(2, i), &diskStore);
+    for (int i = 0; i < get_count(kNumWvsmFiles, options.scale); i++)
+        write_wvsm_wv(codec, get_path(folder, kWvFolder, Utils::str_format("stereo_wvsm_%03d.wv", i)), get_random_length(get_seed(3, i), 2.0, 10.0, 22050), 22050, get_seed(3, i), &diskStore);
+
+    for (int i = 0; i < get_count(kNumWavFiles, options.scale); i++)
+        bSuccess &= write_wav(get_path(folder, kWavFolder, Utils::str_format("voice_%03d.wav", i)), get_random_length(get_seed(4, i), 1.0, 4.0, 22050), 1, 22050, get_seed(4, i), &diskStore);
+
+    for (int i = 0; i < get_count(kNumApcFiles, options.scale); i++)
+    {
+        for (uint16_t numChannels = 1; numChannels <= 2; numChannels++)
+        {
+            PcmFormat format;
+            format.numChannels = numChannels;
+            format.sampleRate = 22050;
+            const uint64_t seed = get_seed(4 + numChannels, i);
+            const uint32_t numFrames = get_random_length(seed, 2.0, 8.0, format.sampleRate);
+            const auto signal = Synth::generate_signal(numFrames, numChannels, format.sampleRate, seed);
+            const char* name = (numChannels == 1) ? "mono_%03d.apc" : "stereo_%03d.apc";
+            bSuccess &= CryoAPC::write_apc_file(get_path(folder, kApcFolder, Utils::str_format(name, i)), format, signal.data(), numFrames, &diskStore);
+        }
+    }
+
+    const int numLabEntries = get_count(kNumLabEntries, options.scale);
+    for (int firstEntry = 0, lab = 0; firstEntry < numLabEntries; firstEntry += kMaxEntriesPerLab, lab++)
+    {
+        const int numEntries = std::min(kMaxEntriesPerLab, numLabEntries - firstEntry);
+        bSuccess &= write_lab(codec, get_path(folder, kLabFolder, Utils::str_format("voice_%02d.lab", lab)), firstEntry, numEntries, get_seed(7, lab));
+    }
+
+    for (int i = 0; i < get_count(kNumBigrpFiles, options.scale); i++)
+        bSuccess &= write_bigrp(get_path(folder, kBigrpFolder, Utils::str_format("music_%02d.bigrp", i)), i, get_seed(8, i));
+
+    if (!bSuccess)
+    {
+        std::cerr << "Could not write the corpus into " << folder << "\n";
+        return false;
+    }
+
+    size_t numFiles = 0;
+    uint64_t totalSize = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(folder))
+    {
+        if (entry.is_regular_file())
+        {
+            numFiles++;
+            totalSize += entry.file_size();
+        }
+    }
+    std::cout << Utils::str_format("Corpus: %zu file(s), %.1f MB (%d LAB entries) in %s\n", numFiles, totalSize / 1e6, numLabEntries, folder.c_str());
+    return true;
+}
+
+} // namespace Corpus
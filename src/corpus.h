@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Corpus {
+
+//-----------------------------------------------------------------------------
+// Generator of a synthetic test corpus (-gen_corpus), written with the
+// project's own encoders and writers from seeded signals and MIDI sequences:
+//   wv/    mono and stereo ADPCM and WVSM INDYWV files
+//   wav/   mono 16-bit WAV files (for the WAV to INDYWV path)
+//   apc/   mono and stereo CRYO APC files
+//   lab/   LAB archives of thousands of short ADPCM entries
+//   bigrp/ BIGRP files of 8-track MIDI songs and embedded WAV samples
+// The same seed and scale always give the same files.
+//-----------------------------------------------------------------------------
+
+struct Options
+{
+    double scale = 1.0; // multiplies the number of files and LAB entries
+    uint64_t seed = 1;
+};
+
+// Subfolders of the corpus
+constexpr const char* kWvFolder = "wv";
+constexpr const char* kWavFolder = "wav";
+constexpr const char* kApcFolder = "apc";
+constexpr const char* kLabFolder = "lab";
+constexpr const char* kBigrpFolder = "bigrp";
+
+bool generate(const std::string& folder, const Options& options);
+
+} // namespace Corpus
@@ -0,0 +1,178 @@
+#include "counters.h"
+
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Counters {
+
+namespace Detail {
+    std::atomic<bool> bEnabled(false);
+}
+
+namespace {
+
+const char* kEventNames[kNumEvents] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+
+// Bit mask of the events opened by enable()
+std::atomic<uint32_t> availableEvents(0);
+
+#if defined(__linux__)
+
+struct EventConfig
+{
+    uint32_t type;
+    uint64_t config;
+};
+
+const EventConfig kEventConfigs[kNumEvents] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+int open_event(const EventConfig& config, int groupFd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = config.type;
+    attr.config = config.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+//-----------------------------------------------------------------------------
+// The counters of one thread, in a single group (cycles leading it) so that
+// they are scheduled together and read with one system call. Events the CPU
+// doesn't have are left out of the group.
+//-----------------------------------------------------------------------------
+class ThreadCounters
+{
+public:
+    ThreadCounters()
+    {
+        for (size_t e = 0; e < kNumEvents; e++)
+        {
+            const int fd = open_event(kEventConfigs[e], numOpened > 0 ? fds[0] : -1);
+            if (fd < 0)
+            {
+                if (numOpened == 0)
+                {
+                    error = errno;
+                    return;
+                }
+                continue;
+            }
+            fds[numOpened] = fd;
+            events[numOpened] = (EEvent)e;
+            eventMask |= 1u << e;
+            numOpened++;
+        }
+    }
+
+    ~ThreadCounters()
+    {
+        for (size_t i = 0; i < numOpened; i++)
+            close(fds[i]);
+    }
+
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+    bool read(Values& outValues) const
+    {
+        if (numOpened == 0)
+            return false;
+
+        // Number of events, then their values in the order they joined the group
+        uint64_t buffer[1 + kNumEvents];
+        const ssize_t size = ::read(fds[0], buffer, sizeof(buffer));
+        if (size < (ssize_t)sizeof(uint64_t) || buffer[0] != numOpened)
+            return false;
+
+        memset(outValues, 0, sizeof(Values));
+        for (size_t i = 0; i < numOpened; i++)
+            outValues[(size_t)events[i]] = buffer[1 + i];
+        return true;
+    }
+
+    bool is_open() const { return numOpened > 0; }
+    int get_error() const { return error; }
+    uint32_t get_event_mask() const { return eventMask; }
+
+private:
+    int fds[kNumEvents] = {};
+    EEvent events[kNumEvents] = {};
+    size_t numOpened = 0;
+    uint32_t eventMask = 0;
+    int error = 0;
+};
+
+ThreadCounters& get_thread_counters()
+{
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+#endif // __linux__
+
+} // namespace
+
+bool enable()
+{
+#if defined(__linux__)
+    const ThreadCounters& counters = get_thread_counters();
+    if (!counters.is_open())
+    {
+        std::cerr << "Hardware counters not available (" << strerror(counters.get_error())
+            << "; check /proc/sys/kernel/perf_event_paranoid, or the container's perf access): running without them\n";
+        return false;
+    }
+
+    availableEvents.store(counters.get_event_mask());
+    for (size_t e = 0; e < kNumEvents; e++)
+    {
+        if (!is_available((EEvent)e))
+            std::cerr << "Hardware counter " << kEventNames[e] << " not available on this CPU\n";
+    }
+
+    Detail::bEnabled.store(true);
+    return true;
+#else
+    std::cerr << "Hardware counters are only supported on Linux: running without them\n";
+    return false;
+#endif
+}
+
+bool read(Values& outValues)
+{
+#if defined(__linux__)
+    return get_thread_counters().read(outValues);
+#else
+    (void)outValues;
+    return false;
+#endif
+}
+
+bool is_available(EEvent event)
+{
+    return (availableEvents.load() & (1u << (size_t)event)) != 0;
+}
+
+const char* get_name(EEvent event)
+{
+    return kEventNames[(size_t)event];
+}
+
+} // namespace Counters
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Counters {
+
+//-----------------------------------------------------------------------------
+// Hardware performance counters of the calling thread (-counters), read at
+// the boundaries of the Stats timers so that each stage of each format gets
+// its cycles, instructions and misses. Linux only (perf_event_open, user
+// space only, as allowed by the default perf_event_paranoid); each thread
+// opens its own counters on first use. When they can't be opened (other
+// systems, containers without perf access, virtual machines without a PMU),
+// enable() says so and everything runs without them.
+//-----------------------------------------------------------------------------
+
+enum class EEvent : uint8_t
+{
+    Cycles,
+    Instructions,
+    BranchMisses,
+    L1DMisses,   // L1 data cache read misses
+    LLCMisses,   // last level cache misses
+    Count
+};
+
+constexpr size_t kNumEvents = (size_t)EEvent::Count;
+
+using Values = uint64_t[kNumEvents];
+
+namespace Detail {
+    extern std::atomic<bool> bEnabled;
+}
+
+// Opens the counters of the calling thread; returns false (with the reason on stderr) if they are not available.
+// Once enabled, the counters are read by the Stats timers of every thread in the process.
+bool enable();
+inline bool is_enabled() { return Detail::bEnabled.load(std::memory_order_relaxed); }
+
+// Current values for the calling thread (opening its counters if needed). The events
+// the CPU doesn't have stay at 0. Returns false if the thread has no counters.
+bool read(Values& outValues);
+
+// Whether the event could be opened (on the thread that called enable())
+bool is_available(EEvent event);
+
+const char* get_name(EEvent event);
+
+} // namespace Counters
@@ -0,0 +1,408 @@
+#include "file_utils.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "stats.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Utils
+{
+    bool read_stats(const std::string& path, uint64_t& size, int64_t& mtime)
+    {
+        std::error_code error;
+        size = std::filesystem::file_size(path, error);
+        if (error)
+            return false;
+
+        auto time = std::filesystem::last_write_time(path, error);
+        if (error)
+            return false;
+
+        mtime = (int64_t)time.time_since_epoch().count();
+        return true;
+    }
+
+    bool write_file(const std::string& path, const void* pData, size_t size)
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Write);
+
+        std::ofstream os(path, std::ofstream::binary);
+        os.write(static_cast<const char*>(pData), size);
+        return os.good();
+    }
+
+    bool FileStream::open(const std::string& path)
+    {
+        // Unbuffered: the callers write large blocks
+        os.rdbuf()->pubsetbuf(nullptr, 0);
+        os.open(path, std::ofstream::binary | std::ofstream::trunc);
+        filePos = 0;
+        return os.is_open();
+    }
+
+    bool FileStream::write(const void* pData, size_t size)
+    {
+        os.write(static_cast<const char*>(pData), size);
+        filePos += size;
+        return os.good();
+    }
+
+    bool FileStream::write_at(uint64_t offset, const void* pData, size_t size)
+    {
+        os.seekp((std::streamoff)offset, std::ios::beg);
+        os.write(static_cast<const char*>(pData), size);
+        os.seekp((std::streamoff)filePos, std::ios::beg);
+        return os.good();
+    }
+
+    bool FileStream::close()
+    {
+        if (!os.is_open())
+            return false;
+        os.close();
+        return !os.fail();
+    }
+
+    bool DiskStore::store(const std::string& path, std::vector<char>&& data)
+    {
+        return write_file(path, data.data(), data.size());
+    }
+
+    std::unique_ptr<OutputStream> DiskStore::open_stream(const std::string& path)
+    {
+        auto file = std::make_unique<FileStream>();
+        if (!file->open(path))
+            return nullptr;
+
+        return file;
+    }
+
+#ifdef _WIN32
+    bool read_file(const std::string& path, std::vector<uint8_t>& outData, size_t maxSize)
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Read);
+        outData.clear();
+
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || (uint64_t)fileSize.QuadPart > maxSize)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        outData.resize(static_cast<size_t>(fileSize.QuadPart));
+        size_t offset = 0;
+        while (offset < outData.size())
+        {
+            DWORD toRead = (DWORD)std::min<size_t>(outData.size() - offset, 1u << 30);
+            DWORD bytesRead = 0;
+            if (!ReadFile(file, outData.data() + offset, toRead, &bytesRead, nullptr) || bytesRead == 0)
+                break;
+            offset += bytesRead;
+        }
+
+        CloseHandle(file);
+        if (offset != outData.size())
+        {
+            outData.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        hFile = file;
+        dataSize = static_cast<size_t>(fileSize.QuadPart);
+        bOpen = true;
+
+        // Empty files can't be mapped, but are still valid (and empty) inputs
+        if (dataSize == 0)
+            return true;
+
+        hMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMapping)
+            pData = static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+
+        if (!pData)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (pData)
+            UnmapViewOfFile(pData);
+        if (hMapping)
+            CloseHandle(hMapping);
+        if (hFile)
+            CloseHandle(hFile);
+
+        pData = nullptr;
+        hMapping = hFile = nullptr;
+        dataSize = 0;
+        bOpen = false;
+    }
+
+    bool MappedOutputFile::open(const std::string& path, size_t initialSize)
+    {
+        close(0);
+
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        hFile = file;
+        if (!map(std::max<size_t>(initialSize, 1)))
+        {
+            close(0);
+            return false;
+        }
+        return true;
+    }
+
+    bool MappedOutputFile::map(size_t size)
+    {
+        // Creating a mapping larger than the file extends (preallocates) the file
+        LARGE_INTEGER mappingSize;
+        mappingSize.QuadPart = (LONGLONG)size;
+        hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, nullptr);
+        if (!hMapping)
+            return false;
+
+        pData = static_cast<uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, size));
+        if (!pData)
+        {
+            CloseHandle(hMapping);
+            hMapping = nullptr;
+            return false;
+        }
+
+        dataSize = size;
+        return true;
+    }
+
+    void MappedOutputFile::unmap()
+    {
+        if (pData)
+            UnmapViewOfFile(pData);
+        if (hMapping)
+            CloseHandle(hMapping);
+
+        pData = nullptr;
+        hMapping = nullptr;
+        dataSize = 0;
+    }
+
+    bool MappedOutputFile::resize(size_t newSize)
+    {
+        if (!hFile)
+            return false;
+
+        unmap();
+        return map(newSize);
+    }
+
+    bool MappedOutputFile::close(size_t finalSize)
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Write);
+        if (!hFile)
+            return false;
+
+        Stats::add(Stats::ECounter::BytesOut, finalSize);
+
+        unmap();
+
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)finalSize;
+        bool bSuccess = SetFilePointerEx(hFile, size, nullptr, FILE_BEGIN) && SetEndOfFile(hFile);
+
+        CloseHandle(hFile);
+        hFile = nullptr;
+        return bSuccess;
+    }
+#else
+    bool read_file(const std::string& path, std::vector<uint8_t>& outData, size_t maxSize)
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Read);
+        outData.clear();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > maxSize)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        outData.resize(static_cast<size_t>(st.st_size));
+        size_t offset = 0;
+        while (offset < outData.size())
+        {
+            ssize_t bytesRead = pread(fd, outData.data() + offset, outData.size() - offset, (off_t)offset);
+            if (bytesRead <= 0)
+                break;
+            offset += (size_t)bytesRead;
+        }
+
+        ::close(fd);
+        if (offset != outData.size())
+        {
+            outData.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        dataSize = static_cast<size_t>(st.st_size);
+        bOpen = true;
+
+        if (dataSize > 0)
+        {
+            void* mapping = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::close(fd);
+                close();
+                return false;
+            }
+            madvise(mapping, dataSize, MADV_SEQUENTIAL);
+            pData = static_cast<const uint8_t*>(mapping);
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        ::close(fd);
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (pData)
+            munmap(const_cast<uint8_t*>(pData), dataSize);
+
+        pData = nullptr;
+        dataSize = 0;
+        bOpen = false;
+    }
+
+    bool MappedOutputFile::open(const std::string& path, size_t initialSize)
+    {
+        close(0);
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        if (!map(std::max<size_t>(initialSize, 1)))
+        {
+            close(0);
+            return false;
+        }
+        return true;
+    }
+
+    bool MappedOutputFile::map(size_t size)
+    {
+        // Reserve the blocks up front so that page faults on the mapping never hit ENOSPC
+#ifdef __linux__
+        if (fallocate(fd, 0, 0, (off_t)size) != 0 && ftruncate(fd, (off_t)size) != 0)
+            return false;
+#else
+        if (ftruncate(fd, (off_t)size) != 0)
+            return false;
+#endif
+
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        pData = static_cast<uint8_t*>(mapping);
+        dataSize = size;
+        return true;
+    }
+
+    void MappedOutputFile::unmap()
+    {
+        if (pData)
+            munmap(pData, dataSize);
+
+        pData = nullptr;
+        dataSize = 0;
+    }
+
+    bool MappedOutputFile::resize(size_t newSize)
+    {
+        if (fd < 0)
+            return false;
+
+        unmap();
+        return map(newSize);
+    }
+
+    bool MappedOutputFile::close(size_t finalSize)
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Write);
+        if (fd < 0)
+            return false;
+
+        Stats::add(Stats::ECounter::BytesOut, finalSize);
+
+        unmap();
+        bool bSuccess = ftruncate(fd, (off_t)finalSize) == 0;
+
+        ::close(fd);
+        fd = -1;
+        return bSuccess;
+    }
+#endif
+
+} // namespace Utils
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+//-----------------------------------------------------------------------------
+// File system access of the converter: input mappings, output files on disk.
+// Not part of the MiscAudioCodecs library, which only goes through memory and
+// Utils::FileStore.
+//-----------------------------------------------------------------------------
+namespace Utils
+{
+    // Size and modification time of a file (as a count of clock ticks), false if it can't be read
+    bool read_stats(const std::string& path, uint64_t& size, int64_t& mtime);
+
+    // Reads a whole file into memory. Fails (leaving outData empty) if the file is larger than maxSize.
+    bool read_file(const std::string& path, std::vector<uint8_t>& outData, size_t maxSize = SIZE_MAX);
+
+    // Writes a whole file. Converted outputs are counted in the BytesOut stat by the
+    // OutputFile or store_file() handing them to a store, not here.
+    bool write_file(const std::string& path, const void* pData, size_t size);
+
+    // Read-only memory mapping of a whole file. The mapping is released on destruction.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const std::string& path) { open(path); }
+        ~MappedFile() { close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+
+        bool is_open() const { return bOpen; }
+        const uint8_t* data() const { return pData; }
+        size_t size() const { return dataSize; }
+
+    private:
+        const uint8_t* pData = nullptr;
+        size_t dataSize = 0;
+        bool bOpen = false;
+#ifdef _WIN32
+        void* hFile = nullptr;
+        void* hMapping = nullptr;
+#endif
+    };
+
+    // Read-write shared memory mapping of a newly created output file.
+    // The file is preallocated to the mapped size and truncated to its final size on close.
+    class MappedOutputFile
+    {
+    public:
+        MappedOutputFile() = default;
+        ~MappedOutputFile() { close(0); }
+
+        MappedOutputFile(const MappedOutputFile&) = delete;
+        MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+        bool open(const std::string& path, size_t initialSize);
+        bool resize(size_t newSize);
+        bool close(size_t finalSize);
+
+        bool is_open() const { return pData != nullptr; }
+        uint8_t* data() const { return pData; }
+        size_t size() const { return dataSize; }
+
+    private:
+        bool map(size_t size);
+        void unmap();
+
+        uint8_t* pData = nullptr;
+        size_t dataSize = 0;
+#ifdef _WIN32
+        void* hFile = nullptr;
+        void* hMapping = nullptr;
+#else
+        int fd = -1;
+#endif
+    };
+
+    // Unbuffered binary file on disk
+    class FileStream : public OutputStream
+    {
+    public:
+        bool open(const std::string& path);
+
+        bool write(const void* pData, size_t size) override;
+        bool write_at(uint64_t offset, const void* pData, size_t size) override;
+        bool close() override;
+
+    private:
+        std::ofstream os;
+        uint64_t filePos = 0;
+    };
+
+    // Writes files straight to the disk (no temporary file): the store used when outputs are neither queued nor archived
+    class DiskStore : public FileStore
+    {
+    public:
+        bool store(const std::string& path, std::vector<char>&& data) override;
+        std::unique_ptr<OutputStream> open_stream(const std::string& path) override;
+        bool allow_direct_write(const std::string&) override { return true; }
+    };
+
+} // namespace Utils
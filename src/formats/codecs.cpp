@@ -0,0 +1,333 @@
+#include "codecs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "cryo_apc.h"
+#include "indywv.h"
+#include "utils.h"
+#include "wave.h"
+
+namespace Codecs {
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Hands the files the converters store to a FileCallback, by file name only
+// (the converters name them inside an output folder).
+//-----------------------------------------------------------------------------
+class CallbackStore : public Utils::FileStore
+{
+public:
+    explicit CallbackStore(const FileCallback& in_onFile) : onFile(in_onFile) {}
+
+    bool store(const std::string& path, std::vector<char>&& data) override
+    {
+        const std::string name = path.substr(path.find_last_of("/\\") + 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        numFiles++;
+        if (onFile(name, std::move(data)))
+            return true;
+        bFailed = true;
+        return false;
+    }
+
+    size_t get_num_files() const { return numFiles; }
+    bool has_failed() const { return bFailed; }
+
+private:
+    const FileCallback& onFile;
+    std::mutex mutex;
+    size_t numFiles = 0;
+    bool bFailed = false;
+};
+
+} // namespace
+
+EFileType detect(const uint8_t* pData, size_t size)
+{
+    char header[8] = {};
+    memcpy(header, pData, std::min(size, sizeof(header)));
+
+    if (strncmp(header, LABN::kLABNId, sizeof(LABN::kLABNId)) == 0)
+    {
+        return EFileType::LABN;
+    }
+    else if (strncmp(header, IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV)) == 0)
+    {
+        return EFileType::IndyWV;
+    }
+    else if (strncmp(header, Wave::kRIFF, sizeof(Wave::kRIFF)) == 0)
+    {
+        return EFileType::Wave;
+    }
+    else if (strncmp(header, CryoAPC::kAPCTag, sizeof(CryoAPC::kAPCTag)) == 0)
+    {
+        return EFileType::CryoAPC;
+    }
+    else if (strncmp(header, Inti::kBigrpTag, sizeof(Inti::kBigrpTag)) == 0)
+    {
+        return EFileType::IntiBigrp;
+    }
+
+    return EFileType::Unknown;
+}
+
+const char* get_type_name(EFileType fileType)
+{
+    switch (fileType)
+    {
+    case EFileType::IndyWV: return "IndyWV";
+    case EFileType::LABN: return "LABN";
+    case EFileType::Wave: return "Wave";
+    case EFileType::CryoAPC: return "CryoAPC";
+    case EFileType::IntiBigrp: return "IntiBigrp";
+    default: return "Unknown";
+    }
+}
+
+bool get_pcm_info(const uint8_t* pData, size_t size, PcmFormat& outFormat, uint64_t& outDataSize)
+{
+    switch (detect(pData, size))
+    {
+    case EFileType::IndyWV:
+    {
+        if (size < sizeof(IndyWVHeader))
+            return false;
+
+        const auto* header = reinterpret_cast<const IndyWVHeader*>(pData);
+        outFormat = PcmFormat();
+        outFormat.numChannels = (uint16_t)header->numChannels;
+        outFormat.sampleRate = header->sampleRate;
+        outFormat.bitSize = (uint16_t)header->sampleBitSize;
+        outDataSize = (uint32_t)header->decompressedSize;
+        return true;
+    }
+    case EFileType::CryoAPC:
+    {
+        uint64_t numFrames = 0;
+        if (!CryoAPC::read_header(pData, size, outFormat, numFrames))
+            return false;
+        outDataSize = numFrames * outFormat.block_align();
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool decode(const uint8_t* pData, size_t size, PcmSink& sink)
+{
+    switch (detect(pData, size))
+    {
+    case EFileType::IndyWV: return IndyWV().decode(pData, size, sink);
+    case EFileType::CryoAPC: return CryoAPC::decode(pData, size, sink);
+    default: return false;
+    }
+}
+
+EFileType StreamReader::detect()
+{
+    constexpr size_t kDetectSize = 8;
+    while (prefix.size() < kDetectSize)
+    {
+        uint8_t buffer[kDetectSize];
+        const size_t sizeRead = readFunction(buffer, kDetectSize - prefix.size());
+        if (sizeRead == 0)
+            break;
+        prefix.insert(prefix.end(), buffer, buffer + sizeRead);
+    }
+
+    return Codecs::detect(prefix.data() + prefixPos, prefix.size() - prefixPos);
+}
+
+size_t StreamReader::read(void* pBuffer, size_t size)
+{
+    size_t totalRead = std::min(size, prefix.size() - prefixPos);
+    memcpy(pBuffer, prefix.data() + prefixPos, totalRead);
+    prefixPos += totalRead;
+
+    while (totalRead < size)
+    {
+        const size_t sizeRead = readFunction((char*)pBuffer + totalRead, size - totalRead);
+        if (sizeRead == 0)
+            break;
+        totalRead += sizeRead;
+    }
+    return totalRead;
+}
+
+void StreamReader::read_all(std::vector<uint8_t>& outData)
+{
+    constexpr size_t kReadSize = 1 << 20;
+    outData.clear();
+    for (;;)
+    {
+        const size_t size = outData.size();
+        outData.resize(size + kReadSize);
+        const size_t sizeRead = read(outData.data() + size, kReadSize);
+        outData.resize(size + sizeRead);
+        if (sizeRead < kReadSize)
+            break;
+    }
+}
+
+bool decode(StreamReader& stream, PcmSink& sink)
+{
+    switch (stream.detect())
+    {
+    case EFileType::IndyWV:
+    {
+        // The decoder needs the whole compressed stream (stereo ADPCM stores one channel after the other)
+        std::vector<uint8_t> data(sizeof(IndyWVHeader));
+        if (stream.read(data.data(), data.size()) != data.size())
+            return false;
+
+        // Read by pieces, so that a bogus size in the header only costs what the stream really holds
+        constexpr size_t kReadSize = 1 << 20;
+        size_t remainingSize = reinterpret_cast<const IndyWVHeader*>(data.data())->dataSize;
+        while (remainingSize)
+        {
+            const size_t size = data.size();
+            const size_t pieceSize = std::min(remainingSize, kReadSize);
+            data.resize(size + pieceSize);
+            const size_t sizeRead = stream.read(data.data() + size, pieceSize);
+            data.resize(size + sizeRead);
+            if (sizeRead < pieceSize)
+                break;
+            remainingSize -= pieceSize;
+        }
+        return IndyWV().decode(data.data(), data.size(), sink);
+    }
+    case EFileType::CryoAPC:
+    {
+        uint8_t header[CryoAPC::StreamDecoder::kHeaderSize];
+        if (stream.read(header, sizeof(header)) != sizeof(header))
+            return false;
+
+        CryoAPC::StreamDecoder decoder;
+        if (!decoder.begin(header, sink))
+            return false;
+
+        constexpr size_t kReadSize = 64 * 1024;
+        std::vector<uint8_t> buffer(kReadSize);
+        for (size_t sizeRead; (sizeRead = stream.read(buffer.data(), buffer.size())) > 0;)
+            decoder.push(buffer.data(), sizeRead);
+        return decoder.end();
+    }
+    default:
+        return false;
+    }
+}
+
+bool decode_to_wav(const uint8_t* pData, size_t size, std::vector<char>& outWav)
+{
+    bool bStored = false;
+    FileCallback onFile = [&](const std::string&, std::vector<char>&& data)
+    {
+        outWav = std::move(data);
+        bStored = true;
+        return true;
+    };
+
+    CallbackStore store(onFile);
+    Wave::Writer writer("decoded.wav", &store);
+    return decode(pData, size, writer) && bStored;
+}
+
+bool decode_lab(const uint8_t* pData, size_t size, const LABN::SinkFactory& createSink)
+{
+    if (detect(pData, size) != EFileType::LABN)
+        return false;
+
+    return LABN::decompress("LAB", pData, size, createSink);
+}
+
+bool encode_wv(const std::string& name, const uint8_t* pWavData, size_t wavSize, const FileCallback& onFile)
+{
+    if (detect(pWavData, wavSize) != EFileType::Wave)
+        return false;
+
+    CallbackStore store(onFile);
+    std::string outPath = name + ".wv";
+    IndyWV().wav_to_wv(pWavData, wavSize, outPath, &store);
+    return store.get_num_files() == 1 && !store.has_failed();
+}
+
+bool transcode_to_wv(const std::string& name, const uint8_t* pData, size_t size, const FileCallback& onFile)
+{
+    CallbackStore store(onFile);
+    IndyWV::Writer writer(name + ".wv", &store);
+    return decode(pData, size, writer) && store.get_num_files() == 1 && !store.has_failed();
+}
+
+bool convert_bigrp(const std::string& name, const uint8_t* pData, size_t size, const Inti::BigrpOptions& options, const FileCallback& onFile)
+{
+    if (detect(pData, size) != EFileType::IntiBigrp)
+        return false;
+
+    CallbackStore store(onFile);
+    Inti::BigrpOptions storeOptions = options;
+    storeOptions.pStore = &store;
+    const bool bConverted = Inti::bigrp_to_midi(name, pData, size, std::string(), storeOptions);
+    return bConverted && !store.has_failed();
+}
+
+bool BufferSink::begin(const PcmFormat& in_format, uint64_t)
+{
+    format = in_format;
+    dataSize = 0;
+    return true;
+}
+
+char* BufferSink::reserve(size_t size)
+{
+    bOverflowReserved = (dataSize + size > capacity);
+    if (!bOverflowReserved)
+        return pBuffer + dataSize;
+
+    if (overflow.size() < size)
+        overflow.resize(size);
+    return overflow.data();
+}
+
+void BufferSink::commit(size_t size)
+{
+    if (bOverflowReserved && dataSize < capacity)
+        memcpy(pBuffer + dataSize, overflow.data(), capacity - (size_t)dataSize);
+    dataSize += size;
+}
+
+bool BufferSink::end()
+{
+    return !is_truncated();
+}
+
+bool CallbackSink::begin(const PcmFormat& in_format, uint64_t)
+{
+    format = in_format;
+    bStopped = false;
+    return true;
+}
+
+char* CallbackSink::reserve(size_t size)
+{
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return buffer.data();
+}
+
+void CallbackSink::commit(size_t size)
+{
+    if (!bStopped && size > 0)
+        bStopped = !callback(format, buffer.data(), size);
+}
+
+bool CallbackSink::end()
+{
+    return !bStopped;
+}
+
+} // namespace Codecs
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "inti_bigrp.h"
+#include "labn.h"
+#include "pcm_sink.h"
+
+//-----------------------------------------------------------------------------
+// API of the MiscAudioCodecs static library, for applications embedding the
+// codecs (e.g. a server decoding request buffers): every conversion goes from
+// memory to memory. Inputs are spans of bytes (or a StreamReader for WV and
+// APC data coming from a pipe); decoded PCM goes to a PcmSink
+// (see BufferSink and CallbackSink below) and whole output files (encoded WV,
+// BIGRP MIDI/SF2) to a FileCallback or a Utils::FileStore. Nothing in the
+// library touches the filesystem: reading and writing files is left to the
+// application. Tables are built once and read-only afterwards, so all the
+// functions can be called from any number of threads. The only mutable state
+// is process-wide and owned by the application: the ISA forced with
+// CpuDispatch::select, and the Stats/Trace/Counters instrumentation (off
+// unless enabled).
+//-----------------------------------------------------------------------------
+
+namespace Codecs {
+
+// Format of a file from its first bytes, Unknown if it isn't handled
+EFileType detect(const uint8_t* pData, size_t size);
+
+const char* get_type_name(EFileType fileType);
+
+// Format and size of the PCM data decode() produces from a WV or APC file, to size a BufferSink up front
+bool get_pcm_info(const uint8_t* pData, size_t size, PcmFormat& outFormat, uint64_t& outDataSize);
+
+// Decodes a whole WV or APC file into the sink
+bool decode(const uint8_t* pData, size_t size, PcmSink& sink);
+
+// Pulls up to 'size' bytes of a stream into pBuffer; returns the number of bytes read, 0 at its end
+using ReadFunction = std::function<size_t(void* pBuffer, size_t size)>;
+
+//-----------------------------------------------------------------------------
+// Input read once from start to end, without seeking (e.g. a pipe). Its
+// format is detected from the first bytes, which are kept for the decoder.
+//-----------------------------------------------------------------------------
+class StreamReader
+{
+public:
+    explicit StreamReader(ReadFunction in_readFunction) : readFunction(std::move(in_readFunction)) {}
+
+    EFileType detect();
+
+    // Reads 'size' bytes, or fewer at the end of the stream; returns the number read
+    size_t read(void* pBuffer, size_t size);
+
+    // Reads the rest of the stream
+    void read_all(std::vector<uint8_t>& outData);
+
+private:
+    ReadFunction readFunction;
+    std::vector<uint8_t> prefix;
+    size_t prefixPos = 0;
+};
+
+// Decodes a WV or APC stream into the sink in a single pass: APC data is decoded as it
+// is read, WV data once its compressed stream (sized by the header) has been read
+bool decode(StreamReader& stream, PcmSink& sink);
+
+// Decodes a whole WV or APC file into a .wav file in memory
+bool decode_to_wav(const uint8_t* pData, size_t size, std::vector<char>& outWav);
+
+// Decodes the WV entries of a LAB archive, each into the sink created for its name (entries with no sink are skipped)
+bool decode_lab(const uint8_t* pData, size_t size, const LABN::SinkFactory& createSink);
+
+// Receives a whole output file: its name (without folder) and content. Returns false on failure.
+using FileCallback = std::function<bool(const std::string& name, std::vector<char>&& data)>;
+
+// Encodes a mono .wav file into "<name>.wv"
+bool encode_wv(const std::string& name, const uint8_t* pWavData, size_t wavSize, const FileCallback& onFile);
+
+// Transcodes a mono WV or APC file into "<name>.wv": the PCM goes from the decoder to the encoder chunk by chunk
+bool transcode_to_wv(const std::string& name, const uint8_t* pData, size_t size, const FileCallback& onFile);
+
+// Converts a BIGRP file into MIDI files and a SoundFont, named after 'name' (the BIGRP file
+// name, which also selects the song mappings of options.game). options.pStore is ignored.
+bool convert_bigrp(const std::string& name, const uint8_t* pData, size_t size, const Inti::BigrpOptions& options, const FileCallback& onFile);
+
+//-----------------------------------------------------------------------------
+// Sink decoding into a buffer owned by the caller. Data past its capacity is
+// dropped and end() fails; get_size() then tells the capacity that was needed.
+//-----------------------------------------------------------------------------
+class BufferSink : public PcmSink
+{
+public:
+    BufferSink(void* in_pBuffer, size_t in_capacity) : pBuffer((char*)in_pBuffer), capacity(in_capacity) {}
+
+    bool begin(const PcmFormat& in_format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+    const PcmFormat& get_format() const { return format; }
+
+    // Size of the decoded data, including what didn't fit
+    uint64_t get_size() const { return dataSize; }
+    bool is_truncated() const { return dataSize > capacity; }
+
+private:
+    char* const pBuffer;
+    const size_t capacity;
+    PcmFormat format;
+    uint64_t dataSize = 0;
+
+    // Where chunks not fitting in the buffer are decoded
+    std::vector<char> overflow;
+    bool bOverflowReserved = false;
+};
+
+//-----------------------------------------------------------------------------
+// Sink handing the decoded PCM to a callback, chunk by chunk as the decoder
+// produces it.
+//-----------------------------------------------------------------------------
+class CallbackSink : public PcmSink
+{
+public:
+    // Returns false to stop: the following chunks are dropped and end() fails
+    using Callback = std::function<bool(const PcmFormat& format, const char* pData, size_t size)>;
+
+    explicit CallbackSink(Callback in_callback) : callback(std::move(in_callback)) {}
+
+    bool begin(const PcmFormat& in_format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    const Callback callback;
+    PcmFormat format;
+    std::vector<char> buffer;
+    bool bStopped = false;
+};
+
+} // namespace Codecs
@@ -0,0 +1,134 @@
+#include "cpu_dispatch.h"
+
+#include <atomic>
+#include <iostream>
+
+#include "utils.h"
+
+#if defined(CPU_DISPATCH_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace CpuDispatch {
+
+namespace {
+
+const char* kIsaNames[kNumIsas] = { "scalar", "sse4.1", "avx2", "avx512" };
+
+#if defined(CPU_DISPATCH_X86)
+
+void cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t (&outRegisters)[4])
+{
+#if defined(_MSC_VER)
+    int registers[4];
+    __cpuidex(registers, (int)leaf, (int)subLeaf);
+    for (int i = 0; i < 4; i++)
+        outRegisters[i] = (uint32_t)registers[i];
+#else
+    __cpuid_count(leaf, subLeaf, outRegisters[0], outRegisters[1], outRegisters[2], outRegisters[3]);
+#endif
+}
+
+// Register states the OS saves on context switches
+uint64_t get_enabled_states()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+EIsa detect_x86()
+{
+    uint32_t registers[4];
+    cpuid(0, 0, registers);
+    const uint32_t maxLeaf = registers[0];
+    if (maxLeaf < 1)
+        return EIsa::Scalar;
+
+    cpuid(1, 0, registers);
+    const uint32_t features = registers[2];
+    const bool bSSE41 = (features & (1u << 19)) && (features & (1u << 9)); // + SSSE3
+    if (!bSSE41)
+        return EIsa::Scalar;
+
+    const bool bOsxsave = (features & (1u << 27)) != 0;
+    const bool bAvx = (features & (1u << 28)) != 0;
+    if (!bOsxsave || !bAvx || maxLeaf < 7)
+        return EIsa::SSE41;
+
+    const uint64_t states = get_enabled_states();
+    const bool bYmmEnabled = (states & 0x6) == 0x6;                // XMM, YMM
+    const bool bZmmEnabled = (states & 0xE6) == 0xE6;              // + opmask, ZMM
+    cpuid(7, 0, registers);
+    const bool bAvx2 = bYmmEnabled && (registers[1] & (1u << 5));
+    const bool bAvx512 = bZmmEnabled && (registers[1] & (1u << 16)) && (registers[1] & (1u << 30)); // F, BW
+
+    if (bAvx2 && bAvx512)
+        return EIsa::AVX512;
+    return bAvx2 ? EIsa::AVX2 : EIsa::SSE41;
+}
+
+#endif // CPU_DISPATCH_X86
+
+std::atomic<EIsa>& get_selected_isa()
+{
+    static std::atomic<EIsa> selectedIsa(detect());
+    return selectedIsa;
+}
+
+} // namespace
+
+EIsa detect()
+{
+#if defined(CPU_DISPATCH_X86)
+    static const EIsa detectedIsa = detect_x86();
+    return detectedIsa;
+#else
+    return EIsa::Scalar;
+#endif
+}
+
+EIsa get_isa()
+{
+    return get_selected_isa().load(std::memory_order_relaxed);
+}
+
+bool select(EIsa isa)
+{
+    if (isa > detect())
+    {
+        std::cerr << "This CPU doesn't support " << get_name(isa) << " (best: " << get_name(detect()) << ")\n";
+        return false;
+    }
+    get_selected_isa().store(isa);
+    return true;
+}
+
+const char* get_name(EIsa isa)
+{
+    return (isa < EIsa::Count) ? kIsaNames[(size_t)isa] : "unknown";
+}
+
+bool find_isa_from_name(const std::string& name, EIsa& outIsa)
+{
+    const std::string lowerName = Utils::str_to_lower(name);
+    for (size_t i = 0; i < kNumIsas; i++)
+    {
+        if (lowerName == kIsaNames[i])
+        {
+            outIsa = (EIsa)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace CpuDispatch
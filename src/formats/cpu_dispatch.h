@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//-----------------------------------------------------------------------------
+// Runtime selection of the vectorized kernels (WVSM expansion, sample format
+// conversions, stereo deinterleave, resampler dot product), so that a single
+// binary runs on any x86-64 CPU and uses the widest instruction set it has.
+// Each kernel lists one variant per ISA (nullptr where it has none); callers
+// bind the variant of the selected ISA, or of the closest one below it, when
+// they start working.
+// The ISA is detected on first use; -isa forces a lower one for testing and
+// benchmarking. All the variants of a kernel give bit-identical results
+// (checked by MiscAudioVerify).
+//-----------------------------------------------------------------------------
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_DISPATCH_X86 1
+#endif
+
+// Variants are compiled for their ISA whatever the flags of the translation unit
+// (MSVC accepts the intrinsics of any ISA without flags)
+#if defined(CPU_DISPATCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+namespace CpuDispatch {
+
+enum class EIsa : uint8_t
+{
+    Scalar,
+    SSE41,
+    AVX2,
+    AVX512, // F + BW
+    Count
+};
+
+constexpr size_t kNumIsas = (size_t)EIsa::Count;
+
+// Widest ISA supported by the CPU and the OS
+EIsa detect();
+
+EIsa get_isa();
+
+// Forces the ISA of the kernels bound from now on; fails if the CPU doesn't support it.
+// The ISA is process-wide: it applies to every thread and every user of the codecs
+// library, so it is meant to be called once, by the application, before converting.
+bool select(EIsa isa);
+
+const char* get_name(EIsa isa);
+bool find_isa_from_name(const std::string& name, EIsa& outIsa);
+
+// Variant of the selected ISA, or of the closest ISA below it having one (nullptr if none)
+template<typename Function>
+Function select_variant(const Function (&variants)[kNumIsas])
+{
+    for (size_t i = (size_t)get_isa() + 1; i-- > 0;)
+    {
+        if (variants[i])
+            return variants[i];
+    }
+    return nullptr;
+}
+
+} // namespace CpuDispatch
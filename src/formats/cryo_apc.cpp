@@ -1,10 +1,12 @@
 #include "cryo_apc.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <assert.h>
 
 #include "common.h"
+#include "stats.h"
 #include "utils.h"
 #include "wave.h"
 
@@ -46,93 +48,232 @@ LONG StepTable[89] = {
    16818, 18500, 20350, 22385,  24623, 27086,  29794, 32767
 };
 
+namespace {
+
+// Input decoded at once (and output padded at once)
+constexpr size_t kChunkInputSize = 64 * 1024;
+
+inline void process_nibble(BYTE code, ChannelState& state)
+{
+    LONG delta = StepTable[state.index] >> 3;
+
+    if (code & 4)
+        delta += StepTable[state.index];
+    if (code & 2)
+        delta += StepTable[state.index] >> 1;
+    if (code & 1)
+        delta += StepTable[state.index] >> 2;
+    if (code & 8) // sign bit
+        state.sample -= delta;
+    else
+        state.sample += delta;
+
+    // clip sample
+    state.sample = Utils::clamp(state.sample, -32768, 32767);
+    // adjust index
+    state.index += IndexAdjust[code];
+    // clip index
+    state.index = Utils::clamp(state.index, 0, 88);
+}
+
+// Code of the nibble getting closest to sample, as process_nibble() will decode it
+inline BYTE find_nibble(int32_t sample, const ChannelState& state)
+{
+    LONG step = StepTable[state.index];
+    LONG diff = sample - state.sample;
+
+    BYTE code = 0;
+    if (diff < 0)
+    {
+        code = 8;
+        diff = -diff;
+    }
+    if (diff >= step)
+    {
+        code |= 4;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step)
+    {
+        code |= 2;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step)
+        code |= 1;
+
+    return code;
+}
+
+} // namespace
+
+void encode_nibbles(const int16_t* pInput, size_t numSamples, uint8_t* pOutput, uint8_t numChannels, ChannelState* states)
+{
+    ChannelState& left = states[0];
+    ChannelState& right = (numChannels == 2) ? states[1] : states[0];
+
+    for (size_t i = 0; i < numSamples; i += 2)
+    {
+        const BYTE high = find_nibble(pInput[i], left);
+        process_nibble(high, left);
+
+        // Odd number of mono samples: the last nibble repeats the last sample
+        const BYTE low = find_nibble((i + 1 < numSamples) ? pInput[i + 1] : pInput[i], right);
+        process_nibble(low, right);
+
+        *pOutput++ = (uint8_t)((high << 4) | low);
+    }
+}
+
+bool write_apc_file(const std::string& path, const PcmFormat& format, const int16_t* pSamples, uint32_t numFrames, Utils::FileStore* pStore)
+{
+    if (format.numChannels != 1 && format.numChannels != 2)
+        return false;
+
+    APCHeader header = {};
+    memcpy(header.szID, kAPCTag, sizeof(kAPCTag));
+    memcpy(header.szVersion, "1.20", sizeof(header.szVersion));
+    header.dwOutSize = numFrames;
+    header.dwSampleRate = format.sampleRate;
+    header.dwStereo = (format.numChannels == 2) ? 1 : 0;
+    if (numFrames > 0)
+    {
+        header.lSampleLeft = pSamples[0];
+        header.lSampleRight = pSamples[format.numChannels - 1];
+    }
+
+    ChannelState states[2];
+    states[0].sample = header.lSampleLeft;
+    states[1].sample = header.lSampleRight;
+
+    const size_t numSamples = (size_t)numFrames * format.numChannels;
+    std::vector<uint8_t> data(sizeof(APCHeader) + (numSamples + 1) / 2);
+    memcpy(data.data(), &header, sizeof(header));
+    encode_nibbles(pSamples, numSamples, data.data() + sizeof(APCHeader), format.numChannels, states);
+
+    return Utils::store_file(path, data.data(), data.size(), pStore);
+}
+
+void decode_nibbles(const uint8_t* pInput, size_t inputSize, int16_t* pOutput, uint8_t numChannels, ChannelState* states)
+{
+    // Low nibble: next sample for mono, right channel for stereo
+    ChannelState& left = states[0];
+    ChannelState& right = (numChannels == 2) ? states[1] : states[0];
+
+    for (size_t i = 0; i < inputSize; i++)
+    {
+        const BYTE input = pInput[i];
+
+        process_nibble(HINIBBLE(input), left);
+        *pOutput++ = (int16_t)left.sample;
+
+        process_nibble(LONIBBLE(input), right);
+        *pOutput++ = (int16_t)right.sample;
+    }
+}
+
+bool read_header(const uint8_t* pApcData, size_t apcSize, PcmFormat& outFormat, uint64_t& outNumFrames)
+{
+    if (apcSize < sizeof(APCHeader))
+        return false;
+
+    const auto* header = reinterpret_cast<const APCHeader*>(pApcData);
+    if (strncmp(header->szID, kAPCTag, sizeof(kAPCTag)) != 0)
+        return false;
+
+    outFormat = PcmFormat();
+    outFormat.numChannels = header->dwStereo ? 2 : 1;
+    outFormat.sampleRate = header->dwSampleRate;
+    outFormat.bitSize = 16;
+    outNumFrames = header->dwOutSize;
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 // Implemented/cleaned up the algorithm found here:
 // https://wiki.multimedia.cx/index.php/CRYO_APC
 //-----------------------------------------------------------------------------
-void apc_to_wav(const std::string& in_apcFilePath, const std::string& in_outFilePath)
+bool decode(const uint8_t* pApcData, size_t apcSize, PcmSink& sink)
 {
-    std::ifstream file(in_apcFilePath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return;
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
 
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    if (apcSize < sizeof(APCHeader))
+        return false;
 
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize))
-        return;
+    StreamDecoder decoder;
+    if (!decoder.begin(pApcData, sink))
+        return false;
 
-    const auto* header = reinterpret_cast<const APCHeader*>(buffer.data());
+    decoder.push(pApcData + sizeof(APCHeader), apcSize - sizeof(APCHeader));
+    return decoder.end();
+}
+
+static_assert(StreamDecoder::kHeaderSize == sizeof(APCHeader), "");
+
+bool StreamDecoder::begin(const uint8_t* pHeader, PcmSink& in_sink)
+{
+    const auto* header = reinterpret_cast<const APCHeader*>(pHeader);
     assert(strncmp((char*)header->szID, kAPCTag, sizeof(kAPCTag)) == 0);
 
-    uint8_t numChannels = header->dwStereo ? 2 : 1;
+    numChannels = header->dwStereo ? 2 : 1;
     uint32_t outBufferSize = header->dwOutSize * numChannels;
 
-    uint16_t* outBuffer = new uint16_t[outBufferSize];
-    memset(outBuffer, 0, outBufferSize);
+    PcmFormat format;
+    format.numChannels = numChannels;
+    format.sampleRate = header->dwSampleRate;
+    format.bitSize = 16;
 
-    LONG lIndexLeft = 0, lIndexRight = 0;
-    LONG lCurSampleLeft = header->lSampleLeft;
-    LONG lCurSampleRight = header->lSampleRight;
+    pSink = &in_sink;
+    remainingOutSize = (uint64_t)outBufferSize * sizeof(uint16_t);
+    if (!pSink->begin(format, remainingOutSize))
+        return false;
 
-    auto processNibble = [](BYTE Code, LONG& lIndex, LONG& lCurSample)
-    {
-        LONG Delta = StepTable[lIndex] >> 3;
-
-        if (Code & 4)
-            Delta += StepTable[lIndex];
-        if (Code & 2)
-            Delta += StepTable[lIndex] >> 1;
-        if (Code & 1)
-            Delta += StepTable[lIndex] >> 2;
-        if (Code & 8) // sign bit
-            lCurSample -= Delta;
-        else
-            lCurSample += Delta;
-
-        // clip sample
-        lCurSample = Utils::clamp(lCurSample, -32768, 32767);
-        // adjust index
-        lIndex += IndexAdjust[Code];
-        // clip index
-        lIndex = Utils::clamp(lIndex, 0, 88);
-    };
-
-    char* pData = buffer.data() + sizeof(APCHeader);
-    uint16_t* outData = outBuffer;
-
-    size_t physicalFileSize = fileSize - sizeof(APCHeader);
-    size_t headerFileSize = (numChannels == 2) ? header->dwOutSize : (header->dwOutSize / 2);
-    size_t remainingData = std::min(physicalFileSize, headerFileSize);
-
-    while (remainingData)
+    Stats::add(Stats::ECounter::Samples, outBufferSize);
+
+    states[0] = ChannelState();
+    states[1] = ChannelState();
+    states[0].sample = header->lSampleLeft;
+    states[1].sample = header->lSampleRight;
+
+    // Data past the size announced by the header is ignored
+    remainingData = (numChannels == 2) ? header->dwOutSize : (header->dwOutSize / 2);
+    return true;
+}
+
+void StreamDecoder::push(const uint8_t* pData, size_t size)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
+
+    // Decoded in chunks, straight into the sink
+    size_t dataSize = (size_t)std::min<uint64_t>(size, remainingData);
+    while (dataSize)
     {
-        BYTE Input = *pData; // current byte of compressed data
-
-        // High nibble (common to mono and stereo)
-        processNibble(HINIBBLE(Input), lIndexLeft, lCurSampleLeft);
-        *outData++ = (uint16_t)lCurSampleLeft;
-
-        // Low nibble: next sample for mono, right channel for stereo
-        if (numChannels == 1)
-        {
-            processNibble(LONIBBLE(Input), lIndexLeft, lCurSampleLeft);
-            *outData++ = (uint16_t)lCurSampleLeft;
-        }
-        else
-        {
-            processNibble(LONIBBLE(Input), lIndexRight, lCurSampleRight);
-            *outData++ = (uint16_t)lCurSampleRight;
-        }
-
-        pData++;
-        remainingData--;
+        size_t chunkSize = std::min(dataSize, kChunkInputSize);
+        int16_t* outData = (int16_t*)pSink->reserve(chunkSize * 2 * sizeof(uint16_t));
+        decode_nibbles(pData, chunkSize, outData, numChannels, states);
+        pData += chunkSize;
+
+        size_t outChunkSize = (size_t)std::min<uint64_t>(chunkSize * 2 * sizeof(uint16_t), remainingOutSize);
+        pSink->commit(outChunkSize);
+        remainingOutSize -= outChunkSize;
+        remainingData -= chunkSize;
+        dataSize -= chunkSize;
     }
+}
 
-    Wave::write(in_outFilePath, (char*)outBuffer, outBufferSize * sizeof(uint16_t), numChannels, header->dwSampleRate, 16);
+bool StreamDecoder::end()
+{
+    // Truncated file: pad up to the size announced in the header
+    while (remainingOutSize)
+    {
+        size_t padSize = (size_t)std::min<uint64_t>(remainingOutSize, kChunkInputSize);
+        memset(pSink->reserve(padSize), 0, padSize);
+        pSink->commit(padSize);
+        remainingOutSize -= padSize;
+    }
 
-    delete[] outBuffer;
+    return pSink->end();
 }
 
 } // namespace CryoAPC
@@ -2,10 +2,61 @@
 
 #include <string>
 
+#include "pcm_sink.h"
+
+namespace Utils {
+    class FileStore;
+}
+
 namespace CryoAPC {
 
 constexpr static char kAPCTag[8] = { 'C', 'R', 'Y', 'O', '_', 'A', 'P', 'C' };
 
-void apc_to_wav(const std::string& in_WvPath, const std::string& in_outFilePath);
+// ADPCM state of one channel
+struct ChannelState
+{
+    int32_t index = 0;
+    int32_t sample = 0;
+};
+
+// Decodes inputSize bytes of nibbles: each byte gives 2 samples (mono) or 1 frame (stereo, high nibble left).
+// states: numChannels channel states, updated.
+void decode_nibbles(const uint8_t* pInput, size_t inputSize, int16_t* pOutput, uint8_t numChannels, ChannelState* states);
+
+// Inverse of decode_nibbles: encodes numSamples interleaved samples into (numSamples + 1) / 2 bytes
+void encode_nibbles(const int16_t* pInput, size_t numSamples, uint8_t* pOutput, uint8_t numChannels, ChannelState* states);
+
+// Encodes 16-bit PCM samples (mono or stereo) into an APC file, handed to the store
+bool write_apc_file(const std::string& path, const PcmFormat& format, const int16_t* pSamples, uint32_t numFrames, Utils::FileStore* pStore);
+
+// Reads the format and length (in frames) of an APC file from its header
+bool read_header(const uint8_t* pApcData, size_t apcSize, PcmFormat& outFormat, uint64_t& outNumFrames);
+
+// Decodes a whole APC file held in memory
+bool decode(const uint8_t* pApcData, size_t apcSize, PcmSink& sink);
+
+//-----------------------------------------------------------------------------
+// Decoder fed with the file in consecutive pieces of any size (e.g. as read
+// from a pipe): the header first, then the nibbles, decoded as they arrive.
+//-----------------------------------------------------------------------------
+class StreamDecoder
+{
+public:
+    static constexpr size_t kHeaderSize = 32;
+
+    // pHeader: the kHeaderSize first bytes of the file
+    bool begin(const uint8_t* pHeader, PcmSink& in_sink);
+    void push(const uint8_t* pData, size_t size);
+
+    // Pads the output to the size announced by the header if the file was truncated
+    bool end();
+
+private:
+    PcmSink* pSink = nullptr;
+    uint8_t numChannels = 1;
+    ChannelState states[2];
+    uint64_t remainingData = 0; // nibble bytes still to decode
+    uint64_t remainingOutSize = 0;
+};
 
 } // namespace CryoAPC
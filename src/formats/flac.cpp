@@ -0,0 +1,933 @@
+#include "flac.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "sample_convert.h"
+#include "stats.h"
+
+//-----------------------------------------------------------------------------
+// Format reference: RFC 9639 (Free Lossless Audio Codec)
+//-----------------------------------------------------------------------------
+namespace Flac {
+
+namespace {
+
+constexpr int kMaxChannels = 8;
+constexpr int kMaxRicePartitionOrder = 8;
+constexpr int kMaxRiceParam = 14;  // 4-bit parameters, 15 is the escape code
+constexpr int kMaxRice2Param = 30; // 5-bit parameters
+constexpr int kLpcPrecision = 12;  // quantized coefficients precision for 4096-sample blocks
+constexpr uint32_t kBlocksPerThread = 16;
+constexpr size_t kMinParallelBlocks = 4; // fewer blocks are encoded on the calling thread
+constexpr size_t kStreamInfoSize = 34;
+constexpr double kPi = 3.14159265358979323846;
+
+struct CrcTables
+{
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+};
+
+const CrcTables& get_crc_tables()
+{
+    static const CrcTables tables = []()
+    {
+        CrcTables t;
+        for (int i = 0; i < 256; i++)
+        {
+            uint8_t c8 = (uint8_t)i;
+            uint16_t c16 = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++)
+            {
+                c8 = (c8 & 0x80) ? (uint8_t)((c8 << 1) ^ 0x07) : (uint8_t)(c8 << 1);
+                c16 = (c16 & 0x8000) ? (uint16_t)((c16 << 1) ^ 0x8005) : (uint16_t)(c16 << 1);
+            }
+            t.crc8[i] = c8;
+            t.crc16[i] = c16;
+        }
+        return t;
+    }();
+    return tables;
+}
+
+uint8_t crc8(const uint8_t* pData, size_t size)
+{
+    const auto& tables = get_crc_tables();
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++)
+        crc = tables.crc8[crc ^ pData[i]];
+    return crc;
+}
+
+uint16_t crc16(const uint8_t* pData, size_t size)
+{
+    const auto& tables = get_crc_tables();
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; i++)
+        crc = (uint16_t)((crc << 8) ^ tables.crc16[(crc >> 8) ^ pData[i]]);
+    return crc;
+}
+
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<uint8_t>& in_out) : out(in_out) {}
+
+    void put(uint32_t value, int numBits)
+    {
+        if (numBits < 32)
+            value &= (1u << numBits) - 1;
+
+        acc = (acc << numBits) | value;
+        bits += numBits;
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((uint8_t)(acc >> bits));
+        }
+    }
+
+    void put_signed(int32_t value, int numBits) { put((uint32_t)value, numBits); }
+
+    void put_rice(uint32_t folded, int param)
+    {
+        uint32_t quotient = folded >> param;
+        for (; quotient >= 32; quotient -= 32)
+            put(0, 32);
+        put(1, quotient + 1);
+        if (param > 0)
+            put(folded, param);
+    }
+
+    void align()
+    {
+        if (bits > 0)
+            put(0, 8 - bits);
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint64_t acc = 0;
+    int bits = 0;
+};
+
+inline uint32_t fold(int32_t residual)
+{
+    return ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+}
+
+int ilog2(uint32_t v)
+{
+    int log = 0;
+    while (v >>= 1)
+        log++;
+    return log;
+}
+
+enum class ESubframe : uint8_t
+{
+    Constant,
+    Verbatim,
+    Fixed,
+    Lpc,
+};
+
+struct Subframe
+{
+    ESubframe type = ESubframe::Verbatim;
+    int order = 0;
+
+    // LPC only
+    int precision = 0;
+    int shift = 0;
+    int32_t qlp[kMaxLpcOrder] = {};
+
+    // Residual coding
+    int partitionOrder = 0;
+    bool bRice2 = false;
+    uint8_t riceParams[1 << kMaxRicePartitionOrder] = {};
+    std::vector<int32_t> residual;
+
+    uint64_t bits = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Residual computation. The loops run over the whole block for one predictor
+// term at a time, so that they vectorize.
+//-----------------------------------------------------------------------------
+void compute_fixed_residual(const int32_t* x, uint32_t n, int order, int32_t* res)
+{
+    switch (order)
+    {
+    case 0:
+        for (uint32_t i = 0; i < n; i++)
+            res[i] = x[i];
+        break;
+    case 1:
+        for (uint32_t i = 1; i < n; i++)
+            res[i] = x[i] - x[i - 1];
+        break;
+    case 2:
+        for (uint32_t i = 2; i < n; i++)
+            res[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+        break;
+    case 3:
+        for (uint32_t i = 3; i < n; i++)
+            res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+        break;
+    case 4:
+        for (uint32_t i = 4; i < n; i++)
+            res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+        break;
+    }
+}
+
+void compute_lpc_residual(const int32_t* x, uint32_t n, const int32_t* qlp, int order, int shift, int32_t* res)
+{
+    // The coefficient precision is chosen so that the sums fit in 32 bits
+    for (uint32_t i = order; i < n; i++)
+        res[i] = 0;
+
+    for (int j = 0; j < order; j++)
+    {
+        const int32_t coef = qlp[j];
+        const int32_t* xj = x - j - 1;
+        for (uint32_t i = order; i < n; i++)
+            res[i] += coef * xj[i];
+    }
+
+    for (uint32_t i = order; i < n; i++)
+        res[i] = x[i] - (res[i] >> shift);
+}
+
+//-----------------------------------------------------------------------------
+// Picks the Rice partition order and parameters, returns the residual size in bits
+//-----------------------------------------------------------------------------
+uint64_t plan_rice(const int32_t* res, uint32_t n, int order, Subframe& sf)
+{
+    int maxPartitionOrder = kMaxRicePartitionOrder;
+    while (maxPartitionOrder > 0 && ((n & ((1u << maxPartitionOrder) - 1)) != 0 || (n >> maxPartitionOrder) <= (uint32_t)order))
+        maxPartitionOrder--;
+
+    uint64_t sums[1 << kMaxRicePartitionOrder];
+    uint32_t counts[1 << kMaxRicePartitionOrder];
+
+    const uint32_t numPartitions = 1u << maxPartitionOrder;
+    const uint32_t partitionSize = n >> maxPartitionOrder;
+    for (uint32_t p = 0; p < numPartitions; p++)
+    {
+        uint32_t start = (p == 0) ? order : p * partitionSize;
+        uint32_t end = (p + 1) * partitionSize;
+        uint64_t sum = 0;
+        for (uint32_t i = start; i < end; i++)
+            sum += fold(res[i]);
+        sums[p] = sum;
+        counts[p] = end - start;
+    }
+
+    uint64_t bestBits = UINT64_MAX;
+    uint8_t params[1 << kMaxRicePartitionOrder];
+
+    for (int partitionOrder = maxPartitionOrder; partitionOrder >= 0; partitionOrder--)
+    {
+        const uint32_t partitions = 1u << partitionOrder;
+        bool bRice2 = false;
+        uint64_t bits = 2 + 4;
+
+        for (uint32_t p = 0; p < partitions; p++)
+        {
+            const uint64_t sum = sums[p];
+            const uint32_t count = counts[p];
+
+            // Estimate: count * (param + 1) unary/binary bits + (sum >> param) quotient bits
+            int param = 0;
+            if (count > 0 && sum > count)
+                param = std::min(ilog2((uint32_t)std::min<uint64_t>(sum / count, UINT32_MAX)), kMaxRice2Param);
+
+            uint64_t paramBits = (uint64_t)count * (param + 1) + (sum >> param);
+            if (param > 0)
+            {
+                uint64_t lowerBits = (uint64_t)count * param + (sum >> (param - 1));
+                if (lowerBits < paramBits)
+                {
+                    param--;
+                    paramBits = lowerBits;
+                }
+            }
+
+            params[p] = (uint8_t)param;
+            bRice2 |= (param > kMaxRiceParam);
+            bits += paramBits;
+        }
+
+        bits += (uint64_t)partitions * (bRice2 ? 5 : 4);
+        if (bits < bestBits)
+        {
+            bestBits = bits;
+            sf.partitionOrder = partitionOrder;
+            sf.bRice2 = bRice2;
+            memcpy(sf.riceParams, params, partitions);
+        }
+
+        // Merge pairs of partitions for the next (lower) order
+        for (uint32_t p = 0; p < partitions / 2; p++)
+        {
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+            counts[p] = counts[2 * p] + counts[2 * p + 1];
+        }
+    }
+
+    return bestBits;
+}
+
+bool quantize_lpc(const double* lp, int order, int precision, int32_t* qlp, int& shift)
+{
+    double cmax = 0.0;
+    for (int i = 0; i < order; i++)
+        cmax = std::max(cmax, std::fabs(lp[i]));
+    if (cmax <= 0.0)
+        return false;
+
+    const int qmax = (1 << (precision - 1)) - 1;
+    const int qmin = -(1 << (precision - 1));
+
+    int log2cmax;
+    std::frexp(cmax, &log2cmax);
+    shift = std::min(precision - 1 - (log2cmax - 1), 15);
+    if (shift < 0)
+        return false; // negative shifts aren't allowed
+
+    // Carry the rounding error over to the next coefficient
+    double error = 0.0;
+    for (int i = 0; i < order; i++)
+    {
+        error += lp[i] * (1 << shift);
+        int32_t q = (int32_t)std::lround(error);
+        q = std::min(std::max(q, qmin), qmax);
+        error -= q;
+        qlp[i] = q;
+    }
+    return true;
+}
+
+class FrameEncoder
+{
+public:
+    FrameEncoder(const PcmFormat& in_format) : format(in_format) {}
+
+    void encode(const char* pPcm, uint32_t blockSize, uint32_t frameNumber, std::vector<uint8_t>& out);
+
+private:
+    void analyze(const int32_t* x, uint32_t n, int bps, Subframe& sf);
+    void try_lpc(const int32_t* x, uint32_t n, int bps, Subframe& sf);
+    void write_subframe(BitWriter& bw, const int32_t* x, uint32_t n, int bps, const Subframe& sf);
+
+    const PcmFormat& format;
+
+    // Channels, plus mid/side candidates for stereo
+    std::vector<int32_t> channels[kMaxChannels];
+    Subframe subframes[kMaxChannels];
+    Subframe candidate;
+
+    std::vector<double> window;
+    std::vector<double> windowed;
+};
+
+void FrameEncoder::encode(const char* pPcm, uint32_t blockSize, uint32_t frameNumber, std::vector<uint8_t>& out)
+{
+    const int numChannels = format.numChannels;
+    const int bps = format.bitSize;
+    const uint32_t bytesPerSample = (bps + 7) / 8;
+
+    for (int c = 0; c < std::max(numChannels, 4); c++)
+        channels[c].resize(blockSize);
+
+    // Deinterleave
+    const uint8_t* pIn = reinterpret_cast<const uint8_t*>(pPcm);
+    if (numChannels == 2 && bps == 16)
+    {
+        // The common case, vectorized (cpu_dispatch.h)
+        SampleConvert::deinterleave_s16_stereo(reinterpret_cast<const int16_t*>(pPcm), channels[0].data(), channels[1].data(), blockSize);
+    }
+    else
+    {
+        for (int c = 0; c < numChannels; c++)
+        {
+            int32_t* pOut = channels[c].data();
+            const uint8_t* pSample = pIn + c * bytesPerSample;
+            const size_t stride = (size_t)numChannels * bytesPerSample;
+
+            if (bps == 16)
+            {
+                for (uint32_t i = 0; i < blockSize; i++, pSample += stride)
+                    pOut[i] = (int16_t)(pSample[0] | (pSample[1] << 8));
+            }
+            else if (bps == 24)
+            {
+                for (uint32_t i = 0; i < blockSize; i++, pSample += stride)
+                    pOut[i] = (int32_t)((uint32_t)(pSample[0] << 8 | pSample[1] << 16 | pSample[2] << 24)) >> 8;
+            }
+            else
+            {
+                for (uint32_t i = 0; i < blockSize; i++, pSample += stride)
+                    pOut[i] = (int32_t)pSample[0] - 128;
+            }
+        }
+    }
+
+    // Channel assignment: 0-7 independent, 8 left/side, 9 side/right, 10 mid/side
+    int assignment = numChannels - 1;
+    const int32_t* subframeData[kMaxChannels];
+    const Subframe* subframePlans[kMaxChannels];
+    int subframeBps[kMaxChannels];
+
+    if (numChannels == 2)
+    {
+        int32_t* left = channels[0].data();
+        int32_t* right = channels[1].data();
+        int32_t* mid = channels[2].data();
+        int32_t* side = channels[3].data();
+        for (uint32_t i = 0; i < blockSize; i++)
+        {
+            mid[i] = (left[i] + right[i]) >> 1;
+            side[i] = left[i] - right[i];
+        }
+
+        analyze(left, blockSize, bps, subframes[0]);
+        analyze(right, blockSize, bps, subframes[1]);
+        analyze(mid, blockSize, bps, subframes[2]);
+        analyze(side, blockSize, bps + 1, subframes[3]);
+
+        const uint64_t bitsL = subframes[0].bits, bitsR = subframes[1].bits;
+        const uint64_t bitsM = subframes[2].bits, bitsS = subframes[3].bits;
+
+        int first = 0, second = 1;
+        uint64_t best = bitsL + bitsR;
+        if (bitsL + bitsS < best) { best = bitsL + bitsS; assignment = 8; first = 0; second = 3; }
+        if (bitsS + bitsR < best) { best = bitsS + bitsR; assignment = 9; first = 3; second = 1; }
+        if (bitsM + bitsS < best) { best = bitsM + bitsS; assignment = 10; first = 2; second = 3; }
+
+        const int chosen[2] = { first, second };
+        for (int c = 0; c < 2; c++)
+        {
+            subframeData[c] = channels[chosen[c]].data();
+            subframePlans[c] = &subframes[chosen[c]];
+            subframeBps[c] = (chosen[c] == 3) ? bps + 1 : bps;
+        }
+    }
+    else
+    {
+        for (int c = 0; c < numChannels; c++)
+        {
+            analyze(channels[c].data(), blockSize, bps, subframes[c]);
+            subframeData[c] = channels[c].data();
+            subframePlans[c] = &subframes[c];
+            subframeBps[c] = bps;
+        }
+    }
+
+    // Frame header
+    out.clear();
+    BitWriter bw(out);
+    bw.put(0xFFF8, 16); // sync code, fixed block size
+
+    int blockSizeCode = (blockSize == kBlockSize) ? 12 : 7;
+    bw.put(blockSizeCode, 4);
+
+    int sampleRateCode;
+    switch (format.sampleRate)
+    {
+    case 88200: sampleRateCode = 1; break;
+    case 176400: sampleRateCode = 2; break;
+    case 192000: sampleRateCode = 3; break;
+    case 8000: sampleRateCode = 4; break;
+    case 16000: sampleRateCode = 5; break;
+    case 22050: sampleRateCode = 6; break;
+    case 24000: sampleRateCode = 7; break;
+    case 32000: sampleRateCode = 8; break;
+    case 44100: sampleRateCode = 9; break;
+    case 48000: sampleRateCode = 10; break;
+    case 96000: sampleRateCode = 11; break;
+    default: sampleRateCode = (format.sampleRate <= 0xFFFF) ? 13 : 0; break;
+    }
+    bw.put(sampleRateCode, 4);
+
+    bw.put(assignment, 4);
+    bw.put(bps == 8 ? 1 : (bps == 16 ? 4 : 6), 3);
+    bw.put(0, 1);
+
+    // Frame number, UTF-8 style coding
+    if (frameNumber < 0x80)
+    {
+        bw.put(frameNumber, 8);
+    }
+    else
+    {
+        int numBytes = (frameNumber < 0x800) ? 2 : (frameNumber < 0x10000) ? 3 : (frameNumber < 0x200000) ? 4 : (frameNumber < 0x4000000) ? 5 : 6;
+        bw.put((0xFF00 >> numBytes) | (frameNumber >> (6 * (numBytes - 1))), 8);
+        for (int b = numBytes - 2; b >= 0; b--)
+            bw.put(0x80 | ((frameNumber >> (6 * b)) & 0x3F), 8);
+    }
+
+    if (blockSizeCode == 7)
+        bw.put(blockSize - 1, 16);
+    if (sampleRateCode == 13)
+        bw.put(format.sampleRate, 16);
+
+    bw.put(crc8(out.data(), out.size()), 8);
+
+    for (int c = 0; c < numChannels; c++)
+        write_subframe(bw, subframeData[c], blockSize, subframeBps[c], *subframePlans[c]);
+
+    bw.align();
+    bw.put(crc16(out.data(), out.size()), 16);
+}
+
+void FrameEncoder::analyze(const int32_t* x, uint32_t n, int bps, Subframe& sf)
+{
+    const uint64_t headerBits = 8;
+
+    bool bConstant = true;
+    for (uint32_t i = 1; i < n && bConstant; i++)
+        bConstant = (x[i] == x[0]);
+
+    if (bConstant)
+    {
+        sf.type = ESubframe::Constant;
+        sf.bits = headerBits + bps;
+        return;
+    }
+
+    sf.type = ESubframe::Verbatim;
+    sf.bits = headerBits + (uint64_t)n * bps;
+
+    // Fixed predictors: pick the order with the smallest total absolute residual
+    if (n > 4)
+    {
+        uint64_t errors[5] = {};
+        for (uint32_t i = 4; i < n; i++)
+        {
+            int32_t e0 = x[i];
+            int32_t e1 = e0 - x[i - 1];
+            int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+            int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+            int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+            errors[0] += std::abs(e0);
+            errors[1] += std::abs(e1);
+            errors[2] += std::abs(e2);
+            errors[3] += std::abs(e3);
+            errors[4] += std::abs(e4);
+        }
+
+        int order = (int)(std::min_element(errors, errors + 5) - errors);
+
+        candidate.type = ESubframe::Fixed;
+        candidate.order = order;
+        candidate.residual.resize(n);
+        compute_fixed_residual(x, n, order, candidate.residual.data());
+        candidate.bits = headerBits + (uint64_t)order * bps + plan_rice(candidate.residual.data(), n, order, candidate);
+
+        if (candidate.bits < sf.bits)
+            std::swap(sf, candidate);
+    }
+
+    if (n > 2 * kMaxLpcOrder)
+        try_lpc(x, n, bps, sf);
+}
+
+void FrameEncoder::try_lpc(const int32_t* x, uint32_t n, int bps, Subframe& sf)
+{
+    // Tukey(0.5) window
+    if (window.size() != n)
+    {
+        window.resize(n);
+        const uint32_t taper = n / 4;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            double w = 1.0;
+            if (i < taper)
+                w = 0.5 - 0.5 * std::cos(kPi * i / taper);
+            else if (i >= n - taper)
+                w = 0.5 - 0.5 * std::cos(kPi * (n - 1 - i) / taper);
+            window[i] = w;
+        }
+    }
+
+    windowed.resize(n);
+    for (uint32_t i = 0; i < n; i++)
+        windowed[i] = x[i] * window[i];
+
+    double autoc[kMaxLpcOrder + 1];
+    for (int lag = 0; lag <= kMaxLpcOrder; lag++)
+    {
+        double sum = 0.0;
+        for (uint32_t i = lag; i < n; i++)
+            sum += windowed[i] * windowed[i - lag];
+        autoc[lag] = sum;
+    }
+
+    if (autoc[0] == 0.0)
+        return;
+
+    // Levinson-Durbin recursion, keeping the coefficients of every order
+    double lpc[kMaxLpcOrder];
+    double coefs[kMaxLpcOrder][kMaxLpcOrder];
+    double errors[kMaxLpcOrder];
+    int maxOrder = kMaxLpcOrder;
+
+    double err = autoc[0];
+    for (int i = 0; i < kMaxLpcOrder; i++)
+    {
+        double r = -autoc[i + 1];
+        for (int j = 0; j < i; j++)
+            r -= lpc[j] * autoc[i - j];
+        r /= err;
+
+        lpc[i] = r;
+        int j = 0;
+        for (; j < (i >> 1); j++)
+        {
+            double tmp = lpc[j];
+            lpc[j] += r * lpc[i - 1 - j];
+            lpc[i - 1 - j] += r * tmp;
+        }
+        if (i & 1)
+            lpc[j] += lpc[j] * r;
+
+        err *= (1.0 - r * r);
+        for (j = 0; j <= i; j++)
+            coefs[i][j] = -lpc[j];
+        errors[i] = err;
+
+        if (err <= 0.0)
+        {
+            maxOrder = i + 1;
+            break;
+        }
+    }
+
+    // Pick the order with the smallest expected size
+    int order = 1;
+    double bestExpectedBits = 1e300;
+    for (int o = 1; o <= maxOrder; o++)
+    {
+        const int precision = std::min(kLpcPrecision, 32 - bps - ilog2(o));
+        double bitsPerSample = (errors[o - 1] > 0.0) ? std::max(0.0, 0.5 * std::log2(0.5 * errors[o - 1] / n)) : 0.0;
+        double expectedBits = bitsPerSample * (n - o) + o * (bps + precision);
+        if (expectedBits < bestExpectedBits)
+        {
+            bestExpectedBits = expectedBits;
+            order = o;
+        }
+    }
+
+    candidate.type = ESubframe::Lpc;
+    candidate.order = order;
+    candidate.precision = std::min(kLpcPrecision, 32 - bps - ilog2(order));
+    if (candidate.precision < 5 || !quantize_lpc(coefs[order - 1], order, candidate.precision, candidate.qlp, candidate.shift))
+        return;
+
+    candidate.residual.resize(n);
+    compute_lpc_residual(x, n, candidate.qlp, order, candidate.shift, candidate.residual.data());
+    candidate.bits = 8 + (uint64_t)order * bps + 4 + 5 + (uint64_t)order * candidate.precision
+        + plan_rice(candidate.residual.data(), n, order, candidate);
+
+    if (candidate.bits < sf.bits)
+        std::swap(sf, candidate);
+}
+
+void FrameEncoder::write_subframe(BitWriter& bw, const int32_t* x, uint32_t n, int bps, const Subframe& sf)
+{
+    bw.put(0, 1);
+
+    switch (sf.type)
+    {
+    case ESubframe::Constant:
+        bw.put(0, 6);
+        bw.put(0, 1); // no wasted bits
+        bw.put_signed(x[0], bps);
+        return;
+    case ESubframe::Verbatim:
+        bw.put(1, 6);
+        bw.put(0, 1);
+        for (uint32_t i = 0; i < n; i++)
+            bw.put_signed(x[i], bps);
+        return;
+    case ESubframe::Fixed:
+        bw.put(8 | sf.order, 6);
+        bw.put(0, 1);
+        for (int i = 0; i < sf.order; i++)
+            bw.put_signed(x[i], bps);
+        break;
+    case ESubframe::Lpc:
+        bw.put(0x20 | (sf.order - 1), 6);
+        bw.put(0, 1);
+        for (int i = 0; i < sf.order; i++)
+            bw.put_signed(x[i], bps);
+        bw.put(sf.precision - 1, 4);
+        bw.put_signed(sf.shift, 5);
+        for (int i = 0; i < sf.order; i++)
+            bw.put_signed(sf.qlp[i], sf.precision);
+        break;
+    }
+
+    // Partitioned Rice residual
+    const int paramBits = sf.bRice2 ? 5 : 4;
+    bw.put(sf.bRice2 ? 1 : 0, 2);
+    bw.put(sf.partitionOrder, 4);
+
+    const uint32_t partitions = 1u << sf.partitionOrder;
+    const uint32_t partitionSize = n >> sf.partitionOrder;
+    const int32_t* res = sf.residual.data();
+    for (uint32_t p = 0; p < partitions; p++)
+    {
+        const int param = sf.riceParams[p];
+        bw.put(param, paramBits);
+
+        uint32_t start = (p == 0) ? sf.order : p * partitionSize;
+        uint32_t end = (p + 1) * partitionSize;
+        for (uint32_t i = start; i < end; i++)
+            bw.put_rice(fold(res[i]), param);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Helper threads shared by all the writers of the process, started on first
+// use. The caller of run() always works on its task too, and helpers only join
+// in when idle: concurrent writers (one per conversion thread) then share the
+// same hardware_concurrency() - 1 helpers instead of each starting its own.
+//-----------------------------------------------------------------------------
+class EncodePool
+{
+public:
+    static EncodePool& get()
+    {
+        static EncodePool pool;
+        return pool;
+    }
+
+    unsigned num_threads() const { return (unsigned)threads.size() + 1; }
+
+    // Runs the task on the calling thread and on up to maxHelpers idle helpers.
+    // The task must share its work out itself (e.g. with an atomic counter).
+    void run(const std::function<void()>& task, size_t maxHelpers)
+    {
+        Batch batch{ &task };
+        maxHelpers = std::min<size_t>(maxHelpers, threads.size());
+        if (maxHelpers > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < maxHelpers; i++)
+                queue.push_back(&batch);
+        }
+        workAvailable.notify_all();
+
+        task();
+
+        // Helpers which haven't picked the batch yet won't be needed anymore
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.erase(std::remove(queue.begin(), queue.end(), &batch), queue.end());
+        batchDone.wait(lock, [&batch]() { return batch.numRunning == 0; });
+    }
+
+private:
+    struct Batch
+    {
+        const std::function<void()>* pTask;
+        int numRunning = 0;
+    };
+
+    EncodePool()
+    {
+        const unsigned numHelpers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        for (unsigned i = 0; i < numHelpers; i++)
+            threads.emplace_back([this]() { help(); });
+    }
+
+    ~EncodePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bStopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    void help()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            workAvailable.wait(lock, [this]() { return bStopping || !queue.empty(); });
+            if (bStopping)
+                return;
+
+            Batch* pBatch = queue.front();
+            queue.pop_front();
+            pBatch->numRunning++;
+
+            lock.unlock();
+            (*pBatch->pTask)();
+            lock.lock();
+
+            if (--pBatch->numRunning == 0)
+                batchDone.notify_all();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable batchDone;
+    std::deque<Batch*> queue;
+    bool bStopping = false;
+};
+
+} // namespace
+
+Writer::~Writer()
+{
+    if (bOpen)
+        end();
+}
+
+bool Writer::begin(const PcmFormat& in_format, uint64_t)
+{
+    format = in_format;
+    if ((format.bitSize != 8 && format.bitSize != 16 && format.bitSize != 24) || format.bFloat
+        || format.numChannels == 0 || format.numChannels > kMaxChannels
+        || format.sampleRate == 0 || format.sampleRate >= (1 << 20))
+    {
+        std::cerr << "FLAC: unsupported PCM format for " << path << "\n";
+        return false;
+    }
+
+    if (!file.open(path, pStore))
+        return false;
+
+    bOpen = true;
+    totalFrames = 0;
+    frameNumber = 0;
+    minFrameSize = maxFrameSize = 0;
+    pendingSize = 0;
+
+    file.write("fLaC", 4);
+    write_stream_info(); // patched in end()
+    return true;
+}
+
+void Writer::write_stream_info()
+{
+    std::vector<uint8_t> block;
+    BitWriter bw(block);
+
+    bw.put(0x80, 8); // last metadata block, STREAMINFO
+    bw.put(kStreamInfoSize, 24);
+
+    bw.put(kBlockSize, 16);
+    bw.put(kBlockSize, 16);
+    bw.put(minFrameSize, 24);
+    bw.put(maxFrameSize, 24);
+    bw.put(format.sampleRate, 20);
+    bw.put(format.numChannels - 1, 3);
+    bw.put(format.bitSize - 1, 5);
+    bw.put((uint32_t)(totalFrames >> 32), 4);
+    bw.put((uint32_t)totalFrames, 32);
+    for (int i = 0; i < 4; i++)
+        bw.put(0, 32); // MD5 signature (unset)
+
+    if (file.tell() == 4)
+        file.write(block.data(), block.size());
+    else
+        file.write_at(4, block.data(), block.size());
+}
+
+char* Writer::reserve(size_t size)
+{
+    if (pending.size() < pendingSize + size)
+        pending.resize(pendingSize + size);
+    return pending.data() + pendingSize;
+}
+
+void Writer::commit(size_t size)
+{
+    pendingSize += size;
+
+    static const unsigned numThreads = EncodePool::get().num_threads();
+    const size_t batchFrames = (size_t)kBlockSize * kBlocksPerThread * numThreads;
+    const size_t pendingFrames = pendingSize / format.block_align();
+    if (pendingFrames >= batchFrames)
+        encode_blocks(pendingFrames, false);
+}
+
+void Writer::encode_blocks(size_t numFrames, bool bFinal)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Encode);
+
+    const uint32_t blockAlign = format.block_align();
+    const size_t numBlocks = bFinal ? (numFrames + kBlockSize - 1) / kBlockSize : numFrames / kBlockSize;
+    if (numBlocks == 0)
+        return;
+
+    std::vector<std::vector<uint8_t>> frames(numBlocks);
+
+    std::atomic<size_t> nextBlock(0);
+    const std::function<void()> encodeRange = [&]()
+    {
+        FrameEncoder encoder(format);
+        for (size_t b = nextBlock++; b < numBlocks; b = nextBlock++)
+        {
+            uint32_t blockSize = (uint32_t)std::min<size_t>(kBlockSize, numFrames - b * kBlockSize);
+            encoder.encode(pending.data() + b * kBlockSize * blockAlign, blockSize, frameNumber + (uint32_t)b, frames[b]);
+        }
+    };
+
+    // Short files (or the tail of a stream) aren't worth waking helpers for
+    if (numBlocks < kMinParallelBlocks)
+        encodeRange();
+    else
+        EncodePool::get().run(encodeRange, numBlocks - 1);
+
+    for (const auto& frame : frames)
+    {
+        const uint32_t frameSize = (uint32_t)frame.size();
+        minFrameSize = minFrameSize ? std::min(minFrameSize, frameSize) : frameSize;
+        maxFrameSize = std::max(maxFrameSize, frameSize);
+        file.write(frame.data(), frame.size());
+    }
+
+    const size_t consumedFrames = std::min(numFrames, numBlocks * kBlockSize);
+    frameNumber += (uint32_t)numBlocks;
+    totalFrames += consumedFrames;
+
+    const size_t consumedSize = consumedFrames * blockAlign;
+    memmove(pending.data(), pending.data() + consumedSize, pendingSize - consumedSize);
+    pendingSize -= consumedSize;
+}
+
+bool Writer::end()
+{
+    if (!bOpen)
+        return false;
+    bOpen = false;
+
+    encode_blocks(pendingSize / format.block_align(), true);
+    write_stream_info();
+
+    pending.clear();
+    pending.shrink_to_fit();
+    return file.close();
+}
+
+} // namespace Flac
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "pcm_sink.h"
+#include "utils.h"
+
+namespace Flac {
+
+constexpr uint32_t kBlockSize = 4096;
+constexpr int kMaxLpcOrder = 8;
+
+//-----------------------------------------------------------------------------
+// Native FLAC encoder (8/16/24-bit integer PCM, up to 8 channels).
+// Fixed 4096-sample blocks; each subframe picks the smallest of constant,
+// verbatim, fixed-predictor and quantized LPC coding, with partitioned Rice
+// residuals. Stereo streams also pick the best of independent/left-side/
+// right-side/mid-side. Incoming PCM is gathered into batches of blocks which
+// are encoded in parallel (with helper threads shared by all the writers of
+// the process), then written in order.
+// STREAMINFO is patched on end() (the MD5 signature is left unset).
+//-----------------------------------------------------------------------------
+class Writer : public PcmSink
+{
+public:
+    // The file goes to the store (as a stream, or whole on end())
+    Writer(const std::string& in_path, Utils::FileStore* in_pStore) : path(in_path), pStore(in_pStore) {}
+    ~Writer() override;
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    void encode_blocks(size_t numFrames, bool bFinal);
+    void write_stream_info();
+
+    const std::string path;
+    Utils::FileStore* const pStore;
+    Utils::OutputFile file;
+    PcmFormat format;
+
+    std::vector<char> pending; // interleaved PCM waiting to be encoded
+    size_t pendingSize = 0;
+
+    uint64_t totalFrames = 0;
+    uint32_t frameNumber = 0;
+    uint32_t minFrameSize = 0;
+    uint32_t maxFrameSize = 0;
+    bool bOpen = false;
+};
+
+} // namespace Flac
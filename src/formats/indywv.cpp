@@ -1,15 +1,24 @@
 #include "indywv.h"
 
+#include <algorithm>
 #include <array>
 #include <assert.h>
 #include <stdint.h>
+#include <cstddef>
+#include <cstring>
 #include <sstream>
 #include <vector>
 #include <iostream>
 
+#include "cpu_dispatch.h"
+#include "stats.h"
 #include "utils.h"
 #include "wave.h"
 
+#if defined(CPU_DISPATCH_X86)
+#include <immintrin.h>
+#endif
+
 // ----------------------------------------------------------------------------
 // from ida_defs.h
 #define LAST_IND(x,part_type)    (sizeof(x)/sizeof(part_type) - 1)
@@ -34,7 +43,86 @@
 #define HIBYTE(x)  BYTEn(x,HIGH_IND(x,uint8_t))
 // ----------------------------------------------------------------------------
 
+namespace {
+
+// Samples handled by the scalar WVSM loop before trying the vector one again
+constexpr std::size_t kWvsmScalarRun = 16;
+
+// Expands the WVSM samples of a block (left and right alternating, starting with left)
+// by whole vectors, as long as they hold no escape code (0x80, followed by a 16-bit
+// sample). Stops before the first vector holding one, or that isn't fully available
+// (in the stream or the block); returns the number of samples written, even.
+using WvsmExpandFunction = std::size_t (*)(const uint8_t*& pData, const uint8_t* pDataEnd, int16_t* pOut, std::size_t numSamples, int sel, int ser);
+
+#if defined(CPU_DISPATCH_X86)
+
+// Shifting the sign-extended bytes left is multiplying them by a power of 2, modulo 2^16
+CPU_TARGET_SSE41 std::size_t wvsm_expand_sse41(const uint8_t*& pData, const uint8_t* pDataEnd, int16_t* pOut, std::size_t numSamples, int sel, int ser)
+{
+    const __m128i escape = _mm_set1_epi8((char)0x80);
+    const __m128i factors = _mm_set1_epi32((int)((1u << sel) | (1u << ser) << 16));
+    std::size_t i = 0;
+    for (; i + 16 <= numSamples && pDataEnd - pData >= 16; i += 16, pData += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)pData);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, escape)) != 0)
+            break;
+        _mm_storeu_si128((__m128i*)(pOut + i), _mm_mullo_epi16(_mm_cvtepi8_epi16(bytes), factors));
+        _mm_storeu_si128((__m128i*)(pOut + i + 8), _mm_mullo_epi16(_mm_cvtepi8_epi16(_mm_srli_si128(bytes, 8)), factors));
+    }
+    return i;
+}
+
+CPU_TARGET_AVX2 std::size_t wvsm_expand_avx2(const uint8_t*& pData, const uint8_t* pDataEnd, int16_t* pOut, std::size_t numSamples, int sel, int ser)
+{
+    const __m256i escape = _mm256_set1_epi8((char)0x80);
+    const __m256i factors = _mm256_set1_epi32((int)((1u << sel) | (1u << ser) << 16));
+    std::size_t i = 0;
+    for (; i + 32 <= numSamples && pDataEnd - pData >= 32; i += 32, pData += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256((const __m256i*)pData);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, escape)) != 0)
+            break;
+        _mm256_storeu_si256((__m256i*)(pOut + i), _mm256_mullo_epi16(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(bytes)), factors));
+        _mm256_storeu_si256((__m256i*)(pOut + i + 16), _mm256_mullo_epi16(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(bytes, 1)), factors));
+    }
+    return i;
+}
+
+CPU_TARGET_AVX512 std::size_t wvsm_expand_avx512(const uint8_t*& pData, const uint8_t* pDataEnd, int16_t* pOut, std::size_t numSamples, int sel, int ser)
+{
+    const __m512i escape = _mm512_set1_epi8((char)0x80);
+    const __m512i factors = _mm512_set1_epi32((int)((1u << sel) | (1u << ser) << 16));
+    std::size_t i = 0;
+    for (; i + 64 <= numSamples && pDataEnd - pData >= 64; i += 64, pData += 64)
+    {
+        const __m512i bytes = _mm512_loadu_si512((const void*)pData);
+        if (_mm512_cmpeq_epi8_mask(bytes, escape) != 0)
+            break;
+        _mm512_storeu_si512((void*)(pOut + i), _mm512_mullo_epi16(_mm512_cvtepi8_epi16(_mm512_castsi512_si256(bytes)), factors));
+        _mm512_storeu_si512((void*)(pOut + i + 32), _mm512_mullo_epi16(_mm512_cvtepi8_epi16(_mm512_extracti64x4_epi64(bytes, 1)), factors));
+    }
+    return i;
+}
+
+const WvsmExpandFunction kWvsmExpandVariants[CpuDispatch::kNumIsas] = { nullptr, wvsm_expand_sse41, wvsm_expand_avx2, wvsm_expand_avx512 };
+
+#else
+
+const WvsmExpandFunction kWvsmExpandVariants[CpuDispatch::kNumIsas] = {};
+
+#endif // CPU_DISPATCH_X86
+
+} // namespace
+
 IndyWV::IndyWV()
+{
+    // The table is shared: built once, even when converters are created from several threads
+    static const bool bDeltaTableBuilt = (build_delta_table(), true);
+    (void)bDeltaTableBuilt;
+}
+
+void IndyWV::build_delta_table()
 {
     // Build index data
     for (uint32_t i = 0; i < 0x40; ++i)
@@ -57,90 +145,103 @@ IndyWV::IndyWV()
     }
 }
 
-void IndyWV::wv_to_wav(const std::string& in_WvPath, std::string& in_outFilePath)
+bool IndyWV::decode(const uint8_t* pWvData, size_t wvSize, PcmSink& sink)
 {
-    std::ifstream file(in_WvPath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return;
-
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
 
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize))
-        return;
+    if (wvSize < sizeof(IndyWVHeader))
+        return false;
 
-    const auto* wvHeader = reinterpret_cast<const IndyWVHeader*>(buffer.data());
+    const auto* wvHeader = reinterpret_cast<const IndyWVHeader*>(pWvData);
     assert(strncmp((char*)wvHeader->tag, IndyWV::kIndyWV, 6) == 0);
 
-    char* outBuffer = new char[wvHeader->decompressedSize];
-    memset(outBuffer, 0, wvHeader->decompressedSize);
+    PcmFormat format;
+    format.numChannels = (uint16_t)wvHeader->numChannels;
+    format.sampleRate = wvHeader->sampleRate;
+    format.bitSize = (uint16_t)wvHeader->sampleBitSize;
 
-    file.seekg(sizeof(IndyWVHeader), std::ios::beg);
+    if (!sink.begin(format, (uint32_t)wvHeader->decompressedSize))
+        return false;
 
-    decompress(file, wvHeader->dataSize, outBuffer, wvHeader->decompressedSize);
-    Wave::write(in_outFilePath, outBuffer,
-        wvHeader->decompressedSize, wvHeader->numChannels, wvHeader->sampleRate, wvHeader->sampleBitSize);
+    if (format.bitSize >= 8)
+        Stats::add(Stats::ECounter::Samples, (uint32_t)wvHeader->decompressedSize / (format.bitSize / 8));
 
-    delete[] outBuffer;
+    decompress(pWvData + sizeof(IndyWVHeader), wvSize - sizeof(IndyWVHeader), wvHeader->dataSize, wvHeader->decompressedSize, sink);
+    return sink.end();
 }
 
-void IndyWV::wav_to_wv(const std::string& in_WavPath, std::string& in_outFilePath)
+void IndyWV::wav_to_wv(const uint8_t* pWavData, size_t wavSize, std::string& in_outFilePath, Utils::FileStore* pStore)
 {
-    using namespace Wave;
-
-    std::ifstream file(in_WavPath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return;
-
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize))
+    Wave::Reader reader;
+    if (!reader.open(pWavData, wavSize))
+    {
+        std::cerr << "Can't read WAV data for " << in_outFilePath << ": " << reader.get_error() << "\n";
         return;
+    }
 
-    const auto* wavHeader = reinterpret_cast<const WavHeader*>(buffer.data());
-    assert(strncmp((char*)wavHeader->tagRIFF, kRIFF, 4) == 0);
+    encode_wv(reader, in_outFilePath, pStore);
+}
 
-    file.seekg(sizeof(WavHeader), std::ios::beg);
+void IndyWV::encode_wv(Wave::Reader& reader, std::string& in_outFilePath, Utils::FileStore* pStore)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Encode);
 
-    auto dataToRead = wavHeader->dataChunkSize;
-    char* inBuffer = new char[dataToRead];
-    memset(inBuffer, 0, dataToRead);
-    file.read(inBuffer, dataToRead);
+    PcmFormat format = reader.get_source_format();
+    format.bitSize = 16; // the encoder works on 16-bit samples, converted by the reader if needed
 
-    if (wavHeader->numChannels == 1)
+    if (format.numChannels == 1)
     {
         // INDYWV ADPCM compression
-        auto outSize = wavHeader->dataChunkSize / 2;
-        char* outBuffer = new char[outSize];
-        memset(outBuffer, 0, outSize);
+        const int16_t* inSamples = reader.get_samples16();
+        const uint32_t numSamples = reader.get_num_frames();
+        const uint32_t decompressedSize = numSamples * sizeof(int16_t);
 
-        auto state = DecompressorState();
-        auto compressedSize = compressADPCM(&state, outBuffer, inBuffer, outSize, wavHeader->numChannels);
+        // Worst case: every sample is an escape code (7-bit code + raw 16-bit sample)
+        std::vector<char> outBuffer(numSamples * 3 + 16, 0);
 
-        write_wv_file(in_outFilePath, wavHeader, outBuffer, compressedSize);
+        Stats::add(Stats::ECounter::Samples, numSamples);
+
+        auto state = DecompressorState();
+        auto compressedSize = compressADPCM(&state, outBuffer.data(), (const char*)inSamples, numSamples, format.numChannels);
 
-        delete[] outBuffer;
+        write_wv_file(in_outFilePath, format, decompressedSize, outBuffer.data(), compressedSize, pStore);
     }
     else
     {
         // TODO handle WVSM compression
+        std::cerr << "INDYWV: only mono sounds can be encoded, " << in_outFilePath << " not written\n";
     }
+}
+
+bool IndyWV::is_wvsm(const uint8_t* pData, size_t availableSize)
+{
+    using namespace Utils;
+
+    // Same stream preamble as checked by decompress()
+    if (availableSize < 10)
+        return false;
 
-    delete[] inBuffer;
+    const uint8_t* pDataEnd = pData + availableSize;
+    auto stepindex0 = readBytes<int8_t>(pData, pDataEnd);
+    auto keysample0 = swap16(readBytes<int16_t>(pData, pDataEnd));
+    auto stepindex1 = readBytes<int8_t>(pData, pDataEnd);
+    auto keysample1 = swap16(readBytes<int16_t>(pData, pDataEnd));
+
+    return stepindex0 < 0 && stepindex1 == 0x64 && keysample0 == 0x1111 && keysample1 == 0x2222 &&
+        strncmp((const char*)pData, kWVSM, 4) == 0;
 }
 
-void IndyWV::decompress(std::ifstream& istream, uint32_t inputDataSize, char* outBuffer, uint32_t infSize)
-{ 
+void IndyWV::decompress(const uint8_t* pData, size_t availableSize, uint32_t inputDataSize, uint32_t infSize, PcmSink& sink)
+{
     using namespace Utils;
 
+    const uint8_t* pDataEnd = pData + availableSize;
+
     uint16_t numChannels = 1;
     auto state = DecompressorState();
 
-    auto unknownParam1 = readBytes<int8_t>(istream);
-    auto unknownParam2 = readBytes<int16_t>(istream);
+    auto unknownParam1 = readBytes<int8_t>(pData, pDataEnd);
+    auto unknownParam2 = readBytes<int16_t>(pData, pDataEnd);
 
     if (unknownParam1 < 0)
     {
@@ -151,49 +252,55 @@ void IndyWV::decompress(std::ifstream& istream, uint32_t inputDataSize, char* ou
     state.keysample[0] = swap16(unknownParam2);
     if (numChannels > 1)
     {
-        state.stepindex[1] = readBytes<int8_t>(istream);
-        state.keysample[1] = swap16(readBytes<int16_t>(istream));
+        state.stepindex[1] = readBytes<int8_t>(pData, pDataEnd);
+        state.keysample[1] = swap16(readBytes<int16_t>(pData, pDataEnd));
     }
 
-    char WVSMHeader[4];
-    peekChar(istream, WVSMHeader, 4);
-
     if (numChannels == 2 &&
         state.stepindex[1] == 0x64 &&
         state.keysample[0] == 0x1111 &&
         state.keysample[1] == 0x2222 &&
-        strncmp(WVSMHeader, kWVSM, 4) == 0
+        pData + 4 <= pDataEnd &&
+        strncmp((const char*)pData, kWVSM, 4) == 0
         )
     {
-        // WVSM decompression
-        istream.read((char*)&WVSMHeader, 4); // advance
+        // WVSM decompression, streamed block by block. Timed as a whole by decode():
+        // no timer per block, which would read the counters twice every 4 KiB.
+        pData += 4;
 
         constexpr std::size_t blockSize = 4096;
-        short* outPtr = (short*)outBuffer;
         for (std::size_t i = 0; i < infSize / blockSize; i++)
         {
-            wvsmInflateBlock(istream, blockSize, outPtr);
+            wvsmInflateBlock(pData, pDataEnd, blockSize, (short*)sink.reserve(blockSize));
+            sink.commit(blockSize);
         }
 
         // Read the remaining data, shorter than 1 block
-        wvsmInflateBlock(istream, infSize % blockSize, outPtr);
-
+        std::size_t remainingSize = infSize % blockSize;
+        if (remainingSize > 0)
+        {
+            char* outData = sink.reserve(remainingSize);
+            outData[remainingSize - 1] = 0; // odd size: last byte isn't part of a sample
+            wvsmInflateBlock(pData, pDataEnd, remainingSize, (short*)outData);
+            sink.commit(remainingSize);
+        }
     }
     else
     {
-        // ADPCM decompression
-        auto dataToRead = inputDataSize;
-        char* inBuffer = new char[dataToRead];
-        memset(inBuffer, 0, dataToRead);
-        istream.read(inBuffer, dataToRead);
-
-        decompressADPCM(&state, outBuffer, inBuffer, infSize / (uint16_t)(numChannels << 1), numChannels);
-
-        delete[] inBuffer;
+        // ADPCM decompression. Stereo streams store the whole left channel before
+        // the right one, so the output is produced in a single chunk.
+        auto dataToRead = std::min<size_t>(inputDataSize, pDataEnd - pData);
+        std::vector<char> inBuffer(inputDataSize + 4, 0);
+        memcpy(inBuffer.data(), pData, dataToRead);
+
+        char* outBuffer = sink.reserve(infSize);
+        memset(outBuffer, 0, infSize);
+        decompressADPCM(&state, outBuffer, inBuffer.data(), infSize / (uint16_t)(numChannels << 1), numChannels);
+        sink.commit(infSize);
     }
 }
 
-void IndyWV::wvsmInflateBlock(std::ifstream& istream, std::size_t blockSize, short*& outData)
+void IndyWV::wvsmInflateBlock(const uint8_t*& pData, const uint8_t* pDataEnd, std::size_t blockSize, short* outData)
 {
     using namespace Utils;
 
@@ -202,17 +309,17 @@ void IndyWV::wvsmInflateBlock(std::ifstream& istream, std::size_t blockSize, sho
         return;
     }
 
-    auto compressedSize = swap16(readBytes<uint16_t>(istream)); // Note, big endian size
-    const char se = readBytes<char>(istream); // sample expander
+    readBytes<uint16_t>(pData, pDataEnd); // compressed size (big endian), not needed to inflate
+    const char se = readBytes<char>(pData, pDataEnd); // sample expander
     const int sel = se >> 4;
     const int ser = se & 0xF;
 
     auto getChannelSample = [&](int expander) -> uint16_t
     {
-        uint16_t val = readBytes<unsigned char>(istream);
+        uint16_t val = readBytes<unsigned char>(pData, pDataEnd);
         if (val == 0x80)
         {
-            auto s = readBytes<uint16_t>(istream);
+            auto s = readBytes<uint16_t>(pData, pDataEnd);
             val = swap16(s);
         }
         else {
@@ -221,22 +328,25 @@ void IndyWV::wvsmInflateBlock(std::ifstream& istream, std::size_t blockSize, sho
         return val;
     };
 
-    for (std::size_t i = 0; i < nSamples; i += 2)
+    // Vector runs between the escape codes (there is no sane shift for a negative left expander)
+    const WvsmExpandFunction expand = (sel >= 0) ? CpuDispatch::select_variant(kWvsmExpandVariants) : nullptr;
+
+    std::size_t i = 0;
+    while (i < nSamples)
     {
-        auto val = getChannelSample(sel);
-        *outData = val;
-        outData++;
-        if (i + 1 >= nSamples)
-            return;
-
-        val = getChannelSample(ser);
-        *outData = val;
-        outData++;
+        if (expand)
+            i += expand(pData, pDataEnd, outData + i, nSamples - i, sel, ser);
+
+        const std::size_t runEnd = expand ? std::min(nSamples, i + kWvsmScalarRun) : nSamples;
+        for (; i < runEnd; i++)
+            outData[i] = getChannelSample((i & 1) ? ser : sel);
     }
 }
 
 void IndyWV::decompressADPCM(DecompressorState* compState, char* outData, char* in_data, int dataSize, unsigned int numChannels)
 {
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
+
     int accStep = 0;
 
     unsigned __int16 inDataSwap = _byteswap_ushort(*(uint16_t*)in_data);
@@ -314,119 +424,285 @@ void IndyWV::decompressADPCM(DecompressorState* compState, char* outData, char*
     }
 }
 
-int IndyWV::compressADPCM(DecompressorState* compState, char* outData, char* inData, int sndDataSize, unsigned int numChannels)
+int IndyWV::compressADPCM(DecompressorState* compState, char* outData, const char* inData, int sndDataSize, unsigned int numChannels)
 {
     if (numChannels == 0)
         return 0;
 
-    int v9 = 0;
+    int bits = 0;
     char accStep = 0;
     char* pOutData = outData;
-    int v38 = 0;
 
     for (uint8_t iChan = 0; iChan < numChannels; iChan++)
     {
-        char* pInData = inData;
         int lastIndex = *(char*)(compState + iChan);
         int lastData = compState->keysample[iChan];
-        int v30 = lastData;
 
-        int remainingData = sndDataSize;
-        while (remainingData)
+        pOutData = compressADPCMChannel(lastIndex, lastData, bits, accStep, pOutData, inData, sndDataSize);
+
+        *(unsigned char*)(iChan + compState) = lastIndex;
+        compState->keysample[iChan] = lastData;
+        inData += 2;
+    }
+
+    if ((accStep & 7) != 0)
+        *pOutData++ = bits << (8 - (accStep & 7));
+
+    int writtenBytes = (int)(pOutData - outData);
+    return writtenBytes + 4;
+}
+
+char* IndyWV::compressADPCMChannel(int& io_lastIndex, int& io_lastData, int& io_bits, char& io_accStep, char* pOutData, const char* pInData, int numSamples)
+{
+    int lastIndex = io_lastIndex;
+    int lastData = io_lastData;
+    int bits = io_bits;
+    char accStep = io_accStep;
+
+    int remainingData = numSamples;
+    while (remainingData)
+    {
+        int v32 = 0;
+        int offset = 0;
+        uint16_t v13 = aStepTable[lastIndex];
+        char initialized = 0;
+        int v14 = *(const __int16*)pInData;
+        int v17 = v14 - lastData;
+        unsigned char step = aStepBits[lastIndex];
+        int stepshift = 1 << (step - 1);
+        char tempOffset = stepshift - 1;
+        if (v17 < 0)
         {
-            int v32 = 0;
-            int offset = 0;
-            uint16_t v13 = aStepTable[lastIndex];
-            char initialized = 0;
-            int v14 = *(__int16*)pInData;
-            int v17 = v14 - lastData;
-            unsigned char step = aStepBits[lastIndex];
-            int stepshift = 1 << (step - 1);
-            char tempOffset = stepshift - 1;
-            if (v17 < 0)
-            {
-                initialized = 1 << ((step - 1) & 0x1f);
-                v17 = -v17;
-            }
-            int v20 = stepshift >> 1;
-            int v21 = step - 1;
-            if (step != 1)
+            initialized = 1 << ((step - 1) & 0x1f);
+            v17 = -v17;
+        }
+        int v20 = stepshift >> 1;
+        int v21 = step - 1;
+        if (step != 1)
+        {
+            for (int iStep = step - 1; iStep > 0; --iStep)
             {
-                for (int iStep = step - 1; iStep > 0; --iStep)
+                if (v17 >= v13)
                 {
-                    if (v17 >= v13)
-                    {
-                        v17 -= v13;
-                        offset |= v20;
-                        v21 = v13 + v32;
-                        v32 += v13;
-                    }
-                    v13 >>= 1;
-                    v20 >>= 1;
+                    v17 -= v13;
+                    offset |= v20;
+                    v21 = v13 + v32;
+                    v32 += v13;
                 }
+                v13 >>= 1;
+                v20 >>= 1;
             }
-            if (offset)
-                v32 += v13;
-            unsigned __int8 v23 = 8 - (accStep & 7);
-            LOWORD(v21) = (uint8_t)(offset | initialized);
-            v9 = (v38 << step) | v21;
-            v38 = v9;
-            accStep += step;
-            if (step >= v23)
-                *pOutData++ = (uint16_t)v9 >> (step - v23);
-            if (offset == tempOffset)
-            {
-                __int16 v24 = *(__int16*)pInData;
-                unsigned __int16 v26;
-                LOBYTE(v26) = BYTE1(v24);
-                HIBYTE(v26) = v9;
-                char* v27 = pOutData + 1;
-                *pOutData = v26 >> (accStep & 7);
-                v9 = (unsigned __int16)v24;
-                v38 = (unsigned __int16)v24;
-                pOutData += 2;
-                *v27 = (unsigned __int16)v24 >> (accStep & 7);
-
-                lastData = v24;
-            }
-            else
-            {
-                lastData += initialized ? -v32 : v32;
-                lastData = Utils::clamp(lastData, -32768, 32767);
-            }
+        }
+        if (offset)
+            v32 += v13;
+        unsigned __int8 v23 = 8 - (accStep & 7);
+        LOWORD(v21) = (uint8_t)(offset | initialized);
+        bits = (bits << step) | v21;
+        accStep += step;
+        if (step >= v23)
+            *pOutData++ = (uint16_t)bits >> (step - v23);
+        if (offset == tempOffset)
+        {
+            __int16 v24 = *(const __int16*)pInData;
+            unsigned __int16 v26;
+            LOBYTE(v26) = BYTE1(v24);
+            HIBYTE(v26) = bits;
+            char* v27 = pOutData + 1;
+            *pOutData = v26 >> (accStep & 7);
+            bits = (unsigned __int16)v24;
+            pOutData += 2;
+            *v27 = (unsigned __int16)v24 >> (accStep & 7);
+
+            lastData = v24;
+        }
+        else
+        {
+            lastData += initialized ? -v32 : v32;
+            lastData = Utils::clamp(lastData, -32768, 32767);
+        }
 
-            lastIndex += aIndexTableTable[step][offset];
-            lastIndex = Utils::clamp(lastIndex, 0, 88);
+        lastIndex += aIndexTableTable[step][offset];
+        lastIndex = Utils::clamp(lastIndex, 0, 88);
 
-            pInData += 2;
-            --remainingData;
-        }
+        pInData += 2;
+        --remainingData;
+    }
 
-        *(unsigned char*)(iChan + compState) = lastIndex;
-        compState->keysample[iChan] = lastData;
-        inData += 2;
+    io_lastIndex = lastIndex;
+    io_lastData = lastData;
+    io_bits = bits;
+    io_accStep = accStep;
+    return pOutData;
+}
+
+void IndyWV::write_wv_file(std::string& path, const PcmFormat& format, uint32_t decompressedSize, const char* inData, uint32_t compressedSize, Utils::FileStore* pStore)
+{
+    using namespace Utils;
+
+    OutputFile file;
+    if (!file.open(path, pStore))
+        return;
+
+    file.write(IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV));
+    writeInt(file, (uint32_t)(format.sampleRate));
+    writeInt(file, (uint32_t)(format.bitSize));
+    writeInt(file, (uint32_t)(format.numChannels));
+    const uint32_t preambleSize = (format.numChannels == 2) ? 6 : 3;
+    writeInt(file, (uint32_t)(compressedSize + preambleSize));
+    writeInt(file, (int32_t)0);
+    writeInt(file, (int32_t)decompressedSize);
+
+    // Stream preamble: initial step index and key sample of each channel.
+    // The step index of the left channel is complemented in stereo streams.
+    writeInt(file, (int8_t)(format.numChannels == 2 ? ~0 : 0));
+    writeInt(file, (int16_t)0);
+    if (format.numChannels == 2)
+    {
+        writeInt(file, (int8_t)0);
+        writeInt(file, (int16_t)0);
     }
+    file.write(inData, compressedSize - 4);
+}
 
-    if ((accStep & 7) != 0)
-        *pOutData++ = v9 << (8 - (accStep & 7));
+void IndyWV::write_wvsm_file(std::string& path, const PcmFormat& format, uint32_t decompressedSize, const uint8_t* pWvsmData, size_t wvsmSize, Utils::FileStore* pStore)
+{
+    using namespace Utils;
 
-    int writtenBytes = (int)(pOutData - outData);
-    return writtenBytes + 4;
+    OutputFile file;
+    if (!file.open(path, pStore))
+        return;
+
+    file.write(IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV));
+    writeInt(file, (uint32_t)(format.sampleRate));
+    writeInt(file, (uint32_t)(format.bitSize));
+    writeInt(file, (uint32_t)(format.numChannels));
+    writeInt(file, (uint32_t)(wvsmSize + 10));
+    writeInt(file, (int32_t)0);
+    writeInt(file, (int32_t)decompressedSize);
+
+    // Same preamble as checked by is_wvsm()
+    writeInt(file, (int8_t)~0);
+    writeInt(file, (int16_t)0x1111);
+    writeInt(file, (int8_t)0x64);
+    writeInt(file, (int16_t)0x2222);
+    file.write(kWVSM, sizeof(kWVSM));
+    file.write(pWvsmData, wvsmSize);
 }
 
-void IndyWV::write_wv_file(std::string& path, const Wave::WavHeader* wavHeader, char* inData, uint32_t compressedSize)
+IndyWV::Writer::~Writer()
+{
+    if (bOpen)
+        end();
+}
+
+bool IndyWV::Writer::begin(const PcmFormat& format, uint64_t)
 {
     using namespace Utils;
 
-    std::ofstream os(path, std::ofstream::binary);
-    os.write(IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV));
-    writeInt(os, (uint32_t)(wavHeader->sampleRate));
-    writeInt(os, (uint32_t)(wavHeader->bitDepth));
-    writeInt(os, (uint32_t)(wavHeader->numChannels));
-    writeInt(os, (uint32_t)(compressedSize + 3));
-    writeInt(os, (int32_t)0);
-    writeInt(os, (int32_t)wavHeader->dataChunkSize);
-    writeInt(os, (int8_t)0); // Unknown
-    writeInt(os, (int16_t)0); // Unknown
-    os.write((char*)inData, compressedSize - 4);
+    if (format.numChannels != 1 || format.bitSize != 16 || format.bFloat)
+    {
+        std::cerr << "INDYWV: only mono 16-bit PCM can be encoded, " << path << " not written\n";
+        return false;
+    }
+
+    if (!file.open(path, pStore))
+        return false;
+
+    bOpen = true;
+    pendingSize = 0;
+    lastIndex = lastData = bits = 0;
+    accStep = 0;
+    numSamples = encodedSize = 0;
+
+    // Same header as write_wv_file(), sizes patched in end()
+    file.write(IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV));
+    writeInt(file, (uint32_t)(format.sampleRate));
+    writeInt(file, (uint32_t)(format.bitSize));
+    writeInt(file, (uint32_t)(format.numChannels));
+    writeInt(file, (uint32_t)0);
+    writeInt(file, (int32_t)0);
+    writeInt(file, (int32_t)0);
+
+    // Stream preamble: initial step index and key sample
+    writeInt(file, (int8_t)0);
+    writeInt(file, (int16_t)0);
+    return true;
+}
+
+char* IndyWV::Writer::reserve(size_t size)
+{
+    if (pending.size() < pendingSize + size)
+        pending.resize(pendingSize + size);
+    return pending.data() + pendingSize;
+}
+
+void IndyWV::Writer::commit(size_t size)
+{
+    // Dropped when begin() failed, instead of buffering the whole stream
+    if (!bOpen)
+        return;
+
+    pendingSize += size;
+    const uint32_t chunkSamples = (uint32_t)(pendingSize / sizeof(int16_t));
+    if (chunkSamples == 0)
+        return;
+
+    encode(pending.data(), chunkSamples);
+
+    // Odd chunk size: the last byte goes with the next chunk
+    pendingSize -= chunkSamples * sizeof(int16_t);
+    if (pendingSize)
+        pending[0] = pending[chunkSamples * sizeof(int16_t)];
+}
+
+void IndyWV::Writer::write(const void* pData, size_t size)
+{
+    if (!bOpen)
+        return;
+
+    // Encoded in place, unless there is an odd byte to prepend
+    if (pendingSize == 0 && size % sizeof(int16_t) == 0)
+    {
+        if (size > 0)
+            encode((const char*)pData, (uint32_t)(size / sizeof(int16_t)));
+        return;
+    }
+    PcmSink::write(pData, size);
+}
+
+void IndyWV::Writer::encode(const char* pSamples, uint32_t chunkSamples)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Encode);
+
+    // Worst case: every sample is an escape code (7-bit code + raw 16-bit sample)
+    char* pOutData = file.reserve((size_t)chunkSamples * 3 + 16);
+    char* pOutEnd = compressADPCMChannel(lastIndex, lastData, bits, accStep, pOutData, pSamples, (int)chunkSamples);
+    file.commit(pOutEnd - pOutData);
+
+    numSamples += chunkSamples;
+    encodedSize += (uint32_t)(pOutEnd - pOutData);
+}
+
+bool IndyWV::Writer::end()
+{
+    if (!bOpen)
+        return false;
+    bOpen = false;
+
+    if ((accStep & 7) != 0)
+    {
+        const char lastByte = (char)(bits << (8 - (accStep & 7)));
+        file.write(&lastByte, 1);
+        encodedSize++;
+    }
+
+    // Same sizes as written by wav_to_wv() (compressADPCM() counts 4 bytes more than it writes)
+    const uint32_t dataSize = encodedSize + 4 + 3;
+    const int32_t decompressedSize = (int32_t)(numSamples * sizeof(int16_t));
+    file.write_at(offsetof(IndyWVHeader, dataSize), &dataSize, sizeof(dataSize));
+    file.write_at(offsetof(IndyWVHeader, decompressedSize), &decompressedSize, sizeof(decompressedSize));
+
+    pending.clear();
+    pending.shrink_to_fit();
+    return file.close();
 }
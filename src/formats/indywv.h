@@ -1,11 +1,14 @@
 #pragma once
 
-#include <fstream>
+#include <string>
+#include <vector>
 
 #include "common.h"
+#include "pcm_sink.h"
+#include "utils.h"
 
 namespace Wave {
-    struct WavHeader;
+    class Reader;
 }
 
 PACK(struct IndyWVHeader
@@ -35,18 +38,75 @@ public:
         int16_t keysample[2];
     };
 
-    void wv_to_wav(const std::string& in_WvPath, std::string& in_outFilePath);
-    void wav_to_wv(const std::string& in_WavPath, std::string& in_outFilePath);
+    // Output files go to the given store
+    void wav_to_wv(const uint8_t* pWavData, size_t wavSize, std::string& in_outFilePath, Utils::FileStore* pStore);
 
-    void write_wv_file(std::string& path, const Wave::WavHeader* wavHeader, char* inData, uint32_t compressedSize);
+    void write_wv_file(std::string& path, const PcmFormat& format, uint32_t decompressedSize, const char* inData, uint32_t compressedSize, Utils::FileStore* pStore);
 
-    void decompress(std::ifstream& istream, uint32_t inputDataSize, char* outBuffer, uint32_t infSize);
+    // Writes an INDYWV file around a WVSM stream (blocks as read by wvsmInflateBlock). WVSM streams are stereo.
+    void write_wvsm_file(std::string& path, const PcmFormat& format, uint32_t decompressedSize, const uint8_t* pWvsmData, size_t wvsmSize, Utils::FileStore* pStore);
 
-private:
-    void wvsmInflateBlock(std::ifstream& istream, std::size_t blockSize, short*& outData);
+    // Decodes a whole INDYWV file held in memory (header included)
+    bool decode(const uint8_t* pWvData, size_t wvSize, PcmSink& sink);
+
+    // Decodes the compressed stream following the INDYWV header
+    void decompress(const uint8_t* pData, size_t availableSize, uint32_t inputDataSize, uint32_t infSize, PcmSink& sink);
+
+    // Whether the compressed stream following the INDYWV header is WVSM (otherwise ADPCM). Only reads its first bytes.
+    static bool is_wvsm(const uint8_t* pData, size_t availableSize);
+
+    // Codec kernels, also driven directly by the benchmarks (MiscAudioBench)
+    void wvsmInflateBlock(const uint8_t*& pData, const uint8_t* pDataEnd, std::size_t blockSize, short* outData);
     void decompressADPCM(DecompressorState* compState, char* outData, char* in_data, int dataSize, unsigned int numChannels);
 
-    int compressADPCM(DecompressorState* compState, char* outData, char* in_data, int dataSize, unsigned int numChannels);
+    int compressADPCM(DecompressorState* compState, char* outData, const char* in_data, int dataSize, unsigned int numChannels);
+
+    //-------------------------------------------------------------------------
+    // ADPCM encoder fed by any decoder (e.g. APC to INDYWV, with -format wv):
+    // each chunk of PCM is encoded as soon as it is committed, carrying the
+    // predictor and bit stream state over to the next one, so the output is
+    // the same as encoding the whole WAV file at once. Mono 16-bit PCM only,
+    // like wav_to_wv(). The header sizes are patched on end().
+    //-------------------------------------------------------------------------
+    class Writer : public PcmSink
+    {
+    public:
+        // The file goes to the store (as a stream, or whole on end())
+        Writer(const std::string& in_path, Utils::FileStore* in_pStore) : path(in_path), pStore(in_pStore) {}
+        ~Writer() override;
+
+        bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+        char* reserve(size_t size) override;
+        void commit(size_t size) override;
+        void write(const void* pData, size_t size) override;
+        bool end() override;
+
+    private:
+        void encode(const char* pSamples, uint32_t chunkSamples);
+
+        const std::string path;
+        Utils::FileStore* const pStore;
+        Utils::OutputFile file;
+
+        std::vector<char> pending; // PCM not encoded yet (an odd byte left by the last chunk)
+        size_t pendingSize = 0;
+
+        int lastIndex = 0;
+        int lastData = 0;
+        int bits = 0;
+        char accStep = 0;
+        uint32_t numSamples = 0;
+        uint32_t encodedSize = 0;
+        bool bOpen = false;
+    };
+
+private:
+    static void build_delta_table();
+
+    void encode_wv(Wave::Reader& reader, std::string& in_outFilePath, Utils::FileStore* pStore);
+
+    // Appends the ADPCM codes of one channel to the bit stream (bits: pending bits, accStep: bits written so far)
+    static char* compressADPCMChannel(int& io_lastIndex, int& io_lastData, int& io_bits, char& io_accStep, char* pOutData, const char* pInData, int numSamples);
 
     static const char* aIndexTableTable[8];
 
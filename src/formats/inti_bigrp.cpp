@@ -3,23 +3,35 @@
 #include "inti_icelib.h"
 
 #include <string>
-#include <fstream>
 #include <sstream>
 #include <vector>
 
 #include <iostream>
 #include <iomanip> 
+#include <memory>
 #include <assert.h>
 #include <bitset>
 #include <tuple>
-#include <filesystem>
 
 #include "midi.h"
+#include "soundfont.h"
+#include "stats.h"
+#include "trace.h"
 #include "wave.h"
 #include "utils.h"
 
 namespace Inti {
 
+// File name without its folder and extension
+std::string get_stem(const std::string& filepath)
+{
+    const size_t nameStart = filepath.find_last_of("/\\") + 1;
+    size_t extensionStart = filepath.find_last_of('.');
+    if (extensionStart == std::string::npos || extensionStart <= nameStart)
+        extensionStart = filepath.size();
+    return filepath.substr(nameStart, extensionStart - nameStart);
+}
+
 std::pair<std::string, std::string> get_current_song_name(const std::string& sequence_stem, bool bGroup)
 {
     std::string common_stem = sequence_stem;
@@ -49,81 +61,75 @@ std::pair<std::string, std::string> get_current_song_name(const std::string& seq
     return { song_name, track_name };
 }
 
-void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& options)
+bool bigrp_to_midi(std::string filepath, const uint8_t* pData, size_t dataSize, std::string out_folder, BigrpOptions& options)
 {
-    std::ifstream file(filepath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return;
-
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
 
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize))
-        return;
-
-    auto* pData = (uint8_t*)buffer.data();
-
-    icelib::bigrp_header_t header;
-    if (!icelib::parse_bigrp_header(&header, pData, fileSize))
-        return;
+    std::vector<Subsong> subsongs;
+    if (!list_subsongs(filepath, pData, dataSize, options.game, subsongs))
+        return false;
 
-    fill_mappings_from_game_id(options);
+    std::string bigrpName = get_stem(filepath);
 
-    std::string bigrpName = std::filesystem::path(filepath).stem().string();
+    // Resolved once per file: per-entry lookups are then a binary search on entry ranges
+    const MappingTable* mappings = find_mapping_table(options.game, bigrpName);
 
     GlobalMidiFile* mergedMidiFile = nullptr;
+    std::unique_ptr<SoundFont::Builder> soundFont; // created on the first embedded sample
 
     if (options.bExportMergedMidis)
     {
         mergedMidiFile = new GlobalMidiFile(
             out_folder,
-            (options.bPrefixWithBigrpName ? bigrpName : "")
+            (options.bPrefixWithBigrpName ? bigrpName : ""),
+            options.pStore
         );
     }
 
-    for (int iSong = 0; iSong < header.total_subsongs; iSong++)
+    for (const Subsong& subsong : subsongs)
     {
-        int offset = header.head_size + header.entry_size * iSong;
-        assert(offset < fileSize);
+        const int iSong = subsong.index;
+        Trace::Span span("bigrp_song", bigrpName, iSong);
 
-        const uint8_t* entryData = pData + offset;
-        icelib::bigrp_entry_t entry;
-        if (!icelib::bigrp_entry_parse(&entry, entryData))
+        // Entries without data (ranges, DCT, out of bounds) have nothing to convert
+        if (subsong.dataSize == 0)
             continue;
 
-        auto codec = static_cast<icelib::EntryCodec>(entry.codec);
-
-        switch (codec)
+        switch (static_cast<icelib::EntryCodec>(subsong.codec))
         {
-        case icelib::EntryCodec::Range:
-            break;
         case icelib::EntryCodec::Data:
-            break;
-        case icelib::EntryCodec::DCT:
-            break;
-        case icelib::EntryCodec::Midi:
         {
-            uint32_t offsetInHeader = icelib::get_u32le(entryData + 0x10);
-            uint32_t midiDataSize = icelib::get_u32le(entryData + 0x14);
-            int midiDataStartOffset = header.head_size + (header.entry_size * iSong) + offsetInHeader;
-            assert(midiDataStartOffset < fileSize);
+            if (!options.bExportSoundFont)
+                break;
 
-            const uint8_t* pMidiData = pData + midiDataStartOffset;
-            assert(strncmp((char*)pMidiData, "MThd", 4) == 0);
+            const uint8_t* pWavData = pData + subsong.dataOffset;
+            if (subsong.dataSize < 12 || strncmp((const char*)pWavData, Wave::kRIFF, 4) != 0)
+                break;
 
-            std::string sequence_name = MidiUtils::get_midi_sequence_name(pMidiData, midiDataSize);
-
-            std::string bigrp_stem = std::filesystem::path(filepath).stem().string();
-            auto mappingFound = std::find_if(options.mappings.begin(), options.mappings.end(),
-                [&bigrp_stem, &iSong](auto& e) { return e.bigrpFileName == bigrp_stem
-                && iSong >= e.entryRange.first && iSong <= e.entryRange.second; });
+            if (!soundFont)
+            {
+                std::string out_full_path = Utils::str_format("%s\\%s.sf2", out_folder.c_str(), bigrpName.c_str());
+                soundFont = std::make_unique<SoundFont::Builder>(out_full_path, bigrpName, options.pStore);
+            }
 
-            if (mappingFound != options.mappings.end())
+            std::string sample_name = Utils::str_format("%s_%03d", bigrpName.c_str(), iSong);
+            soundFont->add_wave(sample_name, pWavData, subsong.dataSize);
+            break;
+        }
+        case icelib::EntryCodec::Midi:
+        {
+            const uint8_t* pMidiData = pData + subsong.dataOffset;
+            const uint32_t midiDataSize = subsong.dataSize;
+            if (midiDataSize < 4 || strncmp((const char*)pMidiData, "MThd", 4) != 0)
             {
-                sequence_name = mappingFound->songName;
+                std::cerr << "Warning: BIGRP MIDI entry " << iSong << " of " << bigrpName << " isn't a MIDI file! Ignoring it...\n";
+                break;
             }
 
+            // Mapped song name, or the sequence name of the MIDI data
+            const std::string& sequence_name = subsong.sequenceName;
+            const Mapping* mappingFound = mappings ? mappings->find(iSong) : nullptr;
+
             if (options.bExportMidis)
             {
                 std::string out_file_name;
@@ -135,10 +141,10 @@ void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& o
                         out_file_name = sequence_name;
                 }
                 else
-                    out_file_name = Utils::str_format("%s_%03d", std::filesystem::path(filepath).stem().string().c_str(), iSong);
+                    out_file_name = Utils::str_format("%s_%03d", bigrpName.c_str(), iSong);
 
                 std::string out_full_path = Utils::str_format("%s\\%s.mid", out_folder.c_str(), out_file_name.c_str());
-                MidiUtils::write_raw_midi_file(out_full_path, pMidiData, midiDataSize);
+                MidiUtils::write_raw_midi_file(out_full_path, pMidiData, midiDataSize, options.pStore);
             }
 
             if (options.bExportMergedMidis)
@@ -146,15 +152,15 @@ void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& o
                 std::string out_file_name, track_name;
                 if (!sequence_name.empty())
                 {
-                    if (mappingFound != options.mappings.end())
+                    if (mappingFound)
                     {
                         out_file_name = sequence_name;
 
                         assert(mergedMidiFile);
                         int fileId = mergedMidiFile->get_current_midi_id();
-                        if (!mappingFound->trackNames.empty())
+                        if (mappingFound->trackNames)
                         {
-                            assert(mappingFound->trackNames.size() == 8);
+                            assert(fileId < kNumTracksPerSong);
                             track_name = mappingFound->trackNames[fileId];
                         }
                         else
@@ -169,7 +175,7 @@ void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& o
                 }
                 else
                 {
-                    out_file_name = Utils::str_format("%s_%03d", std::filesystem::path(filepath).stem().string().c_str(), iSong);
+                    out_file_name = Utils::str_format("%s_%03d", bigrpName.c_str(), iSong);
                     track_name = MidiUtils::get_midi_last_track_name(pMidiData, midiDataSize);
                 }
 
@@ -187,6 +193,69 @@ void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& o
         assert(mergedMidiFile);
         delete mergedMidiFile;
     }
+
+    if (soundFont && !soundFont->close())
+    {
+        std::cerr << "Error while writing the SF2 file for " << bigrpName << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool list_subsongs(const std::string& filepath, const uint8_t* pData, size_t dataSize, EGame game, std::vector<Subsong>& outSubsongs)
+{
+    const int64_t fileSize = (int64_t)dataSize;
+
+    icelib::bigrp_header_t header;
+    if (!icelib::parse_bigrp_header(&header, pData, fileSize))
+        return false;
+
+    std::string bigrpName = get_stem(filepath);
+    const MappingTable* mappings = find_mapping_table(game, bigrpName);
+
+    outSubsongs.clear();
+    for (int iSong = 0; iSong < header.total_subsongs; iSong++)
+    {
+        int64_t offset = (int64_t)header.head_size + (int64_t)header.entry_size * iSong;
+        if (offset + header.entry_size > fileSize)
+        {
+            std::cerr << "Warning: truncated BIGRP entry table in " << bigrpName << "\n";
+            break;
+        }
+
+        const uint8_t* entryData = pData + offset;
+
+        Subsong subsong;
+        subsong.index = iSong;
+
+        icelib::bigrp_entry_t entry;
+        if (icelib::bigrp_entry_parse(&entry, entryData))
+        {
+            int64_t dataStartOffset = offset + entry.body_offset;
+            if (dataStartOffset + entry.body_size <= fileSize)
+            {
+                subsong.dataOffset = (uint32_t)dataStartOffset;
+                subsong.dataSize = entry.body_size;
+            }
+            else
+            {
+                std::cerr << "Warning: BIGRP entry " << iSong << " of " << bigrpName << " out of bounds! Ignoring it...\n";
+            }
+            subsong.codec = entry.codec;
+        }
+
+        if (static_cast<icelib::EntryCodec>(subsong.codec) == icelib::EntryCodec::Midi && subsong.dataSize > 0)
+        {
+            const Mapping* mappingFound = mappings ? mappings->find(iSong) : nullptr;
+            if (mappingFound)
+                subsong.sequenceName = mappingFound->songName;
+            else
+                subsong.sequenceName = MidiUtils::get_midi_sequence_name(pData + subsong.dataOffset, subsong.dataSize);
+        }
+
+        outSubsongs.push_back(std::move(subsong));
+    }
+    return true;
 }
 
 } // namespace Inti
@@ -1,26 +1,41 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
+namespace Utils {
+    class FileStore;
+}
+
 namespace Inti {
 
     constexpr static char kBigrpTag[8] = { 0x0c, 0, 0, 0, 0x34, 0, 0 ,0 };
 
-    // List of currently handled/tested games
+    // List of currently handled/tested games (see inti_mappings.inl)
     enum EGame : uint8_t
     {
         Unknown,
-        Cotm1,
-        Cotm2
+#define INTI_GAME(id, name) id,
+#include "inti_mappings.inl"
+        Count
     };
 
+    constexpr int kNumTracksPerSong = 8;
+
     struct Mapping
     {
-        const std::string bigrpFileName;
-        const std::string songName;
-        const std::pair<int, int> entryRange;
-        const std::vector<std::string> trackNames;
+        const char* songName;
+        std::pair<int, int> entryRange;
+        const char* const* trackNames; // kNumTracksPerSong names, or nullptr
+    };
+
+    // Song mappings of a single BIGRP file, sorted by entry range
+    struct MappingTable
+    {
+        const Mapping* find(int entryId) const;
+
+        std::vector<Mapping> mappings;
     };
 
     struct BigrpOptions
@@ -28,13 +43,35 @@ namespace Inti {
         bool bPrefixWithBigrpName = false;
         bool bExportMidis = false;
         bool bExportMergedMidis = true;
+        bool bExportSoundFont = true; // embedded .wav files, packed into a single .sf2
 
         EGame game = EGame::Unknown;
-        std::vector<Mapping> mappings;
+
+        // Receives the output files (required by bigrp_to_midi)
+        Utils::FileStore* pStore = nullptr;
     };
 
-    void bigrp_to_midi(std::string filepath, std::string out_folder, BigrpOptions& options);
+    // Subsong of a BIGRP file, as found in its entry table
+    struct Subsong
+    {
+        int index = 0;
+        uint32_t codec = 0; // icelib::EntryCodec
+        uint32_t dataOffset = 0; // embedded .wav/.mid blob, from the start of the file (0 if none)
+        uint32_t dataSize = 0;
+        std::string sequenceName; // MIDI subsongs: mapped song name, or the sequence name found in the MIDI data
+    };
+
+    // Converts a BIGRP file in memory into MIDI files and a SoundFont (filepath gives the output names).
+    // Returns false if the file is invalid or its SoundFont couldn't be written.
+    bool bigrp_to_midi(std::string filepath, const uint8_t* pData, size_t dataSize, std::string out_folder, BigrpOptions& options);
+
+    // Lists the subsongs of a BIGRP file in memory, without converting them (filepath gives the mappings to use)
+    bool list_subsongs(const std::string& filepath, const uint8_t* pData, size_t dataSize, EGame game, std::vector<Subsong>& outSubsongs);
+
+    EGame find_game_from_name(const std::string& gameName);
 
-    void fill_mappings_from_game_id(BigrpOptions& options);
+    // Returns the mappings of a given BIGRP file (by stem), or nullptr if it doesn't have any.
+    // The tables are built once and shared read-only.
+    const MappingTable* find_mapping_table(EGame game, const std::string& bigrpStem);
 
 } // namespace Inti
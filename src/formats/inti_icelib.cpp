@@ -61,11 +61,13 @@ bool bigrp_entry_parse(bigrp_entry_t* entry, const uint8_t* buf)
     {
     case EntryCodec::Range:
     case EntryCodec::DCT:
-    case EntryCodec::Data:
     default:
         return false;
+    case EntryCodec::Data:
     case EntryCodec::Midi:
+        /* raw blobs (embedded .wav or .mid), offset relative to the entry */
         entry->body_offset = get_u32le(buf + 0x10);
+        entry->body_size = get_u32le(buf + 0x14);
         return true;
     }
 }
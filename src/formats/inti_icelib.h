@@ -17,6 +17,7 @@ struct bigrp_entry_t
     uint32_t codec;
 
     uint32_t body_offset;
+    uint32_t body_size;
 };
 
 struct bigrp_header_t
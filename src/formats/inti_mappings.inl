@@ -0,0 +1,44 @@
+//-----------------------------------------------------------------------------
+// Game-specific BIGRP remapping data, included by inti_bigrp.h and inti_ron8.cpp.
+// Adding a game or a song only requires editing this file.
+//
+// INTI_GAME(id, name)
+//     declares a game, selected on the command line with -game <name> (case-insensitive)
+// INTI_TRACK_ORDER(id, t0, t1, t2, t3, t4, t5, t6, t7)
+//     names given to the 8 merged tracks of a song, in BIGRP entry order
+// INTI_MAPPING(game, bigrpFileName, songName, firstEntry, lastEntry, trackOrder)
+//     MIDI entries [firstEntry, lastEntry] of <bigrpFileName>.bigrp form the song <songName>.
+//     trackOrder is an INTI_TRACK_ORDER id, or None to keep the track names found in the MIDI files
+//-----------------------------------------------------------------------------
+
+#ifndef INTI_GAME
+#define INTI_GAME(id, name)
+#endif
+#ifndef INTI_TRACK_ORDER
+#define INTI_TRACK_ORDER(id, t0, t1, t2, t3, t4, t5, t6, t7)
+#endif
+#ifndef INTI_MAPPING
+#define INTI_MAPPING(game, bigrpFileName, songName, firstEntry, lastEntry, trackOrder)
+#endif
+
+INTI_GAME(Cotm1, "Cotm1")
+INTI_GAME(Cotm2, "Cotm2")
+
+INTI_TRACK_ORDER(Regular, "dpcm", "noise", "p1", "p2", "saw", "tri", "v1", "v2")
+
+// Bloodstained: Curse of the Moon
+INTI_MAPPING(Cotm1, "GROUP_TITLE", "BGM_FILE", 12, 19, None)
+
+// Bloodstained: Curse of the Moon 2
+INTI_MAPPING(Cotm2, "GROUP_COMMON", "CM2_BGM_Unknown1", 126, 133, Regular)
+INTI_MAPPING(Cotm2, "GROUP_COMMON", "RON8_JGL_PARTY_JOIN_2", 150, 157, Regular)
+INTI_MAPPING(Cotm2, "GROUP_COMMON", "CM2_JGL_MAP", 158, 165, Regular)
+INTI_MAPPING(Cotm2, "GROUP_COMMON", "CM2_BGM_Unknown2", 186, 193, Regular)
+INTI_MAPPING(Cotm2, "GROUP_ST_01", "CM2_BGM_ST01_2", 258, 265, Regular)
+INTI_MAPPING(Cotm2, "GROUP_ST_10", "CM2_BGM_DM06", 308, 315, Regular)
+INTI_MAPPING(Cotm2, "GROUP_ST_10", "CM2_BGM_DM06_2", 316, 323, Regular)
+INTI_MAPPING(Cotm2, "GROUP_STG", "CM2_BGM_STG", 23, 30, Regular)
+
+#undef INTI_GAME
+#undef INTI_TRACK_ORDER
+#undef INTI_MAPPING
@@ -1,32 +1,98 @@
 #include "inti_bigrp.h"
 
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+#include "utils.h"
+
 namespace Inti {
 
-void fill_mappings_from_game_id(BigrpOptions& options)
+namespace {
+
+struct MappingEntry
 {
-    switch (options.game)
-    {
-    case EGame::Cotm1:
+    EGame game;
+    const char* bigrpFileName;
+    Mapping mapping;
+};
+
+constexpr const char* const* kTrackOrderNone = nullptr;
+#define INTI_TRACK_ORDER(id, t0, t1, t2, t3, t4, t5, t6, t7) \
+    constexpr const char* kTrackOrder##id[kNumTracksPerSong] = { t0, t1, t2, t3, t4, t5, t6, t7 };
+#include "inti_mappings.inl"
+
+constexpr MappingEntry kMappingEntries[] = {
+#define INTI_MAPPING(game, bigrpFileName, songName, firstEntry, lastEntry, trackOrder) \
+    { EGame::game, bigrpFileName, { songName, { firstEntry, lastEntry }, kTrackOrder##trackOrder } },
+#include "inti_mappings.inl"
+};
+
+constexpr const char* kGameNames[] = {
+    "",
+#define INTI_GAME(id, name) name,
+#include "inti_mappings.inl"
+};
+static_assert(std::size(kGameNames) == EGame::Count, "");
+
+using GameIndex = std::unordered_map<std::string, MappingTable>;
+
+std::array<GameIndex, EGame::Count> build_index()
+{
+    std::array<GameIndex, EGame::Count> index;
+    for (const auto& entry : kMappingEntries)
     {
-        options.mappings = std::vector<Inti::Mapping>{ { "GROUP_TITLE", "BGM_FILE", { 12, 19 } } };
-        break;
+        index[entry.game][entry.bigrpFileName].mappings.push_back(entry.mapping);
     }
-    case EGame::Cotm2:
+
+    for (auto& game : index)
     {
-        std::vector<std::string> regularTrackNameOrder = { "dpcm", "noise", "p1", "p2", "saw", "tri", "v1", "v2" };
-
-        options.mappings = std::vector<Inti::Mapping>{
-            { "GROUP_COMMON", "CM2_BGM_Unknown1", { 126, 133 }, regularTrackNameOrder },
-            { "GROUP_COMMON", "RON8_JGL_PARTY_JOIN_2", { 150, 157 }, regularTrackNameOrder },
-            { "GROUP_COMMON", "CM2_JGL_MAP", { 158, 165 }, regularTrackNameOrder },
-            { "GROUP_COMMON", "CM2_BGM_Unknown2", { 186, 193 }, regularTrackNameOrder },
-            { "GROUP_ST_01" , "CM2_BGM_ST01_2", { 258, 265 }, regularTrackNameOrder },
-            { "GROUP_ST_10" , "CM2_BGM_DM06", { 308, 315 }, regularTrackNameOrder },
-            { "GROUP_ST_10" , "CM2_BGM_DM06_2", { 316, 323 }, regularTrackNameOrder },
-            { "GROUP_STG" , "CM2_BGM_STG", { 23, 30 }, regularTrackNameOrder },
-        };
+        for (auto& it : game)
+        {
+            auto& mappings = it.second.mappings;
+            std::sort(mappings.begin(), mappings.end(),
+                [](const Mapping& a, const Mapping& b) { return a.entryRange.first < b.entryRange.first; });
+        }
     }
+    return index;
+}
+
+} // namespace
+
+const Mapping* MappingTable::find(int entryId) const
+{
+    // Last mapping starting at or before entryId
+    auto found = std::upper_bound(mappings.begin(), mappings.end(), entryId,
+        [](int id, const Mapping& m) { return id < m.entryRange.first; });
+
+    if (found == mappings.begin())
+        return nullptr;
+
+    --found;
+    return (entryId <= found->entryRange.second) ? &*found : nullptr;
+}
+
+EGame find_game_from_name(const std::string& gameName)
+{
+    const std::string lowerName = Utils::str_to_lower(gameName);
+    for (int game = EGame::Unknown + 1; game < EGame::Count; game++)
+    {
+        if (Utils::str_to_lower(kGameNames[game]) == lowerName)
+            return static_cast<EGame>(game);
     }
+    return EGame::Unknown;
+}
+
+const MappingTable* find_mapping_table(EGame game, const std::string& bigrpStem)
+{
+    // Thread-safe one-time initialization, read-only afterwards
+    static const std::array<GameIndex, EGame::Count> index = build_index();
+
+    if (game >= EGame::Count)
+        return nullptr;
+
+    auto found = index[game].find(bigrpStem);
+    return (found != index[game].end()) ? &found->second : nullptr;
 }
 
 } // namespace Inti
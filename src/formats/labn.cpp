@@ -1,8 +1,11 @@
 #include "labn.h"
 
 #include "indywv.h"
-#include "wave.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
 
+#include <cstring>
 #include <vector>
 #include <assert.h>
 #include <iostream>
@@ -25,20 +28,14 @@ struct LabFileEntry
     uint8_t  typeId[4];
 };
 
-void decompress(const std::string& labPath, const std::string& outFolder)
+bool list_entries(const std::string& labPath, const uint8_t* pLabData, size_t labSize, std::vector<Entry>& outEntries)
 {
-    std::ifstream file(labPath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return;
+    if (labSize < sizeof(LabHeader))
+        return false;
 
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    const size_t fileSize = labSize;
 
-    std::vector<char> buffer(fileSize);
-    if (!file.read(buffer.data(), fileSize))
-        return;
-
-    const auto* labHeaderPtr = reinterpret_cast<const LabHeader*>(buffer.data());
+    const auto* labHeaderPtr = reinterpret_cast<const LabHeader*>(pLabData);
     assert(strncmp((char*)labHeaderPtr->id, "LABN", 4) == 0);
 
     const auto fileCount = labHeaderPtr->fileCount;
@@ -48,7 +45,14 @@ void decompress(const std::string& labPath, const std::string& outFolder)
     const auto* labFileNameListPtr = reinterpret_cast<const char*>(labEntryPtr + labHeaderPtr->fileCount);
     std::string base_filename = labPath.substr(labPath.find_last_of("/\\") + 1);
 
-    auto indyConverter = IndyWV();
+    if (sizeof(LabHeader) + (uint64_t)fileCount * sizeof(LabFileEntry) + fileNameListLength > fileSize)
+    {
+        std::cerr << "Warning: truncated LAB entry table! Ignoring it... " << base_filename << ".\n";
+        return false;
+    }
+
+    outEntries.clear();
+    outEntries.reserve(fileCount);
 
     for (std::size_t f = 0; f < fileCount; ++f, ++labEntryPtr)
     {
@@ -64,38 +68,52 @@ void decompress(const std::string& labPath, const std::string& outFolder)
             std::cerr << "Warning: LAB entry with bad data offset! Ignoring it... " << base_filename << ".\n";
             continue;
         }
-        if ((entry.dataOffset + entry.sizeInBytes) > fileSize)
+        if (((uint64_t)entry.dataOffset + entry.sizeInBytes) > fileSize)
         {
             std::cerr << "Warning: LAB entry with bad data offset/size! Ignoring it... " << base_filename << ".\n";
             continue;
         }
 
-        const char* myData = (char*)labHeaderPtr + entry.dataOffset;
-        const auto mySize = entry.sizeInBytes;
-
-        std::string fileName{ &labFileNameListPtr[entry.nameOffset] };
+        Entry listed;
+        listed.fileName = std::string(&labFileNameListPtr[entry.nameOffset], strnlen(&labFileNameListPtr[entry.nameOffset], fileNameListLength - entry.nameOffset));
+        listed.dataOffset = entry.dataOffset;
+        listed.sizeInBytes = entry.sizeInBytes;
+        memcpy(listed.typeId, entry.typeId, sizeof(listed.typeId));
+        outEntries.push_back(std::move(listed));
+    }
+    return true;
+}
 
-        if (strncmp((char*)myData, IndyWV::kIndyWV, 6) == 0)
-        {
-            const auto* wvHeader = reinterpret_cast<const IndyWVHeader*>(myData);
+bool decompress(const std::string& labPath, const uint8_t* pLabData, size_t labSize, const SinkFactory& createSink)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Decode);
 
-            char* outBuffer = new char[wvHeader->decompressedSize];
-            memset(outBuffer, 0, wvHeader->decompressedSize);
+    std::vector<Entry> entries;
+    if (!list_entries(labPath, pLabData, labSize, entries))
+        return false;
 
-            size_t lastindex = fileName.find_last_of(".");
-            auto fileNameNoExt = fileName.substr(0, lastindex);
-            std::string outPath = outFolder + "\\" + fileNameNoExt + ".wav";
+    auto indyConverter = IndyWV();
+    bool bSuccess = true;
 
-            file.seekg(entry.dataOffset + sizeof(IndyWVHeader), std::ios::beg);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const auto& entry = entries[i];
+        Trace::Span span("lab_entry", entry.fileName, (int64_t)i);
 
-            indyConverter.decompress(file, wvHeader->dataSize, outBuffer, wvHeader->decompressedSize);
+        const char* myData = (const char*)pLabData + entry.dataOffset;
+        const auto mySize = entry.sizeInBytes;
 
-            Wave::write(outPath, outBuffer,
-                wvHeader->decompressedSize, wvHeader->numChannels, wvHeader->sampleRate, wvHeader->sampleBitSize);
+        if (mySize >= sizeof(IndyWVHeader) && strncmp(myData, IndyWV::kIndyWV, 6) == 0)
+        {
+            size_t lastindex = entry.fileName.find_last_of(".");
+            auto fileNameNoExt = entry.fileName.substr(0, lastindex);
 
-            delete[] outBuffer;
+            auto sink = createSink(fileNameNoExt);
+            if (sink)
+                bSuccess &= indyConverter.decode((const uint8_t*)myData, mySize, *sink);
         }
     }
+    return bSuccess;
 }
 
 } // namespace LABN
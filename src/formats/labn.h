@@ -1,12 +1,33 @@
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
+
+#include "pcm_sink.h"
 
 namespace LABN {
 
 constexpr static char kLABNId[4] = { 'L', 'A', 'B', 'N' };
 
-void decompress(const std::string& labPath, const std::string& outFolder);
+struct Entry
+{
+    std::string fileName;
+    uint32_t dataOffset = 0; // from the start of the LAB file
+    uint32_t sizeInBytes = 0;
+    char typeId[4] = {};
+};
+
+// Lists the valid entries of a LAB file in memory, without reading their data (labPath is only used for messages)
+bool list_entries(const std::string& labPath, const uint8_t* pLabData, size_t labSize, std::vector<Entry>& outEntries);
+
+// Returns the sink receiving the decoded data of a LAB entry, given its file name (without extension)
+using SinkFactory = std::function<std::unique_ptr<PcmSink>(const std::string& fileNameNoExt)>;
+
+// Decodes the entries of a LAB file in memory (labPath is only used for messages).
+// Returns false if the entry table is invalid or an entry failed to decode.
+bool decompress(const std::string& labPath, const uint8_t* pLabData, size_t labSize, const SinkFactory& createSink);
 
 } // namespace LABN
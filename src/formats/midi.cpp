@@ -1,17 +1,19 @@
 #include "midi.h"
 
 #include <assert.h>
-#include <filesystem>
+#include <sstream>
 
 #include "midifile/include/MidiFile.h"
 
+#include "stats.h"
 #include "utils.h"
 
 static constexpr int MIDI_META_SEQ_TRACK_NAME = 3;
 
-GlobalMidiFile::GlobalMidiFile(const std::string& in_outFolder, const std::string& in_optionalBigrpName)
+GlobalMidiFile::GlobalMidiFile(const std::string& in_outFolder, const std::string& in_optionalBigrpName, Utils::FileStore* in_pStore)
     : outFolder(in_outFolder)
     , optionalBigrpName(in_optionalBigrpName)
+    , pStore(in_pStore)
 {}
 
 GlobalMidiFile::~GlobalMidiFile()
@@ -57,7 +59,10 @@ void GlobalMidiFile::write_current_sequence()
     else 
         out_path = Utils::str_format("%s\\%s.mid", outFolder.c_str(), sequenceName.c_str());
 
-    bool bSuccess = smf->write(out_path);
+    std::stringstream ss;
+    bool bSuccess = smf->write(ss);
+    const std::string data = ss.str();
+    bSuccess &= Utils::store_file(out_path, data.data(), data.size(), pStore);
     assert(bSuccess);
 
     globalEvents.clear();
@@ -83,6 +88,8 @@ int GlobalMidiFile::get_current_midi_id()
 
 void GlobalMidiFile::add_midi_to_merge(const uint8_t* buffer, int dataSize, const std::string& newSequenceName, const std::string& newTrackName)
 {
+    Stats::ScopedTimer timer(Stats::EStage::Merge);
+
     if (fileCount == 0)
     {
         assert(sequenceName != newSequenceName);
@@ -254,12 +261,9 @@ std::string get_midi_last_track_name(const uint8_t* buffer, int dataSize)
     return "";
 }
 
-void write_raw_midi_file(const std::string& out_path, const uint8_t* pMidiData, uint32_t midiDataSize)
+void write_raw_midi_file(const std::string& out_path, const uint8_t* pMidiData, uint32_t midiDataSize, Utils::FileStore* pStore)
 {
-    bool bFileExists = std::filesystem::exists(out_path);
-    std::ofstream os(out_path, std::ofstream::binary);
-    os.write((char*)pMidiData, midiDataSize);
-    os.close();
+    Utils::store_file(out_path, pMidiData, midiDataSize, pStore);
 }
 
 } // namespace MidiUtils
@@ -3,6 +3,10 @@
 #include <string>
 #include <vector>
 
+namespace Utils {
+    class FileStore;
+}
+
 namespace smf {
     class MidiEvent;
     class MidiFile;
@@ -13,12 +17,12 @@ namespace MidiUtils
     std::string get_midi_sequence_name(const uint8_t* buffer, int dataSize);
     std::string get_midi_last_track_name(const uint8_t* buffer, int dataSize);
 
-    void write_raw_midi_file(const std::string& out_path, const uint8_t* pMidiData, uint32_t midiDataSize);
+    void write_raw_midi_file(const std::string& out_path, const uint8_t* pMidiData, uint32_t midiDataSize, Utils::FileStore* pStore);
 }
 
 struct GlobalMidiFile
 {
-    GlobalMidiFile(const std::string& in_outFolder, const std::string& in_optionalBigrpName);
+    GlobalMidiFile(const std::string& in_outFolder, const std::string& in_optionalBigrpName, Utils::FileStore* in_pStore);
     ~GlobalMidiFile();
 
     void add_global_event(smf::MidiEvent& ev);
@@ -31,6 +35,7 @@ struct GlobalMidiFile
 private:
     const std::string outFolder;
     const std::string optionalBigrpName;
+    Utils::FileStore* const pStore;
 
     int fileCount = 0;
     smf::MidiFile* smf = nullptr;
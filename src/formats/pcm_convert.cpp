@@ -0,0 +1,344 @@
+#include "pcm_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+#include "cpu_dispatch.h"
+#include "sample_convert.h"
+#include "stats.h"
+
+#if defined(CPU_DISPATCH_X86)
+#include <immintrin.h>
+#endif
+
+namespace PcmConvert {
+
+namespace {
+
+constexpr uint32_t kBaseTaps = 64;       // per phase, when upsampling
+constexpr uint32_t kMaxUpFactor = 4096;  // limits the coefficients table size
+constexpr double kCutoff = 0.92;         // relative to the lowest Nyquist frequency
+constexpr double kKaiserBeta = 8.0;
+constexpr double kPi = 3.14159265358979323846;
+
+double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// numTaps is a multiple of 4. All the variants sum in the same order (8 interleaved partial
+// sums, then pairwise), so that the output doesn't depend on the CPU. A 16-lane AVX-512
+// variant would change that order: AVX-512 CPUs use the AVX2 one.
+float dot_scalar(const float* a, const float* b, uint32_t numTaps)
+{
+    float sums[8] = {};
+    uint32_t i = 0;
+    for (; i + 8 <= numTaps; i += 8)
+    {
+        for (uint32_t j = 0; j < 8; j++)
+            sums[j] += a[i + j] * b[i + j];
+    }
+    if (i < numTaps)
+    {
+        for (uint32_t j = 0; j < 4; j++)
+            sums[j] += a[i + j] * b[i + j];
+    }
+
+    for (uint32_t j = 0; j < 4; j++)
+        sums[j] += sums[j + 4];
+    sums[0] += sums[2];
+    sums[1] += sums[3];
+    return sums[0] + sums[1];
+}
+
+#if defined(CPU_DISPATCH_X86)
+
+CPU_TARGET_SSE41 float dot_sse41(const float* a, const float* b, uint32_t numTaps)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= numTaps; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    if (i < numTaps)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+
+CPU_TARGET_AVX2 float dot_avx2(const float* a, const float* b, uint32_t numTaps)
+{
+    __m256 acc = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= numTaps; i += 8)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+    __m128 acc0 = _mm256_castps256_ps128(acc);
+    if (i < numTaps)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+    acc0 = _mm_add_ps(acc0, _mm256_extractf128_ps(acc, 1));
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+
+const Resampler::DotFunction kDotVariants[CpuDispatch::kNumIsas] = { dot_scalar, dot_sse41, dot_avx2, nullptr };
+
+#else
+
+const Resampler::DotFunction kDotVariants[CpuDispatch::kNumIsas] = { dot_scalar };
+
+#endif // CPU_DISPATCH_X86
+
+} // namespace
+
+bool Resampler::init(uint32_t inRate, uint32_t outRate, uint16_t in_numChannels)
+{
+    const uint32_t divisor = std::gcd(inRate, outRate);
+    upFactor = outRate / divisor;
+    downFactor = inRate / divisor;
+    if (upFactor > kMaxUpFactor)
+    {
+        std::cerr << "Unsupported resampling ratio " << inRate << " -> " << outRate << "\n";
+        return false;
+    }
+
+    // Widen the filter when downsampling, to keep the same transition band relative to the output rate
+    const uint32_t widening = (downFactor + upFactor - 1) / upFactor;
+    numTaps = kBaseTaps * widening;
+    numChannels = in_numChannels;
+    dot = CpuDispatch::select_variant(kDotVariants);
+
+    // Phase p, tap k applies to input sample (i - numTaps/2 + 1 + k) for output position i + p/upFactor
+    const double cutoff = kCutoff * std::min(1.0, (double)upFactor / downFactor);
+    const double halfWidth = numTaps / 2.0;
+    coefs.resize((size_t)upFactor * numTaps);
+    for (uint32_t p = 0; p < upFactor; p++)
+    {
+        float* pPhase = &coefs[(size_t)p * numTaps];
+        double sum = 0.0;
+        for (uint32_t k = 0; k < numTaps; k++)
+        {
+            const double d = (double)p / upFactor + halfWidth - 1 - k;
+            const double x = cutoff * d;
+            const double sinc = (x == 0.0) ? 1.0 : std::sin(kPi * x) / (kPi * x);
+            const double w = d / halfWidth;
+            const double window = (std::fabs(w) < 1.0) ? bessel_i0(kKaiserBeta * std::sqrt(1.0 - w * w)) / bessel_i0(kKaiserBeta) : 0.0;
+            const double coef = cutoff * sinc * window;
+            pPhase[k] = (float)coef;
+            sum += coef;
+        }
+
+        // Unity gain for every phase
+        for (uint32_t k = 0; k < numTaps; k++)
+            pPhase[k] = (float)(pPhase[k] / sum);
+    }
+
+    // Silence before the first input sample
+    history.assign(numChannels, std::vector<float>(numTaps / 2 - 1, 0.0f));
+    historyStart = -(int64_t)(numTaps / 2 - 1);
+    historyEnd = 0;
+    numInputFrames = 0;
+    outputIndex = 0;
+    bFlushed = false;
+    return true;
+}
+
+uint64_t Resampler::get_output_frames(uint64_t in_numInputFrames) const
+{
+    return (in_numInputFrames * upFactor + downFactor - 1) / downFactor;
+}
+
+void Resampler::push(const int16_t* pIn, size_t numFrames)
+{
+    for (uint16_t c = 0; c < numChannels; c++)
+    {
+        auto& channel = history[c];
+        const size_t start = channel.size();
+        channel.resize(start + numFrames);
+
+        float* pOut = channel.data() + start;
+        for (size_t i = 0; i < numFrames; i++)
+            pOut[i] = pIn[i * numChannels + c] * (1.0f / 32768.0f);
+    }
+
+    historyEnd += numFrames;
+    numInputFrames += numFrames;
+}
+
+void Resampler::flush()
+{
+    if (bFlushed)
+        return;
+    bFlushed = true;
+
+    for (auto& channel : history)
+        channel.resize(channel.size() + numTaps / 2, 0.0f);
+    historyEnd += numTaps / 2;
+}
+
+size_t Resampler::get_available_frames() const
+{
+    // Output n needs input up to floor(n * down / up) + numTaps/2
+    const int64_t limit = historyEnd - numTaps / 2;
+    if (limit <= 0)
+        return 0;
+
+    uint64_t numOutputs = get_output_frames(std::min<uint64_t>(limit, numInputFrames));
+    return (size_t)(numOutputs - outputIndex);
+}
+
+void Resampler::pull(float* pOut, size_t numFrames)
+{
+    uint64_t position = outputIndex * downFactor;
+    int64_t inputIndex = (int64_t)(position / upFactor);
+    uint32_t phase = (uint32_t)(position % upFactor);
+
+    for (size_t n = 0; n < numFrames; n++)
+    {
+        const float* pCoefs = &coefs[(size_t)phase * numTaps];
+        const size_t offset = (size_t)(inputIndex - numTaps / 2 + 1 - historyStart);
+        for (uint16_t c = 0; c < numChannels; c++)
+            *pOut++ = dot(pCoefs, history[c].data() + offset, numTaps);
+
+        phase += downFactor;
+        inputIndex += phase / upFactor;
+        phase %= upFactor;
+    }
+    outputIndex += numFrames;
+
+    // Drop the input that no further output needs
+    const int64_t keepFrom = inputIndex - numTaps / 2 + 1;
+    if (keepFrom > historyStart)
+    {
+        const size_t drop = (size_t)(keepFrom - historyStart);
+        for (auto& channel : history)
+            channel.erase(channel.begin(), channel.begin() + std::min(drop, channel.size()));
+        historyStart = keepFrom;
+    }
+}
+
+bool ConvertSink::begin(const PcmFormat& format, uint64_t expectedDataSize)
+{
+    inFormat = format;
+    if (inFormat.bitSize != 16 || inFormat.bFloat || inFormat.numChannels == 0)
+    {
+        std::cerr << "Sample conversion only supports 16-bit PCM input\n";
+        return false;
+    }
+
+    outFormat = inFormat;
+    switch (sampleFormat)
+    {
+    case ESampleFormat::S24: outFormat.bitSize = 24; break;
+    case ESampleFormat::F32: outFormat.bitSize = 32; outFormat.bFloat = true; break;
+    default: break;
+    }
+
+    uint64_t numFrames = expectedDataSize / inFormat.block_align();
+
+    bResample = (sampleRate != 0 && sampleRate != inFormat.sampleRate);
+    if (bResample)
+    {
+        if (!resampler.init(inFormat.sampleRate, sampleRate, inFormat.numChannels))
+            return false;
+
+        outFormat.sampleRate = sampleRate;
+        numFrames = resampler.get_output_frames(numFrames);
+    }
+
+    return output->begin(outFormat, numFrames * outFormat.block_align());
+}
+
+char* ConvertSink::reserve(size_t size)
+{
+    if (input.size() < size)
+        input.resize(size);
+    return input.data();
+}
+
+void ConvertSink::commit(size_t size)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Convert);
+
+    const int16_t* pIn = reinterpret_cast<const int16_t*>(input.data());
+    const size_t numSamples = size / sizeof(int16_t);
+
+    if (bResample)
+    {
+        resampler.push(pIn, numSamples / inFormat.numChannels);
+        write_resampled();
+        return;
+    }
+
+    const size_t outSize = numSamples * (outFormat.bitSize / 8);
+    char* pOut = output->reserve(outSize);
+    switch (outFormat.bitSize)
+    {
+    case 24: SampleConvert::s16_to_s24(pIn, reinterpret_cast<uint8_t*>(pOut), numSamples); break;
+    case 32: SampleConvert::s16_to_f32(pIn, reinterpret_cast<float*>(pOut), numSamples); break;
+    default: memcpy(pOut, pIn, outSize); break;
+    }
+    output->commit(outSize);
+}
+
+void ConvertSink::write_resampled()
+{
+    const size_t numFrames = resampler.get_available_frames();
+    if (numFrames == 0)
+        return;
+
+    const size_t numSamples = numFrames * outFormat.numChannels;
+    if (outFormat.bFloat)
+    {
+        // Resample straight into the output
+        resampler.pull(reinterpret_cast<float*>(output->reserve(numSamples * sizeof(float))), numFrames);
+        output->commit(numSamples * sizeof(float));
+        return;
+    }
+
+    if (resampled.size() < numSamples)
+        resampled.resize(numSamples);
+    resampler.pull(resampled.data(), numFrames);
+    write_converted(resampled.data(), numSamples);
+}
+
+void ConvertSink::write_converted(const float* pIn, size_t numSamples)
+{
+    const size_t outSize = numSamples * (outFormat.bitSize / 8);
+    char* pOut = output->reserve(outSize);
+    if (outFormat.bitSize == 24)
+        SampleConvert::f32_to_s24(pIn, reinterpret_cast<uint8_t*>(pOut), numSamples);
+    else
+        SampleConvert::f32_to_s16(pIn, reinterpret_cast<int16_t*>(pOut), numSamples);
+    output->commit(outSize);
+}
+
+bool ConvertSink::end()
+{
+    Stats::ScopedTimer timer(Stats::EStage::Convert);
+
+    if (bResample)
+    {
+        resampler.flush();
+        write_resampled();
+    }
+    return output->end();
+}
+
+} // namespace PcmConvert
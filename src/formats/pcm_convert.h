@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "pcm_sink.h"
+
+namespace PcmConvert {
+
+enum class ESampleFormat : uint8_t
+{
+    Source, // keep the decoded format
+    S16,
+    S24,
+    F32,
+};
+
+//-----------------------------------------------------------------------------
+// Streaming polyphase resampler for any rational ratio (e.g. 22050 -> 48000 is
+// 320/147): Kaiser-windowed sinc, one filter phase per output position, and a
+// SIMD dot product per output sample and channel.
+// Input is pushed in chunks of interleaved int16 frames, output is interleaved
+// float. Output sample n is centered on input position n * inRate / outRate,
+// so there is no delay to compensate for.
+//-----------------------------------------------------------------------------
+class Resampler
+{
+public:
+    using DotFunction = float (*)(const float* a, const float* b, uint32_t numTaps);
+
+    bool init(uint32_t inRate, uint32_t outRate, uint16_t numChannels);
+
+    uint64_t get_output_frames(uint64_t numInputFrames) const;
+
+    void push(const int16_t* pIn, size_t numFrames);
+
+    // Number of output frames computable with the input pushed so far
+    size_t get_available_frames() const;
+
+    // Produces numFrames (<= get_available_frames()) output frames
+    void pull(float* pOut, size_t numFrames);
+
+    // Pads the input with silence so that all remaining output frames become available
+    void flush();
+
+private:
+    uint32_t upFactor = 1;
+    uint32_t downFactor = 1;
+    uint32_t numTaps = 0;
+    uint16_t numChannels = 0;
+    DotFunction dot = nullptr; // variant of the CPU's ISA, bound by init()
+
+    std::vector<float> coefs; // upFactor phases of numTaps coefficients
+
+    // Planar input history, historyStart being the input index of its first sample
+    std::vector<std::vector<float>> history;
+    int64_t historyStart = 0;
+    int64_t historyEnd = 0;
+    uint64_t numInputFrames = 0;
+    uint64_t outputIndex = 0;
+    bool bFlushed = false;
+};
+
+//-----------------------------------------------------------------------------
+// Output stage between a decoder and the file sink: converts the decoded int16
+// PCM to another sample rate and/or sample format (s16, s24, f32) chunk by
+// chunk, as the decoder produces it.
+//-----------------------------------------------------------------------------
+class ConvertSink : public PcmSink
+{
+public:
+    ConvertSink(std::unique_ptr<PcmSink> in_output, uint32_t in_sampleRate, ESampleFormat in_sampleFormat)
+        : output(std::move(in_output)), sampleRate(in_sampleRate), sampleFormat(in_sampleFormat) {}
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    void write_resampled();
+    void write_converted(const float* pIn, size_t numSamples);
+
+    std::unique_ptr<PcmSink> output;
+    const uint32_t sampleRate;
+    const ESampleFormat sampleFormat;
+
+    PcmFormat inFormat;
+    PcmFormat outFormat;
+    bool bResample = false;
+    Resampler resampler;
+
+    std::vector<char> input;
+    std::vector<float> resampled;
+};
+
+} // namespace PcmConvert
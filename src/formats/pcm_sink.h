@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstring>
+#include <stddef.h>
+
+#include "common.h"
+
+struct PcmFormat
+{
+    uint16_t numChannels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitSize = 16;
+    bool bFloat = false; // IEEE float samples (bitSize 32)
+
+    uint32_t block_align() const { return numChannels * bitSize / 8; }
+};
+
+//-----------------------------------------------------------------------------
+// Destination of decoded PCM data.
+// Decoders call begin() once, then produce the data in chunks of any size by
+// decoding straight into the memory returned by reserve() and calling commit(),
+// and finally call end().
+//-----------------------------------------------------------------------------
+class PcmSink
+{
+public:
+    virtual ~PcmSink() = default;
+
+    // expectedDataSize: total size of the PCM data in bytes when known up front, 0 otherwise
+    virtual bool begin(const PcmFormat& format, uint64_t expectedDataSize) = 0;
+
+    // Returns a buffer of at least 'size' bytes, valid until the next commit()
+    virtual char* reserve(size_t size) = 0;
+    virtual void commit(size_t size) = 0;
+
+    virtual bool end() = 0;
+
+    // Hands over a chunk decoded elsewhere (e.g. shared by a TeeSink). Sinks able
+    // to read it in place override this to skip the copy into their own buffer.
+    virtual void write(const void* pData, size_t size)
+    {
+        memcpy(reserve(size), pData, size);
+        commit(size);
+    }
+};
@@ -0,0 +1,144 @@
+#include "peaks.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "stats.h"
+
+namespace Peaks {
+
+bool Writer::begin(const PcmFormat& in_format, uint64_t expectedDataSize)
+{
+    format = in_format;
+    const bool bSupported = format.bFloat ? (format.bitSize == 32)
+        : (format.bitSize == 8 || format.bitSize == 16 || format.bitSize == 24);
+    if (!bSupported || format.numChannels == 0 || samplesPerPixel == 0)
+    {
+        std::cerr << "Peaks: unsupported PCM format for " << path << "\n";
+        return false;
+    }
+
+    bOpen = true;
+    partialFrame.clear();
+    windowMin.assign(format.numChannels, 0);
+    windowMax.assign(format.numChannels, 0);
+    windowFrames = 0;
+    peaks.clear();
+    if (expectedDataSize)
+        peaks.reserve((size_t)(expectedDataSize / format.block_align() / samplesPerPixel + 1) * 2 * format.numChannels);
+    return true;
+}
+
+char* Writer::reserve(size_t size)
+{
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return buffer.data();
+}
+
+void Writer::commit(size_t size)
+{
+    write(buffer.data(), size);
+}
+
+void Writer::write(const void* pData, size_t size)
+{
+    if (!bOpen)
+        return;
+
+    Stats::ScopedTimer timer(Stats::EStage::Encode);
+
+    const uint32_t blockAlign = format.block_align();
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    const uint8_t* pEnd = pBytes + size;
+
+    // Completes the frame the previous chunk ended in
+    if (!partialFrame.empty())
+    {
+        const size_t missingSize = std::min<size_t>(blockAlign - partialFrame.size(), size);
+        partialFrame.insert(partialFrame.end(), pBytes, pBytes + missingSize);
+        pBytes += missingSize;
+        if (partialFrame.size() < blockAlign)
+            return;
+        add_frame(partialFrame.data());
+        partialFrame.clear();
+    }
+
+    for (; pEnd - pBytes >= (ptrdiff_t)blockAlign; pBytes += blockAlign)
+        add_frame(pBytes);
+
+    partialFrame.assign(pBytes, pEnd);
+}
+
+int Writer::read_sample(const uint8_t* pFrame, uint32_t channel) const
+{
+    const uint8_t* p = pFrame + channel * (format.bitSize / 8);
+    if (format.bFloat)
+    {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return (int)std::max(-32768.0f, std::min(32767.0f, value * 32768.0f));
+    }
+
+    switch (format.bitSize)
+    {
+    case 8: return ((int)p[0] - 128) * 256; // unsigned
+    case 16: return (int16_t)(p[0] | (p[1] << 8));
+    default: return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 16;
+    }
+}
+
+void Writer::add_frame(const uint8_t* pFrame)
+{
+    for (uint32_t c = 0; c < format.numChannels; c++)
+    {
+        const int sample = read_sample(pFrame, c);
+        if (windowFrames == 0 || sample < windowMin[c])
+            windowMin[c] = sample;
+        if (windowFrames == 0 || sample > windowMax[c])
+            windowMax[c] = sample;
+    }
+
+    if (++windowFrames == samplesPerPixel)
+        flush_window();
+}
+
+void Writer::flush_window()
+{
+    for (uint32_t c = 0; c < format.numChannels; c++)
+    {
+        peaks.push_back((int16_t)windowMin[c]);
+        peaks.push_back((int16_t)windowMax[c]);
+    }
+    windowFrames = 0;
+}
+
+bool Writer::end()
+{
+    if (!bOpen)
+        return false;
+    bOpen = false;
+
+    if (windowFrames > 0)
+        flush_window();
+
+    const size_t length = peaks.size() / (2 * format.numChannels);
+    std::string json = Utils::str_format("{\"version\":2,\"channels\":%u,\"sample_rate\":%u,\"samples_per_pixel\":%u,\"bits\":16,\"length\":%zu,\"data\":[",
+        (unsigned)format.numChannels, (unsigned)format.sampleRate, (unsigned)samplesPerPixel, length);
+    for (size_t i = 0; i < peaks.size(); i++)
+    {
+        if (i > 0)
+            json += ',';
+        json += std::to_string(peaks[i]);
+    }
+    json += "]}\n";
+
+    Utils::OutputFile file;
+    if (!file.open(path, pStore))
+        return false;
+    file.write(json.data(), json.size());
+    return file.close();
+}
+
+} // namespace Peaks
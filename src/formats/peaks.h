@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "pcm_sink.h"
+#include "utils.h"
+
+namespace Peaks {
+
+constexpr uint32_t kDefaultSamplesPerPixel = 256;
+
+//-----------------------------------------------------------------------------
+// Waveform peaks of decoded PCM (min and max of each channel over windows of
+// samplesPerPixel frames), for the waveform views of editors and asset
+// browsers. Written on end() in the JSON format of BBC's audiowaveform
+// (version 2, 16-bit values, channels interleaved per window), which
+// peaks.js and similar viewers read directly. Reads the chunks in place, so
+// as a TeeSink branch it adds no copy.
+//-----------------------------------------------------------------------------
+class Writer : public PcmSink
+{
+public:
+    // The file goes to the store on end()
+    Writer(const std::string& in_path, Utils::FileStore* in_pStore, uint32_t in_samplesPerPixel = kDefaultSamplesPerPixel)
+        : path(in_path), pStore(in_pStore), samplesPerPixel(in_samplesPerPixel) {}
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    void write(const void* pData, size_t size) override;
+    bool end() override;
+
+private:
+    // Sample of the given frame and channel, scaled to 16 bits
+    int read_sample(const uint8_t* pFrame, uint32_t channel) const;
+    void add_frame(const uint8_t* pFrame);
+    void flush_window();
+
+    const std::string path;
+    Utils::FileStore* const pStore;
+    const uint32_t samplesPerPixel;
+    PcmFormat format;
+
+    std::vector<char> buffer;  // chunks decoded through reserve()
+    std::vector<uint8_t> partialFrame; // frame split between two chunks
+    std::vector<int> windowMin, windowMax; // per channel
+    uint32_t windowFrames = 0;
+    std::vector<int16_t> peaks; // min and max of each channel, window after window
+    bool bOpen = false;
+};
+
+} // namespace Peaks
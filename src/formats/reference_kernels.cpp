@@ -0,0 +1,455 @@
+#include "reference_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "utils.h"
+
+typedef int32_t LONG;
+typedef uint8_t BYTE;
+
+#define HINIBBLE(byte) ((byte) >> 4)
+#define LONIBBLE(byte) ((byte) & 0x0F)
+
+// ----------------------------------------------------------------------------
+// from ida_defs.h
+#define LAST_IND(x,part_type)    (sizeof(x)/sizeof(part_type) - 1)
+#if defined(__BYTE_ORDER) && __BYTE_ORDER == __BIG_ENDIAN
+#  define LOW_IND(x,part_type)   LAST_IND(x,part_type)
+#  define HIGH_IND(x,part_type)  0
+#else
+#  define HIGH_IND(x,part_type)  LAST_IND(x,part_type)
+#  define LOW_IND(x,part_type)   0
+#endif
+
+#define BYTEn(x, n)   (*((uint8_t*)&(x)+n))
+#define WORDn(x, n)   (*((uint16_t*)&(x)+n))
+#define DWORDn(x, n)  (*((uint32_t*)&(x)+n))
+
+#define BYTE1(x)   BYTEn(x,  1)         // byte 1 (counting from 0)
+
+#define LOBYTE(x)  BYTEn(x,LOW_IND(x,uint8_t))
+#define LOWORD(x)  WORDn(x,LOW_IND(x,uint16_t))
+#define LODWORD(x) DWORDn(x,LOW_IND(x,uint32_t))
+
+#define HIBYTE(x)  BYTEn(x,HIGH_IND(x,uint8_t))
+// ----------------------------------------------------------------------------
+
+namespace Reference {
+
+namespace {
+
+// INDYWV tables (indywv_data.cpp)
+short aDeltaTable[5696];
+
+const unsigned short aStepTable[89] =
+{
+    7,     8,     9,    10,     11,    12,    13,    14,
+    16,    17,    19,    21,    23,    25,    28,    31,
+    34,    37,    41,    45,    50,    55,	  60,    66,
+    73,    80,    88,    97,    107,   118,   130,   143,
+    157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,
+    724,   796,   876,   963,   1060,  1166,  1282,  1411,
+    1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,
+    3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,
+    7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+const char aIndex2Bit[8] = {
+    -1, 4, -1, 4, 0, 0, 0, 0 };
+const char aIndex3Bit[8] = {
+    -1, -1, 2, 6, -1, -1, 2, 6 };
+const char aIndex4Bit[16] = {
+    -1, -1, -1, -1, 1, 2, 4, 6, -1, -1, -1, -1, 1, 2, 4, 6 };
+const char aIndex5Bit[32] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, 1, 1, 1, 2, 2, 4, 5, 6,
+    -1, -1, -1, -1, -1, -1, -1, -1, 1, 1, 1, 2, 2, 4, 5, 6 };
+const char aIndex6Bit[64] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    1, 1, 1, 1, 1, 2, 2, 2, 2, 4, 4, 4, 5, 5, 6, 6,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    1, 1, 1, 1, 1, 2, 2, 2, 2, 4, 4, 4, 5, 5, 6, 6 };
+const char aIndex7Bit[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2,
+    2, 2, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2,
+    2, 2, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6 };
+
+const char* aIndexTableTable[8] =
+{
+    NULL,
+    NULL,
+    aIndex2Bit,
+    aIndex3Bit,
+    aIndex4Bit,
+    aIndex5Bit,
+    aIndex6Bit,
+    aIndex7Bit
+};
+
+const char aStepBits[96] =
+{
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0
+};
+
+// CRYO APC tables (cryo_apc.cpp)
+const LONG IndexAdjust[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+const LONG StepTable[89] = {
+   7,     8,	  9,	 10,	11,    12,     13,    14,    16,
+   17,    19,	  21,	 23,	25,    28,     31,    34,    37,
+   41,    45,	  50,	 55,	60,    66,     73,    80,    88,
+   97,    107,   118,	 130,	143,   157,    173,   190,   209,
+   230,   253,   279,	 307,	337,   371,    408,   449,   494,
+   544,   598,   658,	 724,	796,   876,    963,   1060,  1166,
+   1282,  1411,  1552,  1707,	1878,  2066,   2272,  2499,  2749,
+   3024,  3327,  3660,  4026,	4428,  4871,   5358,  5894,  6484,
+   7132,  7845,  8630,  9493,	10442, 11487,  12635, 13899, 15289,
+   16818, 18500, 20350, 22385,  24623, 27086,  29794, 32767
+};
+
+void build_delta_table()
+{
+    // Build index data
+    for (uint32_t i = 0; i < 0x40; ++i)
+    {
+        for (uint32_t j = 0; j < 0x59; ++j)
+        {
+            int16_t stepsize = aStepTable[j];
+            int16_t acc = 0;
+
+            for (uint32_t mask = 32; mask > 0; mask >>= 1)
+            {
+                if ((mask & i) != 0)
+                    acc += stepsize;
+                stepsize >>= 1;
+            }
+
+            auto offset = (64 * j + i);
+            aDeltaTable[offset] = acc;
+        }
+    }
+}
+
+inline void process_nibble(BYTE code, CryoAPC::ChannelState& state)
+{
+    LONG delta = StepTable[state.index] >> 3;
+
+    if (code & 4)
+        delta += StepTable[state.index];
+    if (code & 2)
+        delta += StepTable[state.index] >> 1;
+    if (code & 1)
+        delta += StepTable[state.index] >> 2;
+    if (code & 8) // sign bit
+        state.sample -= delta;
+    else
+        state.sample += delta;
+
+    // clip sample
+    state.sample = Utils::clamp(state.sample, -32768, 32767);
+    // adjust index
+    state.index += IndexAdjust[code];
+    // clip index
+    state.index = Utils::clamp(state.index, 0, 88);
+}
+
+} // namespace
+
+void decompressADPCM(IndyWV::DecompressorState* compState, char* outData, char* in_data, int dataSize, unsigned int numChannels)
+{
+    static const bool bDeltaTableBuilt = (build_delta_table(), true);
+    (void)bDeltaTableBuilt;
+
+    int accStep = 0;
+
+    unsigned __int16 inDataSwap = _byteswap_ushort(*(uint16_t*)in_data);
+    char* pInDataStart = in_data + 2;
+    for (uint32_t k = 0; k < numChannels; ++k)
+    {
+        short* pOutData = (short*)&outData[2 * k];
+        int8_t lastIndex = compState->stepindex[k];
+        int16_t lastData = compState->keysample[k];
+        char* pCurrInData = pInDataStart;
+        int remainingData = dataSize;
+        while (remainingData)
+        {
+            unsigned char step = aStepBits[lastIndex];
+            int stepshift = 1 << (step - 1);
+            char tempOffset = stepshift - 1;
+            accStep += step;
+            int temp1 = stepshift;
+            LOBYTE(temp1) = (stepshift - 1) | stepshift;
+            int offset = temp1 & (inDataSwap >> (16 - accStep));
+            if (accStep > 7)
+            {
+                accStep -= 8;
+                unsigned short temp2 = inDataSwap << 8;
+                LOBYTE(temp2) = *pCurrInData;
+                inDataSwap = temp2;
+                ++pCurrInData;
+            }
+            if ((offset & stepshift) != 0)
+                offset ^= stepshift;
+            else
+                LOWORD(stepshift) = 0;
+
+            int prediction = 0;
+            if ((uint8_t)offset == tempOffset)
+            {
+                auto calc = inDataSwap;
+                prediction = (int16_t)(inDataSwap << accStep);
+                LOWORD(calc) = inDataSwap << 8;
+                LOBYTE(calc) = *pCurrInData;
+                LOBYTE(prediction) = calc >> (8 - accStep);
+                LOWORD(calc) = (uint16_t)calc << 8;
+                LOBYTE(calc) = *(pCurrInData + 1);
+                pCurrInData = pCurrInData + 2;
+                inDataSwap = calc;
+            }
+            else
+            {
+                auto tableOffset = (lastIndex << 6) | (offset << (7 - step));
+                int dataOffset = *(uint16_t*)&aDeltaTable[tableOffset];
+                if ((uint16_t)offset)
+                {
+                    dataOffset += (uint32_t)aStepTable[lastIndex] >> (step - 1);
+                }
+
+                if (stepshift > 0)
+                    prediction = std::max(lastData - dataOffset, -32768);
+                else
+                    prediction = std::min(lastData + dataOffset, 32767);
+            }
+            lastData = prediction;
+            *pOutData = prediction;
+            pOutData += numChannels;
+
+            int index = aIndexTableTable[step][offset] + lastIndex;
+            index = Utils::clamp(index, 0, 88);
+            lastIndex = index;
+            --remainingData;
+        }
+        pInDataStart = pCurrInData;
+        numChannels = numChannels & 0x7fffffff;
+
+        compState->stepindex[k] = lastIndex;
+        compState->keysample[k] = lastData;
+    }
+}
+
+int compressADPCM(IndyWV::DecompressorState* compState, char* outData, const char* inData, int sndDataSize, unsigned int numChannels)
+{
+    if (numChannels == 0)
+        return 0;
+
+    int v9 = 0;
+    char accStep = 0;
+    char* pOutData = outData;
+    int v38 = 0;
+
+    for (uint8_t iChan = 0; iChan < numChannels; iChan++)
+    {
+        const char* pInData = inData;
+        int lastIndex = *(char*)(compState + iChan);
+        int lastData = compState->keysample[iChan];
+
+        int remainingData = sndDataSize;
+        while (remainingData)
+        {
+            int v32 = 0;
+            int offset = 0;
+            uint16_t v13 = aStepTable[lastIndex];
+            char initialized = 0;
+            int v14 = *(const __int16*)pInData;
+            int v17 = v14 - lastData;
+            unsigned char step = aStepBits[lastIndex];
+            int stepshift = 1 << (step - 1);
+            char tempOffset = stepshift - 1;
+            if (v17 < 0)
+            {
+                initialized = 1 << ((step - 1) & 0x1f);
+                v17 = -v17;
+            }
+            int v20 = stepshift >> 1;
+            int v21 = step - 1;
+            if (step != 1)
+            {
+                for (int iStep = step - 1; iStep > 0; --iStep)
+                {
+                    if (v17 >= v13)
+                    {
+                        v17 -= v13;
+                        offset |= v20;
+                        v21 = v13 + v32;
+                        v32 += v13;
+                    }
+                    v13 >>= 1;
+                    v20 >>= 1;
+                }
+            }
+            if (offset)
+                v32 += v13;
+            unsigned __int8 v23 = 8 - (accStep & 7);
+            LOWORD(v21) = (uint8_t)(offset | initialized);
+            v9 = (v38 << step) | v21;
+            v38 = v9;
+            accStep += step;
+            if (step >= v23)
+                *pOutData++ = (uint16_t)v9 >> (step - v23);
+            if (offset == tempOffset)
+            {
+                __int16 v24 = *(const __int16*)pInData;
+                unsigned __int16 v26;
+                LOBYTE(v26) = BYTE1(v24);
+                HIBYTE(v26) = v9;
+                char* v27 = pOutData + 1;
+                *pOutData = v26 >> (accStep & 7);
+                v9 = (unsigned __int16)v24;
+                v38 = (unsigned __int16)v24;
+                pOutData += 2;
+                *v27 = (unsigned __int16)v24 >> (accStep & 7);
+
+                lastData = v24;
+            }
+            else
+            {
+                lastData += initialized ? -v32 : v32;
+                lastData = Utils::clamp(lastData, -32768, 32767);
+            }
+
+            lastIndex += aIndexTableTable[step][offset];
+            lastIndex = Utils::clamp(lastIndex, 0, 88);
+
+            pInData += 2;
+            --remainingData;
+        }
+
+        *(unsigned char*)(iChan + compState) = lastIndex;
+        compState->keysample[iChan] = lastData;
+        inData += 2;
+    }
+
+    if ((accStep & 7) != 0)
+        *pOutData++ = v9 << (8 - (accStep & 7));
+
+    int writtenBytes = (int)(pOutData - outData);
+    return writtenBytes + 4;
+}
+
+void wvsmInflateBlock(const uint8_t*& pData, const uint8_t* pDataEnd, std::size_t blockSize, short* outData)
+{
+    using namespace Utils;
+
+    std::size_t nSamples = blockSize / 2;
+    if (nSamples == 0) {
+        return;
+    }
+
+    readBytes<uint16_t>(pData, pDataEnd); // compressed size (big endian), not needed to inflate
+    const char se = readBytes<char>(pData, pDataEnd); // sample expander
+    const int sel = se >> 4;
+    const int ser = se & 0xF;
+
+    auto getChannelSample = [&](int expander) -> uint16_t
+    {
+        uint16_t val = readBytes<unsigned char>(pData, pDataEnd);
+        if (val == 0x80)
+        {
+            auto s = readBytes<uint16_t>(pData, pDataEnd);
+            val = swap16(s);
+        }
+        else {
+            val = static_cast<int8_t>(val) << expander;
+        }
+        return val;
+    };
+
+    for (std::size_t i = 0; i < nSamples; i += 2)
+    {
+        auto val = getChannelSample(sel);
+        *outData = val;
+        outData++;
+        if (i + 1 >= nSamples)
+            return;
+
+        val = getChannelSample(ser);
+        *outData = val;
+        outData++;
+    }
+}
+
+void apcDecodeNibbles(const uint8_t* pInput, size_t inputSize, int16_t* pOutput, uint8_t numChannels, CryoAPC::ChannelState* states)
+{
+    // Low nibble: next sample for mono, right channel for stereo
+    CryoAPC::ChannelState& left = states[0];
+    CryoAPC::ChannelState& right = (numChannels == 2) ? states[1] : states[0];
+
+    for (size_t i = 0; i < inputSize; i++)
+    {
+        const BYTE input = pInput[i];
+
+        process_nibble(HINIBBLE(input), left);
+        *pOutput++ = (int16_t)left.sample;
+
+        process_nibble(LONIBBLE(input), right);
+        *pOutput++ = (int16_t)right.sample;
+    }
+}
+
+void s16ToF32(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+        pOut[i] = pIn[i] * (1.0f / 32768.0f);
+}
+
+void f32ToS16(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        // NaN gives -32768 (std::max would let it through to lrint, whose result is undefined)
+        const float scaled = pIn[i] * 32768.0f;
+        float value = std::isnan(scaled) ? -32768.0f : std::min(std::max(scaled, -32768.0f), 32767.0f);
+        pOut[i] = (int16_t)std::lrint(value);
+    }
+}
+
+void s16ToS24(const int16_t* pIn, uint8_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        pOut[3 * i] = 0;
+        pOut[3 * i + 1] = (uint8_t)pIn[i];
+        pOut[3 * i + 2] = (uint8_t)(pIn[i] >> 8);
+    }
+}
+
+// The 16-bit path of the FLAC encoder's deinterleave loop
+void deinterleaveS16Stereo(const uint8_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        int32_t* pOut = (c == 0) ? pLeft : pRight;
+        const uint8_t* pSample = pIn + c * 2;
+        for (size_t i = 0; i < numFrames; i++, pSample += 4)
+            pOut[i] = (int16_t)(pSample[0] | (pSample[1] << 8));
+    }
+}
+
+} // namespace Reference
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cryo_apc.h"
+#include "indywv.h"
+
+//-----------------------------------------------------------------------------
+// Frozen copies of the codec kernels (and their tables) as they were before
+// any optimization. The kernels of IndyWV and CryoAPC must keep matching them
+// bit for bit, which MiscAudioVerify checks: never change these, change the
+// optimized kernels instead.
+//-----------------------------------------------------------------------------
+namespace Reference {
+
+void decompressADPCM(IndyWV::DecompressorState* compState, char* outData, char* in_data, int dataSize, unsigned int numChannels);
+int compressADPCM(IndyWV::DecompressorState* compState, char* outData, const char* in_data, int dataSize, unsigned int numChannels);
+void wvsmInflateBlock(const uint8_t*& pData, const uint8_t* pDataEnd, std::size_t blockSize, short* outData);
+
+void apcDecodeNibbles(const uint8_t* pInput, size_t inputSize, int16_t* pOutput, uint8_t numChannels, CryoAPC::ChannelState* states);
+
+void s16ToF32(const int16_t* pIn, float* pOut, size_t numSamples);
+void f32ToS16(const float* pIn, int16_t* pOut, size_t numSamples);
+void s16ToS24(const int16_t* pIn, uint8_t* pOut, size_t numSamples);
+void deinterleaveS16Stereo(const uint8_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames);
+
+} // namespace Reference
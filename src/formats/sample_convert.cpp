@@ -0,0 +1,292 @@
+#include "sample_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "cpu_dispatch.h"
+
+#if defined(CPU_DISPATCH_X86)
+#include <immintrin.h>
+#endif
+
+namespace SampleConvert {
+
+namespace {
+
+using S16ToF32Function = void (*)(const int16_t* pIn, float* pOut, size_t numSamples);
+using F32ToS16Function = void (*)(const float* pIn, int16_t* pOut, size_t numSamples);
+using S16ToS24Function = void (*)(const int16_t* pIn, uint8_t* pOut, size_t numSamples);
+using DeinterleaveFunction = void (*)(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames);
+
+void s16_to_f32_scalar(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+        pOut[i] = pIn[i] * (1.0f / 32768.0f);
+}
+
+void f32_to_s16_scalar(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        // Clamped like the maxps/minps of the vector variants, which return their second
+        // operand when the first is NaN: NaN gives -32768 on every ISA
+        float value = pIn[i] * 32768.0f;
+        value = (value > -32768.0f) ? value : -32768.0f;
+        value = (value < 32767.0f) ? value : 32767.0f;
+        pOut[i] = (int16_t)std::lrint(value);
+    }
+}
+
+void s16_to_s24_scalar(const int16_t* pIn, uint8_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        pOut[3 * i] = 0;
+        pOut[3 * i + 1] = (uint8_t)pIn[i];
+        pOut[3 * i + 2] = (uint8_t)(pIn[i] >> 8);
+    }
+}
+
+void deinterleave_s16_stereo_scalar(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    for (size_t i = 0; i < numFrames; i++)
+    {
+        pLeft[i] = pIn[2 * i];
+        pRight[i] = pIn[2 * i + 1];
+    }
+}
+
+#if defined(CPU_DISPATCH_X86)
+
+// The vector variants convert whole vectors, then leave the remaining samples to the scalar one.
+// Float to integer conversions clamp first, then round to nearest even like lrint.
+
+CPU_TARGET_SSE41 void s16_to_f32_sse41(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)(pIn + i));
+        __m128i lo = _mm_cvtepi16_epi32(in);
+        __m128i hi = _mm_cvtepi16_epi32(_mm_srli_si128(in, 8));
+        _mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(pOut + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    s16_to_f32_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_AVX2 void s16_to_f32_avx2(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(pIn + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(pIn + i + 8)));
+        _mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(pOut + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    s16_to_f32_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_AVX512 void s16_to_f32_avx512(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 32 <= numSamples; i += 32)
+    {
+        __m512i lo = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(pIn + i)));
+        __m512i hi = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(pIn + i + 16)));
+        _mm512_storeu_ps(pOut + i, _mm512_mul_ps(_mm512_cvtepi32_ps(lo), scale));
+        _mm512_storeu_ps(pOut + i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(hi), scale));
+    }
+    s16_to_f32_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_SSE41 void f32_to_s16_sse41(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    // Clamp, round, and pack with 16-bit saturation
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lower = _mm_set1_ps(-32768.0f);
+    const __m128 upper = _mm_set1_ps(32767.0f);
+    size_t i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        __m128 lo = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pIn + i), scale), lower), upper);
+        __m128 hi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pIn + i + 4), scale), lower), upper);
+        _mm_storeu_si128((__m128i*)(pOut + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+    f32_to_s16_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_AVX2 void f32_to_s16_avx2(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 lower = _mm256_set1_ps(-32768.0f);
+    const __m256 upper = _mm256_set1_ps(32767.0f);
+    size_t i = 0;
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m256 lo = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(pIn + i), scale), lower), upper);
+        __m256 hi = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(pIn + i + 8), scale), lower), upper);
+
+        // The pack works within 128-bit lanes: put the quarters back in order
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+        _mm256_storeu_si256((__m256i*)(pOut + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    f32_to_s16_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_AVX512 void f32_to_s16_avx512(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    const __m512 scale = _mm512_set1_ps(32768.0f);
+    const __m512 lower = _mm512_set1_ps(-32768.0f);
+    const __m512 upper = _mm512_set1_ps(32767.0f);
+    size_t i = 0;
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m512 value = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(pIn + i), scale), lower), upper);
+        _mm256_storeu_si256((__m256i*)(pOut + i), _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(value)));
+    }
+    f32_to_s16_scalar(pIn + i, pOut + i, numSamples - i);
+}
+
+CPU_TARGET_SSE41 void s16_to_s24_sse41(const int16_t* pIn, uint8_t* pOut, size_t numSamples)
+{
+    // 16 samples (2 input vectors) make 3 output vectors of 0, low, high byte triplets
+    // (-128: zero byte; the middle vector takes from both inputs)
+    const __m128i shuffle0 = _mm_setr_epi8(-128, 0, 1, -128, 2, 3, -128, 4, 5, -128, 6, 7, -128, 8, 9, -128);
+    const __m128i shuffle1a = _mm_setr_epi8(10, 11, -128, 12, 13, -128, 14, 15, -128, -128, -128, -128, -128, -128, -128, -128);
+    const __m128i shuffle1b = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, -128, 0, 1, -128, 2, 3, -128, 4);
+    const __m128i shuffle2 = _mm_setr_epi8(5, -128, 6, 7, -128, 8, 9, -128, 10, 11, -128, 12, 13, -128, 14, 15);
+    size_t i = 0;
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m128i in0 = _mm_loadu_si128((const __m128i*)(pIn + i));
+        __m128i in1 = _mm_loadu_si128((const __m128i*)(pIn + i + 8));
+        uint8_t* pOutBlock = pOut + 3 * i;
+        _mm_storeu_si128((__m128i*)pOutBlock, _mm_shuffle_epi8(in0, shuffle0));
+        _mm_storeu_si128((__m128i*)(pOutBlock + 16), _mm_or_si128(_mm_shuffle_epi8(in0, shuffle1a), _mm_shuffle_epi8(in1, shuffle1b)));
+        _mm_storeu_si128((__m128i*)(pOutBlock + 32), _mm_shuffle_epi8(in1, shuffle2));
+    }
+    s16_to_s24_scalar(pIn + i, pOut + 3 * i, numSamples - i);
+}
+
+// Each frame is read as a 32-bit word, left sample in the low half: the
+// shifts sign-extend each half into its channel
+
+CPU_TARGET_SSE41 void deinterleave_s16_stereo_sse41(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    size_t i = 0;
+    for (; i + 4 <= numFrames; i += 4)
+    {
+        __m128i frames = _mm_loadu_si128((const __m128i*)(pIn + 2 * i));
+        _mm_storeu_si128((__m128i*)(pLeft + i), _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16));
+        _mm_storeu_si128((__m128i*)(pRight + i), _mm_srai_epi32(frames, 16));
+    }
+    deinterleave_s16_stereo_scalar(pIn + 2 * i, pLeft + i, pRight + i, numFrames - i);
+}
+
+CPU_TARGET_AVX2 void deinterleave_s16_stereo_avx2(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    size_t i = 0;
+    for (; i + 8 <= numFrames; i += 8)
+    {
+        __m256i frames = _mm256_loadu_si256((const __m256i*)(pIn + 2 * i));
+        _mm256_storeu_si256((__m256i*)(pLeft + i), _mm256_srai_epi32(_mm256_slli_epi32(frames, 16), 16));
+        _mm256_storeu_si256((__m256i*)(pRight + i), _mm256_srai_epi32(frames, 16));
+    }
+    deinterleave_s16_stereo_scalar(pIn + 2 * i, pLeft + i, pRight + i, numFrames - i);
+}
+
+CPU_TARGET_AVX512 void deinterleave_s16_stereo_avx512(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    size_t i = 0;
+    for (; i + 16 <= numFrames; i += 16)
+    {
+        __m512i frames = _mm512_loadu_si512((const void*)(pIn + 2 * i));
+        _mm512_storeu_si512((void*)(pLeft + i), _mm512_srai_epi32(_mm512_slli_epi32(frames, 16), 16));
+        _mm512_storeu_si512((void*)(pRight + i), _mm512_srai_epi32(frames, 16));
+    }
+    deinterleave_s16_stereo_scalar(pIn + 2 * i, pLeft + i, pRight + i, numFrames - i);
+}
+
+const S16ToF32Function kS16ToF32Variants[CpuDispatch::kNumIsas] = { s16_to_f32_scalar, s16_to_f32_sse41, s16_to_f32_avx2, s16_to_f32_avx512 };
+const F32ToS16Function kF32ToS16Variants[CpuDispatch::kNumIsas] = { f32_to_s16_scalar, f32_to_s16_sse41, f32_to_s16_avx2, f32_to_s16_avx512 };
+const S16ToS24Function kS16ToS24Variants[CpuDispatch::kNumIsas] = { s16_to_s24_scalar, s16_to_s24_sse41, nullptr, nullptr };
+const DeinterleaveFunction kDeinterleaveVariants[CpuDispatch::kNumIsas] = { deinterleave_s16_stereo_scalar, deinterleave_s16_stereo_sse41, deinterleave_s16_stereo_avx2, deinterleave_s16_stereo_avx512 };
+
+#else
+
+const S16ToF32Function kS16ToF32Variants[CpuDispatch::kNumIsas] = { s16_to_f32_scalar };
+const F32ToS16Function kF32ToS16Variants[CpuDispatch::kNumIsas] = { f32_to_s16_scalar };
+const S16ToS24Function kS16ToS24Variants[CpuDispatch::kNumIsas] = { s16_to_s24_scalar };
+const DeinterleaveFunction kDeinterleaveVariants[CpuDispatch::kNumIsas] = { deinterleave_s16_stereo_scalar };
+
+#endif // CPU_DISPATCH_X86
+
+} // namespace
+
+void u8_to_s16(const uint8_t* pIn, int16_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+        pOut[i] = (int16_t)((pIn[i] - 128) << 8);
+}
+
+void s24_to_s16(const uint8_t* pIn, int16_t* pOut, size_t numSamples)
+{
+    // Keep the 2 most significant bytes of each little-endian 24-bit sample
+    for (size_t i = 0; i < numSamples; i++)
+        pOut[i] = (int16_t)(pIn[3 * i + 1] | (pIn[3 * i + 2] << 8));
+}
+
+void s32_to_s16(const int32_t* pIn, int16_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+        pOut[i] = (int16_t)(pIn[i] >> 16);
+}
+
+void f32_to_s16(const float* pIn, int16_t* pOut, size_t numSamples)
+{
+    CpuDispatch::select_variant(kF32ToS16Variants)(pIn, pOut, numSamples);
+}
+
+void f64_to_s16(const double* pIn, int16_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        double value = std::min(std::max(pIn[i] * 32768.0, -32768.0), 32767.0);
+        pOut[i] = (int16_t)std::lrint(value);
+    }
+}
+
+void s16_to_f32(const int16_t* pIn, float* pOut, size_t numSamples)
+{
+    CpuDispatch::select_variant(kS16ToF32Variants)(pIn, pOut, numSamples);
+}
+
+void s16_to_s24(const int16_t* pIn, uint8_t* pOut, size_t numSamples)
+{
+    CpuDispatch::select_variant(kS16ToS24Variants)(pIn, pOut, numSamples);
+}
+
+void f32_to_s24(const float* pIn, uint8_t* pOut, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        float value = std::min(std::max(pIn[i] * 8388608.0f, -8388608.0f), 8388607.0f);
+        int32_t sample = (int32_t)std::lrint(value);
+        pOut[3 * i] = (uint8_t)sample;
+        pOut[3 * i + 1] = (uint8_t)(sample >> 8);
+        pOut[3 * i + 2] = (uint8_t)(sample >> 16);
+    }
+}
+
+void deinterleave_s16_stereo(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames)
+{
+    CpuDispatch::select_variant(kDeinterleaveVariants)(pIn, pLeft, pRight, numFrames);
+}
+
+} // namespace SampleConvert
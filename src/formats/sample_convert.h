@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// Sample format conversions, written as straight loops over whole buffers so
+// that they vectorize: the 16-bit <-> float and 16 -> 24-bit ones and the
+// stereo deinterleave explicitly, with a variant per ISA (cpu_dispatch.h), the
+// others by the compiler.
+//-----------------------------------------------------------------------------
+namespace SampleConvert {
+
+void u8_to_s16(const uint8_t* pIn, int16_t* pOut, size_t numSamples);
+void s24_to_s16(const uint8_t* pIn, int16_t* pOut, size_t numSamples);
+void s32_to_s16(const int32_t* pIn, int16_t* pOut, size_t numSamples);
+void f32_to_s16(const float* pIn, int16_t* pOut, size_t numSamples);
+void f64_to_s16(const double* pIn, int16_t* pOut, size_t numSamples);
+
+void s16_to_f32(const int16_t* pIn, float* pOut, size_t numSamples);
+void s16_to_s24(const int16_t* pIn, uint8_t* pOut, size_t numSamples);
+void f32_to_s24(const float* pIn, uint8_t* pOut, size_t numSamples);
+
+// Splits interleaved 16-bit stereo frames into one 32-bit buffer per channel
+void deinterleave_s16_stereo(const int16_t* pIn, int32_t* pLeft, int32_t* pRight, size_t numFrames);
+
+} // namespace SampleConvert
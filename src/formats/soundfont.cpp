@@ -0,0 +1,392 @@
+#include "soundfont.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <iostream>
+
+#include "stats.h"
+#include "utils.h"
+#include "wave.h"
+
+namespace SoundFont {
+
+PACK(struct PresetHeader
+{
+    char achPresetName[20];
+    uint16_t wPreset;
+    uint16_t wBank;
+    uint16_t wPresetBagNdx;
+    uint32_t dwLibrary;
+    uint32_t dwGenre;
+    uint32_t dwMorphology;
+});
+static_assert(sizeof(PresetHeader) == 38, "");
+
+PACK(struct Bag
+{
+    uint16_t wGenNdx;
+    uint16_t wModNdx;
+});
+
+PACK(struct ModList
+{
+    uint16_t sfModSrcOper;
+    uint16_t sfModDestOper;
+    int16_t modAmount;
+    uint16_t sfModAmtSrcOper;
+    uint16_t sfModTransOper;
+});
+static_assert(sizeof(ModList) == 10, "");
+
+PACK(struct GenList
+{
+    uint16_t sfGenOper;
+    int16_t genAmount;
+});
+
+PACK(struct InstHeader
+{
+    char achInstName[20];
+    uint16_t wInstBagNdx;
+});
+static_assert(sizeof(InstHeader) == 22, "");
+
+enum EGenerator : uint16_t
+{
+    GenPan = 17,
+    GenInstrument = 41,
+    GenSampleID = 53,
+    GenSampleModes = 54,
+};
+
+enum ESampleType : uint16_t
+{
+    MonoSample = 1,
+    RightSample = 2,
+    LeftSample = 4,
+};
+
+// The spec requires at least 46 zero-valued sample points after each sample
+constexpr uint32_t kSamplePadding = 46;
+constexpr uint32_t kMaxSamples = 0xFFFF;
+
+static void copy_name(char (&dest)[20], const std::string& name)
+{
+    memset(dest, 0, sizeof(dest));
+    memcpy(dest, name.c_str(), std::min<size_t>(name.size(), sizeof(dest) - 1));
+}
+
+Builder::Builder(const std::string& path, const std::string& bankName, Utils::FileStore* pStore)
+{
+    if (!file.open(path, pStore))
+        return;
+
+    using namespace Utils;
+
+    file.write("RIFF", 4);
+    writeInt(file, (uint32_t)0); // patched in close()
+    file.write("sfbk", 4);
+
+    write_info_list(bankName);
+
+    sdtaListPos = file.tell();
+    file.write("LIST", 4);
+    writeInt(file, (uint32_t)0); // patched in close()
+    file.write("sdta", 4);
+    file.write("smpl", 4);
+    writeInt(file, (uint32_t)0); // patched in close()
+}
+
+Builder::~Builder()
+{
+    close();
+}
+
+void Builder::write_info_list(const std::string& bankName)
+{
+    using namespace Utils;
+
+    std::string name = bankName.substr(0, 255);
+    uint32_t nameSize = (uint32_t)(name.size() + 1);
+    nameSize += nameSize & 1;
+    name.resize(nameSize, '\0');
+
+    const char kEngine[8] = "EMU8000";
+
+    file.write("LIST", 4);
+    writeInt(file, (uint32_t)(4 + (8 + 4) + (8 + sizeof(kEngine)) + (8 + nameSize)));
+    file.write("INFO", 4);
+
+    file.write("ifil", 4);
+    writeInt(file, (uint32_t)4);
+    writeInt(file, (uint16_t)2); // version 2.01
+    writeInt(file, (uint16_t)1);
+
+    file.write("isng", 4);
+    writeInt(file, (uint32_t)sizeof(kEngine));
+    file.write(kEngine, sizeof(kEngine));
+
+    file.write("INAM", 4);
+    writeInt(file, nameSize);
+    file.write(name.data(), nameSize);
+}
+
+bool Builder::add_wave(const std::string& name, const uint8_t* pWavData, size_t wavSize)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Merge);
+
+    if (!file.is_open())
+        return false;
+
+    const uint8_t* pFmt = nullptr;
+    const uint8_t* pPcm = nullptr;
+    uint32_t fmtSize = 0, pcmSize = 0;
+    if (!Wave::find_chunk(pWavData, wavSize, "fmt ", pFmt, fmtSize) || fmtSize < 16
+        || !Wave::find_chunk(pWavData, wavSize, "data", pPcm, pcmSize))
+    {
+        std::cerr << "Warning: invalid embedded wave " << name << ", ignoring it.\n";
+        return false;
+    }
+
+    uint16_t audioFormat, numChannels, bitDepth;
+    uint32_t sampleRate;
+    memcpy(&audioFormat, pFmt + 0, 2);
+    memcpy(&numChannels, pFmt + 2, 2);
+    memcpy(&sampleRate, pFmt + 4, 4);
+    memcpy(&bitDepth, pFmt + 14, 2);
+
+    constexpr uint16_t kFormatPCM = 1, kFormatExtensible = 0xFFFE;
+    if ((audioFormat != kFormatPCM && audioFormat != kFormatExtensible) || bitDepth != 16
+        || (numChannels != 1 && numChannels != 2))
+    {
+        std::cerr << "Warning: embedded wave " << name << " isn't 16-bit mono/stereo PCM, ignoring it.\n";
+        return false;
+    }
+
+    if (samples.size() + numChannels > kMaxSamples)
+    {
+        std::cerr << "Warning: too many samples for a single SF2 bank, ignoring " << name << ".\n";
+        return false;
+    }
+
+    const uint32_t numFrames = pcmSize / (2 * numChannels);
+
+    // Optional loop points and root key, from the 'smpl' chunk
+    uint8_t originalKey = 60;
+    uint32_t loopStart = 0, loopEnd = numFrames;
+    bool bLooped = false;
+
+    const uint8_t* pSmpl = nullptr;
+    uint32_t smplSize = 0;
+    if (Wave::find_chunk(pWavData, wavSize, "smpl", pSmpl, smplSize) && smplSize >= 36)
+    {
+        uint32_t unityNote, numLoops;
+        memcpy(&unityNote, pSmpl + 12, 4);
+        memcpy(&numLoops, pSmpl + 28, 4);
+        if (unityNote <= 127)
+            originalKey = (uint8_t)unityNote;
+
+        if (numLoops > 0 && smplSize >= 36 + 24)
+        {
+            uint32_t start, end;
+            memcpy(&start, pSmpl + 36 + 8, 4);
+            memcpy(&end, pSmpl + 36 + 12, 4);
+            if (start < end && end < numFrames)
+            {
+                loopStart = start;
+                loopEnd = end + 1; // inclusive in WAV, exclusive in SF2
+                bLooped = true;
+            }
+        }
+    }
+
+    Instrument instrument;
+    instrument.name = name;
+    instrument.firstSample = (uint16_t)samples.size();
+    instrument.numSamples = numChannels;
+    instrument.bLooped = bLooped;
+
+    for (uint16_t channel = 0; channel < numChannels; channel++)
+    {
+        SampleHeader header;
+        copy_name(header.achSampleName, numChannels == 1 ? name : name + (channel == 0 ? "L" : "R"));
+
+        uint32_t start = write_sample_data(pPcm, numFrames, numChannels, channel);
+        header.dwStart = start;
+        header.dwEnd = start + numFrames;
+        header.dwStartloop = start + loopStart;
+        header.dwEndloop = start + loopEnd;
+        header.dwSampleRate = sampleRate;
+        header.byOriginalKey = originalKey;
+        header.chCorrection = 0;
+
+        if (numChannels == 1)
+        {
+            header.wSampleLink = 0;
+            header.sfSampleType = MonoSample;
+        }
+        else
+        {
+            header.wSampleLink = (uint16_t)(instrument.firstSample + (1 - channel));
+            header.sfSampleType = (channel == 0) ? LeftSample : RightSample;
+        }
+
+        samples.push_back(header);
+    }
+
+    instruments.push_back(instrument);
+    return true;
+}
+
+uint32_t Builder::write_sample_data(const uint8_t* pPcm, uint32_t numFrames, uint16_t numChannels, uint16_t channel)
+{
+    const uint32_t start = smplPointCount;
+
+    if (numChannels == 1)
+    {
+        // Straight from the source mapping, no intermediate copy
+        file.write((const char*)pPcm, (std::streamsize)numFrames * 2);
+    }
+    else
+    {
+        // Deinterleave one channel through a small bounce buffer
+        constexpr uint32_t kBounceFrames = 4096;
+        int16_t bounce[kBounceFrames];
+
+        const int16_t* pIn = (const int16_t*)pPcm + channel;
+        for (uint32_t frame = 0; frame < numFrames; frame += kBounceFrames)
+        {
+            uint32_t count = std::min(kBounceFrames, numFrames - frame);
+            for (uint32_t i = 0; i < count; i++, pIn += numChannels)
+                bounce[i] = *pIn;
+            file.write((const char*)bounce, (std::streamsize)count * 2);
+        }
+    }
+
+    const int16_t padding[kSamplePadding] = {};
+    file.write((const char*)padding, sizeof(padding));
+
+    smplPointCount += numFrames + kSamplePadding;
+    return start;
+}
+
+void Builder::write_pdta_list()
+{
+    std::vector<char> pdta;
+    auto append = [&pdta](const auto& record)
+    {
+        const char* p = reinterpret_cast<const char*>(&record);
+        pdta.insert(pdta.end(), p, p + sizeof(record));
+    };
+
+    // Sub-chunks must appear in this exact order
+    std::vector<PresetHeader> phdr;
+    std::vector<Bag> pbag, ibag;
+    std::vector<GenList> pgen, igen;
+    std::vector<InstHeader> inst;
+
+    for (size_t i = 0; i < instruments.size(); i++)
+    {
+        const auto& instrument = instruments[i];
+
+        PresetHeader preset = {};
+        copy_name(preset.achPresetName, instrument.name);
+        preset.wPreset = (uint16_t)(i % 128);
+        preset.wBank = (uint16_t)(i / 128);
+        preset.wPresetBagNdx = (uint16_t)pbag.size();
+        phdr.push_back(preset);
+
+        pbag.push_back({ (uint16_t)pgen.size(), 0 });
+        pgen.push_back({ GenInstrument, (int16_t)i });
+
+        InstHeader instHeader = {};
+        copy_name(instHeader.achInstName, instrument.name);
+        instHeader.wInstBagNdx = (uint16_t)ibag.size();
+        inst.push_back(instHeader);
+
+        for (uint16_t s = 0; s < instrument.numSamples; s++)
+        {
+            ibag.push_back({ (uint16_t)igen.size(), 0 });
+            if (instrument.numSamples == 2)
+                igen.push_back({ GenPan, (int16_t)(s == 0 ? -500 : 500) });
+            if (instrument.bLooped)
+                igen.push_back({ GenSampleModes, 1 });
+            igen.push_back({ GenSampleID, (int16_t)(instrument.firstSample + s) }); // must be last in the zone
+        }
+    }
+
+    // Terminal records
+    PresetHeader eop = {};
+    copy_name(eop.achPresetName, "EOP");
+    eop.wPresetBagNdx = (uint16_t)pbag.size();
+    phdr.push_back(eop);
+    pbag.push_back({ (uint16_t)pgen.size(), 0 });
+    pgen.push_back({ 0, 0 });
+
+    InstHeader eoi = {};
+    copy_name(eoi.achInstName, "EOI");
+    eoi.wInstBagNdx = (uint16_t)ibag.size();
+    inst.push_back(eoi);
+    ibag.push_back({ (uint16_t)igen.size(), 0 });
+    igen.push_back({ 0, 0 });
+
+    SampleHeader eos = {};
+    copy_name(eos.achSampleName, "EOS");
+
+    const ModList terminalMod = {};
+
+    auto appendChunk = [&](const char* id, const auto& records)
+    {
+        pdta.insert(pdta.end(), id, id + 4);
+        uint32_t size = (uint32_t)(records.size() * sizeof(records[0]));
+        append(size);
+        for (auto& record : records)
+            append(record);
+    };
+
+    pdta.insert(pdta.end(), { 'p', 'd', 't', 'a' });
+    appendChunk("phdr", phdr);
+    appendChunk("pbag", pbag);
+    appendChunk("pmod", std::vector<ModList>{ terminalMod });
+    appendChunk("pgen", pgen);
+    appendChunk("inst", inst);
+    appendChunk("ibag", ibag);
+    appendChunk("imod", std::vector<ModList>{ terminalMod });
+    appendChunk("igen", igen);
+
+    pdta.insert(pdta.end(), { 's', 'h', 'd', 'r' });
+    append((uint32_t)((samples.size() + 1) * sizeof(SampleHeader)));
+    for (auto& sample : samples)
+        append(sample);
+    append(eos);
+
+    file.write("LIST", 4);
+    Utils::writeInt(file, (uint32_t)pdta.size());
+    file.write(pdta.data(), pdta.size());
+}
+
+bool Builder::close()
+{
+    if (!file.is_open())
+        return false;
+
+    using namespace Utils;
+
+    const uint32_t smplSize = smplPointCount * 2;
+
+    write_pdta_list();
+    const uint32_t fileSize = (uint32_t)file.tell();
+
+    // Back-patch the chunk sizes now that everything is known
+    const uint32_t riffSize = fileSize - 8;
+    const uint32_t sdtaSize = 4 + 8 + smplSize;
+    bool bSuccess = file.write_at(4, &riffSize, sizeof(riffSize));
+    bSuccess &= file.write_at(sdtaListPos + 4, &sdtaSize, sizeof(sdtaSize));
+    bSuccess &= file.write_at(sdtaListPos + 16, &smplSize, sizeof(smplSize));
+
+    bSuccess &= file.close();
+    return bSuccess;
+}
+
+} // namespace SoundFont
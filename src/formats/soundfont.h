@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "utils.h"
+
+namespace SoundFont {
+
+PACK(struct SampleHeader
+{
+    char achSampleName[20];
+    uint32_t dwStart;
+    uint32_t dwEnd;
+    uint32_t dwStartloop;
+    uint32_t dwEndloop;
+    uint32_t dwSampleRate;
+    uint8_t byOriginalKey;
+    int8_t chCorrection;
+    uint16_t wSampleLink;
+    uint16_t sfSampleType;
+});
+static_assert(sizeof(SampleHeader) == 46, "");
+
+//-----------------------------------------------------------------------------
+// Writes a .sf2 bank incrementally: sample data is streamed straight into the
+// 'smpl' sub-chunk as waves are added, and only the (small) preset/instrument
+// metadata is kept in memory until close() writes the 'pdta' list.
+// Each added wave gets its own instrument and preset.
+//-----------------------------------------------------------------------------
+class Builder
+{
+public:
+    // The file goes to the store (as a stream, or whole on close())
+    Builder(const std::string& path, const std::string& bankName, Utils::FileStore* pStore);
+    ~Builder();
+
+    bool is_open() const { return file.is_open(); }
+
+    // Adds a 16-bit PCM .wav file (mono or stereo) read from memory
+    bool add_wave(const std::string& name, const uint8_t* pWavData, size_t wavSize);
+
+    // Writes the preset metadata and patches the chunk sizes
+    bool close();
+
+    size_t get_sample_count() const { return samples.size(); }
+
+private:
+    struct Instrument
+    {
+        std::string name;
+        uint16_t firstSample;
+        uint16_t numSamples; // 1 (mono) or 2 (stereo, left then right)
+        bool bLooped;
+    };
+
+    uint32_t write_sample_data(const uint8_t* pPcm, uint32_t numFrames, uint16_t numChannels, uint16_t channel);
+    void write_info_list(const std::string& bankName);
+    void write_pdta_list();
+
+    Utils::OutputFile file;
+    uint64_t sdtaListPos = 0;
+    uint32_t smplPointCount = 0;
+
+    std::vector<SampleHeader> samples;
+    std::vector<Instrument> instruments;
+};
+
+} // namespace SoundFont
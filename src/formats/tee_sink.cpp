@@ -0,0 +1,48 @@
+#include "tee_sink.h"
+
+bool TeeSink::begin(const PcmFormat& format, uint64_t expectedDataSize)
+{
+    active.assign(branches.size(), false);
+    bFailed = false;
+
+    bool bAnyActive = false;
+    for (size_t i = 0; i < branches.size(); i++)
+    {
+        active[i] = branches[i]->begin(format, expectedDataSize);
+        bAnyActive |= active[i];
+        bFailed |= !active[i];
+    }
+    return bAnyActive;
+}
+
+char* TeeSink::reserve(size_t size)
+{
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return buffer.data();
+}
+
+void TeeSink::commit(size_t size)
+{
+    write(buffer.data(), size);
+}
+
+void TeeSink::write(const void* pData, size_t size)
+{
+    for (size_t i = 0; i < branches.size(); i++)
+    {
+        if (active[i])
+            branches[i]->write(pData, size);
+    }
+}
+
+bool TeeSink::end()
+{
+    for (size_t i = 0; i < branches.size(); i++)
+    {
+        if (active[i])
+            bFailed |= !branches[i]->end();
+        active[i] = false;
+    }
+    return !bFailed;
+}
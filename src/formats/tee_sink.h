@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "pcm_sink.h"
+
+//-----------------------------------------------------------------------------
+// Fans a single decode out to several sinks (e.g. a WAV file, a FLAC copy and
+// a peaks file): the decoder produces each chunk once, into the tee's buffer,
+// and every branch gets that same buffer through write(), one after the other
+// on the decoding thread. Each extra output only costs its own encoding;
+// branches reading the chunk in place don't even copy it.
+// A branch failing in begin() is left out and the others carry on; end()
+// fails if any branch failed.
+//-----------------------------------------------------------------------------
+class TeeSink : public PcmSink
+{
+public:
+    explicit TeeSink(std::vector<std::unique_ptr<PcmSink>> in_branches) : branches(std::move(in_branches)) {}
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    void write(const void* pData, size_t size) override;
+    bool end() override;
+
+private:
+    std::vector<std::unique_ptr<PcmSink>> branches;
+    std::vector<bool> active; // per branch: began successfully
+    std::vector<char> buffer;
+    bool bFailed = false;
+};
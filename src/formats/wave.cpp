@@ -1,7 +1,11 @@
 #include "wave.h"
 
+#include "sample_convert.h"
 #include "utils.h"
-#include <fstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
 
 namespace Wave {
 
@@ -9,29 +13,273 @@ constexpr static char kWAVE[4] = { 'W', 'A', 'V', 'E' };
 constexpr static char kfmt[4] = { 'f', 'm', 't', ' ' };
 constexpr static char kdata[4] = { 'd', 'a', 't', 'a' };
 
-void write(const std::string& path, char* pData, uint32_t dataSize, uint8_t numChannels, uint32_t sampleRate, uint32_t bitSize)
+bool find_chunk(const uint8_t* pWavData, size_t wavSize, const char chunkId[4], const uint8_t*& pChunk, uint32_t& chunkSize)
 {
-    using namespace Utils;
+    if (wavSize < 12 || strncmp((const char*)pWavData, kRIFF, 4) != 0 || strncmp((const char*)pWavData + 8, kWAVE, 4) != 0)
+        return false;
 
-    std::ofstream os(path, std::ofstream::binary);
-    os.write(kRIFF, 4);
-    writeInt(os, (uint32_t)(36 + dataSize));
-    os.write(kWAVE, 4);
+    size_t offset = 12;
+    while (offset + 8 <= wavSize)
+    {
+        uint32_t size;
+        memcpy(&size, pWavData + offset + 4, sizeof(size));
 
-    os.write(kfmt, 4);
-    writeInt(os, (uint32_t)16);
-    writeInt(os, (uint16_t)1);
-    writeInt(os, (uint16_t)numChannels);
-    writeInt(os, (uint32_t)sampleRate);
-    uint16_t blockAlign = (numChannels * bitSize / 8);
-    writeInt(os, (uint32_t)(sampleRate * blockAlign));
-    writeInt(os, (uint16_t)blockAlign);
-    writeInt(os, (uint16_t)bitSize);
+        if (strncmp((const char*)pWavData + offset, chunkId, 4) == 0)
+        {
+            pChunk = pWavData + offset + 8;
+            chunkSize = (uint32_t)std::min<size_t>(size, wavSize - offset - 8);
+            return true;
+        }
 
-    os.write(kdata, 4);
-    writeInt(os, (uint32_t)(dataSize));
+        // Chunks are word-aligned
+        offset += 8 + (size_t)size + (size & 1);
+    }
 
-    os.write((char*)pData, dataSize);
+    return false;
+}
+
+bool Reader::open(const uint8_t* pWavData, size_t wavSize)
+{
+    pData = pWavData;
+    dataSize = wavSize;
+    converted.clear();
+    error.clear();
+    return parse();
+}
+
+bool Reader::fail(const char* message)
+{
+    error = message;
+    return false;
+}
+
+bool Reader::parse()
+{
+    const uint8_t* pFmt = nullptr;
+    uint32_t fmtSize = 0;
+    if (!find_chunk(pData, dataSize, kfmt, pFmt, fmtSize))
+        return fail("not a WAVE file, or missing 'fmt ' chunk");
+    if (fmtSize < 16)
+        return fail("invalid 'fmt ' chunk");
+
+    constexpr uint16_t kFormatPCM = 1, kFormatFloat = 3, kFormatExtensible = 0xFFFE;
+
+    uint16_t audioFormat, numChannels, blockAlign, bitSize;
+    uint32_t sampleRate;
+    memcpy(&audioFormat, pFmt + 0, 2);
+    memcpy(&numChannels, pFmt + 2, 2);
+    memcpy(&sampleRate, pFmt + 4, 4);
+    memcpy(&blockAlign, pFmt + 12, 2);
+    memcpy(&bitSize, pFmt + 14, 2);
+
+    if (audioFormat == kFormatExtensible)
+    {
+        // The actual format is in the first 2 bytes of the SubFormat GUID
+        if (fmtSize < 40)
+            return fail("invalid WAVE_FORMAT_EXTENSIBLE 'fmt ' chunk");
+        memcpy(&audioFormat, pFmt + 24, 2);
+    }
+
+    if (audioFormat == kFormatPCM)
+    {
+        if (bitSize != 8 && bitSize != 16 && bitSize != 24 && bitSize != 32)
+            return fail("unsupported PCM sample size");
+        bFloat = false;
+    }
+    else if (audioFormat == kFormatFloat)
+    {
+        if (bitSize != 32 && bitSize != 64)
+            return fail("unsupported float sample size");
+        bFloat = true;
+    }
+    else
+    {
+        return fail("unsupported WAVE format (compressed data?)");
+    }
+
+    if (numChannels == 0 || blockAlign != numChannels * bitSize / 8 || sampleRate == 0)
+        return fail("inconsistent 'fmt ' chunk");
+
+    uint32_t pcmSize = 0;
+    if (!find_chunk(pData, dataSize, kdata, pPcm, pcmSize))
+        return fail("missing 'data' chunk");
+
+    sourceFormat.numChannels = numChannels;
+    sourceFormat.sampleRate = sampleRate;
+    sourceFormat.bitSize = bitSize;
+    numFrames = pcmSize / blockAlign;
+    return true;
+}
+
+const int16_t* Reader::get_samples16()
+{
+    if (!pPcm)
+        return nullptr;
+
+    if (sourceFormat.bitSize == 16 && !bFloat)
+        return reinterpret_cast<const int16_t*>(pPcm);
+
+    const size_t numSamples = get_num_samples();
+    if (converted.size() != numSamples)
+    {
+        converted.resize(numSamples);
+
+        // memcpy'd out of the mapping when the data chunk isn't suitably aligned for the source type
+        auto convertAligned = [&](auto* pTyped, auto convert)
+        {
+            using T = std::remove_const_t<std::remove_pointer_t<decltype(pTyped)>>;
+            if (reinterpret_cast<uintptr_t>(pPcm) % alignof(T) == 0)
+            {
+                convert(reinterpret_cast<const T*>(pPcm), converted.data(), numSamples);
+            }
+            else
+            {
+                std::vector<T> aligned(numSamples);
+                memcpy(aligned.data(), pPcm, numSamples * sizeof(T));
+                convert(aligned.data(), converted.data(), numSamples);
+            }
+        };
+
+        if (bFloat && sourceFormat.bitSize == 32)
+            convertAligned((const float*)nullptr, SampleConvert::f32_to_s16);
+        else if (bFloat)
+            convertAligned((const double*)nullptr, SampleConvert::f64_to_s16);
+        else if (sourceFormat.bitSize == 32)
+            convertAligned((const int32_t*)nullptr, SampleConvert::s32_to_s16);
+        else if (sourceFormat.bitSize == 24)
+            SampleConvert::s24_to_s16(pPcm, converted.data(), numSamples);
+        else
+            SampleConvert::u8_to_s16(pPcm, converted.data(), numSamples);
+    }
+
+    return converted.data();
+}
+
+void fill_header(WavHeader& header, const PcmFormat& format, uint32_t dataSize)
+{
+    memcpy(header.tagRIFF, kRIFF, 4);
+    header.wavSize = 36 + dataSize;
+    memcpy(header.tagWave, kWAVE, 4);
+
+    memcpy(header.tagFmt, kfmt, 4);
+    header.fmtChunkSize = 16;
+    header.audioFormat = format.bFloat ? 3 : 1; // WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM
+    header.numChannels = format.numChannels;
+    header.sampleRate = format.sampleRate;
+    header.byteRate = format.sampleRate * format.block_align();
+    header.sampleAlignment = (short)format.block_align();
+    header.bitDepth = format.bitSize;
+
+    memcpy(header.tagData, kdata, 4);
+    header.dataChunkSize = dataSize;
+}
+
+Writer::~Writer()
+{
+    if (file.is_open())
+        end();
+}
+
+bool Writer::begin(const PcmFormat& format, uint64_t expectedDataSize)
+{
+    if (!file.open(path, pStore))
+        return false;
+
+    dataSize = 0;
+    headerDataSize = (uint32_t)expectedDataSize;
+
+    WavHeader header;
+    fill_header(header, format, headerDataSize);
+    file.write(&header, sizeof(header));
+    return true;
+}
+
+char* Writer::reserve(size_t size)
+{
+    return file.reserve(size);
+}
+
+void Writer::commit(size_t size)
+{
+    file.commit(size);
+    dataSize += size;
+}
+
+bool Writer::end()
+{
+    if (!file.is_open())
+        return false;
+
+    // Patch the sizes if they differ from the ones written up front
+    if (dataSize != headerDataSize)
+    {
+        uint32_t wavSize = (uint32_t)(36 + dataSize);
+        uint32_t chunkSize = (uint32_t)dataSize;
+        file.write_at(offsetof(WavHeader, wavSize), &wavSize, sizeof(wavSize));
+        file.write_at(offsetof(WavHeader, dataChunkSize), &chunkSize, sizeof(chunkSize));
+    }
+
+    return file.close();
+}
+
+bool PipeWriter::begin(const PcmFormat& format, uint64_t expectedDataSize)
+{
+    constexpr uint32_t kMaxDataSize = 0xFFFFFFFFu - 36;
+    bSizeKnown = (expectedDataSize != 0 && expectedDataSize <= kMaxDataSize);
+    headerDataSize = bSizeKnown ? (uint32_t)expectedDataSize : kMaxDataSize;
+    dataSize = 0;
+
+    WavHeader header;
+    fill_header(header, format, headerDataSize);
+    os.write((const char*)&header, sizeof(header));
+    return os.good();
+}
+
+char* PipeWriter::reserve(size_t size)
+{
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return buffer.data();
+}
+
+void PipeWriter::commit(size_t size)
+{
+    const size_t writeSize = (size_t)std::min<uint64_t>(size, headerDataSize - dataSize);
+    os.write(buffer.data(), writeSize);
+    dataSize += writeSize;
+}
+
+bool PipeWriter::end()
+{
+    if (bSizeKnown && dataSize < headerDataSize)
+    {
+        const size_t padSize = headerDataSize - (size_t)dataSize;
+        std::vector<char> silence(std::min<size_t>(padSize, 64 * 1024), 0);
+        for (size_t remaining = padSize; remaining > 0;)
+        {
+            const size_t size = std::min(remaining, silence.size());
+            os.write(silence.data(), size);
+            remaining -= size;
+        }
+    }
+
+    os.flush();
+    return os.good();
+}
+
+void write(const std::string& path, char* pData, uint32_t dataSize, uint8_t numChannels, uint32_t sampleRate, uint32_t bitSize, Utils::FileStore* pStore)
+{
+    PcmFormat format;
+    format.numChannels = numChannels;
+    format.sampleRate = sampleRate;
+    format.bitSize = (uint16_t)bitSize;
+
+    Writer writer(path, pStore);
+    if (!writer.begin(format, dataSize))
+        return;
+
+    writer.write(pData, dataSize);
+    writer.end();
 }
 
 } // namespace Wave
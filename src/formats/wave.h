@@ -1,8 +1,12 @@
 #pragma once
 
 #include "common.h"
+#include "pcm_sink.h"
+#include "utils.h"
 
+#include <ostream>
 #include <string>
+#include <vector>
 
 namespace Wave {
 
@@ -31,6 +35,101 @@ PACK(struct WavHeader
 });
 static_assert(sizeof(WavHeader) == 44, "");
 
-void write(const std::string& path, char* pData, uint32_t dataSize, uint8_t numChannels, uint32_t sampleRate, uint32_t bitSize);
+// Looks for a RIFF sub-chunk inside a WAVE file in memory. On success, pChunk points to the chunk payload.
+bool find_chunk(const uint8_t* pWavData, size_t wavSize, const char chunkId[4], const uint8_t*& pChunk, uint32_t& chunkSize);
+
+//-----------------------------------------------------------------------------
+// .wav reader walking the RIFF chunks (so extra chunks like LIST/fact and
+// extended/extensible 'fmt ' chunks are handled). Samples are exposed as 16-bit
+// PCM: a zero-copy view over the file data for 16-bit inputs, or a converted
+// copy for 8/24/32-bit integer and 32/64-bit float inputs.
+//-----------------------------------------------------------------------------
+class Reader
+{
+public:
+    // The data must stay valid while the reader is used
+    bool open(const uint8_t* pWavData, size_t wavSize);
+
+    const std::string& get_error() const { return error; }
+
+    // Format of the source file (bitSize is the source sample size)
+    const PcmFormat& get_source_format() const { return sourceFormat; }
+    bool is_float() const { return bFloat; }
+
+    uint32_t get_num_frames() const { return numFrames; }
+    size_t get_num_samples() const { return (size_t)numFrames * sourceFormat.numChannels; }
+
+    // Interleaved 16-bit samples, get_num_samples() of them
+    const int16_t* get_samples16();
+
+private:
+    bool parse();
+    bool fail(const char* message);
+
+    const uint8_t* pData = nullptr;
+    size_t dataSize = 0;
+
+    PcmFormat sourceFormat;
+    bool bFloat = false;
+    const uint8_t* pPcm = nullptr;
+    uint32_t numFrames = 0;
+
+    std::vector<int16_t> converted;
+    std::string error;
+};
+
+//-----------------------------------------------------------------------------
+// Streaming .wav writer: the header is written up front (with the expected
+// sizes when known), PCM chunks are appended through large buffered writes,
+// and the RIFF/data sizes are patched on end() if they turned out different.
+//-----------------------------------------------------------------------------
+class Writer : public PcmSink
+{
+public:
+    // The file goes to the store (as a stream, or whole on end())
+    Writer(const std::string& in_path, Utils::FileStore* in_pStore) : path(in_path), pStore(in_pStore) {}
+    ~Writer() override;
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    const std::string path;
+    Utils::FileStore* const pStore;
+    Utils::OutputFile file;
+    uint64_t dataSize = 0;
+    uint32_t headerDataSize = 0;
+};
+
+//-----------------------------------------------------------------------------
+// .wav writer for outputs that can't seek back (e.g. a pipe): the header is
+// written up front with the expected sizes, then the PCM chunks as they come.
+// The data is padded with silence or cut to the size announced in the header.
+// With an unknown size, the header announces the largest one (as streaming
+// tools expect).
+//-----------------------------------------------------------------------------
+class PipeWriter : public PcmSink
+{
+public:
+    explicit PipeWriter(std::ostream& in_os) : os(in_os) {}
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    std::ostream& os;
+    std::vector<char> buffer;
+    uint64_t dataSize = 0;
+    uint32_t headerDataSize = 0;
+    bool bSizeKnown = false;
+};
+
+void fill_header(WavHeader& header, const PcmFormat& format, uint32_t dataSize);
+
+void write(const std::string& path, char* pData, uint32_t dataSize, uint8_t numChannels, uint32_t sampleRate, uint32_t bitSize, Utils::FileStore* pStore);
 
 } // namespace Wave
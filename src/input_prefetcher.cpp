@@ -0,0 +1,472 @@
+#include "input_prefetcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "file_utils.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Input {
+
+#ifdef __linux__
+
+//-----------------------------------------------------------------------------
+// Minimal io_uring, through the raw system calls (no liburing). read_files()
+// reads a batch of whole files in 3 steps, each submitted and reaped with one
+// io_uring_enter: open + size query of all the files, their reads (repeated
+// for the rest of short reads), then their closes. Used by a single thread.
+//-----------------------------------------------------------------------------
+class Prefetcher::IoRing
+{
+public:
+    IoRing() = default;
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Fails where io_uring is missing or disabled (seccomp, kernel.io_uring_disabled),
+    // or lacks the file operations (kernels before 5.6)
+    bool init(unsigned numEntries);
+
+    // Files larger than maxFileSize, or past maxTotalSize (except the first one), are not read.
+    // outSuccess[i] is false for them and for the files that couldn't be read.
+    void read_files(const std::vector<const char*>& filePaths, size_t maxFileSize, size_t maxTotalSize,
+        std::vector<std::vector<uint8_t>>& outData, std::vector<bool>& outSuccess);
+
+private:
+    enum EOp : uint64_t { Open, Size, Read, Close };
+    static uint64_t get_user_data(size_t file, EOp op) { return ((uint64_t)file << 2) | op; }
+
+    io_uring_sqe* add_sqe(uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t offset, uint64_t userData);
+
+    // Submits the queued SQEs and waits for all their completions
+    template <typename Handler>
+    bool complete(Handler&& handler);
+
+    bool is_supported(const uint8_t* pOpcodes, size_t numOpcodes);
+
+    int ringFd = -1;
+    void* pSqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* pCqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned numEntries = 0;
+    unsigned numQueued = 0;
+    bool bBroken = false; // after a failed submission: every file is then left to the workers
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+Prefetcher::IoRing::~IoRing()
+{
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (pCqRing && pCqRing != pSqRing)
+        munmap(pCqRing, cqRingSize);
+    if (pSqRing)
+        munmap(pSqRing, sqRingSize);
+    if (ringFd >= 0)
+        ::close(ringFd);
+}
+
+bool Prefetcher::IoRing::init(unsigned in_numEntries)
+{
+    io_uring_params params = {};
+    ringFd = (int)syscall(__NR_io_uring_setup, in_numEntries, &params);
+    if (ringFd < 0)
+        return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    pSqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (pSqRing == MAP_FAILED)
+    {
+        pSqRing = nullptr;
+        return false;
+    }
+
+    pCqRing = pSqRing;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        pCqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (pCqRing == MAP_FAILED)
+        {
+            pCqRing = nullptr;
+            return false;
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* pSqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (pSqes == MAP_FAILED)
+        return false;
+    sqes = static_cast<io_uring_sqe*>(pSqes);
+
+    uint8_t* pSq = static_cast<uint8_t*>(pSqRing);
+    sqTail = reinterpret_cast<unsigned*>(pSq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(pSq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(pSq + params.sq_off.array);
+    numEntries = params.sq_entries;
+
+    uint8_t* pCq = static_cast<uint8_t*>(pCqRing);
+    cqHead = reinterpret_cast<unsigned*>(pCq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(pCq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(pCq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(pCq + params.cq_off.cqes);
+
+    const uint8_t opcodes[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+    return is_supported(opcodes, sizeof(opcodes));
+}
+
+bool Prefetcher::IoRing::is_supported(const uint8_t* pOpcodes, size_t numOpcodes)
+{
+    constexpr unsigned kNumProbeOps = 256;
+    std::vector<uint8_t> probeBuffer(sizeof(io_uring_probe) + kNumProbeOps * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, kNumProbeOps) < 0)
+        return false;
+
+    for (size_t i = 0; i < numOpcodes; i++)
+    {
+        if (pOpcodes[i] > probe->last_op || !(probe->ops[pOpcodes[i]].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    }
+    return true;
+}
+
+io_uring_sqe* Prefetcher::IoRing::add_sqe(uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t offset, uint64_t userData)
+{
+    const unsigned tail = *sqTail + numQueued++;
+    io_uring_sqe* sqe = &sqes[tail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    sqArray[tail & sqMask] = tail & sqMask;
+    return sqe;
+}
+
+template <typename Handler>
+bool Prefetcher::IoRing::complete(Handler&& handler)
+{
+    const unsigned numRequests = numQueued;
+    __atomic_store_n(sqTail, *sqTail + numQueued, __ATOMIC_RELEASE);
+    numQueued = 0;
+
+    unsigned numSubmitted = 0;
+    unsigned numCompleted = 0;
+    while (numCompleted < (bBroken ? numSubmitted : numRequests))
+    {
+        const unsigned numToSubmit = bBroken ? 0 : numRequests - numSubmitted;
+        const unsigned numToWait = (bBroken ? numSubmitted : numRequests) - numCompleted;
+        const int result = (int)syscall(__NR_io_uring_enter, ringFd, numToSubmit, numToWait, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+
+            // The ring isn't used anymore (the SQEs left in it must never be submitted),
+            // once the requests already submitted are done: their buffers are in use
+            if (bBroken || numSubmitted == numCompleted)
+            {
+                bBroken = true;
+                return false;
+            }
+            bBroken = true;
+            continue;
+        }
+        numSubmitted += std::min<unsigned>(numToSubmit, (unsigned)result);
+
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, numCompleted++)
+        {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            handler((size_t)(cqe.user_data >> 2), (EOp)(cqe.user_data & 3), cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    return !bBroken;
+}
+
+void Prefetcher::IoRing::read_files(const std::vector<const char*>& filePaths, size_t maxFileSize, size_t maxTotalSize,
+    std::vector<std::vector<uint8_t>>& outData, std::vector<bool>& outSuccess)
+{
+    Stats::ScopedTimer timer(Stats::EStage::Read);
+
+    // Two SQEs per file in the first step
+    const size_t numFiles = bBroken ? 0 : std::min<size_t>(filePaths.size(), numEntries / 2);
+    outData.assign(filePaths.size(), {});
+    outSuccess.assign(filePaths.size(), false);
+
+    std::vector<int> fds(numFiles, -1);
+    std::vector<struct statx> sizes(numFiles);
+    std::vector<bool> bHasSize(numFiles, false);
+    for (size_t i = 0; i < numFiles; i++)
+    {
+        io_uring_sqe* open = add_sqe(IORING_OP_OPENAT, AT_FDCWD, (uint64_t)(uintptr_t)filePaths[i], 0, 0, get_user_data(i, Open));
+        open->open_flags = O_RDONLY | O_CLOEXEC;
+        add_sqe(IORING_OP_STATX, AT_FDCWD, (uint64_t)(uintptr_t)filePaths[i], STATX_SIZE, (uint64_t)(uintptr_t)&sizes[i], get_user_data(i, Size));
+    }
+    complete([&](size_t file, EOp op, int result)
+    {
+        if (op == Open && result >= 0)
+            fds[file] = result;
+        else if (op == Size && result >= 0)
+            bHasSize[file] = true;
+    });
+
+    // Whole files are read, in as many rounds as short reads need
+    std::vector<size_t> readSizes(numFiles, 0);
+    std::vector<bool> bReading(numFiles, false);
+    size_t totalSize = 0;
+    for (size_t i = 0; i < numFiles; i++)
+    {
+        if (fds[i] < 0 || !bHasSize[i] || sizes[i].stx_size > maxFileSize)
+            continue;
+        if (i > 0 && totalSize + sizes[i].stx_size > maxTotalSize)
+            continue;
+
+        totalSize += (size_t)sizes[i].stx_size;
+        outData[i].resize((size_t)sizes[i].stx_size);
+        bReading[i] = true;
+    }
+
+    while (true)
+    {
+        for (size_t i = 0; i < numFiles; i++)
+        {
+            if (bReading[i] && readSizes[i] < outData[i].size())
+            {
+                const size_t toRead = std::min<size_t>(outData[i].size() - readSizes[i], 1u << 30);
+                add_sqe(IORING_OP_READ, fds[i], (uint64_t)(uintptr_t)(outData[i].data() + readSizes[i]), (uint32_t)toRead, readSizes[i], get_user_data(i, Read));
+            }
+        }
+        if (numQueued == 0)
+            break;
+
+        if (!complete([&](size_t file, EOp, int result)
+        {
+            // A failed read, or the end of a file that shrank
+            if (result <= 0)
+                bReading[file] = false;
+            else
+                readSizes[file] += (size_t)result;
+        }))
+            break;
+    }
+
+    for (size_t i = 0; i < numFiles; i++)
+    {
+        outSuccess[i] = bReading[i] && readSizes[i] == outData[i].size();
+        if (!outSuccess[i])
+            outData[i] = {};
+
+        if (fds[i] >= 0)
+            add_sqe(IORING_OP_CLOSE, fds[i], 0, 0, 0, get_user_data(i, Close));
+    }
+    if (!complete([](size_t, EOp, int) {}))
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+}
+
+#else
+
+// io_uring is Linux only: the reader threads are used everywhere else
+class Prefetcher::IoRing
+{
+public:
+    bool init(unsigned) { return false; }
+    void read_files(const std::vector<const char*>&, size_t, size_t, std::vector<std::vector<uint8_t>>&, std::vector<bool>&) {}
+};
+
+#endif
+
+Prefetcher::Prefetcher(const std::vector<std::string>& in_paths)
+    : paths(in_paths)
+    , entries(in_paths.size())
+{
+    auto ring = std::make_unique<IoRing>();
+    if (ring->init(2 * kBatchSize))
+    {
+        ioRing = std::move(ring);
+        threads.emplace_back(&Prefetcher::run_batches, this);
+        return;
+    }
+
+    const unsigned numThreads = (unsigned)std::min<size_t>(kNumReaders, paths.size());
+    for (unsigned i = 0; i < numThreads; i++)
+        threads.emplace_back(&Prefetcher::run, this);
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bStopping = true;
+    }
+    readable.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+bool Prefetcher::can_read_next() const
+{
+    if (nextToRead >= paths.size() || nextToRead >= firstNotTaken + kMaxFilesAhead)
+        return false;
+
+    // Over the memory budget, only the file the workers are waiting on may be read
+    return bytesAhead < kMaxBytesAhead || nextToRead == firstNotTaken;
+}
+
+void Prefetcher::run()
+{
+    Trace::set_thread_name("reader");
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        readable.wait(lock, [&]() { return bStopping || can_read_next(); });
+        if (bStopping)
+            return;
+
+        const size_t index = nextToRead++;
+        entries[index].state = EState::Reading;
+        lock.unlock();
+
+        std::vector<uint8_t> data;
+        bool bSuccess;
+        {
+            Trace::Span span("read", paths[index]);
+            bSuccess = Utils::read_file(paths[index], data, kMaxFileSize);
+        }
+
+        lock.lock();
+        set_result(index, bSuccess, std::move(data));
+        ready.notify_all();
+    }
+}
+
+void Prefetcher::run_batches()
+{
+    Trace::set_thread_name("reader");
+
+    std::vector<size_t> indices;
+    std::vector<const char*> batchPaths;
+    std::vector<std::vector<uint8_t>> data;
+    std::vector<bool> successes;
+
+    // While ahead of the workers, waits for room for a whole batch, so that each submission carries several files
+    auto canReadBatch = [&]()
+    {
+        if (!can_read_next())
+            return false;
+        const size_t batchSize = std::min(kBatchSize, paths.size() - nextToRead);
+        return nextToRead == firstNotTaken || nextToRead + batchSize <= firstNotTaken + kMaxFilesAhead;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        readable.wait(lock, [&]() { return bStopping || canReadBatch(); });
+        if (bStopping)
+            return;
+
+        indices.clear();
+        batchPaths.clear();
+        while (indices.size() < kBatchSize && can_read_next())
+        {
+            entries[nextToRead].state = EState::Reading;
+            batchPaths.push_back(paths[nextToRead].c_str());
+            indices.push_back(nextToRead++);
+        }
+        // The first file is read even over the budget: it's the one the workers wait on
+        const size_t maxBatchBytes = (bytesAhead < kMaxBytesAhead) ? kMaxBytesAhead - bytesAhead : 0;
+        lock.unlock();
+
+        {
+            Trace::Span span("read", Utils::str_format("%zu file(s)", indices.size()));
+            ioRing->read_files(batchPaths, kMaxFileSize, maxBatchBytes, data, successes);
+        }
+
+        lock.lock();
+        for (size_t i = 0; i < indices.size(); i++)
+            set_result(indices[i], successes[i], std::move(data[i]));
+        ready.notify_all();
+    }
+}
+
+void Prefetcher::set_result(size_t index, bool bSuccess, std::vector<uint8_t>&& data)
+{
+    Entry& entry = entries[index];
+    if (entry.state == EState::Reading)
+    {
+        entry.state = bSuccess ? EState::Ready : EState::Failed;
+        entry.data = std::move(data);
+        bytesAhead += entry.data.size();
+    }
+}
+
+bool Prefetcher::take(size_t index, std::vector<uint8_t>& outData)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (index >= entries.size())
+        return false;
+
+    Entry& entry = entries[index];
+    auto isReady = [&]() { return entry.state != EState::Queued && entry.state != EState::Reading; };
+    if (!isReady())
+    {
+        Trace::Span span("stall", "waiting for input");
+        ready.wait(lock, isReady);
+    }
+
+    const bool bPrefetched = (entry.state == EState::Ready);
+    bytesAhead -= entry.data.size();
+    outData = std::move(entry.data);
+    entry.data = {};
+    entry.state = EState::Taken;
+
+    while (firstNotTaken < entries.size() && entries[firstNotTaken].state == EState::Taken)
+        firstNotTaken++;
+
+    lock.unlock();
+    readable.notify_all();
+    return bPrefetched;
+}
+
+} // namespace Input
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Input {
+
+//-----------------------------------------------------------------------------
+// Reads the upcoming files of a job list ahead of the workers, so that the
+// open and read round trips of many small files overlap with decoding. On
+// Linux, a single reader thread submits the opens, size queries, reads and
+// closes of up to kBatchSize files as io_uring batches (a few system calls per
+// batch instead of several per file); elsewhere, or when the kernel doesn't
+// allow io_uring, a small pool of reader threads reads the files one by one.
+// At most kMaxFilesAhead files / kMaxBytesAhead bytes are held in memory;
+// files larger than kMaxFileSize aren't prefetched (they are better
+// memory-mapped by the worker).
+//-----------------------------------------------------------------------------
+class Prefetcher
+{
+public:
+    static constexpr size_t kMaxFilesAhead = 64;
+    static constexpr size_t kMaxBytesAhead = 64 << 20;
+    static constexpr size_t kMaxFileSize = 8 << 20;
+    static constexpr unsigned kNumReaders = 4;
+    static constexpr size_t kBatchSize = 32;
+
+    explicit Prefetcher(const std::vector<std::string>& in_paths);
+    ~Prefetcher();
+
+    // Waits for file 'index' of the list and moves its content out. Each file can be taken once.
+    // Returns false if the file wasn't prefetched (too large, or unreadable): read it directly instead.
+    bool take(size_t index, std::vector<uint8_t>& outData);
+
+private:
+    enum class EState : uint8_t
+    {
+        Queued,
+        Reading,
+        Ready,
+        Failed,
+        Taken,
+    };
+
+    struct Entry
+    {
+        EState state = EState::Queued;
+        std::vector<uint8_t> data;
+    };
+
+    class IoRing;
+
+    void run();
+    void run_batches();
+    bool can_read_next() const;
+    void set_result(size_t index, bool bSuccess, std::vector<uint8_t>&& data);
+
+    const std::vector<std::string> paths;
+    std::vector<Entry> entries;
+
+    std::mutex mutex;
+    std::condition_variable readable;
+    std::condition_variable ready;
+
+    size_t nextToRead = 0;
+    size_t firstNotTaken = 0;
+    size_t bytesAhead = 0;
+    bool bStopping = false;
+
+    std::unique_ptr<IoRing> ioRing; // null: reader threads
+    std::vector<std::thread> threads;
+};
+
+} // namespace Input
@@ -0,0 +1,223 @@
+#include "macro_bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "corpus.h"
+#include "file_utils.h"
+#include "utils.h"
+
+namespace MacroBench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct MacroCase
+{
+    const char* name;
+    const char* subFolder;
+    bool bPerFile; // one conversion per input file, otherwise the whole folder at once
+    std::vector<std::string> extraArgs;
+};
+
+const std::vector<MacroCase>& get_macro_cases()
+{
+    static const std::vector<MacroCase> cases = {
+        { "wv_folder", Corpus::kWvFolder, false, {} },
+        { "apc_folder", Corpus::kApcFolder, false, {} },
+        { "apc_folder_flac", Corpus::kApcFolder, false, { "-format", "flac" } },
+        { "wav_to_wv_folder", Corpus::kWavFolder, false, {} },
+        { "lab_files", Corpus::kLabFolder, true, {} },
+        { "bigrp_files", Corpus::kBigrpFolder, true, { "-game", "Cotm1" } },
+    };
+    return cases;
+}
+
+struct MacroResult
+{
+    double filesPerSecond = 0.0;
+    double mbPerSecond = 0.0;
+};
+
+// One line per case: <name> <files/s> <MB/s>, '#' starts a comment
+bool load_baseline(const std::string& path, std::map<std::string, MacroResult>& outResults)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Could not read the baseline " << path << "\n";
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream iss(line);
+        std::string name;
+        MacroResult result;
+        if (iss >> name >> result.filesPerSecond >> result.mbPerSecond)
+            outResults[name] = result;
+    }
+    return true;
+}
+
+bool save_baseline(const std::string& path, const std::map<std::string, MacroResult>& results)
+{
+    std::string text = "# -macro_bench baseline: case, output files/s, input MB/s\n";
+    for (const auto& result : results)
+        text += Utils::str_format("%s %.3f %.3f\n", result.first.c_str(), result.second.filesPerSecond, result.second.mbPerSecond);
+
+    if (!Utils::write_file(path, text.data(), text.size()))
+    {
+        std::cerr << "Could not write the baseline " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Number and total size of the regular files of a folder tree
+std::pair<size_t, uint64_t> get_folder_contents(const std::filesystem::path& folder)
+{
+    size_t numFiles = 0;
+    uint64_t totalSize = 0;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(folder, error))
+    {
+        if (entry.is_regular_file())
+        {
+            numFiles++;
+            totalSize += entry.file_size();
+        }
+    }
+    return { numFiles, totalSize };
+}
+
+double get_elapsed_seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int run(const Options& options, const ConvertFunction& convert)
+{
+    namespace fs = std::filesystem;
+
+    std::map<std::string, MacroResult> baseline;
+    if (!options.baselinePath.empty() && !load_baseline(options.baselinePath, baseline))
+        return -1;
+
+    const int numRepetitions = std::max(options.numRepetitions, 1);
+    const fs::path scratchFolder = fs::path(options.corpusFolder) / "_bench_out";
+
+    std::cout << Utils::str_format("%d run(s) after 1 warm-up, rates of the median run\n", numRepetitions);
+    std::cout << Utils::str_format("%-18s %8s %10s %10s %10s %10s %10s  %s\n",
+        "case", "inputs", "in_MB", "outputs", "median_s", "files/s", "MB/s", "baseline");
+
+    std::map<std::string, MacroResult> results;
+    size_t numRegressions = 0;
+    for (const auto& macroCase : get_macro_cases())
+    {
+        const fs::path inFolder = fs::path(options.corpusFolder) / macroCase.subFolder;
+        if (!fs::is_directory(inFolder))
+        {
+            std::cerr << "Missing corpus folder " << inFolder.string() << " (see -gen_corpus)\n";
+            return -1;
+        }
+
+        std::vector<std::string> inputs;
+        for (const auto& entry : fs::directory_iterator(inFolder))
+        {
+            if (entry.is_regular_file())
+                inputs.push_back(entry.path().string());
+        }
+        std::sort(inputs.begin(), inputs.end());
+        const uint64_t inputSize = get_folder_contents(inFolder).second;
+
+        // Outputs of LAB entries and BIGRP songs are named relative to the output folder:
+        // everything under the case folder is counted
+        const fs::path caseFolder = scratchFolder / macroCase.name;
+        const fs::path outFolder = caseFolder / "out";
+
+        std::vector<double> seconds;
+        size_t numOutputs = 0;
+        for (int r = 0; r <= numRepetitions; r++)
+        {
+            std::error_code error;
+            fs::remove_all(caseFolder, error);
+            fs::create_directories(outFolder, error);
+
+            const auto start = Clock::now();
+            int exitCode = 0;
+            if (macroCase.bPerFile)
+            {
+                for (const auto& input : inputs)
+                    exitCode |= convert(input, outFolder.string(), macroCase.extraArgs);
+            }
+            else
+            {
+                exitCode = convert(inFolder.string(), outFolder.string(), macroCase.extraArgs);
+            }
+            const double elapsed = get_elapsed_seconds(start);
+
+            if (exitCode != 0)
+            {
+                std::cerr << "Conversion failed in case " << macroCase.name << "\n";
+                return -1;
+            }
+
+            numOutputs = get_folder_contents(caseFolder).first;
+            if (r > 0) // the first run is the warm-up
+                seconds.push_back(elapsed);
+        }
+
+        std::error_code error;
+        fs::remove_all(caseFolder, error);
+
+        std::sort(seconds.begin(), seconds.end());
+        const double median = std::max(seconds[seconds.size() / 2], 1e-9);
+
+        MacroResult& result = results[macroCase.name];
+        result.filesPerSecond = numOutputs / median;
+        result.mbPerSecond = inputSize / median / 1e6;
+
+        // Relative change of the slowest of the 2 rates
+        std::string comparison = "-";
+        const auto found = baseline.find(macroCase.name);
+        if (found != baseline.end() && found->second.filesPerSecond > 0.0 && found->second.mbPerSecond > 0.0)
+        {
+            const double change = std::min(result.filesPerSecond / found->second.filesPerSecond, result.mbPerSecond / found->second.mbPerSecond) - 1.0;
+            const bool bRegression = (change * 100.0 < -options.thresholdPercent);
+            comparison = Utils::str_format("%+.1f%%%s", change * 100.0, bRegression ? " REGRESSION" : "");
+            if (bRegression)
+                numRegressions++;
+        }
+
+        std::cout << Utils::str_format("%-18s %8zu %10.2f %10zu %10.3f %10.1f %10.2f  %s\n", macroCase.name, inputs.size(),
+            inputSize / 1e6, numOutputs, median, result.filesPerSecond, result.mbPerSecond, comparison.c_str());
+    }
+
+    std::error_code error;
+    fs::remove(scratchFolder, error);
+
+    if (!options.saveBaselinePath.empty() && !save_baseline(options.saveBaselinePath, results))
+        return -1;
+
+    if (numRegressions > 0)
+    {
+        std::cerr << numRegressions << " case(s) slower than the baseline by more than " << options.thresholdPercent << "%\n";
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace MacroBench
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace MacroBench {
+
+//-----------------------------------------------------------------------------
+// End-to-end benchmark (-macro_bench) on a corpus made by -gen_corpus: each
+// case converts a corpus folder through the command line paths (folder mode,
+// or one conversion per file for LAB and BIGRP files), once to warm up then
+// numRepetitions times into a scratch folder. Reports output files/s and
+// input MB/s of the median run, optionally against a baseline file: a case is
+// a regression when one of its rates drops by more than thresholdPercent.
+//-----------------------------------------------------------------------------
+
+// Converts an input file or folder into outFolder with extra command line
+// arguments, as from the command line. Returns the exit code.
+using ConvertFunction = std::function<int(const std::string& inputPath, const std::string& outFolder, const std::vector<std::string>& extraArgs)>;
+
+struct Options
+{
+    std::string corpusFolder;
+    std::string baselinePath;     // baseline to compare with (optional)
+    std::string saveBaselinePath; // where to save the results as the new baseline (optional)
+    double thresholdPercent = 10.0;
+    int numRepetitions = 3;
+};
+
+// Returns the process exit code: -1 on failure or regression
+int run(const Options& options, const ConvertFunction& convert);
+
+} // namespace MacroBench
@@ -2,12 +2,31 @@
 #include <fstream>
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "Utils.h"
+#include "file_utils.h"
+#include "archive.h"
+#include "catalog.h"
+#include "codecs.h"
+#include "corpus.h"
+#include "counters.h"
+#include "cpu_dispatch.h"
+#include "input_prefetcher.h"
+#include "manifest.h"
 #include "indywv.h"
 #include "labn.h"
+#include "macro_bench.h"
+#include "output.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
 #include "wave.h"
+#include "write_queue.h"
 #include "inti_bigrp.h"
 #include "unit_test.h"
 
@@ -15,10 +34,46 @@
 
 #include <unordered_map>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 const char* kInArg = "-in";
 const char* kOutArg = "-out";
 const char* kGameArg = "-game";
+const char* kMmapArg = "-mmap";
+const char* kFormatArg = "-format";
+const char* kToArg = "-to";
+const char* kRateArg = "-rate";
+const char* kSampleFormatArg = "-sample_format";
+const char* kOutArchiveArg = "-out-archive";
+const char* kSyncWriteArg = "-sync_write";
+const char* kIncrementalArg = "-incremental";
+const char* kStatsArg = "-stats";
+const char* kTraceArg = "-trace";
+const char* kCountersArg = "-counters";
+const char* kIsaArg = "-isa";
+const char* kIndexArg = "-index";
+const char* kListArg = "-list";
+const char* kQueryArg = "-query";
 const char* kUnitTestArg = "-unit_test";
+const char* kGoldenArg = "-golden";
+const char* kUpdateGoldenArg = "-update_golden";
+const char* kBenchRunsArg = "-bench_runs";
+const char* kGenCorpusArg = "-gen_corpus";
+const char* kCorpusScaleArg = "-corpus_scale";
+const char* kMacroBenchArg = "-macro_bench";
+const char* kBaselineArg = "-baseline";
+const char* kSaveBaselineArg = "-save_baseline";
+const char* kThresholdArg = "-threshold";
+const char* kServeArg = "-serve";
+
+// -in - / -out -: standard input / output
+const char* kStdioPath = "-";
+
+// Name of the input read from the standard input, giving the names of its outputs
+const char* kStdinName = "stdin";
 
 std::string get_filename_noext(const std::string& filepath)
 {
@@ -59,6 +114,15 @@ std::string getOutFilePath(const std::string& inPath, const std::string& outArg,
     }
 }
 
+// Pipes carry binary data: no newline translation on the standard input and output
+void setBinaryStdio()
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
 using string_map = std::unordered_map<std::string, std::vector<std::string>>;
 template <class Keyword>
 string_map generic_parse(std::vector<std::string> as, Keyword keyword)
@@ -86,9 +150,26 @@ string_map generic_parse(std::vector<std::string> as, Keyword keyword)
 void printUsage()
 {
     std::cout << "Usage:\n"
-        << "-in <FilePath> : full path of input file, INDYWV or LAB. Type will be auto-deduced)\n"
-        << "-out <FileOrFolderPath> : path of output file or folder\n"
-        << "[-unit_test] : performs unit test - checks algorithm integrity (optional)\n";
+        << "-in <FilePath> : full path of input file, INDYWV or LAB. Type will be auto-deduced), or - to read it from the standard input\n"
+        << "-out <FileOrFolderPath> : path of output file or folder, or - to write the output of a single WV, APC or WAV file to the standard output\n"
+        << "[-mmap] : decode straight into preallocated memory-mapped output files (optional)\n"
+        << "[-format <wav|flac|wv|peaks> [...]] (or -to) : format of decoded audio files, wav by default; wv re-encodes mono WV, APC and LAB sounds to INDYWV ADPCM as they are decoded, peaks writes waveform peaks (.peaks.json). Several formats are all written from a single decode (optional)\n"
+        << "[-rate <Hz>] : resample decoded audio, e.g. 44100 or 48000 (optional)\n"
+        << "[-sample_format <s16|s24|f32>] : sample format of decoded audio, s16 by default (optional)\n"
+        << "[-out-archive <TarPath>] : write all the output files into a single .tar archive (+ .idx index), named relative to -out (optional)\n"
+        << "[-sync_write] : write output files from the decoding thread instead of background I/O threads (optional)\n"
+        << "[-incremental] : skip the inputs converted by a previous run (manifest kept in the output folder) (optional)\n"
+        << "[-stats [ReportPath]] : print a JSON report of per-stage timings, throughput and latencies per format, or write it to ReportPath (optional)\n"
+        << "[-isa <scalar|sse4.1|avx2|avx512>] : force the instruction set of the vectorized kernels, the widest one the CPU has by default (optional)\n"
+        << "[-counters] : add hardware counters (cycles, instructions, branch and cache misses) per format and stage to the -stats report, with IPC, cycles/sample and misses/KB (Linux perf events) (optional)\n"
+        << "[-trace <TracePath>] : record a timeline of the files, LAB entries, BIGRP songs and I/O on each thread (Chrome trace-event JSON, for Perfetto) (optional)\n"
+        << "-index <CatalogPath> -in <FileOrFolder> [-game <GameId>] : scan the headers of all the files of a folder tree into an asset catalog\n"
+        << "-list <CatalogPath> [-query <Pattern>] : list the assets of a catalog, optionally those matching a name/codec pattern (* and ? wildcards)\n"
+        << "-in <CatalogPath> -out <Folder> [-query <Pattern>] : extract (and decode) the assets of a catalog, without rescanning\n"
+        << "-unit_test [<TestFolder>] [-golden <ManifestPath>] [-update_golden] [<conversion options>] : convert the test files in memory and compare their outputs with the golden hashes\n"
+        << "-gen_corpus <Folder> [-corpus_scale <Scale>] : write a synthetic corpus of WV, WAV, APC, LAB and BIGRP files (scale 1: about 200 files and 3000 LAB entries)\n"
+        << "-macro_bench <CorpusFolder> [-bench_runs <N>] [-baseline <Path>] [-save_baseline <Path>] [-threshold <Percent>] : time end-to-end conversions of a corpus, compared with a baseline\n"
+        << "-serve [<SocketPath>] : run file conversion jobs received as JSON lines on the standard input (or a Unix domain socket) on warm worker threads, answering each with a completion record\n";
 }
 
 EFileType getFileTypeFromExt(const std::string& filePath)
@@ -104,71 +185,168 @@ EFileType getFileTypeFromExt(const std::string& filePath)
     return EFileType::Unknown;
 }
 
-EFileType getFileType(std::ifstream& file)
+// Output options given on the command line (-mmap, -format, -rate, -sample_format)
+bool getOutputOptions(string_map* params, Output::Options& outputOptions)
 {
-    file.seekg(0, std::ios::beg);
-
-    char header[8];
-    Utils::peekChar(file, header, 8);
-
-    if (strncmp(header, LABN::kLABNId, sizeof(LABN::kLABNId)) == 0)
+    if (params && params->find(kMmapArg) != params->end())
+        outputOptions.writeMode = Output::EWriteMode::Mapped;
+    if (params && params->find(kFormatArg) != params->end())
     {
-        return EFileType::LABN;
+        // Several formats: all the outputs come from a single decode
+        const auto& formatNames = (*params)[kFormatArg];
+        for (size_t i = 0; i < formatNames.size(); i++)
+        {
+            Output::EFormat format;
+            if (!Output::find_format_from_name(formatNames[i], format))
+            {
+                std::cerr << "Unknown output format " << formatNames[i] << "\n";
+                return false;
+            }
+            if (i == 0)
+                outputOptions.format = format;
+            else
+                outputOptions.extraFormats.push_back(format);
+        }
     }
-    else if (strncmp(header, IndyWV::kIndyWV, sizeof(IndyWV::kIndyWV)) == 0)
+    if (params && params->find(kRateArg) != params->end() && !(*params)[kRateArg].empty())
     {
-        return EFileType::IndyWV;
+        outputOptions.sampleRate = (uint32_t)std::strtoul((*params)[kRateArg][0].c_str(), nullptr, 10);
+        if (outputOptions.sampleRate == 0)
+        {
+            std::cerr << "Invalid sample rate " << (*params)[kRateArg][0] << "\n";
+            return false;
+        }
     }
-    else if (strncmp(header, Wave::kRIFF, sizeof(Wave::kRIFF)) == 0)
+    if (params && params->find(kSampleFormatArg) != params->end() && !(*params)[kSampleFormatArg].empty())
     {
-        return EFileType::Wave;
+        if (!Output::find_sample_format_from_name((*params)[kSampleFormatArg][0], outputOptions.sampleFormat))
+        {
+            std::cerr << "Unknown sample format " << (*params)[kSampleFormatArg][0] << "\n";
+            return false;
+        }
     }
-    else if (strncmp(header, CryoAPC::kAPCTag, sizeof(CryoAPC::kAPCTag)) == 0)
+    return true;
+}
+
+// -out -: the output is written to the standard output (as decoded for WAV, whole for other formats)
+bool setStdoutOutput(Output::Options& outputOptions, Output::StdoutStore& stdoutStore)
+{
+    if (!outputOptions.extraFormats.empty())
     {
-        return EFileType::CryoAPC;
+        std::cerr << "Only one output format can be written to the standard output\n";
+        return false;
     }
-    else if (strncmp(header, Inti::kBigrpTag, sizeof(Inti::kBigrpTag)) == 0)
+    outputOptions.writeMode = Output::EWriteMode::Pipe;
+    outputOptions.pStore = &stdoutStore;
+    return true;
+}
+
+// Writes a JSON report built by the codecs library (stats, trace)
+bool writeReport(const std::string& path, const std::string& json, const char* description)
+{
+    if (!Utils::write_file(path, json.data(), json.size()))
     {
-        return EFileType::IntiBigrp;
+        std::cerr << "Could not write the " << description << " " << path << "\n";
+        return false;
     }
-
-    return EFileType::Unknown;
+    return true;
 }
 
-bool convertFile(const std::string& inputPath, const std::string outputArg, string_map* params)
+// pPrefetched: content of the input file when already read, otherwise the file is memory-mapped
+// pInputHash: receives the content hash of the input (Utils::hash64), from the bytes read for the conversion
+bool convertFile(const std::string& inputPath, const std::string outputArg, string_map* params, Utils::FileStore* pStore = nullptr,
+    const std::vector<uint8_t>* pPrefetched = nullptr, uint64_t* pInputHash = nullptr)
 {
-    std::ifstream file(inputPath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-        return false;
+    Stats::FileScope fileStats(inputPath);
+    Trace::Span span("file", inputPath.substr(inputPath.find_last_of("/\\") + 1));
+
+    // Without a queue or an archive, outputs are written straight to the disk
+    Utils::DiskStore diskStore;
+    if (!pStore)
+        pStore = &diskStore;
+
+    Utils::MappedFile mappedFile;
+    const uint8_t* pInput = nullptr;
+    size_t inputSize = 0;
+    if (pPrefetched)
+    {
+        pInput = pPrefetched->data();
+        inputSize = pPrefetched->size();
+    }
+    else
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Read);
+        if (!mappedFile.open(inputPath))
+            return false;
+        pInput = mappedFile.data();
+        inputSize = mappedFile.size();
+    }
+    Stats::add(Stats::ECounter::BytesIn, inputSize);
+
+    if (pInputHash)
+        *pInputHash = Utils::hash64(pInput, inputSize);
 
-    EFileType fileType = getFileTypeFromExt(inputPath);
-    EFileType actualFileType = getFileType(file);
+    EFileType fileType, actualFileType;
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Detect);
+        fileType = getFileTypeFromExt(inputPath);
+        actualFileType = Codecs::detect(pInput, inputSize);
+    }
+    // Inputs read from the standard input have no extension
+    if (fileType == EFileType::Unknown)
+        fileType = actualFileType;
     assert(fileType == actualFileType);
+    fileStats.set_format(Codecs::get_type_name(fileType));
 
+    Output::Options outputOptions;
+    outputOptions.pStore = pStore;
+    if (!getOutputOptions(params, outputOptions))
+        return false;
+    const std::string pcmExt = Output::get_extension(outputOptions);
+
+    Output::StdoutStore stdoutStore;
+    if (outputArg == kStdioPath)
+    {
+        if (fileType == EFileType::LABN || fileType == EFileType::IntiBigrp)
+        {
+            std::cerr << "LAB and BIGRP files have several outputs: they can't be written to the standard output\n";
+            return false;
+        }
+        if (!setStdoutOutput(outputOptions, stdoutStore))
+            return false;
+        pStore = &stdoutStore;
+    }
+
+    bool bConverted = true;
     switch (fileType)
     {
     case EFileType::IndyWV:
     {
-        auto outFilePath = getOutFilePath(inputPath, outputArg, "wav");
-        IndyWV().wv_to_wav(inputPath, outFilePath);
+        auto outFilePath = getOutFilePath(inputPath, outputArg, pcmExt);
+        auto sink = Output::create_pcm_sink(outFilePath, outputOptions);
+        bConverted = IndyWV().decode(pInput, inputSize, *sink);
         break;
     }
     case EFileType::LABN:
     {
         auto outFolderPath = getOutFolderPath(outputArg);
-        LABN::decompress(inputPath, outFolderPath);
+        bConverted = LABN::decompress(inputPath, pInput, inputSize, [&](const std::string& fileNameNoExt)
+        {
+            return Output::create_pcm_sink(outFolderPath + "\\" + fileNameNoExt + "." + pcmExt, outputOptions);
+        });
         break;
     }
     case EFileType::Wave:
     {
         auto outFilePath = getOutFilePath(inputPath, outputArg, "wv");
-        IndyWV().wav_to_wv(inputPath, outFilePath);
+        IndyWV().wav_to_wv(pInput, inputSize, outFilePath, pStore);
         break;
     }
     case EFileType::CryoAPC:
     {
-        auto outFilePath = getOutFilePath(inputPath, outputArg, "wav");
-        CryoAPC::apc_to_wav(inputPath, outFilePath);
+        auto outFilePath = getOutFilePath(inputPath, outputArg, pcmExt);
+        auto sink = Output::create_pcm_sink(outFilePath, outputOptions);
+        bConverted = CryoAPC::decode(pInput, inputSize, *sink);
         break;
     }
     case EFileType::IntiBigrp:
@@ -176,24 +354,22 @@ bool convertFile(const std::string& inputPath, const std::string outputArg, stri
         Inti::BigrpOptions options;
         options.bPrefixWithBigrpName = true;
         options.bExportMergedMidis = true;
+        options.pStore = pStore;
 
         assert(params);
         if (params->find(kGameArg) != params->end() && !(*params)[kGameArg].empty())
         {
-            const std::string gameArg = (*params)[kGameArg][0];
-            if (Utils::str_to_lower(gameArg) == "cotm1")
-                options.game = Inti::EGame::Cotm1;
-            else if (Utils::str_to_lower(gameArg) == "cotm2")
-                options.game = Inti::EGame::Cotm2;
+            options.game = Inti::find_game_from_name((*params)[kGameArg][0]);
         }
 
         if (options.game == Inti::EGame::Unknown)
         {
             std::cerr << "Please input a game ID for Inti Bigrp files! Using -game <GameId>\n";
+            bConverted = false;
         }
         else
         {
-            Inti::bigrp_to_midi(inputPath, outputArg, options);
+            bConverted = Inti::bigrp_to_midi(inputPath, pInput, inputSize, outputArg, options);
         }
 
         break;
@@ -201,39 +377,441 @@ bool convertFile(const std::string& inputPath, const std::string outputArg, stri
     case EFileType::Unknown:
     default:
         std::cerr << "Unrecognized input file type\n";
+        return false;
     }
+
+    return bConverted;
 }
 
-void do_unit_tests()
+// Options affecting the output files, as recorded in the incremental manifest
+std::string getOptionsKey(const string_map& params)
 {
-    struct Test
+    std::vector<std::string> ignoredArgs = { kInArg, kIncrementalArg, kSyncWriteArg, kMmapArg, kOutArchiveArg, kStatsArg, kCountersArg, kTraceArg, kIsaArg };
+
+    std::vector<std::string> keys;
+    for (const auto& param : params)
     {
-        std::string name;
-        std::string inFile;
-        std::string outExt;
-        std::string refFile;
-    };
+        if (std::find(ignoredArgs.begin(), ignoredArgs.end(), param.first) == ignoredArgs.end())
+            keys.push_back(param.first);
+    }
+    std::sort(keys.begin(), keys.end());
 
-    std::vector<Test> tests{
-        { "INDYWV (ADPCM) to WAV", "dice_mono_adpcm.wv", "wav", "dice_mono_adpcm.wav" },
-        { "WAV (ADPCM) to INDYWV", "dice_mono_adpcm.wav", "wv", "dice_mono_adpcm.wv" },
-        { "INDYWV (WVSM) to WAV", "stereo_wvsm_test.wv", "wav", "stereo_wvsm_test.wav" },
-        { "APC (mono) to WAV", "toctoc_mono.apc", "wav", "toctoc_mono.wav" },
-        { "APC (stereo) to WAV", "eboulis_stereo.apc", "wav", "eboulis_stereo.wav" },
+    std::string optionsKey;
+    for (const auto& key : keys)
+    {
+        optionsKey += key;
+        for (const auto& value : params.at(key))
+            optionsKey += " " + value;
+        optionsKey += ";";
+    }
+    return optionsKey;
+}
+
+// Test folder of the Visual Studio project, relative to the output folder
+const char* kDefaultTestFolder = "..\\..\\..\\src\\test_files";
+
+int do_unit_tests(string_map& params)
+{
+    // Other arguments are conversion options, applying to all the cases
+    string_map conversionParams = params;
+    for (const char* arg : { kUnitTestArg, kGoldenArg, kUpdateGoldenArg, kMmapArg })
+        conversionParams.erase(arg);
+
+    UnitTest::Options options;
+    options.folder = params[kUnitTestArg].empty() ? kDefaultTestFolder : params[kUnitTestArg][0];
+    if (params.find(kGoldenArg) != params.end() && !params[kGoldenArg].empty())
+        options.goldenPath = params[kGoldenArg][0];
+    options.bUpdate = (params.find(kUpdateGoldenArg) != params.end());
+    options.optionsKey = getOptionsKey(conversionParams);
+
+    auto convert = [&](const std::string& inputPath, const std::string& outFolder, Utils::FileStore* pStore)
+    {
+        string_map caseParams = conversionParams;
+        return convertFile(inputPath, outFolder, &caseParams, pStore);
     };
+    auto isInput = [](const std::string& path) { return getFileTypeFromExt(path) != EFileType::Unknown; };
+
+    return UnitTest::run(options, convert, isInput) ? 0 : -1;
+}
 
+std::string getQueryPattern(string_map& params)
+{
+    return (params.find(kQueryArg) != params.end() && !params[kQueryArg].empty()) ? params[kQueryArg][0] : std::string();
+}
+
+int buildCatalog(string_map& params)
+{
+    if (params[kIndexArg].empty() || params.find(kInArg) == params.end() || params[kInArg].empty())
+    {
+        std::cerr << "-index needs a catalog path and an -in parameter\n";
+        printUsage();
+        return -1;
+    }
+
+    auto game = Inti::EGame::Unknown;
+    if (params.find(kGameArg) != params.end() && !params[kGameArg].empty())
+        game = Inti::find_game_from_name(params[kGameArg][0]);
+
+    Catalog::AssetCatalog catalog;
+    if (!catalog.build(params[kInArg][0], game) || !catalog.save(params[kIndexArg][0]))
+        return -1;
+
+    std::cout << catalog.get_assets().size() << " asset(s) in " << catalog.get_sources().size() << " file(s) indexed into " << params[kIndexArg][0] << "\n";
+    return 0;
+}
+
+int listCatalog(string_map& params)
+{
+    if (params[kListArg].empty())
+    {
+        std::cerr << "-list needs a catalog path\n";
+        printUsage();
+        return -1;
+    }
+
+    Catalog::AssetCatalog catalog;
+    if (!catalog.load(params[kListArg][0]))
+        return -1;
+
+    catalog.print(catalog.find(getQueryPattern(params)));
+    return 0;
+}
+
+int extractFromCatalog(const std::string& catalogPath, const std::string& outArg, string_map& params)
+{
+    Catalog::AssetCatalog catalog;
+    if (!catalog.load(catalogPath))
+        return -1;
+
+    std::unique_ptr<Output::WriteQueue> writeQueue;
+    if (params.find(kSyncWriteArg) == params.end() && params.find(kMmapArg) == params.end())
+        writeQueue = std::make_unique<Output::WriteQueue>();
+
+    Utils::DiskStore diskStore;
+    Output::Options outputOptions;
+    outputOptions.pStore = writeQueue ? static_cast<Utils::FileStore*>(writeQueue.get()) : &diskStore;
+    if (!getOutputOptions(&params, outputOptions))
+        return -1;
+
+    auto selected = catalog.find(getQueryPattern(params));
+    size_t numExtracted = catalog.extract(selected, getOutFolderPath(outArg), outputOptions);
+    std::cout << numExtracted << " of " << selected.size() << " selected asset(s) extracted\n";
+
+    if (writeQueue && !writeQueue->flush())
+        return -1;
+    return 0;
+}
+
+// Converts an input file, or all the files of a folder, with the given command line parameters
+int convertInputs(const std::string& inputPath, const std::string& outArg, string_map& result)
+{
     namespace fs = std::filesystem;
-    auto folder = fs::path("..\\..\\..\\src\\test_files");
+    auto inPath = std::filesystem::path(inputPath);
+    const bool bArchive = (result.find(kOutArchiveArg) != result.end() && !result[kOutArchiveArg].empty());
+
+    std::vector<std::string> inputs;
+    if (fs::is_directory(inPath))
+    {
+        for (const auto& entry : std::filesystem::directory_iterator(inPath))
+            inputs.push_back(entry.path().string());
+    }
+    else if (fs::is_regular_file(inPath))
+    {
+        inputs.push_back(inputPath);
+    }
+
+    // Incremental mode: inputs left unchanged since the last run are skipped
+    std::unique_ptr<Incremental::Manifest> manifest;
+    if (result.find(kIncrementalArg) != result.end())
+    {
+        if (bArchive)
+        {
+            std::cerr << "-incremental is ignored with -out-archive: the archive is always rebuilt\n";
+        }
+        else
+        {
+            manifest = std::make_unique<Incremental::Manifest>(getOutFolderPath(outArg), getOptionsKey(result));
+            manifest->load();
+
+            size_t numInputs = inputs.size();
+            inputs.erase(std::remove_if(inputs.begin(), inputs.end(), [&](const std::string& input) { return manifest->is_up_to_date(input); }), inputs.end());
+            std::cout << (numInputs - inputs.size()) << " file(s) up to date, " << inputs.size() << " to convert\n";
+        }
+    }
 
-    for (auto& test : tests)
+    // Directory mode: the next files are read ahead while the current ones are converted
+    std::unique_ptr<Input::Prefetcher> prefetcher;
+    if (inputs.size() > 1)
+        prefetcher = std::make_unique<Input::Prefetcher>(inputs);
+
+    auto convertInput = [&](size_t i, string_map& params, Utils::FileStore* pStore, uint64_t* pInputHash = nullptr)
+    {
+        std::vector<uint8_t> content;
+        if (prefetcher && prefetcher->take(i, content))
+            return convertFile(inputs[i], outArg, &params, pStore, &content, pInputHash);
+
+        return convertFile(inputs[i], outArg, &params, pStore, nullptr, pInputHash);
+    };
+
+    if (bArchive)
+    {
+        Archive::TarWriter archive(getOutFolderPath(outArg));
+        if (!archive.open(result[kOutArchiveArg][0]))
+        {
+            std::cerr << "Could not create archive " << result[kOutArchiveArg][0] << "\n";
+            return -1;
+        }
+
+        // One archive slot per input file: files are converted in parallel,
+        // and their outputs are still written in input order
+        std::vector<std::unique_ptr<Archive::TarWriter::Slot>> slots;
+        for (size_t i = 0; i < inputs.size(); i++)
+            slots.push_back(archive.create_slot());
+
+        std::atomic<size_t> nextInput(0);
+        auto worker = [&]()
+        {
+            Trace::set_thread_name("worker");
+            string_map params = result;
+            for (size_t i = nextInput++; i < inputs.size(); i = nextInput++)
+            {
+                convertInput(i, params, slots[i].get());
+                slots[i]->finish();
+            }
+        };
+
+        const size_t numThreads = std::min<size_t>(inputs.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < numThreads; t++)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads)
+            thread.join();
+
+        slots.clear();
+        return archive.close() ? 0 : -1;
+    }
+
+    // Output files are created, written and renamed into place by background I/O
+    // threads (decoders only queue their data), except in -mmap mode where
+    // decoders write straight into the output files
+    std::unique_ptr<Output::WriteQueue> writeQueue;
+    if (result.find(kSyncWriteArg) == result.end() && result.find(kMmapArg) == result.end())
+        writeQueue = std::make_unique<Output::WriteQueue>();
+
+    // Converted inputs whose outputs may still be queued: they go to the manifest
+    // (in order) once all their outputs are on disk, and not at all if one failed
+    struct ConvertedInput
+    {
+        size_t index;
+        uint64_t hash;
+        std::vector<std::string> outputs;
+    };
+    std::deque<ConvertedInput> convertedInputs;
+    auto completeWritten = [&]()
+    {
+        while (!convertedInputs.empty())
+        {
+            const ConvertedInput& converted = convertedInputs.front();
+            bool bFailed = false;
+            for (const auto& output : converted.outputs)
+            {
+                const auto state = writeQueue ? writeQueue->get_result(output) : Output::WriteQueue::EResult::Written;
+                if (state == Output::WriteQueue::EResult::Pending)
+                    return;
+                bFailed |= (state == Output::WriteQueue::EResult::Failed);
+            }
+
+            if (!bFailed)
+                manifest->complete(inputs[converted.index], converted.hash, converted.outputs);
+            convertedInputs.pop_front();
+        }
+    };
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (!manifest)
+        {
+            convertInput(i, result, writeQueue.get());
+            continue;
+        }
+
+        // Outputs are reported to the recorder, to be listed in the manifest
+        Incremental::RecordingStore recorder(writeQueue.get());
+        uint64_t inputHash = 0;
+        if (convertInput(i, result, &recorder, &inputHash))
+            convertedInputs.push_back({ i, inputHash, recorder.get_outputs() });
+        completeWritten();
+    }
+
+    // Inputs with a failed output are left out of the manifest, to be converted again next time
+    const bool bWritten = !writeQueue || writeQueue->flush();
+    if (manifest)
+    {
+        completeWritten();
+        if (!manifest->save())
+            return -1;
+    }
+
+    return bWritten ? 0 : -1;
+}
+
+// -in -: the input is read from the standard input, in a single pass without seeking.
+// WV and APC data is decoded as it arrives; other formats are read whole first.
+int convertStandardInput(const std::string& outArg, string_map& params)
+{
+    Codecs::StreamReader stream([](void* pBuffer, size_t size)
+    {
+        std::cin.read((char*)pBuffer, size);
+        return (size_t)std::cin.gcount();
+    });
+
+    const EFileType fileType = stream.detect();
+    if (fileType != EFileType::IndyWV && fileType != EFileType::CryoAPC)
+    {
+        std::vector<uint8_t> content;
+        stream.read_all(content);
+        return convertFile(kStdinName, outArg, &params, nullptr, &content) ? 0 : -1;
+    }
+
+    Stats::FileScope fileStats(kStdinName);
+    fileStats.set_format(Codecs::get_type_name(fileType));
+
+    Utils::DiskStore diskStore;
+    Output::Options outputOptions;
+    outputOptions.pStore = &diskStore;
+    if (!getOutputOptions(&params, outputOptions))
+        return -1;
+
+    Output::StdoutStore stdoutStore;
+    if (outArg == kStdioPath && !setStdoutOutput(outputOptions, stdoutStore))
+        return -1;
+
+    auto sink = Output::create_pcm_sink(getOutFilePath(kStdinName, outArg, Output::get_extension(outputOptions)), outputOptions);
+    return Codecs::decode(stream, *sink) ? 0 : -1;
+}
+
+int generateCorpus(string_map& params)
+{
+    if (params[kGenCorpusArg].empty())
+    {
+        std::cerr << "-gen_corpus needs an output folder\n";
+        printUsage();
+        return -1;
+    }
+
+    Corpus::Options options;
+    if (params.find(kCorpusScaleArg) != params.end() && !params[kCorpusScaleArg].empty())
+    {
+        options.scale = std::strtod(params[kCorpusScaleArg][0].c_str(), nullptr);
+        if (options.scale <= 0.0)
+        {
+            std::cerr << "Invalid corpus scale " << params[kCorpusScaleArg][0] << "\n";
+            return -1;
+        }
+    }
+
+    return Corpus::generate(params[kGenCorpusArg][0], options) ? 0 : -1;
+}
+
+int runMacroBenchmark(string_map& params)
+{
+    if (params[kMacroBenchArg].empty())
     {
-        auto inPath = folder / test.inFile;
-        auto outPath = (folder / "temp").string() + "." + test.outExt;
-        auto refFilePath = folder / test.refFile;
-        convertFile(inPath.string(), outPath, nullptr);
-        UnitTest::unit_test(test.name, outPath, refFilePath.string());
-        std::remove(outPath.c_str());
+        std::cerr << "-macro_bench needs a corpus folder (see -gen_corpus)\n";
+        printUsage();
+        return -1;
     }
+
+    MacroBench::Options options;
+    options.corpusFolder = params[kMacroBenchArg][0];
+    if (params.find(kBaselineArg) != params.end() && !params[kBaselineArg].empty())
+        options.baselinePath = params[kBaselineArg][0];
+    if (params.find(kSaveBaselineArg) != params.end() && !params[kSaveBaselineArg].empty())
+        options.saveBaselinePath = params[kSaveBaselineArg][0];
+    if (params.find(kThresholdArg) != params.end() && !params[kThresholdArg].empty())
+        options.thresholdPercent = std::strtod(params[kThresholdArg][0].c_str(), nullptr);
+    if (params.find(kBenchRunsArg) != params.end() && !params[kBenchRunsArg].empty())
+        options.numRepetitions = std::atoi(params[kBenchRunsArg][0].c_str());
+
+    // Same paths as a command line made of -in, -out and the extra arguments
+    return MacroBench::run(options, [](const std::string& inputPath, const std::string& outFolder, const std::vector<std::string>& extraArgs)
+    {
+        string_map convertParams;
+        convertParams[kInArg] = { inputPath };
+        convertParams[kOutArg] = { outFolder };
+        for (size_t i = 0; i + 1 < extraArgs.size(); i += 2)
+            convertParams[extraArgs[i]] = { extraArgs[i + 1] };
+
+        return convertInputs(inputPath, outFolder, convertParams);
+    });
+}
+
+// -serve: each job converts a single file, like -in <in> -out <out> <args>
+int runServer(string_map& params)
+{
+    Server::Options options;
+    if (!params[kServeArg].empty())
+        options.socketPath = params[kServeArg][0];
+
+    // Decoder tables are built here rather than by the first job
+    IndyWV();
+
+    return Server::run(options, [](const Server::Job& job, std::string& outError)
+    {
+        // The other options change the whole run, or would write into the records
+        // Same aliases as on the command line
+        const std::unordered_map<std::string, std::string> jobArgs = {
+            { kGameArg, kGameArg },
+            { kMmapArg, kMmapArg },
+            { kFormatArg, kFormatArg },
+            { kToArg, kFormatArg },
+            { kRateArg, kRateArg },
+            { kSampleFormatArg, kSampleFormatArg }
+        };
+
+        string_map jobParams;
+        std::string flag;
+        for (const auto& arg : job.args)
+        {
+            if (!arg.empty() && arg[0] == '-')
+            {
+                auto jobArg = jobArgs.find(arg);
+                if (jobArg == jobArgs.end())
+                {
+                    outError = "unsupported option " + arg;
+                    return false;
+                }
+                flag = jobArg->second;
+                jobParams[flag];
+            }
+            else if (flag.empty())
+            {
+                outError = "value without option: " + arg;
+                return false;
+            }
+            else
+            {
+                jobParams[flag].push_back(arg);
+            }
+        }
+
+        if (job.input == kStdioPath || job.output == kStdioPath)
+        {
+            outError = "jobs can't use the standard input or output";
+            return false;
+        }
+        if (!std::filesystem::is_regular_file(job.input))
+        {
+            outError = "input file not found: " + job.input;
+            return false;
+        }
+
+        // Written by the worker itself: the outputs are complete when the record is sent
+        jobParams[kInArg] = { job.input };
+        jobParams[kOutArg] = { job.output };
+        return convertFile(job.input, job.output, &jobParams);
+    }) ? 0 : -1;
 }
 
 int main(int argc, const char* argv[])
@@ -244,7 +822,32 @@ int main(int argc, const char* argv[])
         { kInArg, kInArg },
         { kOutArg, kOutArg },
         { kGameArg, kGameArg },
-        { kUnitTestArg, kUnitTestArg }
+        { kMmapArg, kMmapArg },
+        { kFormatArg, kFormatArg },
+        { kToArg, kFormatArg },
+        { kRateArg, kRateArg },
+        { kSampleFormatArg, kSampleFormatArg },
+        { kOutArchiveArg, kOutArchiveArg },
+        { kSyncWriteArg, kSyncWriteArg },
+        { kIncrementalArg, kIncrementalArg },
+        { kStatsArg, kStatsArg },
+        { kTraceArg, kTraceArg },
+        { kCountersArg, kCountersArg },
+        { kIsaArg, kIsaArg },
+        { kIndexArg, kIndexArg },
+        { kListArg, kListArg },
+        { kQueryArg, kQueryArg },
+        { kUnitTestArg, kUnitTestArg },
+        { kGoldenArg, kGoldenArg },
+        { kUpdateGoldenArg, kUpdateGoldenArg },
+        { kBenchRunsArg, kBenchRunsArg },
+        { kGenCorpusArg, kGenCorpusArg },
+        { kCorpusScaleArg, kCorpusScaleArg },
+        { kMacroBenchArg, kMacroBenchArg },
+        { kBaselineArg, kBaselineArg },
+        { kSaveBaselineArg, kSaveBaselineArg },
+        { kThresholdArg, kThresholdArg },
+        { kServeArg, kServeArg }
     };
 
     auto result = generic_parse(args, [&](auto&& s) -> std::vector<std::string> {
@@ -254,12 +857,65 @@ int main(int argc, const char* argv[])
             return {};
     });
 
+    // Before any kernel is bound
+    if (result.find(kIsaArg) != result.end())
+    {
+        CpuDispatch::EIsa isa;
+        if (result[kIsaArg].empty() || !CpuDispatch::find_isa_from_name(result[kIsaArg][0], isa))
+        {
+            std::cerr << "Please input an instruction set with -isa: scalar, sse4.1, avx2 or avx512\n";
+            return -1;
+        }
+        if (!CpuDispatch::select(isa))
+            return -1;
+    }
+
     if (result.find(kUnitTestArg) != result.end())
+        return do_unit_tests(result);
+
+    if (result.find(kGenCorpusArg) != result.end())
+        return generateCorpus(result);
+
+    if (result.find(kMacroBenchArg) != result.end())
+        return runMacroBenchmark(result);
+
+    if (result.find(kServeArg) != result.end())
+        return runServer(result);
+
+    // Per-stage timings are only gathered when a report is asked for; hardware counters go to the same report
+    const bool bCounters = (result.find(kCountersArg) != result.end());
+    const bool bStats = (result.find(kStatsArg) != result.end()) || bCounters;
+    if (bStats)
+        Stats::enable();
+    if (bCounters)
+        Counters::enable();
+
+    const bool bTrace = (result.find(kTraceArg) != result.end() && !result[kTraceArg].empty());
+    if (bTrace)
     {
-        do_unit_tests();
-        return 0;
+        Trace::enable();
+        Trace::set_thread_name("main");
     }
 
+    auto finish = [&](int exitCode)
+    {
+        // The stats report goes to stdout when no path is given
+        auto stats = result.find(kStatsArg);
+        if (bStats && (stats == result.end() || stats->second.empty()))
+            std::cout << Stats::build_report();
+        else if (bStats && !writeReport(stats->second[0], Stats::build_report(), "stats report"))
+            return -1;
+        if (bTrace && !writeReport(result[kTraceArg][0], Trace::build_json(), "trace"))
+            return -1;
+        return exitCode;
+    };
+
+    if (result.find(kIndexArg) != result.end())
+        return buildCatalog(result);
+
+    if (result.find(kListArg) != result.end())
+        return listCatalog(result);
+
     if (result.find(kInArg) == result.end() || result[kInArg].empty())
     {
         std::cerr << "Missing -in parameter\n";
@@ -267,7 +923,8 @@ int main(int argc, const char* argv[])
         return -1;
     }
 
-    if (result.find(kOutArg) == result.end() || result[kOutArg].empty())
+    const bool bArchive = (result.find(kOutArchiveArg) != result.end() && !result[kOutArchiveArg].empty());
+    if (!bArchive && (result.find(kOutArg) == result.end() || result[kOutArg].empty()))
     {
         std::cerr << "Missing -out parameter\n";
         printUsage();
@@ -275,19 +932,33 @@ int main(int argc, const char* argv[])
     }
 
     std::string inputPath = result[kInArg][0];
-    std::string outArg = result[kOutArg][0];
+    std::string outArg = (result.find(kOutArg) != result.end() && !result[kOutArg].empty()) ? result[kOutArg][0] : ".";
 
     namespace fs = std::filesystem;
     auto inPath = std::filesystem::path(inputPath);
-    if (fs::is_directory(inPath))
+
+    if (inputPath == kStdioPath || outArg == kStdioPath)
     {
-        for (const auto& entry : std::filesystem::directory_iterator(inPath))
+        if (outArg == kStdioPath && (bArchive || fs::is_directory(inPath)))
         {
-            convertFile(entry.path().string(), outArg, &result);
+            std::cerr << "Only the output of a single file can be written to the standard output\n";
+            return -1;
         }
+        auto stats = result.find(kStatsArg);
+        if (outArg == kStdioPath && bStats && (stats == result.end() || stats->second.empty()))
+        {
+            std::cerr << "The output goes to the standard output: please give a path to the -stats report\n";
+            return -1;
+        }
+        setBinaryStdio();
     }
-    else if (fs::is_regular_file(inPath))
-    {
-        convertFile(inputPath, outArg, &result);
-    }
+
+    if (inputPath == kStdioPath)
+        return finish(convertStandardInput(outArg, result));
+
+    // Assets listed in a catalog are read from their sources, without rescanning
+    if (fs::is_regular_file(inPath) && Catalog::is_catalog_file(inputPath))
+        return extractFromCatalog(inputPath, outArg, result);
+
+    return finish(convertInputs(inputPath, outArg, result));
 }
@@ -0,0 +1,236 @@
+#include "manifest.h"
+
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+#include "file_utils.h"
+
+namespace Incremental {
+
+namespace {
+
+constexpr char kManifestHeader[] = "# misc_audio_converter manifest v1";
+constexpr char kOutputSeparator = '|';
+
+std::string get_key(const std::string& path)
+{
+    std::error_code error;
+    auto absolutePath = std::filesystem::absolute(path, error);
+    return error ? path : absolutePath.lexically_normal().string();
+}
+
+} // namespace
+
+Manifest::Manifest(const std::string& outFolder, const std::string& in_options)
+    : manifestPath(outFolder + "\\" + ".convert_manifest")
+    , journalPath(outFolder + "\\" + ".convert_journal")
+    , options(in_options)
+{}
+
+uint64_t Manifest::hash_file(const std::string& path)
+{
+    Utils::MappedFile file(path);
+    return file.is_open() ? Utils::hash64(file.data(), file.size()) : 0;
+}
+
+bool Manifest::parse_record(const std::string& line, std::string& path, Record& record)
+{
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    for (std::string field; std::getline(ss, field, '\t');)
+        fields.push_back(field);
+
+    if (fields.size() < 5)
+        return false;
+
+    path = fields[0];
+    record.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+    record.mtime = std::strtoll(fields[2].c_str(), nullptr, 10);
+    record.hash = std::strtoull(fields[3].c_str(), nullptr, 16);
+    record.options = fields[4];
+
+    record.outputs.clear();
+    if (fields.size() > 5)
+    {
+        std::stringstream outputs(fields[5]);
+        for (std::string output; std::getline(outputs, output, kOutputSeparator);)
+            record.outputs.push_back(output);
+    }
+    return true;
+}
+
+std::string Manifest::format_record(const std::string& path, const Record& record)
+{
+    std::string line = Utils::str_format("%s\t%llu\t%lld\t%016llx\t%s\t", path.c_str(),
+        (unsigned long long)record.size, (long long)record.mtime, (unsigned long long)record.hash, record.options.c_str());
+
+    for (size_t i = 0; i < record.outputs.size(); i++)
+    {
+        if (i > 0)
+            line += kOutputSeparator;
+        line += record.outputs[i];
+    }
+    return line;
+}
+
+void Manifest::load()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    records.clear();
+
+    std::string path;
+    Record record;
+
+    std::ifstream manifest(manifestPath);
+    for (std::string line; std::getline(manifest, line);)
+    {
+        if (!line.empty() && line[0] != '#' && parse_record(line, path, record))
+            records[path] = record;
+    }
+
+    // Conversions completed by an interrupted run
+    size_t numReplayed = 0;
+    std::ifstream previousJournal(journalPath);
+    for (std::string line; std::getline(previousJournal, line);)
+    {
+        if (parse_record(line, path, record))
+        {
+            records[path] = record;
+            numReplayed++;
+        }
+    }
+    previousJournal.close();
+
+    if (numReplayed > 0)
+        std::cout << "Resuming an interrupted run: " << numReplayed << " file(s) already converted\n";
+
+    journal.open(journalPath, std::ofstream::app);
+}
+
+bool Manifest::is_up_to_date(const std::string& inputPath)
+{
+    const std::string key = get_key(inputPath);
+
+    uint64_t size;
+    int64_t mtime;
+    if (!Utils::read_stats(inputPath, size, mtime))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = records.find(key);
+    if (found == records.end())
+        return false;
+
+    Record& record = found->second;
+    if (record.options != options || record.size != size)
+        return false;
+
+    for (const auto& output : record.outputs)
+    {
+        if (!std::filesystem::exists(output))
+            return false;
+    }
+
+    // Touched but identical: only then is the content hashed
+    if (record.mtime != mtime)
+    {
+        if (hash_file(inputPath) != record.hash)
+            return false;
+        record.mtime = mtime;
+    }
+    return true;
+}
+
+void Manifest::complete(const std::string& inputPath, uint64_t inputHash, const std::vector<std::string>& outputs)
+{
+    Record record;
+    if (!Utils::read_stats(inputPath, record.size, record.mtime))
+        return;
+
+    record.hash = inputHash;
+    record.options = options;
+    for (const auto& output : outputs)
+        record.outputs.push_back(get_key(output));
+
+    const std::string key = get_key(inputPath);
+    const std::string line = format_record(key, record);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    records[key] = std::move(record);
+
+    journal << line << std::endl; // flushed: the journal must survive an interruption
+}
+
+bool Manifest::save()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string content = std::string(kManifestHeader) + "\n";
+    for (const auto& entry : records)
+        content += format_record(entry.first, entry.second) + "\n";
+
+    // Temp file + rename, so that an interruption can't leave a truncated manifest
+    const std::string tempPath = manifestPath + ".tmp";
+    if (!Utils::write_file(tempPath, content.data(), content.size()))
+        return false;
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, manifestPath, error);
+    if (error)
+    {
+        std::cerr << "Could not update " << manifestPath << ": " << error.message() << "\n";
+        return false;
+    }
+
+    journal.close();
+    std::filesystem::remove(journalPath, error);
+    return true;
+}
+
+bool RecordingStore::store(const std::string& path, std::vector<char>&& data)
+{
+    record(path);
+
+    if (pTarget)
+        return pTarget->store(path, std::move(data));
+
+    return Utils::write_file(path, data.data(), data.size());
+}
+
+std::unique_ptr<Utils::OutputStream> RecordingStore::open_stream(const std::string& path)
+{
+    std::unique_ptr<Utils::OutputStream> stream;
+    if (pTarget)
+    {
+        // Without a stream, the file comes back through store()
+        stream = pTarget->open_stream(path);
+    }
+    else
+    {
+        auto file = std::make_unique<Utils::FileStream>();
+        if (file->open(path))
+            stream = std::move(file);
+    }
+
+    if (stream)
+        record(path);
+    return stream;
+}
+
+bool RecordingStore::allow_direct_write(const std::string& path)
+{
+    if (pTarget && !pTarget->allow_direct_write(path))
+        return false;
+
+    record(path);
+    return true;
+}
+
+void RecordingStore::record(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    outputs.push_back(path);
+}
+
+} // namespace Incremental
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace Incremental {
+
+struct Record
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+    std::string options;
+    std::vector<std::string> outputs;
+};
+
+//-----------------------------------------------------------------------------
+// Conversion manifest kept in the output folder for -incremental runs: for
+// each input, its size, modification time, content hash, the options used and
+// the outputs it produced. An input is up to date when its record matches
+// (size + mtime, or the content hash when only the mtime changed), was
+// converted with the same options, and all of its outputs still exist.
+// Completed conversions are appended to a write-ahead journal as they happen,
+// so an interrupted run resumes where it stopped; save() folds the journal
+// into the manifest.
+//-----------------------------------------------------------------------------
+class Manifest
+{
+public:
+    Manifest(const std::string& outFolder, const std::string& in_options);
+
+    // Loads the manifest, then replays the journal of an interrupted run
+    void load();
+
+    bool is_up_to_date(const std::string& inputPath);
+
+    // Records a finished conversion (thread-safe). inputHash: Utils::hash64 of the
+    // input content, as read for the conversion.
+    void complete(const std::string& inputPath, uint64_t inputHash, const std::vector<std::string>& outputs);
+
+    // Rewrites the manifest (atomically) and clears the journal
+    bool save();
+
+private:
+    static uint64_t hash_file(const std::string& path);
+    static bool parse_record(const std::string& line, std::string& path, Record& record);
+    static std::string format_record(const std::string& path, const Record& record);
+
+    const std::string manifestPath;
+    const std::string journalPath;
+    const std::string options;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Record> records;
+    std::ofstream journal;
+};
+
+//-----------------------------------------------------------------------------
+// Forwards output files to another store (or writes them to disk when there
+// is none) and keeps the list of their paths. Streamed and memory-mapped
+// outputs are only recorded: their data doesn't go through here.
+//-----------------------------------------------------------------------------
+class RecordingStore : public Utils::FileStore
+{
+public:
+    explicit RecordingStore(Utils::FileStore* in_pTarget) : pTarget(in_pTarget) {}
+
+    bool store(const std::string& path, std::vector<char>&& data) override;
+    std::unique_ptr<Utils::OutputStream> open_stream(const std::string& path) override;
+    bool allow_direct_write(const std::string& path) override;
+
+    const std::vector<std::string>& get_outputs() const { return outputs; }
+
+private:
+    void record(const std::string& path);
+
+    Utils::FileStore* const pTarget;
+    std::mutex mutex;
+    std::vector<std::string> outputs;
+};
+
+} // namespace Incremental
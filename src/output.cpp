@@ -0,0 +1,209 @@
+#include "output.h"
+
+#include "file_utils.h"
+#include "flac.h"
+#include "indywv.h"
+#include "peaks.h"
+#include "tee_sink.h"
+#include "utils.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Output {
+
+bool StdoutStore::store(const std::string&, std::vector<char>&& data)
+{
+    std::cout.write(data.data(), data.size());
+    std::cout.flush();
+    return std::cout.good();
+}
+
+bool find_format_from_name(const std::string& name, EFormat& outFormat)
+{
+    auto lowerName = Utils::str_to_lower(name);
+    if (lowerName == "wav") { outFormat = EFormat::Wav; return true; }
+    else if (lowerName == "flac") { outFormat = EFormat::Flac; return true; }
+    else if (lowerName == "wv") { outFormat = EFormat::IndyWV; return true; }
+    else if (lowerName == "peaks") { outFormat = EFormat::Peaks; return true; }
+
+    return false;
+}
+
+bool find_sample_format_from_name(const std::string& name, PcmConvert::ESampleFormat& outSampleFormat)
+{
+    auto lowerName = Utils::str_to_lower(name);
+    if (lowerName == "s16") { outSampleFormat = PcmConvert::ESampleFormat::S16; return true; }
+    else if (lowerName == "s24") { outSampleFormat = PcmConvert::ESampleFormat::S24; return true; }
+    else if (lowerName == "f32") { outSampleFormat = PcmConvert::ESampleFormat::F32; return true; }
+
+    return false;
+}
+
+const char* get_extension(EFormat format)
+{
+    switch (format)
+    {
+    case EFormat::Flac: return "flac";
+    case EFormat::IndyWV: return "wv";
+    case EFormat::Peaks: return "peaks.json";
+    default: return "wav";
+    }
+}
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Zero-copy .wav writer: the output file is preallocated to its expected size
+// and memory-mapped, the header is written in place and reserve() hands out
+// memory inside the mapping, so decoders write PCM straight into the file.
+// The mapping grows if more data than expected is produced.
+//-----------------------------------------------------------------------------
+class MappedWavWriter : public PcmSink
+{
+public:
+    explicit MappedWavWriter(const std::string& in_path) : path(in_path) {}
+    ~MappedWavWriter() override;
+
+    bool begin(const PcmFormat& format, uint64_t expectedDataSize) override;
+    char* reserve(size_t size) override;
+    void commit(size_t size) override;
+    bool end() override;
+
+private:
+    const std::string path;
+    Utils::MappedOutputFile file;
+    size_t dataSize = 0;
+
+    // Where data goes if the mapping couldn't grow: the output is then reported as failed
+    std::vector<char> discardBuffer;
+    bool bFailed = false;
+};
+
+MappedWavWriter::~MappedWavWriter()
+{
+    if (file.is_open())
+        end();
+}
+
+bool MappedWavWriter::begin(const PcmFormat& format, uint64_t expectedDataSize)
+{
+    // Unknown size: start with some room, the mapping grows as needed
+    size_t initialDataSize = expectedDataSize ? (size_t)expectedDataSize : Utils::OutputFile::kBufferSize;
+    if (!file.open(path, sizeof(Wave::WavHeader) + initialDataSize))
+        return false;
+
+    dataSize = 0;
+    bFailed = false;
+    Wave::fill_header(*reinterpret_cast<Wave::WavHeader*>(file.data()), format, (uint32_t)expectedDataSize);
+    return true;
+}
+
+char* MappedWavWriter::reserve(size_t size)
+{
+    const size_t requiredSize = sizeof(Wave::WavHeader) + dataSize + size;
+    if (!bFailed && requiredSize > file.size() && !file.resize(std::max(requiredSize, file.size() * 2)))
+        bFailed = true;
+
+    if (bFailed)
+    {
+        discardBuffer.resize(size);
+        return discardBuffer.data();
+    }
+
+    return reinterpret_cast<char*>(file.data()) + sizeof(Wave::WavHeader) + dataSize;
+}
+
+void MappedWavWriter::commit(size_t size)
+{
+    if (!bFailed)
+        dataSize += size;
+}
+
+bool MappedWavWriter::end()
+{
+    if (!file.is_open())
+        return false;
+
+    if (bFailed)
+    {
+        file.close(0);
+        return false;
+    }
+
+    auto* header = reinterpret_cast<Wave::WavHeader*>(file.data());
+    header->wavSize = (int)(36 + dataSize);
+    header->dataChunkSize = (int)dataSize;
+
+    return file.close(sizeof(Wave::WavHeader) + dataSize);
+}
+
+std::unique_ptr<PcmSink> create_file_sink(const std::string& path, const Options& options)
+{
+    // FLAC frames are variable-sized, so there is nothing to map up front
+    if (options.format == EFormat::Flac)
+        return std::make_unique<Flac::Writer>(path, options.pStore);
+
+    // ADPCM codes are variable-sized too; the PCM is encoded as it comes, never written
+    if (options.format == EFormat::IndyWV)
+        return std::make_unique<IndyWV::Writer>(path, options.pStore);
+
+    if (options.format == EFormat::Peaks)
+        return std::make_unique<Peaks::Writer>(path, options.pStore);
+
+    if (options.writeMode == EWriteMode::Pipe)
+        return std::make_unique<Wave::PipeWriter>(std::cout);
+
+    if (options.writeMode == EWriteMode::Mapped && (!options.pStore || options.pStore->allow_direct_write(path)))
+        return std::make_unique<MappedWavWriter>(path);
+
+    return std::make_unique<Wave::Writer>(path, options.pStore);
+}
+
+// Path of an extra output, next to the main one: the whole extension of the main
+// format is replaced, even with several dots (x.peaks.json -> x.wav)
+std::string replace_extension(const std::string& path, EFormat mainFormat, EFormat format)
+{
+    const std::string mainExtension = std::string(".") + get_extension(mainFormat);
+    size_t baseSize = path.size();
+    if (path.size() > mainExtension.size() && path.compare(path.size() - mainExtension.size(), mainExtension.size(), mainExtension) == 0)
+    {
+        baseSize -= mainExtension.size();
+    }
+    else
+    {
+        const size_t nameStart = path.find_last_of("/\\") + 1;
+        const size_t extensionStart = path.find_last_of('.');
+        if (extensionStart != std::string::npos && extensionStart >= nameStart)
+            baseSize = extensionStart;
+    }
+    return path.substr(0, baseSize) + "." + get_extension(format);
+}
+
+} // namespace
+
+std::unique_ptr<PcmSink> create_pcm_sink(const std::string& path, const Options& options)
+{
+    std::unique_ptr<PcmSink> sink = create_file_sink(path, options);
+    if (!options.extraFormats.empty())
+    {
+        std::vector<std::unique_ptr<PcmSink>> branches;
+        branches.push_back(std::move(sink));
+        for (EFormat format : options.extraFormats)
+        {
+            Options branchOptions = options;
+            branchOptions.format = format;
+            branches.push_back(create_file_sink(replace_extension(path, options.format, format), branchOptions));
+        }
+        sink = std::make_unique<TeeSink>(std::move(branches));
+    }
+
+    // Converted once, before the fan-out
+    if (options.sampleRate != 0 || options.sampleFormat != PcmConvert::ESampleFormat::Source)
+        sink = std::make_unique<PcmConvert::ConvertSink>(std::move(sink), options.sampleRate, options.sampleFormat);
+
+    return sink;
+}
+
+} // namespace Output
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pcm_convert.h"
+#include "pcm_sink.h"
+#include "utils.h"
+
+namespace Output {
+
+enum class EWriteMode : uint8_t
+{
+    Stream, // buffered writes
+    Mapped, // preallocated memory-mapped file, decoded into in place
+    Pipe,   // standard output, as decoded (WAV only; other formats go to pStore)
+};
+
+enum class EFormat : uint8_t
+{
+    Wav,
+    Flac,
+    IndyWV, // mono ADPCM, transcoded chunk by chunk as decoded
+    Peaks,  // waveform peaks (audiowaveform JSON)
+};
+
+struct Options
+{
+    EWriteMode writeMode = EWriteMode::Stream;
+    EFormat format = EFormat::Wav;
+
+    // Other outputs fed by the same decode (-format wav flac peaks), named after the first one
+    std::vector<EFormat> extraFormats;
+
+    // Output stage applied to the decoded PCM (0 / Source: unchanged)
+    uint32_t sampleRate = 0;
+    PcmConvert::ESampleFormat sampleFormat = PcmConvert::ESampleFormat::Source;
+
+    // Receives the output files (the disk, a write queue, an archive...)
+    Utils::FileStore* pStore = nullptr;
+};
+
+//-----------------------------------------------------------------------------
+// Writes whole output files to the standard output (-out -), whatever their
+// name: only meant for conversions producing a single file.
+//-----------------------------------------------------------------------------
+class StdoutStore : public Utils::FileStore
+{
+public:
+    bool store(const std::string& path, std::vector<char>&& data) override;
+};
+
+// Parses a -format value ("wav", "flac", "wv", "peaks"), returns false if unknown
+bool find_format_from_name(const std::string& name, EFormat& outFormat);
+
+// Parses a -sample_format value ("s16", "s24", "f32"), returns false if unknown
+bool find_sample_format_from_name(const std::string& name, PcmConvert::ESampleFormat& outSampleFormat);
+
+// Extension of the output files, without the dot
+const char* get_extension(EFormat format);
+inline const char* get_extension(const Options& options) { return get_extension(options.format); }
+
+// Creates the sink writing decoded PCM to the given output file, or to it and
+// to the same path with the extension of each extra format, from a single decode
+std::unique_ptr<PcmSink> create_pcm_sink(const std::string& path, const Options& options);
+
+} // namespace Output
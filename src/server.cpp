@@ -0,0 +1,633 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "trace.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Server {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t get_elapsed_us(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+//-----------------------------------------------------------------------------
+// Reader of the requests: a single flat JSON object per line, whose values
+// are strings, numbers, booleans, null or arrays of strings.
+//-----------------------------------------------------------------------------
+class RequestReader
+{
+public:
+    explicit RequestReader(const std::string& in_text) : text(in_text) {}
+
+    // Calls onValue(key, string, array, rawValue) for each member of the object
+    template<typename OnValue>
+    bool read_object(OnValue onValue, std::string& outError)
+    {
+        if (!consume('{'))
+            return fail("expected a JSON object", outError);
+        if (consume('}'))
+            return at_end() || fail("unexpected data after the object", outError);
+
+        do
+        {
+            std::string key, value, rawValue;
+            std::vector<std::string> array;
+            if (!read_string(key) || !consume(':'))
+                return fail("expected a member name", outError);
+
+            skip_spaces();
+            const size_t valueStart = pos;
+            if (peek() == '"')
+            {
+                if (!read_string(value))
+                    return fail("invalid string for " + key, outError);
+            }
+            else if (peek() == '[')
+            {
+                if (!read_string_array(array))
+                    return fail(key + " must be an array of strings", outError);
+            }
+            else if (!read_literal(value))
+            {
+                return fail("unsupported value for " + key, outError);
+            }
+            rawValue = text.substr(valueStart, pos - valueStart);
+
+            onValue(key, value, array, rawValue);
+        } while (consume(','));
+
+        if (!consume('}'))
+            return fail("expected ',' or '}'", outError);
+        return at_end() || fail("unexpected data after the object", outError);
+    }
+
+private:
+    static bool fail(const std::string& message, std::string& outError)
+    {
+        outError = message;
+        return false;
+    }
+
+    void skip_spaces()
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n'))
+            pos++;
+    }
+
+    char peek() const { return (pos < text.size()) ? text[pos] : '\0'; }
+
+    bool consume(char c)
+    {
+        skip_spaces();
+        if (peek() != c)
+            return false;
+        pos++;
+        return true;
+    }
+
+    bool at_end()
+    {
+        skip_spaces();
+        return pos == text.size();
+    }
+
+    bool read_hex4(uint32_t& outValue)
+    {
+        if (pos + 4 > text.size())
+            return false;
+        outValue = 0;
+        for (size_t i = 0; i < 4; i++)
+        {
+            const char c = text[pos++];
+            outValue <<= 4;
+            if (c >= '0' && c <= '9') outValue |= (uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f') outValue |= (uint32_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') outValue |= (uint32_t)(c - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& str, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            str += (char)codePoint;
+        }
+        else if (codePoint < 0x800)
+        {
+            str += (char)(0xC0 | (codePoint >> 6));
+            str += (char)(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            str += (char)(0xE0 | (codePoint >> 12));
+            str += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            str += (char)(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            str += (char)(0xF0 | (codePoint >> 18));
+            str += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+            str += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            str += (char)(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    bool read_string(std::string& outValue)
+    {
+        if (!consume('"'))
+            return false;
+
+        outValue.clear();
+        while (pos < text.size())
+        {
+            const char c = text[pos++];
+            if (c == '"')
+                return true;
+            if (c != '\\')
+            {
+                outValue += c;
+                continue;
+            }
+
+            if (pos == text.size())
+                return false;
+            const char escaped = text[pos++];
+            switch (escaped)
+            {
+            case '"': case '\\': case '/': outValue += escaped; break;
+            case 'b': outValue += '\b'; break;
+            case 'f': outValue += '\f'; break;
+            case 'n': outValue += '\n'; break;
+            case 'r': outValue += '\r'; break;
+            case 't': outValue += '\t'; break;
+            case 'u':
+            {
+                uint32_t codePoint;
+                if (!read_hex4(codePoint))
+                    return false;
+
+                // Characters outside the BMP come as a surrogate pair
+                uint32_t lowSurrogate;
+                if (codePoint >= 0xD800 && codePoint < 0xDC00 && text.compare(pos, 2, "\\u") == 0)
+                {
+                    pos += 2;
+                    if (!read_hex4(lowSurrogate) || lowSurrogate < 0xDC00 || lowSurrogate >= 0xE000)
+                        return false;
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+                }
+                append_utf8(outValue, codePoint);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool read_string_array(std::vector<std::string>& outValues)
+    {
+        if (!consume('['))
+            return false;
+        if (consume(']'))
+            return true;
+
+        do
+        {
+            std::string value;
+            if (!read_string(value))
+                return false;
+            outValues.push_back(std::move(value));
+        } while (consume(','));
+
+        return consume(']');
+    }
+
+    // Number, true, false or null, as written
+    bool read_literal(std::string& outValue)
+    {
+        const size_t start = pos;
+        while (pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '-' || text[pos] == '+' || text[pos] == '.'))
+            pos++;
+        outValue = text.substr(start, pos - start);
+        if (outValue == "true" || outValue == "false" || outValue == "null")
+            return true;
+
+        char* pEnd = nullptr;
+        std::strtod(outValue.c_str(), &pEnd);
+        return !outValue.empty() && pEnd == outValue.c_str() + outValue.size();
+    }
+
+    const std::string& text;
+    size_t pos = 0;
+};
+
+struct Request
+{
+    Job job;
+    std::string idJson = "null"; // id as sent, echoed in the records
+    std::string command;
+};
+
+bool parse_request(const std::string& line, Request& outRequest, std::string& outError)
+{
+    bool bHasInput = false, bHasOutput = false;
+    auto onValue = [&](const std::string& key, const std::string& value, const std::vector<std::string>& array, const std::string& rawValue)
+    {
+        if (key == "id") { outRequest.job.id = value; outRequest.idJson = rawValue; }
+        else if (key == "cmd") { outRequest.command = value; }
+        else if (key == "in") { outRequest.job.input = value; bHasInput = true; }
+        else if (key == "out") { outRequest.job.output = value; bHasOutput = true; }
+        else if (key == "args") { outRequest.job.args = array; }
+    };
+
+    if (!RequestReader(line).read_object(onValue, outError))
+        return false;
+
+    if (!outRequest.command.empty())
+    {
+        if (outRequest.command != "shutdown")
+        {
+            outError = "unknown command " + outRequest.command;
+            return false;
+        }
+    }
+    else if (!bHasInput || !bHasOutput || outRequest.job.input.empty() || outRequest.job.output.empty())
+    {
+        outError = "a job needs \"in\" and \"out\"";
+        return false;
+    }
+    return true;
+}
+
+std::string make_error_record(const std::string& idJson, const std::string& error)
+{
+    return "{\"id\": " + idJson + ", \"status\": \"error\", \"error\": \"" + Utils::escape_json(error) + "\"}";
+}
+
+//-----------------------------------------------------------------------------
+// Client of the server: requests come in as lines, records go out as lines.
+// Records are sent by the worker threads as their jobs complete.
+//-----------------------------------------------------------------------------
+class Connection
+{
+public:
+    virtual ~Connection() = default;
+
+    // Next request line; false at the end of the input
+    virtual bool read_line(std::string& outLine) = 0;
+
+    void send(const std::string& record)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        write(record + "\n");
+    }
+
+protected:
+    virtual void write(const std::string& data) = 0;
+
+private:
+    std::mutex writeMutex;
+};
+
+class StdioConnection : public Connection
+{
+public:
+    bool read_line(std::string& outLine) override
+    {
+        return (bool)std::getline(std::cin, outLine);
+    }
+
+protected:
+    void write(const std::string& data) override
+    {
+        std::cout << data << std::flush;
+    }
+};
+
+#ifndef _WIN32
+class SocketConnection : public Connection
+{
+public:
+    explicit SocketConnection(int in_fd) : fd(in_fd) {}
+    ~SocketConnection() override { close(fd); }
+
+    bool read_line(std::string& outLine) override
+    {
+        for (;;)
+        {
+            const size_t lineEnd = buffer.find('\n');
+            if (lineEnd != std::string::npos)
+            {
+                outLine = buffer.substr(0, lineEnd);
+                buffer.erase(0, lineEnd + 1);
+                return true;
+            }
+
+            char chunk[4096];
+            const ssize_t sizeRead = ::read(fd, chunk, sizeof(chunk));
+            if (sizeRead <= 0)
+            {
+                // Last request without a newline
+                outLine = std::move(buffer);
+                buffer.clear();
+                return !outLine.empty();
+            }
+            buffer.append(chunk, (size_t)sizeRead);
+        }
+    }
+
+    // Wakes up the thread blocked in read_line()
+    void stop_reading() { shutdown(fd, SHUT_RD); }
+
+    std::atomic<bool> bDone{ false };
+
+protected:
+    void write(const std::string& data) override
+    {
+        // Records for a client which went away are dropped
+        for (size_t written = 0; written < data.size();)
+        {
+            const ssize_t size = ::write(fd, data.data() + written, data.size() - written);
+            if (size <= 0)
+                return;
+            written += (size_t)size;
+        }
+    }
+
+private:
+    const int fd;
+    std::string buffer;
+};
+#endif
+
+//-----------------------------------------------------------------------------
+// Worker threads started once for the lifetime of the server, taking the jobs
+// of all the clients from a single queue.
+//-----------------------------------------------------------------------------
+class WorkerPool
+{
+public:
+    WorkerPool(unsigned numThreads, const ConvertFunction& in_convert) : convert(in_convert)
+    {
+        for (unsigned i = 0; i < std::max(numThreads, 1u); i++)
+            threads.emplace_back(&WorkerPool::run, this);
+    }
+
+    // Finishes the queued jobs
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bStopping = true;
+        }
+        jobsAvailable.notify_all();
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    void submit(Request&& request, std::shared_ptr<Connection> connection)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back({ std::move(request), std::move(connection), Clock::now() });
+        }
+        jobsAvailable.notify_one();
+    }
+
+    // Waits until all the jobs submitted so far are done
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]() { return tasks.empty() && numBusyThreads == 0; });
+    }
+
+private:
+    struct Task
+    {
+        Request request;
+        std::shared_ptr<Connection> connection;
+        Clock::time_point receiveTime;
+    };
+
+    void run()
+    {
+        Trace::set_thread_name("worker");
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            jobsAvailable.wait(lock, [&]() { return bStopping || !tasks.empty(); });
+            if (tasks.empty())
+                return; // stopping
+
+            Task task = std::move(tasks.front());
+            tasks.pop_front();
+            numBusyThreads++;
+            lock.unlock();
+
+            process(task);
+
+            lock.lock();
+            numBusyThreads--;
+            if (tasks.empty() && numBusyThreads == 0)
+                idle.notify_all();
+        }
+    }
+
+    void process(Task& task)
+    {
+        const Clock::time_point startTime = Clock::now();
+        std::string error;
+        const bool bSuccess = convert(task.request.job, error);
+        const Clock::time_point endTime = Clock::now();
+
+        if (!bSuccess)
+        {
+            task.connection->send(make_error_record(task.request.idJson, error.empty() ? "conversion failed" : error));
+            return;
+        }
+
+        task.connection->send(Utils::str_format("{\"id\": %s, \"status\": \"ok\", \"queue_us\": %lld, \"convert_us\": %lld, \"total_us\": %lld}",
+            task.request.idJson.c_str(),
+            (long long)get_elapsed_us(task.receiveTime, startTime),
+            (long long)get_elapsed_us(startTime, endTime),
+            (long long)get_elapsed_us(task.receiveTime, endTime)));
+    }
+
+    const ConvertFunction& convert;
+
+    std::mutex mutex;
+    std::condition_variable jobsAvailable;
+    std::condition_variable idle;
+
+    std::deque<Task> tasks;
+    unsigned numBusyThreads = 0;
+    bool bStopping = false;
+
+    std::vector<std::thread> threads;
+};
+
+// Reads the requests of a client until its input ends, or until a shutdown request (returns true then)
+bool read_requests(const std::shared_ptr<Connection>& connection, WorkerPool& pool, std::atomic<bool>& bStopping)
+{
+    std::string line;
+    while (connection->read_line(line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        Request request;
+        std::string error;
+        if (!parse_request(line, request, error))
+        {
+            connection->send(make_error_record(request.idJson, error));
+            continue;
+        }
+
+        if (request.command == "shutdown")
+        {
+            // New jobs are refused from now on, the pending ones are finished first
+            bStopping = true;
+            pool.wait_idle();
+            connection->send("{\"id\": " + request.idJson + ", \"status\": \"ok\"}");
+            return true;
+        }
+
+        if (bStopping)
+        {
+            connection->send(make_error_record(request.idJson, "the server is shutting down"));
+            continue;
+        }
+        pool.submit(std::move(request), connection);
+    }
+    return false;
+}
+
+#ifndef _WIN32
+bool serve_socket(const std::string& socketPath, WorkerPool& pool)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path too long: " << socketPath << "\n";
+        return false;
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // Records written to a client which went away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str()); // left over by a previous server
+    if (listenFd < 0 || bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+    {
+        std::cerr << "Could not listen on " << socketPath << "\n";
+        if (listenFd >= 0)
+            close(listenFd);
+        return false;
+    }
+    std::cerr << "Listening on " << socketPath << "\n";
+
+    struct Client
+    {
+        std::shared_ptr<SocketConnection> connection;
+        std::thread thread;
+    };
+    std::vector<Client> clients;
+    std::atomic<bool> bStopping(false);
+
+    while (!bStopping)
+    {
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (bStopping || errno != EINTR)
+                break;
+            continue;
+        }
+
+        // Threads of the clients which went away
+        auto isDone = [](Client& client) { return client.connection->bDone.load(); };
+        for (auto& client : clients)
+        {
+            if (isDone(client))
+                client.thread.join();
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), isDone), clients.end());
+
+        auto connection = std::make_shared<SocketConnection>(fd);
+        std::thread thread([connection, &pool, &bStopping, listenFd]()
+        {
+            if (read_requests(connection, pool, bStopping))
+                shutdown(listenFd, SHUT_RDWR); // wakes up accept()
+            connection->bDone = true;
+        });
+        clients.push_back({ connection, std::move(thread) });
+    }
+
+    bStopping = true;
+    for (auto& client : clients)
+    {
+        client.connection->stop_reading();
+        client.thread.join();
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return true;
+}
+#endif
+
+} // namespace
+
+bool run(const Options& options, const ConvertFunction& convert)
+{
+    const unsigned numWorkers = options.numWorkers ? options.numWorkers : std::max(1u, std::thread::hardware_concurrency());
+    WorkerPool pool(numWorkers, convert);
+
+    if (options.socketPath.empty())
+    {
+        std::atomic<bool> bStopping(false);
+        read_requests(std::make_shared<StdioConnection>(), pool, bStopping);
+        pool.wait_idle();
+        return true;
+    }
+
+#ifdef _WIN32
+    std::cerr << "-serve only reads requests from the standard input on Windows\n";
+    return false;
+#else
+    return serve_socket(options.socketPath, pool);
+#endif
+}
+
+} // namespace Server
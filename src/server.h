@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Server {
+
+//-----------------------------------------------------------------------------
+// Conversion daemon (-serve): reads newline-delimited JSON job requests from
+// the standard input, or from the clients of a Unix domain socket, and runs
+// them on a pool of worker threads started once, so that threads and decoder
+// tables stay warm from one job to the next. Each job gets a JSON completion
+// record with its timings, written back to the client that sent it as soon as
+// it is done (so not necessarily in request order: match them by id).
+//
+//   {"id": "42", "in": "a.wv", "out": "converted", "args": ["-format", "flac"]}
+//   -> {"id": "42", "status": "ok", "queue_us": 8, "convert_us": 412, "total_us": 425}
+//   {"id": "43", "cmd": "shutdown"}
+//   -> {"id": "43", "status": "ok"} once the jobs received before are done
+//
+// Failed jobs get "status": "error" and an "error" message.
+//-----------------------------------------------------------------------------
+
+struct Job
+{
+    std::string id;
+    std::string input;
+    std::string output;
+    std::vector<std::string> args; // conversion options, e.g. { "-game", "Cotm1" }
+};
+
+// Runs a job; returns false (with a message) if it failed
+using ConvertFunction = std::function<bool(const Job& job, std::string& outError)>;
+
+struct Options
+{
+    std::string socketPath; // empty: standard input and output
+    unsigned numWorkers = 0; // 0: one per hardware thread
+};
+
+// Serves until the standard input ends (without socket) or a shutdown request comes
+bool run(const Options& options, const ConvertFunction& convert);
+
+} // namespace Server
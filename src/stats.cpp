@@ -0,0 +1,410 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "counters.h"
+#include "utils.h"
+
+namespace Stats {
+
+namespace Detail {
+    std::atomic<bool> bEnabled(false);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kNumStages = (size_t)EStage::Count;
+constexpr size_t kNumCounters = (size_t)ECounter::Count;
+constexpr size_t kNumSlowestFiles = 10;
+constexpr char kUnknownFormat[] = "unknown";
+
+const char* kStageNames[kNumStages] = { "detect", "read", "decode", "convert", "encode", "merge", "write" };
+const char* kCounterNames[kNumCounters] = { "bytes_in", "bytes_out", "samples" };
+
+// Hardware counters (-counters) of each stage of a format
+struct StageEvents
+{
+    uint64_t values[kNumStages][Counters::kNumEvents] = {};
+};
+
+// Written by its own thread only: relaxed atomics are enough for the report to read them
+struct ThreadStats
+{
+    std::atomic<uint64_t> stageNs[kNumStages] = {};
+    std::atomic<uint64_t> counters[kNumCounters] = {};
+
+    // Owner thread only
+    EStage currentStage = EStage::Count;
+    Clock::time_point stageStart;
+    const char* currentFormat = kUnknownFormat;
+    Counters::Values eventStart = {};
+
+    // Written by the owner thread, read by the report
+    std::mutex eventsMutex;
+    std::map<std::string, StageEvents> formatEvents;
+};
+
+struct FileRecord
+{
+    std::string path;
+    const char* format;
+    double seconds;
+    uint64_t counters[kNumCounters];
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadStats>> threads; // kept after their thread exits
+    std::vector<FileRecord> files;
+    Clock::time_point startTime;
+};
+
+Registry& get_registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+ThreadStats& get_thread_stats()
+{
+    thread_local ThreadStats* pStats = nullptr;
+    if (!pStats)
+    {
+        Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(std::make_unique<ThreadStats>());
+        pStats = registry.threads.back().get();
+    }
+    return *pStats;
+}
+
+void increment(std::atomic<uint64_t>& value, uint64_t delta)
+{
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+uint64_t get_elapsed_ns(Clock::time_point start, Clock::time_point end)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+// Attributes the hardware counts since the last timer boundary to the running stage (of the current format)
+void sample_events(ThreadStats& stats)
+{
+    Counters::Values values;
+    if (!Counters::is_enabled() || !Counters::read(values))
+        return;
+
+    if (stats.currentStage != EStage::Count)
+    {
+        std::lock_guard<std::mutex> lock(stats.eventsMutex);
+        uint64_t* pTotals = stats.formatEvents[stats.currentFormat].values[(size_t)stats.currentStage];
+        for (size_t e = 0; e < Counters::kNumEvents; e++)
+            pTotals[e] += values[e] - stats.eventStart[e];
+    }
+    memcpy(stats.eventStart, values, sizeof(values));
+}
+
+// Nearest-rank percentile of sorted values
+double get_percentile(const std::vector<double>& sortedValues, double percentile)
+{
+    if (sortedValues.empty())
+        return 0.0;
+
+    size_t rank = (size_t)std::ceil(percentile / 100.0 * sortedValues.size());
+    return sortedValues[std::min(std::max<size_t>(rank, 1), sortedValues.size()) - 1];
+}
+
+std::string format_latencies(std::vector<double> seconds)
+{
+    std::sort(seconds.begin(), seconds.end());
+    return Utils::str_format("\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f",
+        get_percentile(seconds, 50) * 1000.0, get_percentile(seconds, 99) * 1000.0, seconds.empty() ? 0.0 : seconds.back() * 1000.0);
+}
+
+std::string format_counters(const uint64_t* counters)
+{
+    std::string json;
+    for (size_t c = 0; c < kNumCounters; c++)
+        json += Utils::str_format("%s\"%s\": %llu", c > 0 ? ", " : "", kCounterNames[c], (unsigned long long)counters[c]);
+    return json;
+}
+
+} // namespace
+
+void Detail::add(ECounter counter, uint64_t value)
+{
+    increment(get_thread_stats().counters[(size_t)counter], value);
+}
+
+void enable()
+{
+    get_registry().startTime = Clock::now();
+    Detail::bEnabled.store(true);
+}
+
+void ScopedTimer::start(EStage stage)
+{
+    ThreadStats& stats = get_thread_stats();
+    sample_events(stats);
+    const auto now = Clock::now();
+
+    // Pause the enclosing timer
+    if (stats.currentStage != EStage::Count)
+        increment(stats.stageNs[(size_t)stats.currentStage], get_elapsed_ns(stats.stageStart, now));
+
+    parentStage = stats.currentStage;
+    stats.currentStage = stage;
+    stats.stageStart = now;
+}
+
+void ScopedTimer::stop()
+{
+    ThreadStats& stats = get_thread_stats();
+    sample_events(stats);
+    const auto now = Clock::now();
+
+    increment(stats.stageNs[(size_t)stats.currentStage], get_elapsed_ns(stats.stageStart, now));
+
+    // Resume the enclosing timer
+    stats.currentStage = parentStage;
+    stats.stageStart = now;
+}
+
+FileScope::FileScope(const std::string& in_path)
+    : bActive(is_enabled())
+{
+    if (!bActive)
+        return;
+
+    path = in_path;
+    ThreadStats& stats = get_thread_stats();
+    for (size_t c = 0; c < kNumCounters; c++)
+        startCounters[c] = stats.counters[c].load(std::memory_order_relaxed);
+    startTime = Clock::now();
+}
+
+void FileScope::set_format(const char* in_format)
+{
+    format = in_format;
+    if (bActive)
+        get_thread_stats().currentFormat = in_format;
+}
+
+FileScope::~FileScope()
+{
+    if (!bActive)
+        return;
+
+    FileRecord record;
+    record.path = std::move(path);
+    record.format = format;
+    record.seconds = get_elapsed_ns(startTime, Clock::now()) * 1e-9;
+
+    ThreadStats& stats = get_thread_stats();
+    for (size_t c = 0; c < kNumCounters; c++)
+        record.counters[c] = stats.counters[c].load(std::memory_order_relaxed) - startCounters[c];
+    stats.currentFormat = kUnknownFormat;
+
+    Registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.files.push_back(std::move(record));
+}
+
+namespace {
+
+struct FormatStats
+{
+    std::vector<double> seconds;
+    double totalSeconds = 0.0;
+    uint64_t counters[kNumCounters] = {};
+};
+
+std::string join(const std::vector<std::string>& items, const char* separator)
+{
+    std::string joined;
+    for (size_t i = 0; i < items.size(); i++)
+        joined += (i > 0 ? separator : "") + items[i];
+    return joined;
+}
+
+// Hardware counters per format and stage, with IPC, cycles per sample and misses per KB of input.
+// What runs before the format of a file is known (read, detect) or on threads working for no file
+// in particular (write queue, FLAC encoders) counts as the unknown format.
+std::string format_events(Registry& registry, const std::map<std::string, FormatStats>& formats)
+{
+    using Counters::EEvent;
+
+    std::map<std::string, StageEvents> totals;
+    for (const auto& pThread : registry.threads)
+    {
+        std::lock_guard<std::mutex> lock(pThread->eventsMutex);
+        for (const auto& entry : pThread->formatEvents)
+        {
+            StageEvents& formatTotals = totals[entry.first];
+            for (size_t s = 0; s < kNumStages; s++)
+            {
+                for (size_t e = 0; e < Counters::kNumEvents; e++)
+                    formatTotals.values[s][e] += entry.second.values[s][e];
+            }
+        }
+    }
+
+    std::vector<std::string> eventNames;
+    for (size_t e = 0; e < Counters::kNumEvents; e++)
+    {
+        if (Counters::is_available((EEvent)e))
+            eventNames.push_back(Utils::str_format("\"%s\"", Counters::get_name((EEvent)e)));
+    }
+
+    std::vector<std::string> formatItems;
+    for (const auto& entry : totals)
+    {
+        auto found = formats.find(entry.first);
+        const uint64_t samples = (found != formats.end()) ? found->second.counters[(size_t)ECounter::Samples] : 0;
+        const double kilobytesIn = (found != formats.end()) ? found->second.counters[(size_t)ECounter::BytesIn] / 1024.0 : 0.0;
+
+        std::vector<std::string> stageItems;
+        for (size_t s = 0; s < kNumStages; s++)
+        {
+            const uint64_t* values = entry.second.values[s];
+            if (values[(size_t)EEvent::Cycles] == 0)
+                continue;
+
+            std::vector<std::string> fields;
+            for (size_t e = 0; e < Counters::kNumEvents; e++)
+            {
+                if (Counters::is_available((EEvent)e))
+                    fields.push_back(Utils::str_format("\"%s\": %llu", Counters::get_name((EEvent)e), (unsigned long long)values[e]));
+            }
+
+            const double cycles = (double)values[(size_t)EEvent::Cycles];
+            if (Counters::is_available(EEvent::Instructions))
+                fields.push_back(Utils::str_format("\"ipc\": %.3f", values[(size_t)EEvent::Instructions] / cycles));
+            if (samples > 0)
+                fields.push_back(Utils::str_format("\"cycles_per_sample\": %.3f", cycles / samples));
+            for (EEvent event : { EEvent::BranchMisses, EEvent::L1DMisses, EEvent::LLCMisses })
+            {
+                if (kilobytesIn > 0.0 && Counters::is_available(event))
+                    fields.push_back(Utils::str_format("\"%s_per_kb\": %.3f", Counters::get_name(event), values[(size_t)event] / kilobytesIn));
+            }
+
+            stageItems.push_back(Utils::str_format("        \"%s\": { %s }", kStageNames[s], join(fields, ", ").c_str()));
+        }
+
+        if (!stageItems.empty())
+            formatItems.push_back(Utils::str_format("      \"%s\": {\n%s\n      }", Utils::escape_json(entry.first).c_str(), join(stageItems, ",\n").c_str()));
+    }
+
+    std::string json = "  \"counters\": {\n";
+    json += "    \"events\": [" + join(eventNames, ", ") + "],\n";
+    json += "    \"formats\": {\n" + join(formatItems, ",\n") + (formatItems.empty() ? "" : "\n") + "    }\n";
+    json += "  },\n";
+    return json;
+}
+
+} // namespace
+
+std::string build_report()
+{
+    Registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    const double wallSeconds = get_elapsed_ns(registry.startTime, Clock::now()) * 1e-9;
+
+    std::string json = "{\n";
+    json += Utils::str_format("  \"wall_seconds\": %.6f,\n", wallSeconds);
+    json += Utils::str_format("  \"files\": %zu,\n", registry.files.size());
+
+    // Stage times and counters, per thread and in total
+    uint64_t totalStageNs[kNumStages] = {};
+    uint64_t totalCounters[kNumCounters] = {};
+    json += "  \"threads\": [\n";
+    for (size_t t = 0; t < registry.threads.size(); t++)
+    {
+        const ThreadStats& stats = *registry.threads[t];
+
+        uint64_t counters[kNumCounters];
+        for (size_t c = 0; c < kNumCounters; c++)
+        {
+            counters[c] = stats.counters[c].load(std::memory_order_relaxed);
+            totalCounters[c] += counters[c];
+        }
+
+        json += Utils::str_format("    { \"id\": %zu, \"stages_s\": { ", t);
+        for (size_t s = 0; s < kNumStages; s++)
+        {
+            const uint64_t ns = stats.stageNs[s].load(std::memory_order_relaxed);
+            totalStageNs[s] += ns;
+            json += Utils::str_format("%s\"%s\": %.6f", s > 0 ? ", " : "", kStageNames[s], ns * 1e-9);
+        }
+        json += " }, " + format_counters(counters) + (t + 1 < registry.threads.size() ? " },\n" : " }\n");
+    }
+    json += "  ],\n";
+
+    json += "  \"stages_s\": { ";
+    for (size_t s = 0; s < kNumStages; s++)
+        json += Utils::str_format("%s\"%s\": %.6f", s > 0 ? ", " : "", kStageNames[s], totalStageNs[s] * 1e-9);
+    json += " },\n";
+    json += "  \"totals\": { " + format_counters(totalCounters) + " },\n";
+
+    // Throughput per input format: rates are per busy thread (sum of file latencies)
+    std::map<std::string, FormatStats> formats;
+    std::vector<double> allSeconds;
+    for (const auto& file : registry.files)
+    {
+        FormatStats& format = formats[file.format];
+        format.seconds.push_back(file.seconds);
+        format.totalSeconds += file.seconds;
+        for (size_t c = 0; c < kNumCounters; c++)
+            format.counters[c] += file.counters[c];
+        allSeconds.push_back(file.seconds);
+    }
+
+    json += "  \"formats\": {\n";
+    size_t formatIndex = 0;
+    for (const auto& entry : formats)
+    {
+        const FormatStats& format = entry.second;
+        const double busySeconds = std::max(format.totalSeconds, 1e-9);
+        json += Utils::str_format("    \"%s\": { \"files\": %zu, %s, \"busy_s\": %.6f, \"mb_in_per_s\": %.3f, \"mb_out_per_s\": %.3f, \"samples_per_s\": %.0f, %s }%s\n",
+            Utils::escape_json(entry.first).c_str(), format.seconds.size(), format_counters(format.counters).c_str(), format.totalSeconds,
+            format.counters[(size_t)ECounter::BytesIn] / busySeconds / 1e6, format.counters[(size_t)ECounter::BytesOut] / busySeconds / 1e6,
+            format.counters[(size_t)ECounter::Samples] / busySeconds, format_latencies(format.seconds).c_str(),
+            ++formatIndex < formats.size() ? "," : "");
+    }
+    json += "  },\n";
+    json += "  \"latency\": { " + format_latencies(allSeconds) + " },\n";
+
+    if (Counters::is_enabled())
+        json += format_events(registry, formats);
+
+    // Slowest files
+    std::vector<const FileRecord*> slowest;
+    for (const auto& file : registry.files)
+        slowest.push_back(&file);
+    const size_t numSlowest = std::min(kNumSlowestFiles, slowest.size());
+    std::partial_sort(slowest.begin(), slowest.begin() + numSlowest, slowest.end(),
+        [](const FileRecord* a, const FileRecord* b) { return a->seconds > b->seconds; });
+
+    json += "  \"slowest_files\": [\n";
+    for (size_t i = 0; i < numSlowest; i++)
+    {
+        const FileRecord& file = *slowest[i];
+        json += Utils::str_format("    { \"path\": \"%s\", \"format\": \"%s\", \"ms\": %.3f, %s }%s\n", Utils::escape_json(file.path).c_str(),
+            file.format, file.seconds * 1000.0, format_counters(file.counters).c_str(), i + 1 < numSlowest ? "," : "");
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+} // namespace Stats
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Stats {
+
+enum class EStage : uint8_t
+{
+    Detect,  // input type detection
+    Read,    // reading/mapping input files
+    Decode,  // decompression kernels
+    Convert, // resampling, sample format conversion
+    Encode,  // WV and FLAC encoders
+    Merge,   // MIDI merge, SoundFont packing
+    Write,   // output files (or hand-off to the write queue)
+    Count
+};
+
+enum class ECounter : uint8_t
+{
+    BytesIn,
+    BytesOut,
+    Samples, // decoded or encoded samples (all channels)
+    Count
+};
+
+namespace Detail {
+    extern std::atomic<bool> bEnabled;
+    void add(ECounter counter, uint64_t value);
+}
+
+// Stats are only gathered once enabled (-stats); until then timers and counters cost a flag test.
+// The switch and the recorded stats are process-wide: they cover every thread and every user of
+// the codecs library in the process, so only the application should enable them, once at startup.
+void enable();
+inline bool is_enabled() { return Detail::bEnabled.load(std::memory_order_relaxed); }
+
+inline void add(ECounter counter, uint64_t value)
+{
+    if (is_enabled())
+        Detail::add(counter, value);
+}
+
+//-----------------------------------------------------------------------------
+// Attributes the time spent in a scope to a stage of the calling thread.
+// Timers nest: while an inner timer runs, the enclosing one is paused, so that
+// each stage gets its own (exclusive) time and the stages add up to the time
+// spent inside timers.
+//-----------------------------------------------------------------------------
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(EStage stage) : bActive(is_enabled())
+    {
+        if (bActive)
+            start(stage);
+    }
+
+    ~ScopedTimer()
+    {
+        if (bActive)
+            stop();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    void start(EStage stage);
+    void stop();
+
+    const bool bActive;
+    EStage parentStage = EStage::Count;
+};
+
+//-----------------------------------------------------------------------------
+// Records the latency and counters (in/out bytes, samples) of the conversion
+// of one input file, processed by the calling thread, for the final report.
+//-----------------------------------------------------------------------------
+class FileScope
+{
+public:
+    explicit FileScope(const std::string& in_path);
+    ~FileScope();
+
+    FileScope(const FileScope&) = delete;
+    FileScope& operator=(const FileScope&) = delete;
+
+    // Also attributes the hardware counters (-counters) of the thread to this format
+    void set_format(const char* in_format);
+
+private:
+    const bool bActive;
+    std::string path;
+    const char* format = "unknown";
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t startCounters[(size_t)ECounter::Count] = {};
+};
+
+// Builds the JSON report: per-thread stage times and counters, per-format
+// throughput and latency percentiles, slowest files
+std::string build_report();
+
+} // namespace Stats
@@ -0,0 +1,157 @@
+#include "synth.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "midifile/include/MidiFile.h"
+
+namespace Synth {
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+struct Tone
+{
+    double phase = 0.0;
+    double frequency = 0.0;
+    double amplitude = 0.0;
+    double decay = 1.0;
+};
+
+} // namespace
+
+std::vector<int16_t> generate_signal(size_t numFrames, uint16_t numChannels, uint32_t sampleRate, uint64_t seed)
+{
+    Random random(seed);
+    std::vector<int16_t> samples(numFrames * numChannels);
+
+    constexpr int kNumTones = 4;
+    Tone tones[kNumTones];
+    const size_t noteLength = std::max<size_t>(sampleRate / 4, 1);
+
+    for (size_t frame = 0; frame < numFrames; frame++)
+    {
+        // New notes every quarter of a second, with short silences in between
+        if (frame % noteLength == 0)
+        {
+            const bool bSilence = random.range(0, 7) == 0;
+            for (auto& tone : tones)
+            {
+                tone.frequency = 55.0 * std::pow(2.0, random.range(0, 60) / 12.0);
+                tone.amplitude = bSilence ? 0.0 : 1500.0 + random.range(0, 6000);
+                tone.decay = 1.0 - 1.0 / (0.2 * sampleRate + random.range(0, sampleRate));
+            }
+        }
+
+        double mix = 0.0;
+        for (auto& tone : tones)
+        {
+            mix += tone.amplitude * std::sin(tone.phase);
+            tone.phase += 2.0 * kPi * tone.frequency / sampleRate;
+            if (tone.phase > 2.0 * kPi)
+                tone.phase -= 2.0 * kPi;
+            tone.amplitude *= tone.decay;
+        }
+
+        for (uint16_t c = 0; c < numChannels; c++)
+        {
+            double value = mix * (1.0 - 0.2 * c) + (random.uniform() - 0.5) * 200.0;
+
+            // Rare transients
+            if (random.range(0, 4095) == 0)
+                value = random.range(0, 1) ? 32767.0 : -32768.0;
+
+            samples[frame * numChannels + c] = (int16_t)std::max(-32768.0, std::min(32767.0, value));
+        }
+    }
+    return samples;
+}
+
+std::vector<uint8_t> encode_wvsm(const int16_t* pSamples, size_t numSamples, size_t blockSize)
+{
+    std::vector<uint8_t> stream;
+    const size_t samplesPerBlock = blockSize / 2;
+
+    for (size_t blockStart = 0; blockStart < numSamples; blockStart += samplesPerBlock)
+    {
+        const size_t blockSamples = std::min(samplesPerBlock, numSamples - blockStart);
+        const int16_t* pBlock = pSamples + blockStart;
+
+        // One expander per interleaved channel, from its mean level: louder samples get escaped.
+        // Limited to 7, the expander byte is read as a signed char.
+        int expanders[2] = {};
+        for (int parity = 0; parity < 2; parity++)
+        {
+            uint64_t sum = 0, count = 0;
+            for (size_t i = parity; i < blockSamples; i += 2, count++)
+                sum += (uint64_t)std::abs((int)pBlock[i]);
+            const int level = count ? (int)(4 * sum / count) : 0;
+            while (expanders[parity] < 7 && (level >> expanders[parity]) > 127)
+                expanders[parity]++;
+        }
+
+        const size_t sizeOffset = stream.size();
+        stream.push_back(0);
+        stream.push_back(0);
+        stream.push_back((uint8_t)((expanders[0] << 4) | expanders[1]));
+
+        for (size_t i = 0; i < blockSamples; i++)
+        {
+            const int expander = expanders[i & 1];
+            const int value = pBlock[i] >> expander;
+            if (value < -127 || value > 127)
+            {
+                stream.push_back(0x80);
+                stream.push_back((uint8_t)((uint16_t)pBlock[i] >> 8)); // big endian
+                stream.push_back((uint8_t)pBlock[i]);
+            }
+            else
+            {
+                stream.push_back((uint8_t)(int8_t)value);
+            }
+        }
+
+        // Big endian compressed size of the block
+        const size_t compressedSize = stream.size() - sizeOffset - 2;
+        stream[sizeOffset] = (uint8_t)(compressedSize >> 8);
+        stream[sizeOffset + 1] = (uint8_t)compressedSize;
+    }
+    return stream;
+}
+
+std::vector<uint8_t> generate_midi(int numNotes, int channel, const std::string& sequenceName, const std::string& trackName, uint64_t seed)
+{
+    Random random(seed);
+
+    constexpr int kTicksPerQuarter = 480;
+    smf::MidiFile midiFile;
+    midiFile.setTPQ(kTicksPerQuarter);
+    midiFile.addTracks(1);
+    midiFile.addTrackName(0, 0, sequenceName);
+    midiFile.addTempo(0, 0, 90.0 + random.range(0, 60));
+    midiFile.addTrackName(1, 0, trackName);
+
+    int tick = 0;
+    for (int n = 0; n < numNotes; n++)
+    {
+        const int key = random.range(36, 96);
+        const int velocity = random.range(40, 127);
+        const int length = kTicksPerQuarter / 4 * random.range(1, 8);
+
+        midiFile.addNoteOn(1, tick, channel, key, velocity);
+        if (random.range(0, 15) == 0)
+            midiFile.addPitchBend(1, tick + length / 2, channel, random.uniform() * 2.0 - 1.0);
+        midiFile.addNoteOff(1, tick + length, channel, key);
+        tick += length;
+    }
+    midiFile.sortTracks();
+
+    std::stringstream ss;
+    midiFile.write(ss);
+    const std::string data = ss.str();
+    return std::vector<uint8_t>(data.begin(), data.end());
+}
+
+} // namespace Synth
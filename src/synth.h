@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Synth {
+
+//-----------------------------------------------------------------------------
+// Deterministic generators of synthetic test data (signals, encoded streams,
+// MIDI sequences), so that benchmarks and tests are reproducible from a seed
+// without shipping game data.
+//-----------------------------------------------------------------------------
+
+// xorshift64* generator: same sequence on every platform for a given seed
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint32_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (uint32_t)((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // Integer in [minValue, maxValue]
+    int range(int minValue, int maxValue) { return minValue + (int)(next() % (uint32_t)(maxValue - minValue + 1)); }
+
+    // Real in [0, 1)
+    double uniform() { return next() / 4294967296.0; }
+
+private:
+    uint64_t state;
+};
+
+// Music-like interleaved 16-bit signal: decaying tones, noise, silences and
+// occasional full-scale transients (which exercise the escape paths of the codecs)
+std::vector<int16_t> generate_signal(size_t numFrames, uint16_t numChannels, uint32_t sampleRate, uint64_t seed);
+
+// WVSM stream (as read by IndyWV::wvsmInflateBlock, blockSize output bytes per block) of 16-bit samples.
+// Lossy: samples are stored as 8-bit values scaled per block, out of range samples are escaped.
+std::vector<uint8_t> encode_wvsm(const int16_t* pSamples, size_t numSamples, size_t blockSize = 4096);
+
+// Standard MIDI file: a tempo/name track (named sequenceName) and a note track on one channel
+std::vector<uint8_t> generate_midi(int numNotes, int channel, const std::string& sequenceName, const std::string& trackName, uint64_t seed);
+
+} // namespace Synth
@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+namespace Trace {
+
+namespace Detail {
+    std::atomic<bool> bEnabled(false);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event
+{
+    const char* category;
+    char name[Span::kMaxNameLength + 1];
+    int64_t id;
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+// Single producer (the owner thread): events are published by the release
+// store of numWritten, the oldest ones are overwritten once the ring is full
+struct ThreadBuffer
+{
+    explicit ThreadBuffer(size_t capacity) : events(capacity) {}
+
+    std::vector<Event> events;
+    std::atomic<uint64_t> numWritten{ 0 };
+    std::string threadName;
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads; // kept after their thread exits
+    size_t eventsPerThread = kDefaultEventsPerThread;
+    Clock::time_point startTime;
+};
+
+Registry& get_registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+ThreadBuffer& get_thread_buffer()
+{
+    thread_local ThreadBuffer* pBuffer = nullptr;
+    if (!pBuffer)
+    {
+        Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(std::make_unique<ThreadBuffer>(registry.eventsPerThread));
+        pBuffer = registry.threads.back().get();
+    }
+    return *pBuffer;
+}
+
+uint64_t get_time_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - get_registry().startTime).count();
+}
+
+} // namespace
+
+void enable(size_t eventsPerThread)
+{
+    Registry& registry = get_registry();
+    registry.eventsPerThread = std::max<size_t>(eventsPerThread, 1);
+    registry.startTime = Clock::now();
+    Detail::bEnabled.store(true);
+}
+
+void set_thread_name(const char* name)
+{
+    if (is_enabled())
+        get_thread_buffer().threadName = name;
+}
+
+void Span::begin(const char* in_category, const std::string& in_name, int64_t in_id)
+{
+    category = in_category;
+    id = in_id;
+
+    // Keeps the end of long names (file names of long paths)
+    const size_t length = std::min(in_name.size(), kMaxNameLength);
+    memcpy(name, in_name.data() + in_name.size() - length, length);
+    name[length] = 0;
+
+    startNs = get_time_ns();
+}
+
+void Span::end()
+{
+    ThreadBuffer& buffer = get_thread_buffer();
+
+    const uint64_t index = buffer.numWritten.load(std::memory_order_relaxed);
+    Event& event = buffer.events[index % buffer.events.size()];
+    event.category = category;
+    memcpy(event.name, name, sizeof(name));
+    event.id = id;
+    event.startNs = startNs;
+    event.durationNs = get_time_ns() - startNs;
+
+    buffer.numWritten.store(index + 1, std::memory_order_release);
+}
+
+std::string build_json()
+{
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool bFirst = true;
+    auto add_event = [&](const std::string& event)
+    {
+        json += (bFirst ? "" : ",\n") + event;
+        bFirst = false;
+    };
+
+    size_t numDropped = 0;
+    {
+        Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        for (size_t tid = 0; tid < registry.threads.size(); tid++)
+        {
+            const ThreadBuffer& buffer = *registry.threads[tid];
+            if (!buffer.threadName.empty())
+            {
+                add_event(Utils::str_format("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                    tid, Utils::escape_json(buffer.threadName).c_str()));
+            }
+
+            const uint64_t numWritten = buffer.numWritten.load(std::memory_order_acquire);
+            const uint64_t numKept = std::min<uint64_t>(numWritten, buffer.events.size());
+            numDropped += (size_t)(numWritten - numKept);
+
+            for (uint64_t i = numWritten - numKept; i < numWritten; i++)
+            {
+                const Event& event = buffer.events[i % buffer.events.size()];
+                std::string args = (event.id >= 0) ? Utils::str_format(",\"args\":{\"id\":%lld}", (long long)event.id) : std::string();
+                add_event(Utils::str_format("{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f%s}",
+                    event.category, Utils::escape_json(event.name).c_str(), tid, event.startNs / 1000.0, event.durationNs / 1000.0, args.c_str()));
+            }
+        }
+    }
+    json += "\n]}\n";
+
+    if (numDropped > 0)
+        std::cerr << "Trace: the " << numDropped << " oldest span(s) were overwritten, the ring buffers were full\n";
+
+    return json;
+}
+
+} // namespace Trace
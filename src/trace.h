@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Trace {
+
+namespace Detail {
+    extern std::atomic<bool> bEnabled;
+}
+
+constexpr size_t kDefaultEventsPerThread = 1 << 16;
+
+// Spans are only recorded once enabled (-trace); until then a span costs a flag test.
+// Each thread keeps its last eventsPerThread spans. The switch and the buffers are
+// process-wide (every user of the codecs library records into them): to be enabled
+// once by the application, before its threads start.
+void enable(size_t eventsPerThread = kDefaultEventsPerThread);
+inline bool is_enabled() { return Detail::bEnabled.load(std::memory_order_relaxed); }
+
+// Name of the calling thread in the timeline
+void set_thread_name(const char* name);
+
+//-----------------------------------------------------------------------------
+// Records the time spent in a scope on the calling thread, as a complete
+// event of the timeline. Events go to a fixed-size ring buffer owned by the
+// thread: no lock and no allocation once the buffer exists. The category must
+// be a string literal; names are truncated to kMaxNameLength.
+//-----------------------------------------------------------------------------
+class Span
+{
+public:
+    static constexpr size_t kMaxNameLength = 55;
+
+    // id: optional index shown with the event (e.g. entry number), -1 if none
+    Span(const char* category, const std::string& name, int64_t id = -1)
+        : bActive(is_enabled())
+    {
+        if (bActive)
+            begin(category, name, id);
+    }
+
+    ~Span()
+    {
+        if (bActive)
+            end();
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    void begin(const char* category, const std::string& name, int64_t id);
+    void end();
+
+    const bool bActive;
+    const char* category = nullptr;
+    char name[kMaxNameLength + 1];
+    int64_t id = -1;
+    uint64_t startNs = 0;
+};
+
+// Builds the recorded spans of all threads in Chrome trace-event format (JSON),
+// to be opened with Perfetto or chrome://tracing
+std::string build_json();
+
+} // namespace Trace
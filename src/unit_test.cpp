@@ -1,45 +1,339 @@
 #include "unit_test.h"
 
-#include "indywv.h"
-#include "wave.h"
+#include "utils.h"
 
-#include <vector>
-#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace UnitTest {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr char kGoldenHeader[] = "# misc_audio_converter golden hashes v1";
+constexpr char kOptionsPrefix[] = "# options\t";
+constexpr char kNoOutput[] = "-";
+
+struct Output
+{
+    std::string name;   // relative to the output folder, / separated
+    uint64_t size = 0;
+    uint64_t hash = 0;
+};
+
+struct Case
+{
+    std::string input;  // relative to the test folder, / separated
+    std::vector<Output> expected;
+    std::vector<Output> actual;
+    bool bConverted = false;
+    double milliseconds = 0;
+    std::vector<std::string> errors;
+};
 
-#include <cstdlib>
+std::string to_generic(std::string path)
+{
+    std::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
 
-void UnitTest::unit_test(const std::string& testName, const std::string& in_leftFilePath, const std::string& in_rightFilePath)
+//-----------------------------------------------------------------------------
+// Keeps the size and hash of the outputs of a conversion instead of writing
+// them.
+//-----------------------------------------------------------------------------
+class HashingStore : public Utils::FileStore
 {
-    auto bSuccess = [&]()
+public:
+    explicit HashingStore(const std::string& outFolder)
+        : prefix(to_generic(outFolder))
     {
-        std::ifstream fileA(in_leftFilePath, std::ios::in | std::ios::binary | std::ifstream::ate);
-        std::ifstream fileB(in_rightFilePath, std::ios::in | std::ios::binary | std::ifstream::ate);
+        while (!prefix.empty() && prefix.back() == '/')
+            prefix.pop_back();
+    }
 
-        if (fileA.fail() || fileB.fail())
-            return false;
+    bool store(const std::string& path, std::vector<char>&& data) override
+    {
+        Output output;
+        output.name = to_generic(path);
+        if (output.name.compare(0, prefix.size(), prefix) == 0)
+            output.name.erase(0, prefix.size());
+        while (!output.name.empty() && output.name.front() == '/')
+            output.name.erase(0, 1);
+        output.size = data.size();
+        output.hash = Utils::hash64(data.data(), data.size());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        outputs.push_back(std::move(output));
+        return true;
+    }
+
+    std::vector<Output> take_outputs()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::sort(outputs.begin(), outputs.end(), [](const Output& a, const Output& b) { return a.name < b.name; });
+        return std::move(outputs);
+    }
+
+private:
+    std::string prefix;
+    std::mutex mutex;
+    std::vector<Output> outputs;
+};
 
-        if (fileA.tellg() != fileB.tellg())
+bool load_golden(const std::string& path, std::vector<Case>& outCases, std::string& outOptionsKey)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open golden manifest " << path << " (create it with -update_golden)\n";
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != kGoldenHeader)
+    {
+        std::cerr << path << " is not a golden manifest\n";
+        return false;
+    }
+
+    for (; std::getline(file, line);)
+    {
+        if (line.compare(0, sizeof(kOptionsPrefix) - 1, kOptionsPrefix) == 0)
+        {
+            outOptionsKey = line.substr(sizeof(kOptionsPrefix) - 1);
+            continue;
+        }
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        for (std::string field; std::getline(ss, field, '\t');)
+            fields.push_back(field);
+        if (fields.size() < 4)
+        {
+            std::cerr << "Invalid golden manifest line: " << line << "\n";
             return false;
+        }
+
+        if (outCases.empty() || outCases.back().input != fields[0])
+        {
+            outCases.emplace_back();
+            outCases.back().input = fields[0];
+        }
+        if (fields[1] == kNoOutput)
+            continue;
+
+        Output output;
+        output.name = fields[1];
+        output.size = std::strtoull(fields[2].c_str(), nullptr, 10);
+        output.hash = std::strtoull(fields[3].c_str(), nullptr, 16);
+        outCases.back().expected.push_back(output);
+    }
+
+    for (auto& testCase : outCases)
+        std::sort(testCase.expected.begin(), testCase.expected.end(), [](const Output& a, const Output& b) { return a.name < b.name; });
+    return true;
+}
+
+bool save_golden(const std::string& path, const std::vector<Case>& cases, const std::string& optionsKey)
+{
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not write golden manifest " << path << "\n";
+        return false;
+    }
+
+    file << kGoldenHeader << "\n" << kOptionsPrefix << optionsKey << "\n";
+    for (const auto& testCase : cases)
+    {
+        if (testCase.actual.empty())
+            file << testCase.input << "\t" << kNoOutput << "\t0\t0\n";
 
-        fileA.seekg(0, std::ifstream::beg);
-        fileB.seekg(0, std::ifstream::beg);
-        auto bAreEqual = std::equal(std::istreambuf_iterator<char>(fileA.rdbuf()),
-            std::istreambuf_iterator<char>(),
-            std::istreambuf_iterator<char>(fileB.rdbuf()));
+        for (const auto& output : testCase.actual)
+        {
+            file << Utils::str_format("%s\t%s\t%llu\t%016llx\n", testCase.input.c_str(), output.name.c_str(),
+                (unsigned long long)output.size, (unsigned long long)output.hash);
+        }
+    }
+    return file.good();
+}
+
+// All the inputs of the folder tree, sorted
+std::vector<Case> find_inputs(const std::string& folder, const IsInputFunction& isInput)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<Case> cases;
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(folder, error); !error && it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        if (it->is_directory() && it->path().filename().string().compare(0, 1, "_") == 0)
+        {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file() || !isInput(it->path().string()))
+            continue;
+
+        cases.emplace_back();
+        cases.back().input = fs::relative(it->path(), folder).generic_string();
+    }
+
+    std::sort(cases.begin(), cases.end(), [](const Case& a, const Case& b) { return a.input < b.input; });
+    return cases;
+}
+
+void compare_outputs(Case& testCase)
+{
+    auto expected = testCase.expected.begin();
+    auto actual = testCase.actual.begin();
+    while (expected != testCase.expected.end() || actual != testCase.actual.end())
+    {
+        if (actual == testCase.actual.end() || (expected != testCase.expected.end() && expected->name < actual->name))
+        {
+            testCase.errors.push_back("missing output " + expected->name);
+            ++expected;
+        }
+        else if (expected == testCase.expected.end() || actual->name < expected->name)
+        {
+            testCase.errors.push_back("unexpected output " + actual->name);
+            ++actual;
+        }
+        else
+        {
+            if (expected->size != actual->size)
+            {
+                testCase.errors.push_back(Utils::str_format("%s: %llu bytes, expected %llu", actual->name.c_str(),
+                    (unsigned long long)actual->size, (unsigned long long)expected->size));
+            }
+            else if (expected->hash != actual->hash)
+            {
+                testCase.errors.push_back(Utils::str_format("%s: content differs (hash %016llx, expected %016llx)", actual->name.c_str(),
+                    (unsigned long long)actual->hash, (unsigned long long)expected->hash));
+            }
+            ++expected;
+            ++actual;
+        }
+    }
+}
 
-        return bAreEqual;
-    }();
+} // namespace
 
-    std::cout << "Unit Test: " << testName << "...";
+bool run(const Options& options, const ConvertFunction& convert, const IsInputFunction& isInput)
+{
+    namespace fs = std::filesystem;
+
+    if (!fs::is_directory(options.folder))
+    {
+        std::cerr << "Test folder " << options.folder << " not found\n";
+        return false;
+    }
+    const std::string goldenPath = options.goldenPath.empty() ? (fs::path(options.folder) / kGoldenFileName).string() : options.goldenPath;
 
-    if (bSuccess)
-        std::cout << "Success!\n";
+    std::vector<Case> cases;
+    if (options.bUpdate)
+    {
+        cases = find_inputs(options.folder, isInput);
+    }
     else
     {
-        std::cerr << "Failed!\n";
-#ifdef _DEBUG
-        assert(bSuccess && "Unit test failed!");
-#endif
+        std::string goldenOptionsKey;
+        if (!load_golden(goldenPath, cases, goldenOptionsKey))
+            return false;
+        if (goldenOptionsKey != options.optionsKey)
+        {
+            std::cerr << "The golden hashes were recorded with options \"" << goldenOptionsKey << "\", not \"" << options.optionsKey << "\"\n";
+            return false;
+        }
     }
-}
\ No newline at end of file
+
+    if (cases.empty())
+    {
+        std::cerr << "No test case in " << options.folder << "\n";
+        return false;
+    }
+
+    // Outputs are named as if written to an existing folder (so that single files keep their
+    // name), but they only go to the hashing store
+    const std::string outFolder = fs::temp_directory_path().string();
+
+    const auto start = Clock::now();
+    std::atomic<size_t> nextCase(0);
+    auto worker = [&]()
+    {
+        for (size_t i = nextCase++; i < cases.size(); i = nextCase++)
+        {
+            Case& testCase = cases[i];
+            HashingStore store(outFolder);
+
+            const auto caseStart = Clock::now();
+            testCase.bConverted = convert((fs::path(options.folder) / testCase.input).string(), outFolder, &store);
+            testCase.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - caseStart).count();
+            testCase.actual = store.take_outputs();
+
+            if (!testCase.bConverted)
+                testCase.errors.push_back("conversion failed");
+            else if (!options.bUpdate)
+                compare_outputs(testCase);
+        }
+    };
+
+    const unsigned int numThreads = (unsigned int)std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), cases.size());
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < numThreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t numFailed = 0, numOutputs = 0;
+    double caseSeconds = 0;
+    for (const auto& testCase : cases)
+    {
+        numOutputs += testCase.actual.size();
+        caseSeconds += testCase.milliseconds / 1000.0;
+
+        const std::string timing = Utils::str_format(" (%.1f ms, %zu output(s))\n", testCase.milliseconds, testCase.actual.size());
+        if (testCase.errors.empty())
+        {
+            std::cout << "Unit Test: " << testCase.input << "...Success!" << timing;
+        }
+        else
+        {
+            numFailed++;
+            std::cerr << "Unit Test: " << testCase.input << "...Failed!" << timing;
+            for (const auto& error : testCase.errors)
+                std::cerr << "    " << error << "\n";
+        }
+    }
+
+    std::cout << Utils::str_format("%zu case(s), %zu failed, %zu output(s) in %.2f s (%.2f s of conversions on %u thread(s))\n",
+        cases.size(), numFailed, numOutputs, seconds, caseSeconds, numThreads);
+
+    if (!options.bUpdate)
+        return numFailed == 0;
+
+    if (numFailed > 0)
+    {
+        std::cerr << "Golden manifest not updated: some conversions failed\n";
+        return false;
+    }
+    if (!save_golden(goldenPath, cases, options.optionsKey))
+        return false;
+    std::cout << "Golden hashes written to " << goldenPath << "\n";
+    return true;
+}
+
+} // namespace UnitTest
@@ -1,9 +1,37 @@
 #pragma once
 
+#include <functional>
 #include <string>
 
-class UnitTest
+namespace Utils { class FileStore; }
+
+namespace UnitTest {
+
+//-----------------------------------------------------------------------------
+// Regression run over a folder of test files (-unit_test <Folder>). Each input
+// listed in the golden manifest (golden.txt in the folder) is converted into
+// memory, with cases running in parallel on all cores. The size and content
+// hash of every output must match the recorded ones; nothing is written to
+// disk. -update_golden converts all the inputs of the folder tree instead and
+// rewrites the manifest from the results. Folders starting with _ (such as the
+// scratch output of -macro_bench) are skipped.
+//-----------------------------------------------------------------------------
+
+// Converts inputPath with its outputs named as if written to outFolder, handing them to pStore
+using ConvertFunction = std::function<bool(const std::string& inputPath, const std::string& outFolder, Utils::FileStore* pStore)>;
+using IsInputFunction = std::function<bool(const std::string& path)>;
+
+constexpr char kGoldenFileName[] = "golden.txt";
+
+struct Options
 {
-public:
-	static void unit_test(const std::string& testName, const std::string& in_leftFilePath, const std::string& in_rightFilePath);
+    std::string folder;
+    std::string goldenPath;   // <folder>/golden.txt if empty
+    std::string optionsKey;   // conversion options, recorded in the manifest: hashes only compare with the same ones
+    bool bUpdate = false;
 };
+
+// Returns whether all the cases match their golden hashes (or, with bUpdate, whether the manifest was written)
+bool run(const Options& options, const ConvertFunction& convert, const IsInputFunction& isInput);
+
+} // namespace UnitTest
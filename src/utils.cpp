@@ -1,16 +1,13 @@
 #include "utils.h"
 
 #include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "stats.h"
 
 namespace Utils
 {
-    void peekChar(std::ifstream& stream, char* data, size_t size)
-    {
-        auto pos = stream.tellg();
-        stream.read(data, size);
-        stream.seekg(pos, std::ios::beg);
-    }
-
     uint16_t swap16(uint16_t x)
     {
         uint16_t hi = (x & 0xff00) >> 8;
@@ -33,4 +30,215 @@ namespace Utils
         return retStr;
     }
 
+    std::string escape_json(const std::string& str)
+    {
+        std::string escaped;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                escaped += str_format("\\u%04x", (unsigned)c);
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    uint64_t hash64(const void* pData, size_t size)
+    {
+        // 8 bytes per step: xor-multiply, with a final avalanche
+        constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+        const uint8_t* p = static_cast<const uint8_t*>(pData);
+        uint64_t hash = 0xCBF29CE484222325ull ^ (size * kMultiplier);
+
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            hash = (hash ^ word) * kMultiplier;
+            hash ^= hash >> 29;
+        }
+
+        uint64_t tail = 0;
+        memcpy(&tail, p + i, size - i);
+        hash = (hash ^ tail) * kMultiplier;
+
+        hash ^= hash >> 32;
+        hash *= 0xD6E8FEB86659FD93ull;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    void OutputFile::AlignedDelete::operator()(char* p) const
+    {
+        ::operator delete[](p, std::align_val_t(kBufferAlignment));
+    }
+
+    bool store_file(const std::string& path, const void* pData, size_t size, FileStore* pStore)
+    {
+        if (!pStore)
+            return false;
+
+        Stats::ScopedTimer timer(Stats::EStage::Write);
+        Stats::add(Stats::ECounter::BytesOut, size);
+
+        const char* pBytes = static_cast<const char*>(pData);
+        return pStore->store(path, std::vector<char>(pBytes, pBytes + size));
+    }
+
+    bool OutputFile::open(const std::string& path, FileStore* in_pStore)
+    {
+        close();
+
+        filePos = 0;
+        bufferUsed = 0;
+        bStreamFailed = false;
+
+        if (!in_pStore)
+            return false;
+
+        stream = in_pStore->open_stream(path);
+        if (stream)
+            return true;
+
+        pStore = in_pStore;
+        storePath = path;
+        memory.clear();
+        memoryUsed = 0;
+        return true;
+    }
+
+    bool OutputFile::close()
+    {
+        Stats::ScopedTimer timer(Stats::EStage::Write);
+
+        if (pStore)
+        {
+            Stats::add(Stats::ECounter::BytesOut, memoryUsed);
+            FileStore* pTarget = pStore;
+            pStore = nullptr;
+            memory.resize(memoryUsed);
+            return pTarget->store(storePath, std::move(memory));
+        }
+
+        if (!stream)
+            return false;
+
+        bool bSuccess = flush();
+        Stats::add(Stats::ECounter::BytesOut, filePos);
+        bSuccess &= stream->close();
+        stream.reset();
+        return bSuccess;
+    }
+
+    bool OutputFile::flush()
+    {
+        if (!stream)
+        {
+            bufferUsed = 0; // nowhere to write to
+            return false;
+        }
+
+        if (bufferUsed > 0)
+        {
+            Stats::ScopedTimer timer(Stats::EStage::Write);
+            bStreamFailed |= !stream->write(buffer.get(), bufferUsed);
+            filePos += bufferUsed;
+            bufferUsed = 0;
+        }
+        return !bStreamFailed;
+    }
+
+    char* OutputFile::reserve(size_t size)
+    {
+        if (pStore)
+        {
+            if (memory.size() < memoryUsed + size)
+                memory.resize(std::max(memoryUsed + size, memory.size() * 2));
+            return memory.data() + memoryUsed;
+        }
+
+        if (bufferUsed + size > bufferCapacity)
+        {
+            flush();
+
+            if (size > bufferCapacity)
+            {
+                size_t capacity = std::max(kBufferSize, (size + kBufferAlignment - 1) & ~(kBufferAlignment - 1));
+                buffer.reset(static_cast<char*>(::operator new[](capacity, std::align_val_t(kBufferAlignment))));
+                bufferCapacity = capacity;
+            }
+        }
+        return buffer.get() + bufferUsed;
+    }
+
+    void OutputFile::commit(size_t size)
+    {
+        if (pStore)
+        {
+            memoryUsed += size;
+            return;
+        }
+
+        bufferUsed += size;
+    }
+
+    void OutputFile::write(const void* pData, size_t size)
+    {
+        if (pStore)
+        {
+            memcpy(reserve(size), pData, size);
+            memoryUsed += size;
+            return;
+        }
+
+        // Large writes go straight to the file
+        if (size >= kBufferSize)
+        {
+            if (!flush())
+                return;
+            Stats::ScopedTimer timer(Stats::EStage::Write);
+            bStreamFailed |= !stream->write(pData, size);
+            filePos += size;
+            return;
+        }
+
+        memcpy(reserve(size), pData, size);
+        commit(size);
+    }
+
+    bool OutputFile::write_at(uint64_t offset, const void* pData, size_t size)
+    {
+        if (offset + size > tell())
+            return false;
+
+        if (pStore)
+        {
+            memcpy(memory.data() + offset, pData, size);
+            return true;
+        }
+
+        // Still in the buffer: patch it in place
+        if (offset >= filePos)
+        {
+            memcpy(buffer.get() + (offset - filePos), pData, size);
+            return true;
+        }
+
+        if (!flush())
+            return false;
+
+        return stream->write_at(offset, pData, size);
+    }
+
+
 } // namespace Utils
@@ -1,7 +1,11 @@
 #pragma once
 
-#include <fstream>
-#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace Utils
 {
@@ -14,24 +18,114 @@ namespace Utils
         return std::max(lower, std::min(val, upper));
     }
 
-    void peekChar(std::ifstream& stream, char* data, size_t size);
-
     std::string str_to_lower(const std::string& inputStr);
 
+    // Escapes a string for a JSON string literal (quotes, backslashes, control characters)
+    std::string escape_json(const std::string& str);
+
+    // Reads a value from memory: reads past the end return 0
     template<typename T>
-    T readBytes(std::ifstream& stream)
+    T readBytes(const uint8_t*& pData, const uint8_t* pDataEnd)
     {
-        T a;
-        stream.read((char*)&a, sizeof(T));
+        T a = 0;
+        if (pData + sizeof(T) <= pDataEnd)
+        {
+            memcpy(&a, pData, sizeof(T));
+            pData += sizeof(T);
+        }
+        else
+        {
+            pData = pDataEnd;
+        }
         return a;
     }
 
-    template<typename T>
-    auto writeInt(std::ostream& os, T val)
+    // Output file written progressively, in order, with patches of bytes already written
+    class OutputStream
     {
-        os.write(reinterpret_cast<const char*>(&val), sizeof(val));
+    public:
+        virtual ~OutputStream() = default;
+        virtual bool write(const void* pData, size_t size) = 0;
+        virtual bool write_at(uint64_t offset, const void* pData, size_t size) = 0;
+        virtual bool close() = 0;
     };
 
+    // Destination of output files (e.g. entries of an archive). Whole files produced in
+    // memory go through store(); files written progressively (OutputFile) ask for a
+    // stream first, and are built in memory then stored when there is none.
+    // Files written to disk in place (memory-mapped) ask allow_direct_write() first,
+    // which refuses when the store needs the data itself.
+    // All may be called from any thread.
+    class FileStore
+    {
+    public:
+        virtual ~FileStore() = default;
+        virtual bool store(const std::string& path, std::vector<char>&& data) = 0;
+        virtual std::unique_ptr<OutputStream> open_stream(const std::string&) { return nullptr; }
+        virtual bool allow_direct_write(const std::string&) { return false; }
+    };
+
+    // Fast non-cryptographic 64-bit hash of a memory block
+    uint64_t hash64(const void* pData, size_t size);
+
+    // Hands a whole file in memory to the store (fails without one)
+    bool store_file(const std::string& path, const void* pData, size_t size, FileStore* pStore);
+
+    // Binary output file with write coalescing: small writes are gathered in a large
+    // aligned buffer and handed over in big blocks to the stream the store opens for
+    // the file. Without a stream, the file is built in memory and handed to the store
+    // on close(). Opening fails without a store.
+    class OutputFile
+    {
+    public:
+        static constexpr size_t kBufferSize = 1 << 20;
+        static constexpr size_t kBufferAlignment = 4096;
+
+        OutputFile() = default;
+        ~OutputFile() { close(); }
+
+        OutputFile(const OutputFile&) = delete;
+        OutputFile& operator=(const OutputFile&) = delete;
+
+        bool open(const std::string& path, FileStore* in_pStore);
+        bool close();
+
+        bool is_open() const { return pStore || stream; }
+        uint64_t tell() const { return pStore ? memoryUsed : filePos + bufferUsed; }
+
+        // Returns a buffer of at least 'size' bytes to write into, valid until commit()
+        char* reserve(size_t size);
+        void commit(size_t size);
+        void write(const void* pData, size_t size);
+
+        // Overwrites bytes that were already written (e.g. to patch a header)
+        bool write_at(uint64_t offset, const void* pData, size_t size);
+
+    private:
+        struct AlignedDelete { void operator()(char* p) const; };
+
+        bool flush();
+
+        std::unique_ptr<OutputStream> stream;
+        bool bStreamFailed = false;
+        std::unique_ptr<char[], AlignedDelete> buffer;
+        size_t bufferCapacity = 0;
+        size_t bufferUsed = 0;
+        uint64_t filePos = 0;
+
+        // In-memory mode
+        FileStore* pStore = nullptr;
+        std::string storePath;
+        std::vector<char> memory;
+        size_t memoryUsed = 0;
+    };
+
+    template<typename T>
+    void writeInt(OutputFile& file, T val)
+    {
+        file.write(&val, sizeof(val));
+    }
+
     template<typename ... Args>
     std::string str_format(const std::string& format, Args ... args)
     {
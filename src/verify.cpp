@@ -0,0 +1,545 @@
+#include "verify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_dispatch.h"
+#include "cryo_apc.h"
+#include "indywv.h"
+#include "reference_kernels.h"
+#include "sample_convert.h"
+#include "synth.h"
+#include "utils.h"
+
+namespace Verify {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kCasesPerBatch = 256;
+constexpr size_t kWvsmBlockSize = 4096;
+
+// Different for every case, the same from one run to the next
+uint64_t get_case_seed(uint64_t seed, uint64_t caseIndex)
+{
+    return (seed * 0x9E3779B97F4A7C15ull) ^ (caseIndex * 0xBF58476D1CE4E5B9ull + 1);
+}
+
+// Mostly short inputs, where the stream and block boundaries are, sometimes long ones
+int get_random_size(Synth::Random& random)
+{
+    switch (random.range(0, 3))
+    {
+    case 0: return random.range(0, 8);
+    case 1: return random.range(0, 64);
+    case 2: return random.range(0, 1024);
+    default: return random.range(0, 8192);
+    }
+}
+
+// Step indexes at their bounds more often than not
+int get_random_index(Synth::Random& random)
+{
+    switch (random.range(0, 3))
+    {
+    case 0: return 0;
+    case 1: return 88;
+    default: return random.range(0, 88);
+    }
+}
+
+int16_t get_random_sample(Synth::Random& random)
+{
+    switch (random.range(0, 3))
+    {
+    case 0: return -32768;
+    case 1: return 32767;
+    case 2: return 0;
+    default: return (int16_t)random.next();
+    }
+}
+
+// Random bytes, with runs of patterns reaching the edge cases of ADPCM streams:
+// all ones (escape codes), zeros (step index falling to 0), large codes (index rising to 88)
+void fill_bytes(Synth::Random& random, uint8_t* pData, size_t size)
+{
+    static const uint8_t kPatterns[] = { 0xFF, 0x00, 0x77, 0x7F, 0x80, 0xF7 };
+
+    size_t i = 0;
+    while (i < size)
+    {
+        const size_t runLength = std::min<size_t>(size - i, random.range(1, 64));
+        const bool bPattern = random.range(0, 3) == 0;
+        const uint8_t pattern = kPatterns[random.range(0, sizeof(kPatterns) - 1)];
+        for (size_t j = 0; j < runLength; j++, i++)
+            pData[i] = bPattern ? pattern : (uint8_t)random.next();
+    }
+}
+
+// Signals reaching the edge cases of the encoder: full-scale noise and square waves
+// (escape codes, index at 88), silence (index at 0), ramps, music-like signal
+std::vector<int16_t> get_random_signal(Synth::Random& random, size_t numSamples)
+{
+    std::vector<int16_t> signal(numSamples);
+    switch (random.range(0, 4))
+    {
+    case 0:
+        for (auto& sample : signal)
+            sample = (int16_t)random.next();
+        break;
+    case 1:
+    {
+        const int period = random.range(1, 64);
+        for (size_t i = 0; i < numSamples; i++)
+            signal[i] = ((i / period) & 1) ? 32767 : -32768;
+        break;
+    }
+    case 2:
+        std::fill(signal.begin(), signal.end(), get_random_sample(random));
+        break;
+    case 3:
+    {
+        const int slope = random.range(-512, 512);
+        int value = get_random_sample(random);
+        for (auto& sample : signal)
+        {
+            sample = (int16_t)value;
+            value = Utils::clamp(value + slope, -32768, 32767);
+        }
+        break;
+    }
+    default:
+        signal = Synth::generate_signal(numSamples, 1, 22050, random.next());
+        break;
+    }
+    return signal;
+}
+
+// Index of the first differing element, or -1 if none
+template<typename T>
+int64_t find_first_difference(const std::vector<T>& expected, const std::vector<T>& actual)
+{
+    const auto found = std::mismatch(expected.begin(), expected.end(), actual.begin());
+    return (found.first == expected.end()) ? -1 : (int64_t)(found.first - expected.begin());
+}
+
+std::string describe_sample_difference(const std::vector<int16_t>& expected, const std::vector<int16_t>& actual, int64_t index, unsigned int numChannels)
+{
+    return Utils::str_format("sample %lld (frame %lld, channel %u): reference %d, kernel %d", (long long)index,
+        (long long)(index / numChannels), (unsigned)(index % numChannels), expected[index], actual[index]);
+}
+
+bool check_adpcm_decode(Synth::Random& random, IndyWV& codec, uint64_t& outNumSamples, std::string& outMismatch)
+{
+    const unsigned int numChannels = random.range(1, 2);
+    const int numSamples = get_random_size(random);
+
+    // Worst case: an escape code for every sample, and the decoder reads 2 bytes ahead
+    std::vector<uint8_t> input((size_t)numSamples * numChannels * 3 + 8);
+    fill_bytes(random, input.data(), input.size());
+
+    IndyWV::DecompressorState initialState;
+    for (int c = 0; c < 2; c++)
+    {
+        initialState.stepindex[c] = (int8_t)get_random_index(random);
+        initialState.keysample[c] = get_random_sample(random);
+    }
+
+    std::vector<int16_t> expected((size_t)numSamples * numChannels, 0), actual(expected.size(), 0);
+    std::vector<uint8_t> referenceInput = input;
+    IndyWV::DecompressorState referenceState = initialState, state = initialState;
+    Reference::decompressADPCM(&referenceState, (char*)expected.data(), (char*)referenceInput.data(), numSamples, numChannels);
+    codec.decompressADPCM(&state, (char*)actual.data(), (char*)input.data(), numSamples, numChannels);
+    outNumSamples += expected.size();
+
+    const std::string inputDescription = Utils::str_format("%u channel(s), %d sample(s) per channel, initial index %d/%d, key sample %d/%d",
+        numChannels, numSamples, initialState.stepindex[0], initialState.stepindex[1], initialState.keysample[0], initialState.keysample[1]);
+
+    const int64_t difference = find_first_difference(expected, actual);
+    if (difference >= 0)
+    {
+        outMismatch = describe_sample_difference(expected, actual, difference, numChannels) + "; " + inputDescription;
+        return false;
+    }
+    if (memcmp(&referenceState, &state, sizeof(state)) != 0)
+    {
+        outMismatch = "different final state; " + inputDescription;
+        return false;
+    }
+    return true;
+}
+
+bool check_adpcm_encode(Synth::Random& random, IndyWV& codec, uint64_t& outNumSamples, std::string& outMismatch)
+{
+    const unsigned int numChannels = random.range(1, 2);
+    const int numSamples = get_random_size(random);
+
+    // Each channel is read from the same stream, one sample apart
+    const std::vector<int16_t> signal = get_random_signal(random, numSamples + 1);
+
+    // The state of channel 1 partly lives in a second state structure
+    IndyWV::DecompressorState initialStates[2];
+    for (auto& initialState : initialStates)
+    {
+        for (int c = 0; c < 2; c++)
+        {
+            initialState.stepindex[c] = (int8_t)get_random_index(random);
+            initialState.keysample[c] = get_random_sample(random);
+        }
+    }
+
+    std::vector<uint8_t> expected((size_t)numSamples * numChannels * 3 + 16, 0), actual(expected.size(), 0);
+    IndyWV::DecompressorState referenceStates[2] = { initialStates[0], initialStates[1] };
+    IndyWV::DecompressorState states[2] = { initialStates[0], initialStates[1] };
+    const int expectedSize = Reference::compressADPCM(referenceStates, (char*)expected.data(), (const char*)signal.data(), numSamples, numChannels);
+    const int actualSize = codec.compressADPCM(states, (char*)actual.data(), (const char*)signal.data(), numSamples, numChannels);
+    outNumSamples += (uint64_t)numSamples * numChannels;
+
+    const std::string inputDescription = Utils::str_format("%u channel(s), %d sample(s) per channel, initial index %d, key sample %d",
+        numChannels, numSamples, initialStates[0].stepindex[0], initialStates[0].keysample[0]);
+
+    const int64_t difference = find_first_difference(expected, actual);
+    if (difference >= 0)
+    {
+        outMismatch = Utils::str_format("byte %lld: reference 0x%02x, kernel 0x%02x; ", (long long)difference, expected[difference], actual[difference]) + inputDescription;
+        return false;
+    }
+    if (expectedSize != actualSize)
+    {
+        outMismatch = Utils::str_format("size: reference %d, kernel %d; ", expectedSize, actualSize) + inputDescription;
+        return false;
+    }
+    if (memcmp(referenceStates, states, sizeof(states)) != 0)
+    {
+        outMismatch = "different final state; " + inputDescription;
+        return false;
+    }
+    return true;
+}
+
+bool check_wvsm_inflate(Synth::Random& random, IndyWV& codec, uint64_t& outNumSamples, std::string& outMismatch)
+{
+    // Full blocks, then possibly a partial one of any size (odd sizes included)
+    std::vector<size_t> blockSizes(random.range(0, 3), kWvsmBlockSize);
+    if (random.range(0, 1) == 0)
+        blockSizes.push_back(random.range(0, (int)kWvsmBlockSize));
+
+    std::vector<uint8_t> stream;
+    size_t numSamples = 0;
+    for (size_t blockSize : blockSizes)
+    {
+        const size_t blockSamples = blockSize / 2;
+        numSamples += blockSamples;
+
+        // Compressed size (ignored by the decoder), expanders: the left one is read as a signed char
+        stream.push_back((uint8_t)random.next());
+        stream.push_back((uint8_t)random.next());
+        stream.push_back((uint8_t)((random.range(0, 7) << 4) | random.range(0, 15)));
+
+        const int escapeRate = random.range(0, 8);
+        for (size_t i = 0; i < blockSamples; i++)
+        {
+            if (random.range(0, 15) < escapeRate)
+            {
+                stream.push_back(0x80);
+                stream.push_back((uint8_t)random.next());
+                stream.push_back((uint8_t)random.next());
+            }
+            else
+            {
+                stream.push_back((uint8_t)random.next());
+            }
+        }
+    }
+
+    // Truncated streams: the decoder reads zeros past the end
+    if (random.range(0, 3) == 0)
+        stream.resize(random.range(0, (int)stream.size()));
+
+    std::vector<int16_t> expected(numSamples, 0), actual(numSamples, 0);
+    const uint8_t* pReferenceData = stream.data();
+    const uint8_t* pData = stream.data();
+    const uint8_t* pDataEnd = stream.data() + stream.size();
+    size_t outOffset = 0;
+    for (size_t blockSize : blockSizes)
+    {
+        Reference::wvsmInflateBlock(pReferenceData, pDataEnd, blockSize, expected.data() + outOffset);
+        codec.wvsmInflateBlock(pData, pDataEnd, blockSize, actual.data() + outOffset);
+        outOffset += blockSize / 2;
+    }
+    outNumSamples += numSamples;
+
+    std::string inputDescription = Utils::str_format("%zu stream bytes, blocks of", stream.size());
+    for (size_t blockSize : blockSizes)
+        inputDescription += Utils::str_format(" %zu", blockSize);
+    inputDescription += " bytes";
+
+    const int64_t difference = find_first_difference(expected, actual);
+    if (difference >= 0)
+    {
+        outMismatch = describe_sample_difference(expected, actual, difference, 2) + "; " + inputDescription;
+        return false;
+    }
+    if (pReferenceData != pData)
+    {
+        outMismatch = Utils::str_format("stream position: reference %zu, kernel %zu; ", (size_t)(pReferenceData - stream.data()), (size_t)(pData - stream.data())) + inputDescription;
+        return false;
+    }
+    return true;
+}
+
+bool check_apc_decode(Synth::Random& random, IndyWV&, uint64_t& outNumSamples, std::string& outMismatch)
+{
+    const uint8_t numChannels = (uint8_t)random.range(1, 2);
+    std::vector<uint8_t> input(get_random_size(random));
+    fill_bytes(random, input.data(), input.size());
+
+    CryoAPC::ChannelState initialStates[2];
+    for (auto& initialState : initialStates)
+    {
+        initialState.index = get_random_index(random);
+        initialState.sample = get_random_sample(random);
+    }
+
+    std::vector<int16_t> expected(input.size() * 2, 0), actual(expected.size(), 0);
+    CryoAPC::ChannelState referenceStates[2] = { initialStates[0], initialStates[1] };
+    CryoAPC::ChannelState states[2] = { initialStates[0], initialStates[1] };
+    Reference::apcDecodeNibbles(input.data(), input.size(), expected.data(), numChannels, referenceStates);
+    CryoAPC::decode_nibbles(input.data(), input.size(), actual.data(), numChannels, states);
+    outNumSamples += expected.size();
+
+    const std::string inputDescription = Utils::str_format("%u channel(s), %zu input byte(s), initial index %d/%d, sample %d/%d", numChannels,
+        input.size(), initialStates[0].index, initialStates[1].index, initialStates[0].sample, initialStates[1].sample);
+
+    const int64_t difference = find_first_difference(expected, actual);
+    if (difference >= 0)
+    {
+        outMismatch = describe_sample_difference(expected, actual, difference, numChannels) + "; " + inputDescription;
+        return false;
+    }
+    if (memcmp(referenceStates, states, sizeof(states)) != 0)
+    {
+        outMismatch = "different final state; " + inputDescription;
+        return false;
+    }
+    return true;
+}
+
+// Floats reaching the edge cases of the conversions: clipping, rounding ties, signed zeros, NaN and infinities
+float get_random_float(Synth::Random& random)
+{
+    switch (random.range(0, 5))
+    {
+    case 0: return (random.range(-32768, 32767) + 0.5f) / 32768.0f;
+    case 1: return (float)(random.uniform() * 4.0 - 2.0);
+    case 2: return random.range(0, 1) ? 1.0f : -1.0f;
+    case 3: return random.range(0, 1) ? 0.0f : -0.0f;
+    case 4: return random.range(0, 2) == 0 ? std::numeric_limits<float>::quiet_NaN() : (random.range(0, 1) ? 1.0f : -1.0f) * std::numeric_limits<float>::infinity();
+    default: return (float)(random.uniform() * 2.0 - 1.0);
+    }
+}
+
+bool check_sample_convert(Synth::Random& random, IndyWV&, uint64_t& outNumSamples, std::string& outMismatch)
+{
+    // Odd sizes and unaligned buffers, for the vector loops and their tails
+    const size_t numSamples = get_random_size(random);
+    const size_t offset = random.range(0, 7);
+
+    std::vector<int16_t> s16(numSamples + offset);
+    std::vector<float> f32(numSamples + offset);
+    for (size_t i = 0; i < numSamples + offset; i++)
+    {
+        s16[i] = random.range(0, 1) ? get_random_sample(random) : (int16_t)random.next();
+        f32[i] = get_random_float(random);
+    }
+    const int16_t* pS16 = s16.data() + offset;
+    const float* pF32 = f32.data() + offset;
+    outNumSamples += numSamples * 4;
+
+    const std::string inputDescription = Utils::str_format("%zu sample(s), offset %zu", numSamples, offset);
+
+    // Floats compared bit for bit
+    std::vector<float> expectedF32(numSamples + 1), actualF32(numSamples + 1);
+    Reference::s16ToF32(pS16, expectedF32.data(), numSamples);
+    SampleConvert::s16_to_f32(pS16, actualF32.data() + 1, numSamples);
+    std::vector<uint32_t> expectedBits(numSamples), actualBits(numSamples);
+    memcpy(expectedBits.data(), expectedF32.data(), numSamples * sizeof(float));
+    memcpy(actualBits.data(), actualF32.data() + 1, numSamples * sizeof(float));
+    int64_t difference = find_first_difference(expectedBits, actualBits);
+    if (difference >= 0)
+    {
+        outMismatch = Utils::str_format("s16_to_f32, sample %lld (%d): reference %.9g, kernel %.9g; ", (long long)difference,
+            pS16[difference], expectedF32[difference], actualF32[difference + 1]) + inputDescription;
+        return false;
+    }
+
+    std::vector<int16_t> expectedS16(numSamples), actualS16(numSamples);
+    Reference::f32ToS16(pF32, expectedS16.data(), numSamples);
+    SampleConvert::f32_to_s16(pF32, actualS16.data(), numSamples);
+    difference = find_first_difference(expectedS16, actualS16);
+    if (difference >= 0)
+    {
+        outMismatch = Utils::str_format("f32_to_s16, sample %lld (%.9g): reference %d, kernel %d; ", (long long)difference,
+            pF32[difference], expectedS16[difference], actualS16[difference]) + inputDescription;
+        return false;
+    }
+
+    std::vector<uint8_t> expectedS24(numSamples * 3), actualS24(numSamples * 3);
+    Reference::s16ToS24(pS16, expectedS24.data(), numSamples);
+    SampleConvert::s16_to_s24(pS16, actualS24.data(), numSamples);
+    difference = find_first_difference(expectedS24, actualS24);
+    if (difference >= 0)
+    {
+        outMismatch = Utils::str_format("s16_to_s24, byte %lld (sample %d): reference 0x%02x, kernel 0x%02x; ", (long long)difference,
+            pS16[difference / 3], expectedS24[difference], actualS24[difference]) + inputDescription;
+        return false;
+    }
+
+    // Frames made of the same samples, channels compared one after the other
+    const size_t numFrames = numSamples / 2;
+    std::vector<int32_t> expectedChannels(numFrames * 2), actualChannels(numFrames * 2);
+    Reference::deinterleaveS16Stereo((const uint8_t*)pS16, expectedChannels.data(), expectedChannels.data() + numFrames, numFrames);
+    SampleConvert::deinterleave_s16_stereo(pS16, actualChannels.data(), actualChannels.data() + numFrames, numFrames);
+    difference = find_first_difference(expectedChannels, actualChannels);
+    if (difference >= 0)
+    {
+        outMismatch = Utils::str_format("deinterleave_s16_stereo, %s sample of frame %lld: reference %d, kernel %d; ", difference < (int64_t)numFrames ? "left" : "right",
+            (long long)(difference % numFrames), expectedChannels[difference], actualChannels[difference]) + inputDescription;
+        return false;
+    }
+    return true;
+}
+
+struct Kernel
+{
+    const char* name;
+    bool (*check)(Synth::Random& random, IndyWV& codec, uint64_t& outNumSamples, std::string& outMismatch);
+    bool bDispatched; // has variants per ISA (cpu_dispatch.h), each of them is checked
+};
+
+const Kernel kKernels[] = {
+    { "adpcm_decode", check_adpcm_decode, false },
+    { "adpcm_encode", check_adpcm_encode, false },
+    { "wvsm_inflate", check_wvsm_inflate, true },
+    { "apc_decode", check_apc_decode, false },
+    { "sample_convert", check_sample_convert, true },
+};
+
+// Runs the cases of a kernel on all cores; returns whether they all match
+bool run_kernel(const Kernel& kernel, const Options& options)
+{
+    const auto start = Clock::now();
+
+    // Cases are handed out by batches; cases after a known divergence are skipped,
+    // the ones before still run so that the first one is reported
+    std::atomic<uint64_t> nextCase(0);
+    std::atomic<uint64_t> firstMismatchCase(UINT64_MAX);
+    std::atomic<uint64_t> totalSamples(0);
+    std::mutex mutex;
+    std::string firstMismatch;
+
+    auto worker = [&]()
+    {
+        IndyWV codec;
+        uint64_t numSamples = 0;
+        for (uint64_t batch = nextCase.fetch_add(kCasesPerBatch); batch < options.numCases; batch = nextCase.fetch_add(kCasesPerBatch))
+        {
+            const uint64_t batchEnd = std::min(batch + kCasesPerBatch, options.numCases);
+            for (uint64_t i = batch; i < batchEnd && i < firstMismatchCase.load(std::memory_order_relaxed); i++)
+            {
+                Synth::Random random(get_case_seed(options.seed, i));
+                std::string mismatch;
+                if (kernel.check(random, codec, numSamples, mismatch))
+                    continue;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (i < firstMismatchCase.load())
+                {
+                    firstMismatchCase.store(i);
+                    firstMismatch = mismatch;
+                }
+            }
+        }
+        totalSamples += numSamples;
+    };
+
+    const unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < numThreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const std::string name = kernel.bDispatched ? Utils::str_format("%s (%s)", kernel.name, CpuDispatch::get_name(CpuDispatch::get_isa())) : kernel.name;
+    std::cout << Utils::str_format("Verify %-23s %10llu case(s), %12llu sample(s), %6.2f s: ", name.c_str(),
+        (unsigned long long)options.numCases, (unsigned long long)totalSamples.load(), seconds);
+
+    if (firstMismatchCase.load() == UINT64_MAX)
+    {
+        std::cout << "identical to the reference\n";
+        return true;
+    }
+
+    std::cout << "DIVERGES\n";
+    std::cerr << Utils::str_format("  first divergence in case %llu (seed %llu): ", (unsigned long long)firstMismatchCase.load(),
+        (unsigned long long)options.seed) << firstMismatch << "\n";
+    return false;
+}
+
+} // namespace
+
+bool run(const Options& options)
+{
+    using CpuDispatch::EIsa;
+
+    // The kernels with variants are checked with each ISA of the CPU, unless one was forced
+    const EIsa selectedIsa = CpuDispatch::get_isa();
+    std::vector<EIsa> isas;
+    for (size_t i = 0; i <= (size_t)CpuDispatch::detect(); i++)
+    {
+        if (options.bAllIsas || (EIsa)i == selectedIsa)
+            isas.push_back((EIsa)i);
+    }
+
+    bool bAllMatch = true;
+    size_t numKernels = 0;
+
+    for (const Kernel& kernel : kKernels)
+    {
+        if (!options.filter.empty() && std::string(kernel.name).find(options.filter) == std::string::npos)
+            continue;
+        numKernels++;
+
+        if (!kernel.bDispatched)
+        {
+            bAllMatch &= run_kernel(kernel, options);
+            continue;
+        }
+
+        for (EIsa isa : isas)
+        {
+            CpuDispatch::select(isa);
+            bAllMatch &= run_kernel(kernel, options);
+        }
+        CpuDispatch::select(selectedIsa);
+    }
+
+    if (numKernels == 0)
+    {
+        std::cerr << "No kernel matches " << options.filter << "\n";
+        return false;
+    }
+    return bAllMatch;
+}
+
+} // namespace Verify
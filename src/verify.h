@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Verify {
+
+//-----------------------------------------------------------------------------
+// Differential check of the codec kernels (MiscAudioVerify executable):
+// IndyWV ADPCM decode/encode, WVSM inflate, the APC nibble decoder and the
+// sample format conversions are run next to their frozen reference
+// (reference_kernels.h) on seeded random and edge-case inputs (escape codes,
+// step indexes at their bounds, odd sizes, partial and truncated WVSM blocks,
+// rounding ties), on all cores. Outputs and final codec states must be
+// identical; the first divergent sample is reported. The kernels with vector
+// variants (cpu_dispatch.h) are checked with each ISA of the CPU.
+//-----------------------------------------------------------------------------
+
+struct Options
+{
+    std::string filter;          // only the kernels whose name contains it (all if empty)
+    uint64_t numCases = 250000;  // per kernel
+    uint64_t seed = 1;
+    bool bAllIsas = true;        // kernels with variants per ISA: check all those of the CPU, or only the selected one
+};
+
+// Returns whether all the kernels match their reference
+bool run(const Options& options);
+
+} // namespace Verify
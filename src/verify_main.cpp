@@ -0,0 +1,64 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "cpu_dispatch.h"
+#include "verify.h"
+
+//-----------------------------------------------------------------------------
+// MiscAudioVerify: differential check of the codec kernels against their
+// reference implementation (verify.h), built against the codecs library
+// alone. The exit code is -1 if any kernel diverges.
+//-----------------------------------------------------------------------------
+
+const char* kCasesArg = "-cases";
+const char* kSeedArg = "-seed";
+const char* kIsaArg = "-isa";
+
+void printUsage()
+{
+    std::cout << "Usage: MiscAudioVerify [<Filter>] [-cases <NumCasesPerKernel>] [-seed <Seed>] [-isa <scalar|sse4.1|avx2|avx512>]\n"
+        << "Checks that the codec kernels match their reference implementation bit for bit on random and edge-case inputs,\n"
+        << "optionally only those whose name contains Filter, with every instruction set of the CPU unless -isa is given\n";
+}
+
+int main(int argc, const char* argv[])
+{
+    Verify::Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool bHasValue = (i + 1 < argc);
+        if (arg == kCasesArg && bHasValue)
+        {
+            options.numCases = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == kSeedArg && bHasValue)
+        {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == kIsaArg)
+        {
+            CpuDispatch::EIsa isa;
+            if (!bHasValue || !CpuDispatch::find_isa_from_name(argv[++i], isa))
+            {
+                std::cerr << "Please input an instruction set with -isa: scalar, sse4.1, avx2 or avx512\n";
+                return -1;
+            }
+            if (!CpuDispatch::select(isa))
+                return -1;
+            options.bAllIsas = false;
+        }
+        else if (arg[0] != '-' && options.filter.empty())
+        {
+            options.filter = arg;
+        }
+        else
+        {
+            printUsage();
+            return -1;
+        }
+    }
+
+    return Verify::run(options) ? 0 : -1;
+}
@@ -0,0 +1,303 @@
+#include "write_queue.h"
+
+#include <filesystem>
+#include <iostream>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace Output {
+
+namespace {
+
+bool create_parent_folders(const std::string& path)
+{
+    std::error_code error;
+    const std::filesystem::path parentPath = std::filesystem::path(path).parent_path();
+    if (!parentPath.empty())
+        std::filesystem::create_directories(parentPath, error);
+    return !error;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// Output written progressively: its blocks are queued as chunks of the file
+//-----------------------------------------------------------------------------
+class WriteQueue::TempStream : public Utils::OutputStream
+{
+public:
+    TempStream(WriteQueue& in_queue, const std::shared_ptr<File>& in_pFile)
+        : queue(in_queue), pFile(in_pFile) {}
+
+    ~TempStream() override
+    {
+        if (!bClosed)
+            close();
+    }
+
+    bool write(const void* pData, size_t size) override
+    {
+        const char* pBytes = static_cast<const char*>(pData);
+        return queue.push(pFile, { std::vector<char>(pBytes, pBytes + size), 0, false }, false);
+    }
+
+    bool write_at(uint64_t offset, const void* pData, size_t size) override
+    {
+        const char* pBytes = static_cast<const char*>(pData);
+        return queue.push(pFile, { std::vector<char>(pBytes, pBytes + size), offset, true }, false);
+    }
+
+    // Only reports the failures known so far: the writes may still be queued
+    bool close() override
+    {
+        bClosed = true;
+        return queue.push(pFile, {}, true);
+    }
+
+private:
+    WriteQueue& queue;
+    const std::shared_ptr<File> pFile;
+    bool bClosed = false;
+};
+
+WriteQueue::WriteQueue(unsigned numThreads, size_t in_maxQueuedBytes)
+    : maxQueuedBytes(in_maxQueuedBytes)
+{
+    for (unsigned i = 0; i < std::max(numThreads, 1u); i++)
+        threads.emplace_back(&WriteQueue::run, this);
+}
+
+WriteQueue::~WriteQueue()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bStopping = true;
+    }
+    filesAvailable.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+bool WriteQueue::store(const std::string& path, std::vector<char>&& data)
+{
+    return push(create_file(path), { std::move(data), 0, false }, true);
+}
+
+std::unique_ptr<Utils::OutputStream> WriteQueue::open_stream(const std::string& path)
+{
+    // Created by an I/O thread along with its first chunk
+    return std::make_unique<TempStream>(*this, create_file(path));
+}
+
+WriteQueue::EResult WriteQueue::get_result(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pendingPaths.count(path) > 0)
+        return EResult::Pending;
+    return failedPaths.count(path) > 0 ? EResult::Failed : EResult::Written;
+}
+
+std::shared_ptr<WriteQueue::File> WriteQueue::create_file(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingPaths[path]++;
+    return std::make_shared<File>(path);
+}
+
+bool WriteQueue::push(const std::shared_ptr<File>& pFile, Chunk&& chunk, bool bClose)
+{
+    const size_t size = chunk.data.size();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Backpressure. A chunk larger than the cap still goes through once the queue is empty.
+    auto hasSpace = [&]() { return queuedBytes == 0 || queuedBytes + size <= maxQueuedBytes; };
+    if (!hasSpace())
+    {
+        Trace::Span span("stall", "write queue full");
+        spaceAvailable.wait(lock, hasSpace);
+    }
+
+    // Once a write failed, the rest of the file is dropped
+    if (!pFile->bFailed && (size > 0 || chunk.bAtOffset))
+    {
+        pFile->chunks.push_back(std::move(chunk));
+        queuedBytes += size;
+    }
+    pFile->bClosed |= bClose;
+
+    const bool bSchedule = !pFile->bScheduled;
+    if (bSchedule)
+    {
+        pFile->bScheduled = true;
+        files.push_back(pFile);
+    }
+    const bool bSuccess = !pFile->bFailed;
+    lock.unlock();
+
+    if (bSchedule)
+        filesAvailable.notify_one();
+    return bSuccess;
+}
+
+bool WriteQueue::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&]() { return files.empty() && numBusyThreads == 0; });
+
+    bool bSuccess = !bFailed;
+    bFailed = false;
+    return bSuccess;
+}
+
+void WriteQueue::run()
+{
+    Trace::set_thread_name("writer");
+
+    struct Task
+    {
+        std::shared_ptr<File> pFile;
+        std::vector<Chunk> chunks;
+        bool bClose = false;
+        bool bSuccess = true;
+    };
+    std::vector<Task> batch;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        filesAvailable.wait(lock, [&]() { return bStopping || !files.empty(); });
+        if (files.empty())
+            return; // stopping
+
+        // Take several files at once, to limit the round trips through the lock
+        while (!files.empty() && batch.size() < kMaxBatchSize)
+        {
+            Task task;
+            task.pFile = std::move(files.front());
+            files.pop_front();
+            for (auto& chunk : task.pFile->chunks)
+                task.chunks.push_back(std::move(chunk));
+            task.pFile->chunks.clear();
+            task.bClose = task.pFile->bClosed;
+            batch.push_back(std::move(task));
+        }
+        numBusyThreads++;
+        lock.unlock();
+
+        size_t writtenBytes = 0;
+        for (auto& task : batch)
+        {
+            for (const auto& chunk : task.chunks)
+                writtenBytes += chunk.data.size();
+
+            Stats::ScopedTimer timer(Stats::EStage::Write);
+            Trace::Span span("write", task.pFile->path);
+            task.bSuccess = write_chunks(*task.pFile, task.chunks);
+            if (task.bClose)
+                task.bSuccess = finish(*task.pFile, task.bSuccess);
+        }
+
+        lock.lock();
+        numBusyThreads--;
+        queuedBytes -= writtenBytes;
+        for (auto& task : batch)
+        {
+            File& file = *task.pFile;
+            file.bFailed |= !task.bSuccess;
+            if (task.bClose)
+            {
+                if (--pendingPaths[file.path] == 0)
+                    pendingPaths.erase(file.path);
+                if (file.bFailed)
+                    failedPaths.insert(file.path);
+                else
+                    failedPaths.erase(file.path);
+                bFailed |= file.bFailed;
+            }
+            else if (!file.chunks.empty() || file.bClosed)
+            {
+                files.push_back(std::move(task.pFile)); // more came in while writing: stays scheduled
+            }
+            else
+            {
+                file.bScheduled = false;
+            }
+        }
+        batch.clear();
+
+        spaceAvailable.notify_all();
+        if (!files.empty())
+            filesAvailable.notify_all();
+        else if (numBusyThreads == 0)
+            idle.notify_all();
+    }
+}
+
+bool WriteQueue::write_chunks(File& file, std::vector<Chunk>& chunks)
+{
+    if (file.bFailed)
+        return false;
+
+    if (!file.tempFile)
+    {
+        create_parent_folders(file.path);
+
+        file.tempFile = std::make_unique<Utils::FileStream>();
+        if (!file.tempFile->open(file.path + ".tmp"))
+        {
+            std::cerr << "Could not create " << file.path << ".tmp\n";
+            return false;
+        }
+    }
+
+    for (const auto& chunk : chunks)
+    {
+        const bool bWritten = chunk.bAtOffset ? file.tempFile->write_at(chunk.offset, chunk.data.data(), chunk.data.size())
+            : file.tempFile->write(chunk.data.data(), chunk.data.size());
+        if (!bWritten)
+        {
+            std::cerr << "Could not write " << file.path << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WriteQueue::finish(File& file, bool bSuccess)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code error;
+    const std::string tempPath = file.path + ".tmp";
+    if (file.tempFile)
+    {
+        if (!file.tempFile->close() && bSuccess)
+        {
+            std::cerr << "Could not write " << file.path << "\n";
+            bSuccess = false;
+        }
+        file.tempFile.reset();
+    }
+    if (!bSuccess)
+    {
+        fs::remove(tempPath, error);
+        return false;
+    }
+
+    // Replaces any previous output atomically
+    fs::rename(tempPath, file.path, error);
+    if (error)
+    {
+        std::cerr << "Could not move " << tempPath << " into place: " << error.message() << "\n";
+        fs::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace Output
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "file_utils.h"
+#include "utils.h"
+
+namespace Output {
+
+//-----------------------------------------------------------------------------
+// Write-behind queue: decoding threads hand over output data and return
+// straight away, dedicated I/O threads create the folders, open, write, close
+// and rename the files. Whole files built in memory (store()) and the blocks
+// of progressively written outputs (open_stream(), e.g. WAV or FLAC files of
+// any size) are queued alike, as chunks of a file; an I/O thread takes a file
+// with the chunks queued so far, and only one works on a given file at a time,
+// so its writes (and header patches) happen in order.
+// Each file is written to a temporary file which is renamed into place once
+// complete, so readers never see partial outputs.
+// Queued data is capped in bytes: writes block while the queue is full, so
+// that decoding can't run arbitrarily far ahead of the disk.
+// Failures are reported per file: with the path on stderr, by get_result(),
+// and by close() on a stream when already known (e.g. the file couldn't be
+// created).
+//-----------------------------------------------------------------------------
+class WriteQueue : public Utils::FileStore
+{
+public:
+    static constexpr size_t kDefaultMaxQueuedBytes = 256 << 20;
+    static constexpr size_t kMaxBatchSize = 16; // files taken at once by an I/O thread
+
+    enum class EResult
+    {
+        Pending,
+        Written,
+        Failed
+    };
+
+    explicit WriteQueue(unsigned numThreads = 2, size_t in_maxQueuedBytes = kDefaultMaxQueuedBytes);
+    ~WriteQueue() override;
+
+    bool store(const std::string& path, std::vector<char>&& data) override;
+    std::unique_ptr<Utils::OutputStream> open_stream(const std::string& path) override;
+
+    // State of an output handed to the queue (Written for a path it never had)
+    EResult get_result(const std::string& path);
+
+    // Waits until everything queued so far is on disk, returns false if any write failed
+    bool flush();
+
+private:
+    class TempStream;
+
+    struct Chunk
+    {
+        std::vector<char> data;
+        uint64_t offset = 0;
+        bool bAtOffset = false; // write_at(), otherwise appended
+    };
+
+    struct File
+    {
+        explicit File(const std::string& in_path) : path(in_path) {}
+
+        const std::string path;
+        std::deque<Chunk> chunks; // not written yet
+        bool bClosed = false;     // no more chunks: closed and renamed once written
+        bool bScheduled = false;  // queued, or taken by an I/O thread
+        bool bFailed = false;
+        std::unique_ptr<Utils::FileStream> tempFile; // only used by the I/O thread holding the file
+    };
+
+    std::shared_ptr<File> create_file(const std::string& path);
+    // Returns false if the file has already failed
+    bool push(const std::shared_ptr<File>& pFile, Chunk&& chunk, bool bClose);
+    void run();
+    static bool write_chunks(File& file, std::vector<Chunk>& chunks);
+    static bool finish(File& file, bool bSuccess);
+
+    std::mutex mutex;
+    std::condition_variable filesAvailable;
+    std::condition_variable spaceAvailable;
+    std::condition_variable idle;
+
+    std::deque<std::shared_ptr<File>> files; // with chunks to write, or to finish
+    std::unordered_map<std::string, unsigned> pendingPaths;
+    std::unordered_set<std::string> failedPaths;
+    const size_t maxQueuedBytes;
+    size_t queuedBytes = 0;
+    unsigned numBusyThreads = 0;
+    bool bStopping = false;
+    bool bFailed = false;
+
+    std::vector<std::thread> threads;
+};
+
+} // namespace Output